@@ -26,19 +26,23 @@
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <poll.h>
 #include <assert.h>
 #include <errno.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/eventfd.h>
 #include <gbm.h>
 #include <drm_fourcc.h>
 #include <xf86drm.h>
 #include <cube_utils.h>
 #include <cube_ipc.h>
 #include <cube_protocal.h>
+#include <cube_protocal_v2.h>
 #include <cube_log.h>
 #include <cube_event.h>
 #include <cube_shm.h>
+#include <cube_shm_ring.h>
 #include <cube_cache.h>
 #include <cube_client.h>
 
@@ -46,6 +50,18 @@
 #define CB_IPC_BUF_MAX_LEN (1 << 19)
 #endif
 
+/* outbound queue: initial size and hard limit */
+#define CLIENT_TX_SIZE (16 << 10)
+#define CLIENT_TX_MAX (4 << 20)
+/* bounded wait for queued commands on destroy, in ms */
+#define CLIENT_TX_DRAIN_TRIES 10
+#define CLIENT_TX_DRAIN_TIMEOUT 100
+
+/* inbound buffer starts small and grows up to CB_IPC_BUF_MAX_LEN */
+#define CLIENT_RX_SIZE (16 << 10)
+/* bytes read from the socket per wakeup */
+#define CLIENT_RX_READ_MAX (256 << 10)
+
 #define client_debug(client, fmt, ...) do { \
 	if ((client)->debug_level >= CB_LOG_DEBUG) { \
 		cb_client_tlog((client)->pid_name, (client)->log_handle, \
@@ -96,14 +112,27 @@ struct client {
 	u64 link_id;
 
 	/* for IPC */
-	u8 ipc_buf[CB_IPC_BUF_MAX_LEN];
-	size_t ipc_sz, byts_to_rd;
-	u8 *cursor;
-	struct cb_fds ipc_fds;
+	void *rx; /* inbound frames */
 	s32 sock;
 	struct cb_event_source *sock_source;
+	u32 sock_mask;
+	void *tx; /* outbound message queue */
 	struct cb_event_source *destroy_idle_source;
 
+	/* optional shared memory transport, see cube_shm_ring.h */
+	void *c2s_ring, *s2c_ring;
+	struct cb_event_source *s2c_ring_source;
+	bool c2s_ring_on, s2c_ring_on;
+	/*
+	 * socket frames announced by s2c ring markers, not dispatched yet,
+	 * below 0 when taken before their marker
+	 */
+	s64 sock_frames_due;
+
+	/* negotiated protocol version, see cube_protocal_v2.h */
+	u32 proto;
+	u32 v2_tx_seq, v2_rx_seq;
+
 	/* main loop exit or not */
 	bool exit;
 
@@ -198,6 +227,10 @@ struct client {
 	void *mode_created_cb_userdata;
 	void (*mode_created_cb)(bool success, void *userdata);
 
+	void *capture_cb_userdata;
+	void (*capture_cb)(void *userdata, s32 pipe, u64 bo_id, u64 seq,
+			   s64 result);
+
 	void *surface_created_cb_userdata;
 	void (*surface_created_cb)(bool success, void *userdata, u64 id);
 
@@ -251,6 +284,35 @@ static inline struct client *to_client(struct cb_client *client)
 	return container_of(client, struct client, base);
 }
 
+static void shm_transport_fini(struct client *cli)
+{
+	if (cli->s2c_ring_source) {
+		cb_event_source_remove(cli->s2c_ring_source);
+		cli->s2c_ring_source = NULL;
+	}
+	cb_shm_ring_destroy(cli->c2s_ring);
+	cli->c2s_ring = NULL;
+	cb_shm_ring_destroy(cli->s2c_ring);
+	cli->s2c_ring = NULL;
+	cli->c2s_ring_on = cli->s2c_ring_on = false;
+}
+
+/* give queued commands a short chance to leave before the socket closes */
+static void client_drain(struct client *cli)
+{
+	struct pollfd pfd;
+	s32 i;
+
+	for (i = 0; i < CLIENT_TX_DRAIN_TRIES; i++) {
+		if (cb_ipc_tx_flush(cli->tx, cli->sock) <= 0)
+			break;
+		pfd.fd = cli->sock;
+		pfd.events = POLLOUT;
+		if (poll(&pfd, 1, CLIENT_TX_DRAIN_TIMEOUT) <= 0)
+			break;
+	}
+}
+
 static void destroy(struct cb_client *client)
 {
 	struct client *cli = to_client(client);
@@ -349,6 +411,16 @@ static void destroy(struct cb_client *client)
 		if (cli->sock_source)
 			cb_event_source_remove(cli->sock_source);
 
+		if (cli->tx) {
+			client_drain(cli);
+			cb_ipc_tx_destroy(cli->tx);
+		}
+
+		if (cli->rx)
+			cb_ipc_rx_destroy(cli->rx);
+
+		shm_transport_fini(cli);
+
 		if (cli->sock > 0)
 			close(cli->sock);
 
@@ -383,6 +455,79 @@ static void stop(struct cb_client *client)
 	cli->exit = true;
 }
 
+static s32 client_flush(struct client *cli)
+{
+	u32 mask = CB_EVT_READABLE;
+	s32 ret;
+
+	ret = cb_ipc_tx_flush(cli->tx, cli->sock);
+	if (ret < 0)
+		return ret;
+
+	if (ret > 0)
+		mask |= CB_EVT_WRITABLE;
+
+	if (mask != cli->sock_mask) {
+		cb_event_source_fd_update_mask(cli->sock_source, mask);
+		cli->sock_mask = mask;
+	}
+
+	return 0;
+}
+
+/*
+ * queue a framed message, the rest is sent when the socket is writable.
+ * With the shm transport on, messages go to the c2s ring, the socket only
+ * takes those with fds or too big for the ring, the ring counts them for
+ * its next marker.
+ */
+static s32 client_send(struct client *cli, u8 *buf, size_t length,
+		       struct cb_fds *fds)
+{
+	s32 ret;
+
+	if (cli->c2s_ring_on) {
+		if (!fds || !fds->count) {
+			ret = cb_shm_ring_write(cli->c2s_ring, buf, length);
+			if (ret != -ENOSPC) {
+				if (ret < 0)
+					errno = -ret;
+				return ret;
+			}
+		}
+	}
+
+	ret = cb_ipc_tx_queue(cli->tx, buf, length, fds);
+	if (ret < 0) {
+		errno = -ret;
+		return ret;
+	}
+	if (cli->c2s_ring_on)
+		cb_shm_ring_skip(cli->c2s_ring);
+
+	ret = client_flush(cli);
+	if (ret < 0)
+		errno = -ret;
+	return ret;
+}
+
+/* frame a v2 body, see cube_protocal_v2.h */
+static s32 client_send_v2(struct client *cli, u16 opcode, void *body)
+{
+	u64 msg[CB_V2_MSG_MAX / sizeof(u64)];
+	u8 *p;
+
+	p = cb_v2_encode((u8 *)msg, opcode, cli->v2_tx_seq);
+	if (!p) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+	cli->v2_tx_seq++;
+	memcpy(p, body, cb_v2_msg_size(opcode) - sizeof(struct cb_v2_hdr));
+
+	return client_send(cli, (u8 *)msg, cb_v2_msg_size(opcode), NULL);
+}
+
 static void set_raw_input_en(struct cb_client *client, bool en)
 {
 	struct client *cli = to_client(client);
@@ -401,23 +546,7 @@ static void set_raw_input_en(struct cb_client *client, bool en)
 	
 	length = cli->raw_input_en_len;
 
-	do {
-		ret = cb_sendmsg(cli->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	if (ret < 0) {
-		client_err(cli, "failed to send raw input en length. %s",
-			   strerror(errno));
-		if (cli->connection_lost_cb)
-			cli->connection_lost_cb(
-					cli->connection_lost_cb_userdata);
-		stop(&cli->base);
-		return;
-	}
-
-	do {
-		ret = cb_sendmsg(cli->sock, cli->raw_input_en_cmd, length,NULL);
-	} while (ret == -EAGAIN);
+	ret = client_send(cli, cli->raw_input_en_cmd, length, NULL);
 	if (ret < 0) {
 		client_err(cli, "failed to send raw input en. %s",
 			   strerror(errno));
@@ -441,24 +570,7 @@ static s32 send_get_kbd_led_st(struct cb_client *client)
 
 	length = cli->get_kbd_led_st_len;
 
-	do {
-		ret = cb_sendmsg(cli->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	if (ret < 0) {
-		client_err(cli, "failed to send get kbd led st length. %s",
-			   strerror(errno));
-		if (cli->connection_lost_cb)
-			cli->connection_lost_cb(
-					cli->connection_lost_cb_userdata);
-		stop(&cli->base);
-		return -errno;
-	}
-
-	do {
-		ret = cb_sendmsg(cli->sock, cli->get_kbd_led_st_cmd, length,
-				 NULL);
-	} while (ret == -EAGAIN);
+	ret = client_send(cli, cli->get_kbd_led_st_cmd, length, NULL);
 	if (ret < 0) {
 		client_err(cli, "failed to send get kbd led st cmd. %s",
 			   strerror(errno));
@@ -553,24 +665,7 @@ static s32 send_get_edid(struct cb_client *client, u64 pipe)
 
 	length = cli->get_edid_len;
 
-	do {
-		ret = cb_sendmsg(cli->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	if (ret < 0) {
-		client_err(cli, "failed to send get edid length. %s",
-			   strerror(errno));
-		if (cli->connection_lost_cb)
-			cli->connection_lost_cb(
-					cli->connection_lost_cb_userdata);
-		stop(&cli->base);
-		return -errno;
-	}
-
-	do {
-		ret = cb_sendmsg(cli->sock, cli->get_edid_cmd, length,
-				 NULL);
-	} while (ret == -EAGAIN);
+	ret = client_send(cli, cli->get_edid_cmd, length, NULL);
 	if (ret < 0) {
 		client_err(cli, "failed to send get edid cmd. %s",
 			   strerror(errno));
@@ -606,24 +701,7 @@ static s32 send_set_kbd_led_st(struct cb_client *client, u32 led_status)
 
 	length = cli->set_kbd_led_st_len;
 
-	do {
-		ret = cb_sendmsg(cli->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	if (ret < 0) {
-		client_err(cli, "failed to send set kbd led st length. %s",
-			   strerror(errno));
-		if (cli->connection_lost_cb)
-			cli->connection_lost_cb(
-					cli->connection_lost_cb_userdata);
-		stop(&cli->base);
-		return -errno;
-	}
-
-	do {
-		ret = cb_sendmsg(cli->sock, cli->set_kbd_led_st_cmd, length,
-				 NULL);
-	} while (ret == -EAGAIN);
+	ret = client_send(cli, cli->set_kbd_led_st_cmd, length, NULL);
 	if (ret < 0) {
 		client_err(cli, "failed to send set kbd led st cmd. %s",
 			   strerror(errno));
@@ -658,12 +736,9 @@ static s32 set_client_cap(struct cb_client *client, u64 cap)
 	
 	length = n;
 
-	do {
-		ret = cb_sendmsg(cli->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
+	ret = client_send(cli, set_cap_tx_cmd, length, NULL);
 	if (ret < 0) {
-		client_err(cli, "failed to send client cap length. %s",
+		client_err(cli, "failed to send client cap cmd (dbg). %s",
 			   strerror(errno));
 		if (cli->connection_lost_cb)
 			cli->connection_lost_cb(
@@ -672,22 +747,131 @@ static s32 set_client_cap(struct cb_client *client, u64 cap)
 		return -errno;
 	}
 
-	do {
-		ret = cb_sendmsg(cli->sock, set_cap_tx_cmd, length, NULL);
-	} while (ret == -EAGAIN);
+	free(set_cap_tx_cmd);
+
+	return 0;
+}
+
+static s32 ring_cb(s32 fd, u32 mask, void *data);
+
+static s32 enable_shm_transport(struct cb_client *client, u32 ring_size)
+{
+	struct client *cli = to_client(client);
+	struct cb_fds fds;
+	s32 area, efd_c2s = -1, efd_s2c = -1, ret;
+	u8 *p;
+	u32 n;
+
+	if (!client)
+		return -EINVAL;
+
+	if (cli->c2s_ring)
+		return -EBUSY;
+
+	area = cb_shm_ring_area_create(ring_size);
+	if (area < 0) {
+		client_err(cli, "failed to create ring area. %s",
+			   strerror(-area));
+		return area;
+	}
+
+	efd_c2s = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	efd_s2c = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (efd_c2s < 0 || efd_s2c < 0) {
+		ret = -errno;
+		goto err;
+	}
+
+	ret = -ENOMEM;
+	cli->c2s_ring = cb_shm_ring_create(area, CB_SHM_RING_C2S, true,
+					   efd_c2s);
+	if (!cli->c2s_ring)
+		goto err;
+	cli->s2c_ring = cb_shm_ring_create(area, CB_SHM_RING_S2C, false,
+					   efd_s2c);
+	if (!cli->s2c_ring)
+		goto err_fini;
+	cli->s2c_ring_source = cb_event_loop_add_fd(cli->loop, efd_s2c,
+						    CB_EVT_READABLE,
+						    ring_cb, cli);
+	if (!cli->s2c_ring_source)
+		goto err_fini;
+
+	p = cb_client_create_shm_setup_cmd(ring_size, &n);
+	if (!p)
+		goto err_fini;
+
+	/* the fds are duplicated into the queue */
+	fds.fds[0] = area;
+	fds.fds[1] = efd_c2s;
+	fds.fds[2] = efd_s2c;
+	fds.count = 3;
+	ret = client_send(cli, p, n, &fds);
+	free(p);
+	close(area);
 	if (ret < 0) {
-		client_err(cli, "failed to send client cap cmd (dbg). %s",
+		client_err(cli, "failed to send shm setup cmd. %s",
 			   strerror(errno));
+		shm_transport_fini(cli);
 		if (cli->connection_lost_cb)
 			cli->connection_lost_cb(
 					cli->connection_lost_cb_userdata);
 		stop(&cli->base);
-		return -errno;
+		return ret;
 	}
 
-	free(set_cap_tx_cmd);
-
 	return 0;
+
+err_fini:
+	/* the rings own their doorbell from now on */
+	if (cli->c2s_ring)
+		efd_c2s = -1;
+	if (cli->s2c_ring)
+		efd_s2c = -1;
+	shm_transport_fini(cli);
+err:
+	if (efd_c2s >= 0)
+		close(efd_c2s);
+	if (efd_s2c >= 0)
+		close(efd_s2c);
+	close(area);
+	return ret;
+}
+
+static void shm_setup_ack_proc(struct client *cli, u8 *buf)
+{
+	s64 result;
+	u8 *p;
+	u32 n;
+	s32 ret;
+
+	if (cb_client_parse_shm_setup_ack_cmd(buf, &result) < 0 || result) {
+		client_err(cli, "server refused shm transport.");
+		shm_transport_fini(cli);
+		return;
+	}
+
+	/* server messages after the ack come through the s2c ring */
+	cli->s2c_ring_on = true;
+
+	p = cb_client_create_shm_on_cmd(&n);
+	if (!p) {
+		shm_transport_fini(cli);
+		return;
+	}
+	ret = client_send(cli, p, n, NULL);
+	free(p);
+	if (ret < 0) {
+		client_err(cli, "failed to send shm on cmd. %s",
+			   strerror(errno));
+		if (cli->connection_lost_cb)
+			cli->connection_lost_cb(
+					cli->connection_lost_cb_userdata);
+		stop(&cli->base);
+		return;
+	}
+	cli->c2s_ring_on = true;
+	client_notice(cli, "shm transport on");
 }
 
 static s32 set_server_dbg(struct cb_client *client,
@@ -713,23 +897,7 @@ static s32 set_server_dbg(struct cb_client *client,
 	
 	length = cli->shell_tx_len;
 
-	do {
-		ret = cb_sendmsg(cli->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	if (ret < 0) {
-		client_err(cli, "failed to send shell cmd (dbg) length. %s",
-			   strerror(errno));
-		if (cli->connection_lost_cb)
-			cli->connection_lost_cb(
-					cli->connection_lost_cb_userdata);
-		stop(&cli->base);
-		return -errno;
-	}
-
-	do {
-		ret = cb_sendmsg(cli->sock, cli->shell_tx_cmd, length, NULL);
-	} while (ret == -EAGAIN);
+	ret = client_send(cli, cli->shell_tx_cmd, length, NULL);
 	if (ret < 0) {
 		client_err(cli, "failed to send shell cmd (dbg). %s",
 			   strerror(errno));
@@ -972,6 +1140,11 @@ static s32 change_layout(struct cb_client *client)
 		cli->shell.value.layout.cfg[i].pipe = disp->pipe;
 		memcpy(&cli->shell.value.layout.cfg[i].input_rc,
 		       &disp->input_rc, sizeof(struct cb_rect));
+		cli->shell.value.layout.cfg[i].transform = disp->transform;
+		cli->shell.value.layout.cfg[i].render_scale =
+						disp->render_scale;
+		cli->shell.value.layout.cfg[i].render_scale_auto =
+						disp->render_scale_auto;
 		if (disp->pending_mode) {
 			cli->shell.value.layout.cfg[i].mode_handle
 				= disp->pending_mode;
@@ -993,23 +1166,7 @@ static s32 change_layout(struct cb_client *client)
 	
 	length = cli->shell_tx_len;
 
-	do {
-		ret = cb_sendmsg(cli->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	if (ret < 0) {
-		client_err(cli, "failed to send shell cmd length. %s",
-			   strerror(errno));
-		if (cli->connection_lost_cb)
-			cli->connection_lost_cb(
-					cli->connection_lost_cb_userdata);
-		stop(&cli->base);
-		return -errno;
-	}
-
-	do {
-		ret = cb_sendmsg(cli->sock, cli->shell_tx_cmd, length, NULL);
-	} while (ret == -EAGAIN);
+	ret = client_send(cli, cli->shell_tx_cmd, length, NULL);
 	if (ret < 0) {
 		client_err(cli, "failed to send shell cmd (layout). %s",
 			   strerror(errno));
@@ -1071,23 +1228,7 @@ static s32 enumerate_mode(struct cb_client *client, s32 pipe, void *last_mode,
 	
 	length = cli->shell_tx_len;
 
-	do {
-		ret = cb_sendmsg(cli->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	if (ret < 0) {
-		client_err(cli, "failed to send shell cmd (enum) length. %s",
-			   strerror(errno));
-		if (cli->connection_lost_cb)
-			cli->connection_lost_cb(
-					cli->connection_lost_cb_userdata);
-		stop(&cli->base);
-		return -errno;
-	}
-
-	do {
-		ret = cb_sendmsg(cli->sock, cli->shell_tx_cmd, length, NULL);
-	} while (ret == -EAGAIN);
+	ret = client_send(cli, cli->shell_tx_cmd, length, NULL);
 	if (ret < 0) {
 		client_err(cli, "failed to send shell cmd (enum). %s",
 			   strerror(errno));
@@ -1150,23 +1291,7 @@ static s32 query_layout(struct cb_client *client)
 	
 	length = cli->shell_tx_len;
 
-	do {
-		ret = cb_sendmsg(cli->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	if (ret < 0) {
-		client_err(cli, "failed to send shell cmd length. %s",
-			   strerror(errno));
-		if (cli->connection_lost_cb)
-			cli->connection_lost_cb(
-					cli->connection_lost_cb_userdata);
-		stop(&cli->base);
-		return -errno;
-	}
-
-	do {
-		ret = cb_sendmsg(cli->sock, cli->shell_tx_cmd, length, NULL);
-	} while (ret == -EAGAIN);
+	ret = client_send(cli, cli->shell_tx_cmd, length, NULL);
 	if (ret < 0) {
 		client_err(cli, "failed to send shell cmd (query layout). %s",
 			   strerror(errno));
@@ -1271,23 +1396,7 @@ static s32 create_mode(struct cb_client *client, struct mode_info *info,
 	
 	length = cli->shell_tx_len;
 
-	do {
-		ret = cb_sendmsg(cli->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	if (ret < 0) {
-		client_err(cli, "failed to send shell cmd length. %s",
-			   strerror(errno));
-		if (cli->connection_lost_cb)
-			cli->connection_lost_cb(
-					cli->connection_lost_cb_userdata);
-		stop(&cli->base);
-		return -errno;
-	}
-
-	do {
-		ret = cb_sendmsg(cli->sock, cli->shell_tx_cmd, length, NULL);
-	} while (ret == -EAGAIN);
+	ret = client_send(cli, cli->shell_tx_cmd, length, NULL);
 	if (ret < 0) {
 		client_err(cli, "failed to send shell cmd (create mode). %s",
 			   strerror(errno));
@@ -1324,6 +1433,115 @@ static s32 set_create_mode_cb(struct cb_client *client, void *userdata,
 	return 0;
 }
 
+static s32 send_capture_cmd(struct client *cli)
+{
+	size_t length;
+	s32 ret;
+	u8 *p;
+
+	p = cb_dup_shell_cmd(cli->shell_tx_cmd, cli->shell_tx_cmd_t,
+			     cli->shell_tx_len, &cli->shell);
+	if (!p) {
+		client_err(cli, "failed to dup shell cmd");
+		return -EINVAL;
+	}
+	
+	length = cli->shell_tx_len;
+
+	ret = client_send(cli, cli->shell_tx_cmd, length, NULL);
+	if (ret < 0) {
+		client_err(cli, "failed to send shell cmd (capture). %s",
+			   strerror(errno));
+		if (cli->connection_lost_cb)
+			cli->connection_lost_cb(
+					cli->connection_lost_cb_userdata);
+		stop(&cli->base);
+		return -errno;
+	}
+
+	return 0;
+}
+
+static s32 capture_start(struct cb_client *client, s32 pipe, u64 *bo_ids,
+			 u32 count_bos, u32 interval_ms)
+{
+	struct client *cli = to_client(client);
+	u32 i;
+
+	if (!client)
+		return -EINVAL;
+
+	if (!bo_ids || !count_bos || count_bos > CB_CAPTURE_BO_MAX) {
+		client_err(cli, "illegal capture bo count %u", count_bos);
+		return -EINVAL;
+	}
+
+	client_debug(cli, "capture start pipe %d, %u bo(s), interval %u ms",
+		     pipe, count_bos, interval_ms);
+	memset(&cli->shell.value.capture, 0, sizeof(cli->shell.value.capture));
+	cli->shell.cmd = CB_SHELL_OUTPUT_CAPTURE_START;
+	cli->shell.value.capture.pipe = pipe;
+	cli->shell.value.capture.count_bos = count_bos;
+	for (i = 0; i < count_bos; i++)
+		cli->shell.value.capture.bo_ids[i] = bo_ids[i];
+	cli->shell.value.capture.interval_ms = interval_ms;
+
+	return send_capture_cmd(cli);
+}
+
+static s32 capture_stop(struct cb_client *client, s32 pipe)
+{
+	struct client *cli = to_client(client);
+
+	if (!client)
+		return -EINVAL;
+
+	client_debug(cli, "capture stop pipe %d", pipe);
+	memset(&cli->shell.value.capture, 0, sizeof(cli->shell.value.capture));
+	cli->shell.cmd = CB_SHELL_OUTPUT_CAPTURE_STOP;
+	cli->shell.value.capture.pipe = pipe;
+
+	return send_capture_cmd(cli);
+}
+
+static s32 capture_release(struct cb_client *client, s32 pipe, u64 bo_id)
+{
+	struct client *cli = to_client(client);
+
+	if (!client)
+		return -EINVAL;
+
+	client_debug(cli, "capture release pipe %d bo %lX", pipe, bo_id);
+	memset(&cli->shell.value.capture, 0, sizeof(cli->shell.value.capture));
+	cli->shell.cmd = CB_SHELL_OUTPUT_CAPTURE_RELEASE;
+	cli->shell.value.capture.pipe = pipe;
+	cli->shell.value.capture.bo_id = bo_id;
+
+	return send_capture_cmd(cli);
+}
+
+static s32 set_capture_cb(struct cb_client *client, void *userdata,
+			  void (*capture_cb)(void *userdata, s32 pipe,
+					     u64 bo_id, u64 seq, s64 result))
+{
+	struct client *cli = to_client(client);
+
+	if (!client)
+		return -EINVAL;
+
+	client_debug(cli, "set capture cb %p, %p", capture_cb, userdata);
+
+	if (!capture_cb) {
+		client_err(cli, "capture_cb is null");
+		return -EINVAL;
+	}
+
+	cli->capture_cb_userdata = userdata;
+	cli->capture_cb = capture_cb;
+
+	return 0;
+}
+
 static s32 create_surface(struct cb_client *client, struct cb_surface_info *s)
 {
 	struct client *cli = to_client(client);
@@ -1352,24 +1570,7 @@ static s32 create_surface(struct cb_client *client, struct cb_surface_info *s)
 
 	length = cli->create_surface_tx_len;
 
-	do {
-		ret = cb_sendmsg(cli->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	if (ret < 0) {
-		client_err(cli, "failed to send create surf length. %s",
-			   strerror(errno));
-		if (cli->connection_lost_cb)
-			cli->connection_lost_cb(
-					cli->connection_lost_cb_userdata);
-		stop(&cli->base);
-		return -errno;
-	}
-
-	do {
-		ret = cb_sendmsg(cli->sock, cli->create_surface_tx_cmd,
-				 length, NULL);
-	} while (ret == -EAGAIN);
+	ret = client_send(cli, cli->create_surface_tx_cmd, length, NULL);
 	if (ret < 0) {
 		client_err(cli, "failed to send create surf cmd. %s",
 			   strerror(errno));
@@ -1433,24 +1634,7 @@ static s32 create_view(struct cb_client *client, struct cb_view_info *v)
 
 	length = cli->create_view_tx_len;
 
-	do {
-		ret = cb_sendmsg(cli->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	if (ret < 0) {
-		client_err(cli, "failed to send create view length. %s",
-			   strerror(errno));
-		if (cli->connection_lost_cb)
-			cli->connection_lost_cb(
-					cli->connection_lost_cb_userdata);
-		stop(&cli->base);
-		return -errno;
-	}
-
-	do {
-		ret = cb_sendmsg(cli->sock, cli->create_view_tx_cmd,
-				 length, NULL);
-	} while (ret == -EAGAIN);
+	ret = client_send(cli, cli->create_view_tx_cmd, length, NULL);
 	if (ret < 0) {
 		client_err(cli, "failed to send create view cmd. %s",
 			   strerror(errno));
@@ -1516,27 +1700,11 @@ static s32 create_bo(struct cb_client *client, void *bo)
 
 	length = cli->create_bo_tx_len;
 
-	do {
-		ret = cb_sendmsg(cli->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	if (ret < 0) {
-		client_err(cli, "failed to send create bo length. %s",
-			   strerror(errno));
-		if (cli->connection_lost_cb)
-			cli->connection_lost_cb(
-					cli->connection_lost_cb_userdata);
-		stop(&cli->base);
-		return -errno;
+	fds.count = buffer->count_fds;
+	for (i = 0; i < fds.count; i++) {
+		fds.fds[i] = buffer->info.fd[i];
 	}
-
-	do {
-		fds.count = buffer->count_fds;
-		for (i = 0; i < fds.count; i++) {
-			fds.fds[i] = buffer->info.fd[i];
-		}
-		ret = cb_sendmsg(cli->sock, cli->create_bo_tx_cmd,length, &fds);
-	} while (ret == -EAGAIN);
+	ret = client_send(cli, cli->create_bo_tx_cmd, length, &fds);
 	if (ret < 0) {
 		client_err(cli, "failed to send create bo cmd. %s",
 			   strerror(errno));
@@ -1575,6 +1743,7 @@ static s32 set_create_bo_cb(struct cb_client *client,
 static s32 destroy_bo(struct cb_client *client, u64 bo_id)
 {
 	struct client *cli = to_client(client);
+	struct cb_v2_destroy_bo destroy;
 	size_t length;
 	u8 *p;
 	s32 ret;
@@ -1589,35 +1758,23 @@ static s32 destroy_bo(struct cb_client *client, u64 bo_id)
 		return -EINVAL;
 	}
 
-	p = cb_dup_destroy_bo_cmd(cli->destroy_bo_tx_cmd,
-				  cli->destroy_bo_tx_cmd_t,
-				  cli->destroy_bo_tx_len,
-				  bo_id);
-	if (!p) {
-		client_err(cli, "failed to dup destroy bo cmd");
-		return -EINVAL;
-	}
+	if (cli->proto >= CB_PROTO_V2) {
+		destroy.bo_id = bo_id;
+		ret = client_send_v2(cli, CB_V2_OP_DESTROY_BO, &destroy);
+	} else {
+		p = cb_dup_destroy_bo_cmd(cli->destroy_bo_tx_cmd,
+					  cli->destroy_bo_tx_cmd_t,
+					  cli->destroy_bo_tx_len,
+					  bo_id);
+		if (!p) {
+			client_err(cli, "failed to dup destroy bo cmd");
+			return -EINVAL;
+		}
 
-	length = cli->destroy_bo_tx_len;
+		length = cli->destroy_bo_tx_len;
 
-	do {
-		ret = cb_sendmsg(cli->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	if (ret < 0) {
-		client_err(cli, "failed to send destroy bo length. %s",
-			   strerror(errno));
-		if (cli->connection_lost_cb)
-			cli->connection_lost_cb(
-					cli->connection_lost_cb_userdata);
-		stop(&cli->base);
-		return -errno;
+		ret = client_send(cli, cli->destroy_bo_tx_cmd, length, NULL);
 	}
-
-	do {
-		ret = cb_sendmsg(cli->sock, cli->destroy_bo_tx_cmd,
-				 length, NULL);
-	} while (ret == -EAGAIN);
 	if (ret < 0) {
 		client_err(cli, "failed to send destroy bo cmd. %s",
 			   strerror(errno));
@@ -1634,6 +1791,7 @@ static s32 destroy_bo(struct cb_client *client, u64 bo_id)
 static s32 commit_bo(struct cb_client *client, struct cb_commit_info *c)
 {
 	struct client *cli = to_client(client);
+	struct cb_v2_commit commit;
 	size_t length;
 	u8 *p;
 	s32 ret;
@@ -1649,35 +1807,23 @@ static s32 commit_bo(struct cb_client *client, struct cb_commit_info *c)
 	}
 
 	memcpy(&cli->c, c, sizeof(*c));
-	p = cb_dup_commit_req_cmd(cli->commit_tx_cmd,
-				  cli->commit_tx_cmd_t,
-				  cli->commit_tx_len,
-				  &cli->c);
-	if (!p) {
-		client_err(cli, "failed to dup commit bo cmd");
-		return -EINVAL;
-	}
+	if (cli->proto >= CB_PROTO_V2) {
+		cb_v2_commit_from_info(&commit, &cli->c);
+		ret = client_send_v2(cli, CB_V2_OP_COMMIT, &commit);
+	} else {
+		p = cb_dup_commit_req_cmd(cli->commit_tx_cmd,
+					  cli->commit_tx_cmd_t,
+					  cli->commit_tx_len,
+					  &cli->c);
+		if (!p) {
+			client_err(cli, "failed to dup commit bo cmd");
+			return -EINVAL;
+		}
 
-	length = cli->commit_tx_len;
+		length = cli->commit_tx_len;
 
-	do {
-		ret = cb_sendmsg(cli->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	if (ret < 0) {
-		client_err(cli, "failed to send commit bo length. %s",
-			   strerror(errno));
-		if (cli->connection_lost_cb)
-			cli->connection_lost_cb(
-					cli->connection_lost_cb_userdata);
-		stop(&cli->base);
-		return -errno;
+		ret = client_send(cli, cli->commit_tx_cmd, length, NULL);
 	}
-
-	do {
-		ret = cb_sendmsg(cli->sock, cli->commit_tx_cmd,
-				 length, NULL);
-	} while (ret == -EAGAIN);
 	if (ret < 0) {
 		client_err(cli, "failed to send commit bo cmd. %s",
 			   strerror(errno));
@@ -1734,23 +1880,7 @@ static s32 af_commit_bo(struct cb_client *client, u8 *buffer)
 
 	length = (size_t)n;
 
-	do {
-		ret = cb_sendmsg(cli->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	if (ret < 0) {
-		client_err(cli, "failed to send af commit bo length. %s",
-			   strerror(errno));
-		if (cli->connection_lost_cb)
-			cli->connection_lost_cb(
-					cli->connection_lost_cb_userdata);
-		stop(&cli->base);
-		return -errno;
-	}
-
-	do {
-		ret = cb_sendmsg(cli->sock, buffer, length, NULL);
-	} while (ret == -EAGAIN);
+	ret = client_send(cli, buffer, length, NULL);
 	if (ret < 0) {
 		client_err(cli, "failed to send af commit bo cmd. %s",
 			   strerror(errno));
@@ -1834,6 +1964,7 @@ static s32 set_bo_completed_cb(struct cb_client *client, void *userdata,
 static s32 commit_mc(struct cb_client *client, struct cb_mc_info *mc)
 {
 	struct client *cli = to_client(client);
+	struct cb_v2_mc_commit commit;
 	size_t length;
 	u8 *p;
 	s32 ret;
@@ -1849,35 +1980,23 @@ static s32 commit_mc(struct cb_client *client, struct cb_mc_info *mc)
 	}
 
 	memcpy(&cli->mc, mc, sizeof(*mc));
-	p = cb_dup_mc_commit_cmd(cli->commit_mc_tx_cmd,
-				 cli->commit_mc_tx_cmd_t,
-				 cli->commit_mc_tx_len,
-				 &cli->mc);
-	if (!p) {
-		client_err(cli, "failed to dup commit mc cmd");
-		return -EINVAL;
-	}
-
-	length = cli->commit_mc_tx_len;
-
-	do {
-		ret = cb_sendmsg(cli->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	if (ret < 0) {
-		client_err(cli, "failed to send commit mc length. %s",
-			   strerror(errno));
-		if (cli->connection_lost_cb)
-			cli->connection_lost_cb(
-					cli->connection_lost_cb_userdata);
-		stop(&cli->base);
-		return -errno;
-	}
+	if (cli->proto >= CB_PROTO_V2) {
+		cb_v2_mc_commit_from_info(&commit, &cli->mc);
+		ret = client_send_v2(cli, CB_V2_OP_MC_COMMIT, &commit);
+	} else {
+		p = cb_dup_mc_commit_cmd(cli->commit_mc_tx_cmd,
+					 cli->commit_mc_tx_cmd_t,
+					 cli->commit_mc_tx_len,
+					 &cli->mc);
+		if (!p) {
+			client_err(cli, "failed to dup commit mc cmd");
+			return -EINVAL;
+		}
 
-	do {
-		ret = cb_sendmsg(cli->sock, cli->commit_mc_tx_cmd,
-				 length, NULL);
-	} while (ret == -EAGAIN);
+		length = cli->commit_mc_tx_len;
+
+		ret = client_send(cli, cli->commit_mc_tx_cmd, length, NULL);
+	}
 	if (ret < 0) {
 		client_err(cli, "failed to send commit mc cmd. %s",
 			   strerror(errno));
@@ -1965,6 +2084,10 @@ static s32 shell_proc(struct client *cli, u8 *buf)
 				       sizeof(struct cb_rect));
 				memcpy(&disp->input_rc, &cfg->input_rc,
 				       sizeof(struct cb_rect));
+				disp->transform = cfg->transform;
+				disp->render_scale = cfg->render_scale;
+				disp->render_scale_auto =
+						cfg->render_scale_auto;
 				disp->mode_current = cfg->mode_handle;
 				disp->mode_custom = cfg->custom_mode_handle;
 				disp->width_preferred =
@@ -2013,6 +2136,11 @@ static s32 shell_proc(struct client *cli, u8 *buf)
 					memcpy(&disp->input_rc,
 					       &cfg->input_rc,
 					       sizeof(struct cb_rect));
+					disp->transform = cfg->transform;
+					disp->render_scale =
+						cfg->render_scale;
+					disp->render_scale_auto =
+						cfg->render_scale_auto;
 					disp->mode_current = cfg->mode_handle;
 					disp->mode_custom
 						= cfg->custom_mode_handle;
@@ -2068,6 +2196,10 @@ static s32 shell_proc(struct client *cli, u8 *buf)
 				       sizeof(struct cb_rect));
 				memcpy(&disp->input_rc, &cfg->input_rc,
 				       sizeof(struct cb_rect));
+				disp->transform = cfg->transform;
+				disp->render_scale = cfg->render_scale;
+				disp->render_scale_auto =
+						cfg->render_scale_auto;
 				disp->mode_current = cfg->mode_handle;
 				disp->mode_custom = cfg->custom_mode_handle;
 				disp->width_preferred =
@@ -2117,6 +2249,11 @@ static s32 shell_proc(struct client *cli, u8 *buf)
 					memcpy(&disp->input_rc,
 					       &cfg->input_rc,
 					       sizeof(struct cb_rect));
+					disp->transform = cfg->transform;
+					disp->render_scale =
+						cfg->render_scale;
+					disp->render_scale_auto =
+						cfg->render_scale_auto;
 					disp->mode_current = cfg->mode_handle;
 					disp->mode_custom
 						= cfg->custom_mode_handle;
@@ -2221,6 +2358,30 @@ static s32 shell_proc(struct client *cli, u8 *buf)
 			}
 		}
 		break;
+	case CB_SHELL_OUTPUT_CAPTURE_START:
+		/* capture start result, no bo is captured */
+		client_debug(cli, "capture start pipe %d result %ld",
+			     cli->shell.value.capture.pipe,
+			     cli->shell.value.capture.result);
+		if (cli->capture_cb) {
+			cli->capture_cb(cli->capture_cb_userdata,
+					cli->shell.value.capture.pipe,
+					0, 0, cli->shell.value.capture.result);
+		}
+		break;
+	case CB_SHELL_OUTPUT_CAPTURE_NOTIFY:
+		client_debug(cli, "captured pipe %d bo %lX seq %lu",
+			     cli->shell.value.capture.pipe,
+			     cli->shell.value.capture.bo_id,
+			     cli->shell.value.capture.seq);
+		if (cli->capture_cb) {
+			cli->capture_cb(cli->capture_cb_userdata,
+					cli->shell.value.capture.pipe,
+					cli->shell.value.capture.bo_id,
+					cli->shell.value.capture.seq,
+					cli->shell.value.capture.result);
+		}
+		break;
 	default:
 		client_err(cli, "unknown shell cmd %d", cli->shell.cmd);
 		return -EINVAL;
@@ -2229,10 +2390,158 @@ static s32 shell_proc(struct client *cli, u8 *buf)
 	return 0;
 }
 
-static void client_ipc_proc(struct client *cli)
+/*
+ * Ask for the highest protocol version both sides speak. Only the frequent
+ * commands have a v2 form, the others stay TLV.
+ */
+static void proto_select(struct client *cli, u32 version)
+{
+	u32 n;
+	u8 *p;
+	s32 ret;
+
+	if (version < CB_PROTO_V2)
+		return;
+
+	p = cb_client_create_proto_select_cmd(version, &n);
+	if (!p)
+		return;
+	ret = client_send(cli, p, n, NULL);
+	free(p);
+	if (ret < 0) {
+		client_err(cli, "failed to send protocol select cmd. %s",
+			   strerror(errno));
+		if (cli->connection_lost_cb)
+			cli->connection_lost_cb(
+					cli->connection_lost_cb_userdata);
+		stop(&cli->base);
+		return;
+	}
+	cli->proto = version;
+	client_notice(cli, "protocol v%u", version);
+}
+
+static void commit_ack_proc(struct client *cli, u64 id, u64 surface_id)
+{
+	client_debug(cli, "received commit ack %016X, %p",
+		     id, cli->bo_commited_cb);
+	if (cli->bo_commited_cb) {
+		if (id == (u64)(-1)) {
+			client_err(cli, "failed to commit bo.");
+			cli->bo_commited_cb(false,
+				cli->bo_commited_cb_userdata, (u64)-1,
+				surface_id);
+			return;
+		}
+		cli->bo_commited_cb(true,
+			cli->bo_commited_cb_userdata, id, surface_id);
+	}
+}
+
+static void bo_flipped_proc(struct client *cli, u64 id, u64 surface_id)
+{
+	client_debug(cli, "received bo flipped event %016X, %p",
+		     id, cli->bo_flipped_cb);
+	if (cli->bo_flipped_cb) {
+		if (id == (u64)(-1)) {
+			client_err(cli, "Unknown bo flipped.");
+			return;
+		}
+		cli->bo_flipped_cb(cli->bo_flipped_cb_userdata, id,
+				   surface_id);
+	}
+}
+
+static void bo_completed_proc(struct client *cli, u64 id, u64 surface_id)
+{
+	client_debug(cli, "received bo completed event %016X, %p",
+		     id, cli->bo_completed_cb);
+	if (cli->bo_completed_cb) {
+		if (id == (u64)(-1)) {
+			client_err(cli, "Unknown bo completed.");
+			return;
+		}
+		cli->bo_completed_cb(cli->bo_completed_cb_userdata,
+				     id, surface_id);
+	}
+}
+
+static void view_focus_chg_proc(struct client *cli, u64 view_id,
+				bool focus_on)
+{
+	client_debug(cli, "received view focus chg event %016X %c",
+		     view_id, focus_on ? 'Y': 'N');
+	if (cli->view_focus_chg_cb) {
+		cli->view_focus_chg_cb(cli->view_focus_chg_userdata,
+				       view_id, focus_on);
+	}
+}
+
+static void mc_commit_ack_proc(struct client *cli, u64 id)
+{
+	client_debug(cli, "received mc commited ack %016X, %p",
+		     id, cli->mc_commited_cb);
+	if (cli->mc_commited_cb) {
+		if (id) {
+			cli->mc_commited_cb(false,
+				cli->mc_commited_cb_userdata, id);
+			return;
+		}
+		cli->mc_commited_cb(true,
+			cli->mc_commited_cb_userdata, id);
+	}
+}
+
+static void client_v2_proc(struct client *cli, u8 *buf, size_t ipc_sz)
+{
+	struct cb_v2_commit_ack *ack;
+	struct cb_v2_bo_event *ev;
+	struct cb_v2_view_focus_chg *chg;
+	struct cb_v2_mc_commit_ack *mc_ack;
+	void *body;
+	u16 opcode;
+	u32 seq;
+
+	body = cb_v2_decode(buf, ipc_sz, &opcode, &seq);
+	if (!body) {
+		client_err(cli, "malformed v2 message, size %lu", ipc_sz);
+		return;
+	}
+
+	if (seq != cli->v2_rx_seq)
+		client_warn(cli, "v2 message seq %u, expect %u", seq,
+			    cli->v2_rx_seq);
+	cli->v2_rx_seq = seq + 1;
+
+	switch (opcode) {
+	case CB_V2_OP_COMMIT_ACK:
+		ack = body;
+		commit_ack_proc(cli, ack->result, ack->surface_id);
+		break;
+	case CB_V2_OP_BO_FLIPPED:
+		ev = body;
+		bo_flipped_proc(cli, ev->bo_id, ev->surface_id);
+		break;
+	case CB_V2_OP_BO_COMPLETE:
+		ev = body;
+		bo_completed_proc(cli, ev->bo_id, ev->surface_id);
+		break;
+	case CB_V2_OP_VIEW_FOCUS_CHG:
+		chg = body;
+		view_focus_chg_proc(cli, chg->view_id, chg->on ? true : false);
+		break;
+	case CB_V2_OP_MC_COMMIT_ACK:
+		mc_ack = body;
+		mc_commit_ack_proc(cli, mc_ack->result);
+		break;
+	default:
+		client_err(cli, "unexpected v2 opcode %u", opcode);
+		break;
+	}
+}
+
+static void client_ipc_proc(struct client *cli, u8 *buf, size_t ipc_sz)
 {
-	u8 *buf;
-	size_t ipc_sz;
 	u32 flag, ret;
 	struct cb_tlv *tlv;
 	u64 id;
@@ -2247,8 +2556,11 @@ static void client_ipc_proc(struct client *cli)
 	if (!cli)
 		return;
 
-	ipc_sz = cli->ipc_sz;
-	buf = &cli->ipc_buf[0] + sizeof(size_t);
+	if (cb_v2_is_msg(buf, ipc_sz)) {
+		client_v2_proc(cli, buf, ipc_sz);
+		return;
+	}
+
 	flag = *((u32 *)buf);
 	tlv = (struct cb_tlv *)(buf + sizeof(u32));
 	assert(ipc_sz == (tlv->length + sizeof(*tlv) + sizeof(flag)));
@@ -2257,7 +2569,13 @@ static void client_ipc_proc(struct client *cli)
 		tlv->tag == CB_TAG_GET_KBD_LED_STATUS_ACK ||
 		tlv->tag == CB_TAG_GET_EDID_ACK ||
 		tlv->tag == CB_TAG_GUI_INPUT ||
-		tlv->tag == CB_TAG_VIEW_FOCUS_CHG);
+		tlv->tag == CB_TAG_VIEW_FOCUS_CHG ||
+		tlv->tag == CB_TAG_SHM_SETUP_ACK);
+
+	if (tlv->tag == CB_TAG_SHM_SETUP_ACK) {
+		shm_setup_ack_proc(cli, buf);
+		return;
+	}
 
 	if (tlv->tag == CB_TAG_GUI_INPUT) {
 		msg = cb_client_parse_input_msg(buf, &count_msg);
@@ -2311,14 +2629,7 @@ static void client_ipc_proc(struct client *cli)
 			client_err(cli, "failed to parse view focus chg "
 				   "message. ret = %d", ret);
 		} else {
-			client_debug(cli, "received view focus chg event "
-				     "%016X %c", view_id, focus_on ? 'Y': 'N');
-			if (cli->view_focus_chg_cb) {
-				cli->view_focus_chg_cb(
-					cli->view_focus_chg_userdata,
-					view_id,
-					focus_on);
-			}
+			view_focus_chg_proc(cli, view_id, focus_on);
 		}
 		return;
 	}
@@ -2368,6 +2679,7 @@ static void client_ipc_proc(struct client *cli)
 		cli->link_id = id;
 		client_debug(cli, "received link id %016X, %p",
 			     id, cli->ready_cb);
+		proto_select(cli, cb_client_parse_link_proto(buf));
 		if (cli->ready_cb) {
 			cli->ready_cb(cli->ready_cb_userdata);
 		}
@@ -2421,45 +2733,15 @@ static void client_ipc_proc(struct client *cli)
 	}
 	if (flag & (1 << CB_CMD_COMMIT_ACK_SHIFT)) {
 		id = cb_client_parse_commit_ack_cmd(buf, &surface_id);
-		client_debug(cli, "received commit ack %016X, %p",
-			     id, cli->bo_commited_cb);
-		if (cli->bo_commited_cb) {
-			if (id == (u64)(-1)) {
-				client_err(cli, "failed to commit bo.");
-				cli->bo_commited_cb(false,
-					cli->bo_commited_cb_userdata, (u64)-1,
-					surface_id);
-				return;
-			}
-			cli->bo_commited_cb(true,
-				cli->bo_commited_cb_userdata, id, surface_id);
-		}
+		commit_ack_proc(cli, id, surface_id);
 	}
 	if (flag & (1 << CB_CMD_BO_FLIPPED_SHIFT)) {
 		id = cb_client_parse_bo_flipped_cmd(buf, &surface_id);
-		client_debug(cli, "received bo flipped event %016X, %p",
-			     id, cli->bo_flipped_cb);
-		if (cli->bo_flipped_cb) {
-			if (id == (u64)(-1)) {
-				client_err(cli, "Unknown bo flipped.");
-				return;
-			}
-			cli->bo_flipped_cb(cli->bo_flipped_cb_userdata, id,
-					   surface_id);
-		}
+		bo_flipped_proc(cli, id, surface_id);
 	}
 	if (flag & (1 << CB_CMD_BO_COMPLETE_SHIFT)) {
 		id = cb_client_parse_bo_complete_cmd(buf, &surface_id);
-		client_debug(cli, "received bo completed event %016X, %p",
-			     id, cli->bo_completed_cb);
-		if (cli->bo_completed_cb) {
-			if (id == (u64)(-1)) {
-				client_err(cli, "Unknown bo completed.");
-				return;
-			}
-			cli->bo_completed_cb(cli->bo_completed_cb_userdata,
-					     id, surface_id);
-		}
+		bo_completed_proc(cli, id, surface_id);
 	}
 	if (flag & (1 << CB_CMD_DESTROY_ACK_SHIFT)) {
 		client_debug(cli, "received destroy result %p",
@@ -2507,107 +2789,124 @@ static void client_ipc_proc(struct client *cli)
 	}
 	if (flag & (1 << CB_CMD_MC_COMMIT_ACK_SHIFT)) {
 		id = cb_client_parse_mc_commit_ack_cmd(buf);
-		client_debug(cli, "received mc commited ack %016X, %p",
-			     id, cli->mc_commited_cb);
-		if (cli->mc_commited_cb) {
-			if (id) {
-				cli->mc_commited_cb(false,
-					cli->mc_commited_cb_userdata, id);
-				return;
-			}
-			cli->mc_commited_cb(true,
-				cli->mc_commited_cb_userdata, id);
+		mc_commit_ack_proc(cli, id);
+	}
+}
+
+/*
+ * Next frame from the server. With the shm transport on, frames come from
+ * the s2c ring and a marker there stands for a run of socket frames, which
+ * may have been taken already while the ring was drained.
+ */
+static s32 client_next_frame(struct client *cli, u8 **buf, size_t *sz)
+{
+	s32 ret;
+
+	if (!cli->s2c_ring_on)
+		return cb_ipc_rx_next(cli->rx, buf, sz);
+
+	for (;;) {
+		if (cli->sock_frames_due > 0) {
+			/* 0 until the socket frame arrives */
+			ret = cb_ipc_rx_next(cli->rx, buf, sz);
+			if (ret > 0)
+				cli->sock_frames_due--;
+			return ret;
+		}
+
+		ret = cb_shm_ring_read(cli->s2c_ring, buf, sz);
+		if (ret == CB_SHM_RING_MARKER) {
+			cli->sock_frames_due += *sz;
+			continue;
+		}
+		if (ret != 0)
+			return ret;
+		if (!cb_shm_ring_sleep(cli->s2c_ring))
+			continue;
+
+		/* the ring is drained, socket frames are next in order */
+		ret = cb_ipc_rx_next(cli->rx, buf, sz);
+		if (ret > 0)
+			cli->sock_frames_due--;
+		return ret;
+	}
+}
+
+/* dispatch every complete frame, a partial one waits for more */
+static s32 client_dispatch(struct client *cli)
+{
+	size_t sz;
+	u8 *buf;
+	s32 ret;
+
+	while (!cli->exit) {
+		ret = client_next_frame(cli, &buf, &sz);
+		if (ret < 0) {
+			client_err(cli, "bad message from server (%s).",
+				   strerror(-ret));
+			if (cli->connection_lost_cb)
+				cli->connection_lost_cb(
+					cli->connection_lost_cb_userdata);
+			stop(&cli->base);
+			return ret;
 		}
+		if (!ret)
+			break;
+		client_ipc_proc(cli, buf, sz);
 	}
+
+	return 0;
 }
 
 static s32 sock_cb(s32 fd, u32 mask, void *data)
 {
 	struct client *cli = data;
-	size_t byts_rd;
-	s32 ret, i;
-	s32 flag; /* 0: length not received, 1: length received. */
-	struct cb_fds ipc_fds;
-	s32 *p;
+	s32 ret;
 
-	cli->ipc_fds.count = 0;
-	if (cli->cursor >= ((u8 *)(cli->ipc_buf) + sizeof(size_t))) {
-		flag = 1;
-	} else {
-		flag = 0;
+	if (mask & CB_EVT_WRITABLE) {
+		ret = client_flush(cli);
+		if (ret < 0) {
+			client_err(cli, "failed to flush to server (%s).",
+				   strerror(-ret));
+			if (cli->connection_lost_cb)
+				cli->connection_lost_cb(
+					cli->connection_lost_cb_userdata);
+			stop(&cli->base);
+			return ret;
+		}
 	}
 
-	do {
-		/* bytes_to_rd is set when client create: sizeof(size_t) */
-		/* printf("try to receive %lu\n", client->byts_to_rd); */
-		ret = cb_recvmsg(cli->sock, cli->cursor,
-				 cli->byts_to_rd, &ipc_fds);
-		/* printf("receive return %d\n", ret); */
-	} while (ret == -EAGAIN);
+	if (!(mask & (CB_EVT_READABLE | CB_EVT_HANGUP | CB_EVT_ERROR)))
+		return 0;
 
-	if (ret < 0) {
-		client_err(cli, "failed to recv from server (%s).",
-			   strerror(-ret));
+	ret = cb_ipc_rx_fill(cli->rx, cli->sock, CLIENT_RX_READ_MAX);
+	if (ret == 0) {
+		client_err(cli, "connection lost.");
 		if (cli->connection_lost_cb)
 			cli->connection_lost_cb(
 					cli->connection_lost_cb_userdata);
 		stop(&cli->base);
-		return ret;
-	} else if (ret == 0) {
-		client_err(cli, "connection lost.");
+		return 0;
+	} else if (ret < 0 && ret != -EAGAIN && ret != -ENOBUFS) {
+		client_err(cli, "failed to recv from server (%s).",
+			   strerror(-ret));
 		if (cli->connection_lost_cb)
 			cli->connection_lost_cb(
 					cli->connection_lost_cb_userdata);
 		stop(&cli->base);
-		return 0;
+		return ret;
 	}
 
-	if (ipc_fds.count > 0) {
-		p = &cli->ipc_fds.fds[cli->ipc_fds.count];
-		for (i = 0; i < ipc_fds.count; i++) {
-			p[i] = ipc_fds.fds[i];
-		}
-		cli->ipc_fds.count += ipc_fds.count;
-	}
-
-	cli->cursor += ret;
-	cli->byts_to_rd -= ret;
-	byts_rd = ret;
-
-	if (!flag) {
-		if (ret >= sizeof(size_t)) {
-			/* received the length */
-			flag = 1;
-			memcpy(&cli->byts_to_rd, cli->ipc_buf, sizeof(size_t));
-			cli->ipc_sz = cli->byts_to_rd;
-			/* printf("ipc size: %lu\n", client->ipc_sz); */
-			/* printf("%p %p\n", client->cursor, client->ipc_buf);*/
-			if ((byts_rd - sizeof(size_t)) > cli->ipc_sz) {
-				/* received more than one ipc message */
-				cli->byts_to_rd = 0;
-			} else {
-				cli->byts_to_rd -= (byts_rd -sizeof(size_t));
-			}
-		}
-	}
+	return client_dispatch(cli);
+}
 
-	if (!cli->byts_to_rd) {
-		cli->cursor = (u8 *)cli->ipc_buf;
-		cli->byts_to_rd = sizeof(size_t);
-		/* printf("complete.\n"); */
-		/* TODO &client->ipc_buf[0] + sizeof(size_t), ipc_sz */
-		/*
-		printf("proc ipc message: %p, %lu\n",
-			&cli->ipc_buf[0] + sizeof(size_t), cli->ipc_sz);
-		printf("ipc received %d fds.\n", cli->ipc_fds.count);
-		for (i = 0; i < cli->ipc_fds.count; i++) {
-			printf("fds[%d]: %d\n", i, cli->ipc_fds.fds[i]);
-		}
-		*/
-		client_ipc_proc(cli);
-		cli->ipc_fds.count = 0;
-	}
-	return 0;
+static s32 ring_cb(s32 fd, u32 mask, void *data)
+{
+	struct client *cli = data;
+
+	cb_shm_ring_doorbell_ack(cli->s2c_ring);
+
+	return client_dispatch(cli);
 }
 
 static void add_idle_task(struct cb_client *client, void *userdata,
@@ -2683,6 +2982,7 @@ struct cb_client *cb_client_create(s32 seat)
 		return NULL;
 
 	cli->debug_level = CB_LOG_NOTICE;
+	cli->proto = CB_PROTO_V1;
 
 	memset(cli->pid_name, 0, 9);
 	sprintf(cli->pid_name, "%08lX", syscall(SYS_gettid));
@@ -2721,6 +3021,14 @@ struct cb_client *cb_client_create(s32 seat)
 		goto err;
 	}
 
+	cli->tx = cb_ipc_tx_create(CLIENT_TX_SIZE, CLIENT_TX_MAX);
+	if (!cli->tx)
+		goto err;
+
+	cli->rx = cb_ipc_rx_create(CLIENT_RX_SIZE, CB_IPC_BUF_MAX_LEN);
+	if (!cli->rx)
+		goto err;
+
 	cli->sock_source = cb_event_loop_add_fd(cli->loop,
 						cli->sock,
 						CB_EVT_READABLE,
@@ -2728,10 +3036,7 @@ struct cb_client *cb_client_create(s32 seat)
 						cli);
 	if (!cli->sock_source)
 		goto err;
-
-	cli->byts_to_rd = sizeof(size_t);
-	cli->cursor = cli->ipc_buf;
-	cli->ipc_sz = 0;
+	cli->sock_mask = CB_EVT_READABLE;
 
 	cli->create_surface_tx_cmd_t = cb_client_create_surface_cmd(NULL,
 						&cli->create_surface_tx_len);
@@ -2807,6 +3112,7 @@ struct cb_client *cb_client_create(s32 seat)
 	cli->base.stop = stop;
 	cli->base.set_server_dbg = set_server_dbg;
 	cli->base.set_client_cap = set_client_cap;
+	cli->base.enable_shm_transport = enable_shm_transport;
 	cli->base.set_input_msg_cb = set_input_msg_cb;
 	cli->base.set_raw_input_evts_cb = set_raw_input_evts_cb;
 	cli->base.set_raw_touch_evts_cb = set_raw_touch_evts_cb;
@@ -2828,6 +3134,10 @@ struct cb_client *cb_client_create(s32 seat)
 	cli->base.change_layout = change_layout;
 	cli->base.create_mode = create_mode;
 	cli->base.set_create_mode_cb = set_create_mode_cb;
+	cli->base.capture_start = capture_start;
+	cli->base.capture_stop = capture_stop;
+	cli->base.capture_release = capture_release;
+	cli->base.set_capture_cb = set_capture_cb;
 	cli->base.create_surface = create_surface;
 	cli->base.set_create_surface_cb = set_create_surface_cb;
 	cli->base.create_view = create_view;
@@ -2936,6 +3246,12 @@ void *cb_client_gbm_bo_create(s32 drmfd,
 	case CB_PIX_FMT_RGB888:
 		buffer->fourcc = mk_fourcc('R', 'G', '2', '4');
 		break;
+	/**
+	 * 16-bit RGB 565 format. B [4:0]  G [10:5]  R [15:11]
+	 */
+	case CB_PIX_FMT_RGB565:
+		buffer->fourcc = mk_fourcc('R', 'G', '1', '6');
+		break;
 	/**
 	 * 2 plane YCbCr format, 2x2 subsampled Cb:Cr plane
 	 */
@@ -2948,10 +3264,6 @@ void *cb_client_gbm_bo_create(s32 drmfd,
 	 * 2 plane YCbCr format, non-subsampled Cb and Cr planes
 	 */
 	case CB_PIX_FMT_NV24:
-	/**
-	 * 16-bit RGB 565 format. B [4:0]  G [10:5]  R [15:11]
-	 */
-	case CB_PIX_FMT_RGB565:
 	/**
 	 * packed YCbCr format, Y0Cb0 Y1Cr0 Y2Cb2 Y3Cr2
 	 */
@@ -2995,6 +3307,7 @@ void *cb_client_gbm_bo_create(s32 drmfd,
 		/* TODO */
 	} else if (buffer->info.pix_fmt == CB_PIX_FMT_ARGB8888 ||
 		   buffer->info.pix_fmt == CB_PIX_FMT_RGB888 ||
+		   buffer->info.pix_fmt == CB_PIX_FMT_RGB565 ||
 		   buffer->info.pix_fmt == CB_PIX_FMT_XRGB8888) {
 		buffer->info.strides[0] = gbm_bo_get_stride(buffer->client_bo);
 		buffer->info.offsets[0] = 0;
@@ -3157,14 +3470,56 @@ void *cb_client_dma_buf_bo_create(s32 drmfd,
 	 * 24-bit RGB 888 format. B [7:0]  G [15:8]  R [23:16]
 	 */
 	case CB_PIX_FMT_RGB888:
+		buffer->fourcc = mk_fourcc('R', 'G', '2', '4');
+		create_arg.bpp = 24;
+		if (!hstride)
+			w = (width + 16 - 1) & ~(16 - 1);
+		else
+			w = hstride;
+		if (!vstride)
+			h = (height + 16 - 1) & ~(16 - 1);
+		else
+			h = vstride;
+		create_arg.width = w;
+		create_arg.height = h;
+		break;
+
 	/**
 	 * 16-bit RGB 565 format. B [4:0]  G [10:5]  R [15:11]
 	 */
 	case CB_PIX_FMT_RGB565:
+		buffer->fourcc = mk_fourcc('R', 'G', '1', '6');
+		create_arg.bpp = 16;
+		if (!hstride)
+			w = (width + 16 - 1) & ~(16 - 1);
+		else
+			w = hstride;
+		if (!vstride)
+			h = (height + 16 - 1) & ~(16 - 1);
+		else
+			h = vstride;
+		create_arg.width = w;
+		create_arg.height = h;
+		break;
+
 	/**
 	 * packed YCbCr format, Y0Cb0 Y1Cr0 Y2Cb2 Y3Cr2
 	 */
 	case CB_PIX_FMT_YUYV:
+		buffer->fourcc = mk_fourcc('Y', 'U', 'Y', 'V');
+		create_arg.bpp = 16;
+		if (!hstride)
+			w = (width + 16 - 1) & ~(16 - 1);
+		else
+			w = hstride;
+		if (!vstride)
+			h = (height + 16 - 1) & ~(16 - 1);
+		else
+			h = vstride;
+		create_arg.width = w;
+		create_arg.height = h;
+		break;
+
 	/**
 	 * 3 plane YCbCr format, 2x2 subsampled Cb and Cr planes
 	 */
@@ -3214,7 +3569,10 @@ void *cb_client_dma_buf_bo_create(s32 drmfd,
 		pitches[1] = buffer->info.strides[1];
 		offsets[1] = create_arg.pitch * h;
 	} else if (buffer->info.pix_fmt == CB_PIX_FMT_ARGB8888 ||
-		   buffer->info.pix_fmt == CB_PIX_FMT_XRGB8888) {
+		   buffer->info.pix_fmt == CB_PIX_FMT_XRGB8888 ||
+		   buffer->info.pix_fmt == CB_PIX_FMT_RGB888 ||
+		   buffer->info.pix_fmt == CB_PIX_FMT_RGB565 ||
+		   buffer->info.pix_fmt == CB_PIX_FMT_YUYV) {
 		buffer->info.sizes[0] = create_arg.size;
 		buffer->info.strides[0] = create_arg.pitch;
 		buffer->info.offsets[0] = 0;
@@ -3379,6 +3737,8 @@ void *cb_client_shm_bo_create(enum cb_pix_fmt pix_fmt,
 	struct client_buffer *buffer;
 	s32 ret;
 	u32 w, h, size;
+	/* bytes per pixel of packed formats */
+	u32 cpp = 4;
 
 	if (!width || !height || !count_planes || !maps || !pitches ||
 	    !offsets || !sizes)
@@ -3504,14 +3864,53 @@ void *cb_client_shm_bo_create(enum cb_pix_fmt pix_fmt,
 	 * 24-bit RGB 888 format. B [7:0]  G [15:8]  R [23:16]
 	 */
 	case CB_PIX_FMT_RGB888:
+		buffer->fourcc = mk_fourcc('R', 'G', '2', '4');
+		if (!hstride)
+			w = (width + 16 - 1) & ~(16 - 1);
+		else
+			w = hstride;
+		if (!vstride)
+			h = (height + 16 - 1) & ~(16 - 1);
+		else
+			h = vstride;
+		cpp = 3;
+		size = w * h * cpp;
+		break;
+
 	/**
 	 * 16-bit RGB 565 format. B [4:0]  G [10:5]  R [15:11]
 	 */
 	case CB_PIX_FMT_RGB565:
+		buffer->fourcc = mk_fourcc('R', 'G', '1', '6');
+		if (!hstride)
+			w = (width + 16 - 1) & ~(16 - 1);
+		else
+			w = hstride;
+		if (!vstride)
+			h = (height + 16 - 1) & ~(16 - 1);
+		else
+			h = vstride;
+		cpp = 2;
+		size = w * h * cpp;
+		break;
+
 	/**
 	 * packed YCbCr format, Y0Cb0 Y1Cr0 Y2Cb2 Y3Cr2
 	 */
 	case CB_PIX_FMT_YUYV:
+		buffer->fourcc = mk_fourcc('Y', 'U', 'Y', 'V');
+		if (!hstride)
+			w = (width + 16 - 1) & ~(16 - 1);
+		else
+			w = hstride;
+		if (!vstride)
+			h = (height + 16 - 1) & ~(16 - 1);
+		else
+			h = vstride;
+		cpp = 2;
+		size = w * h * cpp;
+		break;
+
 	/**
 	 * 3 plane YCbCr format, 2x1 subsampled Cb and Cr planes
 	 */
@@ -3553,9 +3952,12 @@ void *cb_client_shm_bo_create(enum cb_pix_fmt pix_fmt,
 		pitches[1] = buffer->info.strides[0];
 		offsets[1] = buffer->info.sizes[0];
 	} else if (buffer->info.pix_fmt == CB_PIX_FMT_ARGB8888 ||
-		   buffer->info.pix_fmt == CB_PIX_FMT_XRGB8888) {
+		   buffer->info.pix_fmt == CB_PIX_FMT_XRGB8888 ||
+		   buffer->info.pix_fmt == CB_PIX_FMT_RGB888 ||
+		   buffer->info.pix_fmt == CB_PIX_FMT_RGB565 ||
+		   buffer->info.pix_fmt == CB_PIX_FMT_YUYV) {
 		buffer->info.sizes[0] = size;
-		buffer->info.strides[0] = w * 4;
+		buffer->info.strides[0] = w * cpp;
 		buffer->info.offsets[0] = 0;
 		buffer->info.planes = 1;
 		*count_planes = 1;
@@ -3624,3 +4026,30 @@ void cb_client_shm_bo_destroy(void *bo)
 	free(buffer);
 }
 
+void *cb_client_solid_bo_create(u32 color, u32 width, u32 height)
+{
+	struct client_buffer *buffer;
+
+	if (!width || !height)
+		return NULL;
+
+	buffer = calloc(1, sizeof(*buffer));
+	if (!buffer)
+		return NULL;
+
+	buffer->fourcc = mk_fourcc('A', 'R', '2', '4');
+	buffer->info.pix_fmt = CB_PIX_FMT_ARGB8888;
+	buffer->info.type = CB_BUF_TYPE_SOLID;
+	buffer->info.width = width;
+	buffer->info.height = height;
+	buffer->info.color = color;
+	buffer->count_fds = 0;
+
+	return buffer;
+}
+
+void cb_client_solid_bo_destroy(void *bo)
+{
+	free(bo);
+}
+
@@ -44,6 +44,9 @@ struct cb_client_mode_desc {
 struct cb_client_display {
 	s32 pipe; /* read only */
 	struct cb_rect desktop_rc, input_rc; /* read / write */
+	u32 transform; /* read / write, enum cb_output_transform */
+	u32 render_scale; /* read / write, percent, 0: not changed */
+	bool render_scale_auto; /* read / write */
 	struct mode_req mr; /* write only */
 	void *pending_mode; /* write only */
 	void *mode_current; /* read only */
@@ -80,6 +83,14 @@ struct cb_client {
 
 	s32 (*set_client_cap)(struct cb_client *client, u64 cap);
 
+	/*
+	 * Move commits and buffer events to shared memory rings, ring_size
+	 * bytes each way. The socket keeps setup and fd passing. The switch
+	 * happens once the server acknowledged, until then (or if it refuses)
+	 * messages keep going through the socket.
+	 */
+	s32 (*enable_shm_transport)(struct cb_client *client, u32 ring_size);
+
 	s32 (*set_input_msg_cb)(struct cb_client *client,
 				void *userdata,
 				void (*input_msg_cb)(
@@ -143,6 +154,23 @@ struct cb_client {
 				  void (*mode_created_cb)(
 				  	bool success, void *userdata));
 
+	/*
+	 * capture output by writeback.
+	 * bo_ids are SHM bos or direct show DMA-BUF bos in the size of the
+	 * output's current video timing.
+	 * capture_cb is called with bo_id 0 for the start result, then with
+	 * each captured bo. A captured bo is not written again until it is
+	 * given back by capture_release.
+	 */
+	s32 (*capture_start)(struct cb_client *client, s32 pipe, u64 *bo_ids,
+			     u32 count_bos, u32 interval_ms);
+	s32 (*capture_stop)(struct cb_client *client, s32 pipe);
+	s32 (*capture_release)(struct cb_client *client, s32 pipe, u64 bo_id);
+	s32 (*set_capture_cb)(struct cb_client *client, void *userdata,
+			      void (*capture_cb)(void *userdata, s32 pipe,
+						 u64 bo_id, u64 seq,
+						 s64 result));
+
 	s32 (*create_surface)(struct cb_client *client,
 			      struct cb_surface_info *s);
 	s32 (*set_create_surface_cb)(struct cb_client *client, void *userdata,
@@ -286,6 +314,13 @@ void *cb_client_shm_bo_create(enum cb_pix_fmt pix_fmt,
 
 void cb_client_shm_bo_destroy(void *bo);
 
+/*
+ * memoryless bo, the view it is committed to is filled with the ARGB8888
+ * color. width and height are nominal, the fill follows the view size.
+ */
+void *cb_client_solid_bo_create(u32 color, u32 width, u32 height);
+void cb_client_solid_bo_destroy(void *bo);
+
 void *cb_client_gbm_bo_create(s32 drmfd,
 			      void *gbm,
 			      enum cb_pix_fmt pix_fmt,
@@ -54,6 +54,14 @@ void usage(void)
 	fprintf(stderr, "\t\t\te.g. cube_manager --set-layout="
 			"0,0/2560x1440-0,0/40330x65536@1"
 			":2560,0/1600x900-40330,0/25206x40960@1\n");
+	fprintf(stderr, "\t\t\tAppend r90/r180/r270 to the mode index to "
+			"rotate the output counter-clockwise\n");
+	fprintf(stderr, "\t\t\te.g. cube_manager --set-layout="
+			"0,0/1080x1920-0,0/65536x65536@-1r90\n");
+	fprintf(stderr, "\t\t\tAppend s50-s100 to render at the percent of "
+			"the mode size, sNa to let the server lower it\n");
+	fprintf(stderr, "\t\t\te.g. cube_manager --set-layout="
+			"0,0/3840x2160-0,0/65536x65536@-1s75a\n");
 	fprintf(stderr, "cube_manager --enumerate\n");
 	fprintf(stderr, "\tEnumerate all timings for all outputs supported\n");
 	fprintf(stderr, "cube_manager --create-mode timing_string\n");
@@ -260,7 +268,7 @@ static void parse_mode_create_param(char *param, struct cb_client *client,
 static void parse_layout_param(char *param, struct cb_client *client)
 {
 	char *opt = malloc(256);
-	char *p, *src;
+	char *p, *src, *r, *s;
 	s32 i = 0, mode_index, j;
 	struct cb_client_mode_desc *m;
 
@@ -314,6 +322,33 @@ static void parse_layout_param(char *param, struct cb_client *client)
 		if (!p)
 			break;
 		mode_index = atoi(p);
+		client->displays[i].transform = CB_TRANSFORM_NORMAL;
+		r = strchr(p, 'r');
+		if (r) {
+			switch (atoi(r + 1)) {
+			case 90:
+				client->displays[i].transform = CB_TRANSFORM_90;
+				break;
+			case 180:
+				client->displays[i].transform =
+							CB_TRANSFORM_180;
+				break;
+			case 270:
+				client->displays[i].transform =
+							CB_TRANSFORM_270;
+				break;
+			default:
+				break;
+			}
+		}
+		client->displays[i].render_scale = 0;
+		client->displays[i].render_scale_auto = false;
+		s = strchr(p, 's');
+		if (s) {
+			client->displays[i].render_scale = atoi(s + 1);
+			if (strchr(s, 'a'))
+				client->displays[i].render_scale_auto = true;
+		}
 
 		printf("desktop[%d]: %d,%d %ux%u\n", i,
 			client->displays[i].desktop_rc.pos.x,
@@ -405,6 +440,9 @@ static void layout_query_cb(void *userdata)
 		printf("\tinput_rc: %d,%d %ux%u\n",
 			disp->input_rc.pos.x, disp->input_rc.pos.y,
 			disp->input_rc.w, disp->input_rc.h);
+		printf("\trotation: %u\n", disp->transform * 90);
+		printf("\trender scale: %u%%%s\n", disp->render_scale,
+			disp->render_scale_auto ? " auto" : "");
 		printf("\tmode_current: %p\n", disp->mode_current);
 		printf("\tmode_custom: %p\n", disp->mode_custom);
 		printf("\tConnector name: %s\n", disp->connector_name);
@@ -459,6 +497,9 @@ static void layout_changed_cb(void *userdata)
 		printf("\tinput_rc: %d,%d %ux%u\n",
 			disp->input_rc.pos.x, disp->input_rc.pos.y,
 			disp->input_rc.w, disp->input_rc.h);
+		printf("\trotation: %u\n", disp->transform * 90);
+		printf("\trender scale: %u%%%s\n", disp->render_scale,
+			disp->render_scale_auto ? " auto" : "");
 		printf("\tmode_current: %p\n", disp->mode_current);
 		printf("\tmode_custom: %p\n", disp->mode_custom);
 		printf("\tConnector name: %s\n", disp->connector_name);
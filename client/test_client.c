@@ -48,7 +48,8 @@ static void usage(void)
 			"--dmabuf-zpos zpos "
 			"--pipe-locked pipe "
 			"--atomic-commit Y/N (use atomic flush commit or not) "
-			"--composed Y/N\n");
+			"--composed Y/N "
+			"--shm-ring size (shared memory transport)\n");
 }
 
 static struct option options[] = {
@@ -64,10 +65,11 @@ static struct option options[] = {
 	{"pipe-locked", 1, NULL, 'l'},
 	{"composed", 1, NULL, 'c'},
 	{"atomic-commit", 1, NULL, 'a'},
+	{"shm-ring", 1, NULL, 'r'},
 	{NULL, 0, NULL, 0},
 };
 
-static char short_options[] = "t:x:y:w:h:p:v:f:z:l:c:a:";
+static char short_options[] = "t:x:y:w:h:p:v:f:z:l:c:a:r:";
 
 struct bo_info {
 	void *bo;
@@ -91,6 +93,7 @@ struct cube_client {
 	bool use_af_commit;
 	bool use_dmabuf;
 	bool composed;
+	u32 shm_ring_size; /* 0: keep everything on the socket */
 	s32 x, y;
 	s32 drag_x, drag_y;
 	u32 width, height;
@@ -269,6 +272,52 @@ static void fill_nv16(u8 *data, u32 width, u32 height, u32 hstride, u32 vstride)
 	}
 }
 
+static void fill_rgb565_colorbar(u8 *data, u32 width, u32 height,
+				 u32 stride)
+{
+	const u16 ccolors[] = {
+		0xFFFF, /* white */
+		0xFFE0, /* yellow */
+		0x07FF, /* cyan */
+		0x07E0, /* green */
+		0xF81F, /* perple */
+		0xF800, /* red */
+		0x0000, /* black */
+		0x001F, /* blue */
+	};
+
+	s32 i, j;
+	u32 bar;
+	u32 interval = width / ARRAY_SIZE(ccolors);
+	u16 *pixel = (u16 *)data;
+	static u32 delta = 0;
+
+	for (i = 0; i < height; i++) {
+		for (j = 0; j < width; j++) {
+			bar = (j + delta) / interval;
+			bar %= ARRAY_SIZE(ccolors);
+			pixel[j] = ccolors[bar];
+		}
+		pixel += (stride >> 1);
+	}
+	delta += 2;
+	if (delta >= width)
+		delta = 0;
+}
+
+static void fill_yuyv(u8 *data, u32 width, u32 height, u32 stride)
+{
+	static bool green = true;
+
+	if (green) {
+		memset(data, 0x00, stride * height);
+		green = false;
+	} else {
+		memset(data, 0x7F, stride * height);
+		green = true;
+	}
+}
+
 static struct bo_info *get_free_bo(struct cube_client *client)
 {
 	struct bo_info *bo, *bo_next;
@@ -389,6 +438,16 @@ static s32 repaint_cb(void *userdata)
 				  bo_info->height,
 				  bo_info->pitches[0],
 				  bo_info->offsets[1] / bo_info->pitches[0]);
+		} else if (client->pix_fmt == CB_PIX_FMT_RGB565) {
+			fill_rgb565_colorbar(bo_info->maps[0],
+				  bo_info->width,
+				  bo_info->height,
+				  bo_info->pitches[0]);
+		} else if (client->pix_fmt == CB_PIX_FMT_YUYV) {
+			fill_yuyv(bo_info->maps[0],
+				  bo_info->width,
+				  bo_info->height,
+				  bo_info->pitches[0]);
 		}
 
 		cb_client_dma_buf_bo_sync_end(bo_info->bo);
@@ -807,6 +866,9 @@ static void ready_cb(void *userdata)
 	s32 ret;
 
 	cli->set_connection_lost_cb(cli, client, connection_lost_cb);
+	if (client->shm_ring_size &&
+	    cli->enable_shm_transport(cli, client->shm_ring_size) < 0)
+		fprintf(stderr, "failed to enable shm transport.\n");
 	cli->set_client_cap(cli, CB_CLIENT_CAP_INPUT);
 	cli->set_input_msg_cb(cli, client, input_msg_cb);
 
@@ -1168,6 +1230,9 @@ s32 main(s32 argc, char **argv)
 			else
 				client->composed = false;
 			break;
+		case 'r':
+			client->shm_ring_size = atoi(optarg);
+			break;
 		default:
 			usage();
 			free(client);
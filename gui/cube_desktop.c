@@ -63,6 +63,9 @@ struct logo_desc {
 
 static char short_options[] = "l:s:";
 
+/* grid interval of the default background */
+#define DEF_BG_TILE 96
+
 struct bo_info {
 	void *bo;
 	u64 bo_id;
@@ -202,7 +205,7 @@ static void fill_def_bg(u8 *data, u32 width, u32 height, u32 stride,
 			struct cb_pos *offset)
 {
 	s32 i, j;
-	u32 interval = 96;
+	u32 interval = DEF_BG_TILE;
 	u32 *pixel = (u32 *)data + offset->y * (stride >> 2) + offset->x;
 	bool white;
 
@@ -232,6 +235,76 @@ static void fill_def_bg(u8 *data, u32 width, u32 height, u32 stride,
 	}
 }
 
+/*
+ * the default background is one grid cell repeated by the server over the
+ * desktop, the logo is drawn into a desktop sized bo.
+ */
+static s32 bg_bo_create(struct cube_desktop *desktop, struct bo_info *bo_info)
+{
+	struct cb_pos origin = { .x = 0, .y = 0 };
+	s32 i;
+
+	if (desktop->logo) {
+		bo_info->width = desktop->desktop_rc.w;
+		bo_info->height = desktop->desktop_rc.h;
+	} else {
+		bo_info->width = DEF_BG_TILE;
+		bo_info->height = DEF_BG_TILE;
+	}
+
+	bo_info->bo = cb_client_shm_bo_create(CB_PIX_FMT_ARGB8888,
+					bo_info->width,
+					bo_info->height,
+					0,
+					0,
+					&bo_info->count_fds,
+					&bo_info->count_planes,
+					bo_info->fds,
+					bo_info->maps,
+					bo_info->pitches,
+					bo_info->offsets,
+					bo_info->sizes);
+	if (!bo_info->bo) {
+		fprintf(stderr, "failed to create shm bo\n");
+		return -ENOMEM;
+	}
+	memset(bo_info->maps[0], 0, bo_info->sizes[0]);
+
+	if (!desktop->logo) {
+		printf("Fill bg tile %ux%u\n", bo_info->width,
+			bo_info->height);
+		fill_def_bg(bo_info->maps[0], bo_info->width, bo_info->height,
+			    bo_info->pitches[0], &origin);
+		return 0;
+	}
+
+	if (desktop->duplicated) {
+		printf("Fill %d,%d %ux%u\n", desktop->desktop_rc.pos.x,
+			desktop->desktop_rc.pos.y,
+			bo_info->width, bo_info->height);
+		fill_logo(bo_info->maps[0],
+			bo_info->width,
+			bo_info->height,
+			bo_info->pitches[0],
+			&desktop->desktop_rc.pos,
+			desktop->logo);
+	} else {
+		for (i = 0; i < desktop->heads_nr; i++) {
+			printf("Fill %d,%d %ux%u\n", desktop->heads[i].rc.pos.x,
+				desktop->heads[i].rc.pos.y,
+				desktop->heads[i].rc.w, desktop->heads[i].rc.h);
+			fill_logo(bo_info->maps[0],
+				desktop->heads[i].rc.w,
+				desktop->heads[i].rc.h,
+				bo_info->pitches[0],
+				&desktop->heads[i].rc.pos,
+				desktop->logo);
+		}
+	}
+
+	return 0;
+}
+
 static void update_desktop_rc(struct cube_desktop *desktop)
 {
 	s32 i;
@@ -368,64 +441,8 @@ static void layout_changed_cb(void *userdata)
 		memset(bo_info, 0, sizeof(*bo_info));
 	}
 	desktop->create_bo_pending = true;
-	bo_info->bo = cb_client_shm_bo_create(CB_PIX_FMT_ARGB8888,
-					desktop->desktop_rc.w,
-					desktop->desktop_rc.h,
-					0,
-					0,
-					&bo_info->count_fds,
-					&bo_info->count_planes,
-					bo_info->fds,
-					bo_info->maps,
-					bo_info->pitches,
-					bo_info->offsets,
-					bo_info->sizes);
-	if (!bo_info->bo) {
-		fprintf(stderr, "failed to create shm bo\n");
+	if (bg_bo_create(desktop, bo_info) < 0)
 		goto err;
-	}
-	memset(bo_info->maps[0], 0, bo_info->sizes[0]);
-	bo_info->width = desktop->desktop_rc.w;
-	bo_info->height = desktop->desktop_rc.h;
-	if (desktop->duplicated) {
-		printf("Fill %d,%d %ux%u\n", desktop->desktop_rc.pos.x,
-			desktop->desktop_rc.pos.y,
-			bo_info->width, bo_info->height);
-		if (desktop->logo) {
-			fill_logo(bo_info->maps[0],
-				bo_info->width,
-				bo_info->height,
-				bo_info->pitches[0],
-				&desktop->desktop_rc.pos,
-				desktop->logo);
-		} else {
-			fill_def_bg(bo_info->maps[0],
-				bo_info->width,
-				bo_info->height,
-				bo_info->pitches[0],
-				&desktop->desktop_rc.pos);
-		}
-	} else {
-		for (i = 0; i < desktop->heads_nr; i++) {
-			printf("Fill %d,%d %ux%u\n", desktop->heads[i].rc.pos.x,
-				desktop->heads[i].rc.pos.y,
-				desktop->heads[i].rc.w, desktop->heads[i].rc.h);
-			if (desktop->logo) {
-				fill_logo(bo_info->maps[0],
-					desktop->heads[i].rc.w,
-					desktop->heads[i].rc.h,
-					bo_info->pitches[0],
-					&desktop->heads[i].rc.pos,
-					desktop->logo);
-			} else {
-				fill_def_bg(bo_info->maps[0],
-					desktop->heads[i].rc.w,
-					desktop->heads[i].rc.h,
-					bo_info->pitches[0],
-					&desktop->heads[i].rc.pos);
-			}
-		}
-	}
 
 	ret = cli->create_bo(cli, bo_info->bo);
 	if (ret < 0) {
@@ -451,6 +468,7 @@ static void surface_info_update(struct cube_desktop *desktop)
 	memcpy(&desktop->s.opaque, &desktop->desktop_rc,sizeof(struct cb_rect));
 	desktop->s.width = desktop->desktop_rc.w;
 	desktop->s.height = desktop->desktop_rc.h;
+	desktop->s.tiled = !desktop->logo;
 }
 
 static void view_info_update(struct cube_desktop *desktop)
@@ -571,66 +589,8 @@ static void view_created_cb(bool success, void *userdata, u64 view_id)
 		memset(desktop->bos[i], 0, sizeof(struct bo_info));
 	}
 	bo_info = desktop->bos[desktop->bo_cur];
-	bo_info->bo = cb_client_shm_bo_create(CB_PIX_FMT_ARGB8888,
-					desktop->desktop_rc.w,
-					desktop->desktop_rc.h,
-					0,
-					0,
-					&bo_info->count_fds,
-					&bo_info->count_planes,
-					bo_info->fds,
-					bo_info->maps,
-					bo_info->pitches,
-					bo_info->offsets,
-					bo_info->sizes);
-	if (!bo_info->bo) {
-		fprintf(stderr, "failed to create shm bo\n");
+	if (bg_bo_create(desktop, bo_info) < 0)
 		goto err;
-	}
-	memset(bo_info->maps[0], 0, bo_info->sizes[0]);
-	bo_info->width = desktop->desktop_rc.w;
-	bo_info->height = desktop->desktop_rc.h;
-	if (desktop->duplicated) {
-		printf("Fill %d,%d %ux%u\n", desktop->desktop_rc.pos.x,
-			desktop->desktop_rc.pos.y,
-			bo_info->width, bo_info->height);
-		if (desktop->logo) {
-			printf("Fill logo\n");
-			fill_logo(bo_info->maps[0],
-				bo_info->width,
-				bo_info->height,
-				bo_info->pitches[0],
-				&desktop->desktop_rc.pos,
-				desktop->logo);
-		} else {
-			printf("Fill bg\n");
-			fill_def_bg(bo_info->maps[0],
-				bo_info->width,
-				bo_info->height,
-				bo_info->pitches[0],
-				&desktop->desktop_rc.pos);
-		}
-	} else {
-		for (i = 0; i < desktop->heads_nr; i++) {
-			printf("Fill %d,%d %ux%u\n", desktop->heads[i].rc.pos.x,
-				desktop->heads[i].rc.pos.y,
-				desktop->heads[i].rc.w, desktop->heads[i].rc.h);
-			if (desktop->logo) {
-				fill_logo(bo_info->maps[0],
-					desktop->heads[i].rc.w,
-					desktop->heads[i].rc.h,
-					bo_info->pitches[0],
-					&desktop->heads[i].rc.pos,
-					desktop->logo);
-			} else {
-				fill_def_bg(bo_info->maps[0],
-					desktop->heads[i].rc.w,
-					desktop->heads[i].rc.h,
-					bo_info->pitches[0],
-					&desktop->heads[i].rc.pos);
-			}
-		}
-	}
 
 	cli->set_create_bo_cb(cli, desktop, bo_created_cb);
 	ret = cli->create_bo(cli, bo_info->bo);
@@ -33,7 +33,10 @@
 #include <cube_utils.h>
 #include <cube_log.h>
 #include <cube_event.h>
+#include <cube_shm_ring.h>
+#include <cube_handle.h>
 #include <cube_protocal.h>
+#include <cube_protocal_v2.h>
 #include <cube_scanout.h>
 #include <cube_client_agent.h>
 
@@ -65,39 +68,149 @@ static enum cb_log_level clia_dbg = CB_LOG_NOTICE;
 	cb_tlog("[CLIA][ERROR ] " fmt, ##__VA_ARGS__); \
 } while (0);
 
+/* handle table types, tag the IDs of each kind, and objects per table */
+#define CLIENT_HANDLE_SURFACE 1
+#define CLIENT_HANDLE_VIEW 2
+#define CLIENT_HANDLE_BO 3
+#define CLIENT_HANDLE_MAX (1 << 16)
+
+/* damage of an af commit is coarsened above this many boxes */
+#define AFC_DAMAGE_MAX_BOXES 32
+
+/* outbound queue: initial size, hard limit and input event high water */
+#define CLIENT_TX_SIZE (64 << 10)
+#define CLIENT_TX_MAX (8 << 20)
+#define CLIENT_TX_HIGH_WATER (256 << 10)
+
+/* inbound buffer starts small and grows up to CB_IPC_BUF_MAX_LEN */
+#define CLIENT_RX_SIZE (16 << 10)
+/* per wakeup: bytes read from the socket and frames dispatched */
+#define CLIENT_RX_READ_MAX (256 << 10)
+#define CLIENT_RX_BUDGET 64
+
+static void cb_client_agent_update_mask(struct cb_client_agent *client)
+{
+	u32 mask = CB_EVT_READABLE;
+
+	if (cb_ipc_tx_pending(client->tx))
+		mask |= CB_EVT_WRITABLE;
+
+	if (mask == client->sock_mask || !client->sock_source)
+		return;
+
+	cb_event_source_fd_update_mask(client->sock_source, mask);
+	client->sock_mask = mask;
+}
+
+static s32 cb_client_agent_flush(struct cb_client_agent *client)
+{
+	s32 ret;
+
+	ret = cb_ipc_tx_flush(client->tx, client->sock);
+	if (ret < 0)
+		return ret;
+
+	cb_client_agent_update_mask(client);
+	return 0;
+}
+
+static s32 cb_client_agent_drop(struct cb_client_agent *client)
+{
+	if (!client->tx_dropped)
+		clia_warn("client %p lags, dropping input events", client);
+	client->tx_dropped++;
+	return 0;
+}
+
+/*
+ * Queue one framed message and try to push it out. Whatever the socket
+ * does not take now is sent when it becomes writable again. Droppable
+ * messages (input events) are discarded while the client lags behind.
+ * Once the client set up the shared memory transport messages go to the
+ * s2c ring, the socket only takes what the ring has no room for.
+ */
+static s32 cb_client_agent_send(struct cb_client_agent *client, u8 *buf,
+				size_t length, bool droppable)
+{
+	s32 ret;
+
+	if (client->destroy_idle_source)
+		return 0;
+
+	if (client->s2c_ring_on) {
+		ret = cb_shm_ring_write(client->s2c_ring, buf, length);
+		if (ret != -ENOSPC) {
+			if (ret < 0)
+				errno = -ret;
+			return ret;
+		}
+		if (droppable)
+			return cb_client_agent_drop(client);
+	} else if (droppable
+		   && cb_ipc_tx_pending(client->tx) > CLIENT_TX_HIGH_WATER) {
+		return cb_client_agent_drop(client);
+	}
+
+	if (droppable && client->tx_dropped) {
+		clia_notice("client %p dropped %llu input messages", client,
+			    client->tx_dropped);
+		client->tx_dropped = 0;
+	}
+
+	ret = cb_ipc_tx_queue(client->tx, buf, length, NULL);
+	if (ret < 0) {
+		errno = -ret;
+		return ret;
+	}
+	if (client->s2c_ring_on)
+		cb_shm_ring_skip(client->s2c_ring);
+
+	ret = cb_client_agent_flush(client);
+	if (ret < 0)
+		errno = -ret;
+	return ret;
+}
+
+/* Frame a v2 body, see cube_protocal_v2.h */
+static s32 cb_client_agent_send_v2(struct cb_client_agent *client,
+				   u16 opcode, void *body)
+{
+	u64 msg[CB_V2_MSG_MAX / sizeof(u64)];
+	u8 *p;
+
+	p = cb_v2_encode((u8 *)msg, opcode, client->v2_tx_seq);
+	if (!p) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+	client->v2_tx_seq++;
+	memcpy(p, body, cb_v2_msg_size(opcode) - sizeof(struct cb_v2_hdr));
+
+	return cb_client_agent_send(client, (u8 *)msg,
+				    cb_v2_msg_size(opcode), false);
+}
+
 static void cb_client_agent_send_surface_ack(struct cb_client_agent *client,
 					     void *surface)
 {
+	struct cb_surface *s = surface;
+	u64 id = s ? s->id : 0;
 	size_t length;
 	s32 ret;
 	u8 *p;
 
 	p = cb_dup_surface_id_cmd(client->surface_id_created_tx_cmd,
 				  client->surface_id_created_tx_cmd_t,
-				  client->surface_id_created_tx_len,
-				  (u64)surface);
+				  client->surface_id_created_tx_len, id);
 	if (!p) {
 		clia_err("failed to dup surface ack");
 		return;
 	}
 
 	length = client->surface_id_created_tx_len;
-	do {
-		ret = cb_sendmsg(client->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send surface ack length: %llu", length);
-	if (ret < 0) {
-		clia_err("failed to send surface ack length. %s",
-			 strerror(errno));
-		client->c->rm_client(client->c, client);
-		return;
-	}
-
-	do {
-		ret = cb_sendmsg(client->sock,client->surface_id_created_tx_cmd,
-				 length, NULL);
-	} while (ret == -EAGAIN);
+	ret = cb_client_agent_send(client,
+				   client->surface_id_created_tx_cmd,
+				   length, false);
 	clia_debug("send surface ack cmd: %llu", length);
 	if (ret < 0) {
 		clia_err("failed to send surface ack cmd %p. %s", surface,
@@ -109,36 +222,24 @@ static void cb_client_agent_send_surface_ack(struct cb_client_agent *client,
 static void cb_client_agent_send_view_ack(struct cb_client_agent *client,
 					  void *view)
 {
+	struct cb_view *v = view;
+	u64 id = v ? v->id : 0;
 	size_t length;
 	s32 ret;
 	u8 *p;
 
 	p = cb_dup_view_id_cmd(client->view_id_created_tx_cmd,
 			       client->view_id_created_tx_cmd_t,
-			       client->view_id_created_tx_len,
-			       (u64)view);
+			       client->view_id_created_tx_len, id);
 	if (!p) {
 		clia_err("failed to dup view ack");
 		return;
 	}
 
 	length = client->view_id_created_tx_len;
-	do {
-		ret = cb_sendmsg(client->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send view ack length: %llu", length);
-	if (ret < 0) {
-		clia_err("failed to send view ack length. %s",
-			 strerror(errno));
-		client->c->rm_client(client->c, client);
-		return;
-	}
-
-	do {
-		ret = cb_sendmsg(client->sock, client->view_id_created_tx_cmd,
-				 length, NULL);
-	} while (ret == -EAGAIN);
+	ret = cb_client_agent_send(client,
+				   client->view_id_created_tx_cmd,
+				   length, false);
 	clia_debug("send view ack cmd: %llu", length);
 	if (ret < 0) {
 		clia_err("failed to send view ack cmd %p. %s", view,
@@ -150,36 +251,23 @@ static void cb_client_agent_send_view_ack(struct cb_client_agent *client,
 static void cb_client_agent_send_bo_create_ack(struct cb_client_agent *client,
 					       void *bo)
 {
+	struct cb_buffer *buffer = bo;
+	u64 id = buffer ? buffer->id : 0;
 	size_t length;
 	s32 ret;
 	u8 *p;
 
 	p = cb_dup_bo_id_cmd(client->bo_id_created_tx_cmd,
 			     client->bo_id_created_tx_cmd_t,
-			     client->bo_id_created_tx_len,
-			     (u64)bo);
+			     client->bo_id_created_tx_len, id);
 	if (!p) {
 		clia_err("failed to dup bo commit ack");
 		return;
 	}
 
 	length = client->bo_id_created_tx_len;
-	do {
-		ret = cb_sendmsg(client->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send bo id created length: %llu", length);
-	if (ret < 0) {
-		clia_err("failed to send bo id created length. %s",
-			 strerror(errno));
-		client->c->rm_client(client->c, client);
-		return;
-	}
-
-	do {
-		ret = cb_sendmsg(client->sock, client->bo_id_created_tx_cmd,
-				 length, NULL);
-	} while (ret == -EAGAIN);
+	ret = cb_client_agent_send(client,
+				   client->bo_id_created_tx_cmd, length, false);
 	clia_debug("send bo id created: %llu", length);
 	if (ret < 0) {
 		clia_err("failed to send bo id created ack %p. %s", bo,
@@ -191,37 +279,31 @@ static void cb_client_agent_send_bo_create_ack(struct cb_client_agent *client,
 static void cb_client_agent_send_bo_commit_ack(struct cb_client_agent *client,
 					       u64 result, u64 surface_id)
 {
+	struct cb_v2_commit_ack ack;
 	size_t length;
 	s32 ret;
 	u8 *p;
 
-	p = cb_dup_commit_ack_cmd(client->bo_commit_ack_tx_cmd,
-				  client->bo_commit_ack_tx_cmd_t,
-				  client->bo_commit_ack_tx_len,
-				  result, surface_id);
-	if (!p) {
-		clia_err("failed to dup bo commit ack");
-		return;
-	}
+	if (client->proto >= CB_PROTO_V2) {
+		ack.result = result;
+		ack.surface_id = surface_id;
+		ret = cb_client_agent_send_v2(client, CB_V2_OP_COMMIT_ACK, &ack);
+	} else {
+		p = cb_dup_commit_ack_cmd(client->bo_commit_ack_tx_cmd,
+					  client->bo_commit_ack_tx_cmd_t,
+					  client->bo_commit_ack_tx_len,
+					  result, surface_id);
+		if (!p) {
+			clia_err("failed to dup bo commit ack");
+			return;
+		}
 
-	length = client->bo_commit_ack_tx_len;
-	do {
-		ret = cb_sendmsg(client->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send bo commit ack length: %llu", length);
-	if (ret < 0) {
-		clia_err("failed to send bo commit ack length. %s",
-			 strerror(errno));
-		client->c->rm_client(client->c, client);
-		return;
+		length = client->bo_commit_ack_tx_len;
+		ret = cb_client_agent_send(client,
+					   client->bo_commit_ack_tx_cmd,
+					   length, false);
+		clia_debug("send bo commit ack: %llu", length);
 	}
-
-	do {
-		ret = cb_sendmsg(client->sock, client->bo_commit_ack_tx_cmd,
-				 length, NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send bo commit ack: %llu", length);
 	if (ret < 0) {
 		clia_err("failed to send bo commit ack. %s", strerror(errno));
 		client->c->rm_client(client->c, client);
@@ -231,37 +313,33 @@ static void cb_client_agent_send_bo_commit_ack(struct cb_client_agent *client,
 static void cb_client_agent_send_bo_flipped(struct cb_client_agent *client,
 					    void *bo, u64 surface_id)
 {
+	struct cb_buffer *buffer = bo;
+	u64 id = buffer ? buffer->id : 0;
+	struct cb_v2_bo_event ev;
 	size_t length;
 	s32 ret;
 	u8 *p;
 
-	p = cb_dup_bo_flipped_cmd(client->bo_flipped_tx_cmd,
-				  client->bo_flipped_tx_cmd_t,
-				  client->bo_flipped_tx_len,
-				  (u64)bo, surface_id);
-	if (!p) {
-		clia_err("failed to dup bo flipped");
-		return;
-	}
+	if (client->proto >= CB_PROTO_V2) {
+		ev.bo_id = id;
+		ev.surface_id = surface_id;
+		ret = cb_client_agent_send_v2(client, CB_V2_OP_BO_FLIPPED, &ev);
+	} else {
+		p = cb_dup_bo_flipped_cmd(client->bo_flipped_tx_cmd,
+					  client->bo_flipped_tx_cmd_t,
+					  client->bo_flipped_tx_len,
+					  id, surface_id);
+		if (!p) {
+			clia_err("failed to dup bo flipped");
+			return;
+		}
 
-	length = client->bo_flipped_tx_len;
-	do {
-		ret = cb_sendmsg(client->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send bo flipped length: %llu", length);
-	if (ret < 0) {
-		clia_err("failed to send bo flipped length. %s",
-			 strerror(errno));
-		client->c->rm_client(client->c, client);
-		return;
+		length = client->bo_flipped_tx_len;
+		ret = cb_client_agent_send(client,
+					   client->bo_flipped_tx_cmd,
+					   length, false);
+		clia_debug("send bo flipped: %llu", length);
 	}
-
-	do {
-		ret = cb_sendmsg(client->sock, client->bo_flipped_tx_cmd,
-				 length, NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send bo flipped: %llu", length);
 	if (ret < 0) {
 		clia_err("failed to send bo flipped %p, %s", bo,
 			 strerror(errno));
@@ -272,37 +350,34 @@ static void cb_client_agent_send_bo_flipped(struct cb_client_agent *client,
 static void cb_client_agent_send_bo_complete(struct cb_client_agent *client,
 					     void *bo, u64 surface_id)
 {
+	struct cb_buffer *buffer = bo;
+	u64 id = buffer ? buffer->id : 0;
+	struct cb_v2_bo_event ev;
 	size_t length;
 	s32 ret;
 	u8 *p;
 
-	p = cb_dup_bo_complete_cmd(client->bo_complete_tx_cmd,
-				   client->bo_complete_tx_cmd_t,
-				   client->bo_complete_tx_len,
-				   (u64)bo, surface_id);
-	if (!p) {
-		clia_err("failed to dup bo complete");
-		return;
-	}
+	if (client->proto >= CB_PROTO_V2) {
+		ev.bo_id = id;
+		ev.surface_id = surface_id;
+		ret = cb_client_agent_send_v2(client, CB_V2_OP_BO_COMPLETE,
+					      &ev);
+	} else {
+		p = cb_dup_bo_complete_cmd(client->bo_complete_tx_cmd,
+					   client->bo_complete_tx_cmd_t,
+					   client->bo_complete_tx_len,
+					   id, surface_id);
+		if (!p) {
+			clia_err("failed to dup bo complete");
+			return;
+		}
 
-	length = client->bo_complete_tx_len;
-	do {
-		ret = cb_sendmsg(client->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send bo complete length: %llu", length);
-	if (ret < 0) {
-		clia_err("failed to send bo complete length. %s",
-			 strerror(errno));
-		client->c->rm_client(client->c, client);
-		return;
+		length = client->bo_complete_tx_len;
+		ret = cb_client_agent_send(client,
+					   client->bo_complete_tx_cmd,
+					   length, false);
+		clia_debug("send bo complete: %llu", length);
 	}
-
-	do {
-		ret = cb_sendmsg(client->sock, client->bo_complete_tx_cmd,
-				 length, NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send bo complete: %llu", length);
 	if (ret < 0) {
 		clia_err("failed to send bo complete %p, %s", bo,
 			 strerror(errno));
@@ -327,21 +402,7 @@ static void cb_client_agent_send_input_msg(struct cb_client_agent *client,
 
 	tlv->tag = CB_TAG_GUI_INPUT;
 
-	do {
-		ret = cb_sendmsg(client->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send gui input msg length: %llu", length);
-	if (ret < 0) {
-		clia_err("failed to send gui input msg length. %s",
-			 strerror(errno));
-		client->c->rm_client(client->c, client);
-		return;
-	}
-
-	do {
-		ret = cb_sendmsg(client->sock, msg, length, NULL);
-	} while (ret == -EAGAIN);
+	ret = cb_client_agent_send(client, msg, length, true);
 	clia_debug("send gui input msg: %llu", length);
 	if (ret < 0) {
 		clia_err("failed to send gui input msg. %s",
@@ -368,21 +429,7 @@ static void cb_client_agent_send_raw_input(struct cb_client_agent *client,
 
 	tlv->tag = CB_TAG_RAW_INPUT;
 
-	do {
-		ret = cb_sendmsg(client->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send raw input length: %llu", length);
-	if (ret < 0) {
-		clia_err("failed to send raw input length. %s",
-			 strerror(errno));
-		client->c->rm_client(client->c, client);
-		return;
-	}
-
-	do {
-		ret = cb_sendmsg(client->sock, evts, length, NULL);
-	} while (ret == -EAGAIN);
+	ret = cb_client_agent_send(client, evts, length, true);
 	clia_debug("send raw input evts: %llu", length);
 	if (ret < 0) {
 		clia_err("failed to send raw input evts. %s",
@@ -408,21 +455,7 @@ static void cb_client_agent_send_raw_touch(struct cb_client_agent *client,
 
 	tlv->tag = CB_TAG_RAW_TOUCH;
 
-	do {
-		ret = cb_sendmsg(client->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send raw touch length: %llu", length);
-	if (ret < 0) {
-		clia_err("failed to send raw touch length. %s",
-			 strerror(errno));
-		client->c->rm_client(client->c, client);
-		return;
-	}
-
-	do {
-		ret = cb_sendmsg(client->sock, evts, length, NULL);
-	} while (ret == -EAGAIN);
+	ret = cb_client_agent_send(client, evts, length, true);
 	clia_debug("send raw touch evts: %llu", length);
 	if (ret < 0) {
 		clia_err("failed to send raw touch evts. %s",
@@ -448,22 +481,7 @@ static void cb_client_agent_send_hpd_evt(struct cb_client_agent *client,
 	}
 
 	length = client->hpd_tx_len;
-	do {
-		ret = cb_sendmsg(client->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send hpd cmd length: %llu", length);
-	if (ret < 0) {
-		clia_err("failed to send hpd cmd length. %s",
-			 strerror(errno));
-		client->c->rm_client(client->c, client);
-		return;
-	}
-
-	do {
-		ret = cb_sendmsg(client->sock, client->hpd_tx_cmd,
-				 length, NULL);
-	} while (ret == -EAGAIN);
+	ret = cb_client_agent_send(client, client->hpd_tx_cmd, length, false);
 	clia_debug("send hpd cmd: %llu", length);
 	if (ret < 0) {
 		clia_err("failed to send hpd cmd %s", strerror(errno));
@@ -474,37 +492,35 @@ static void cb_client_agent_send_hpd_evt(struct cb_client_agent *client,
 static void cb_client_agent_send_view_focus_cfg(struct cb_client_agent *client,
 						void *v, bool on)
 {
+	struct cb_view *view = v;
+	u64 id = view ? view->id : 0;
+	struct cb_v2_view_focus_chg chg;
 	size_t length;
 	s32 ret;
 	u8 *p;
 
-	p = cb_dup_view_focus_chg_cmd(client->view_focus_chg_cmd,
-				      client->view_focus_chg_cmd_t,
-				      client->view_focus_chg_len,
-				      (u64)v, on);
-	if (!p) {
-		clia_err("failed to dup view focus chg command");
-		return;
-	}
+	if (client->proto >= CB_PROTO_V2) {
+		chg.view_id = id;
+		chg.on = on;
+		chg.pad = 0;
+		ret = cb_client_agent_send_v2(client, CB_V2_OP_VIEW_FOCUS_CHG,
+					      &chg);
+	} else {
+		p = cb_dup_view_focus_chg_cmd(client->view_focus_chg_cmd,
+					      client->view_focus_chg_cmd_t,
+					      client->view_focus_chg_len,
+					      id, on);
+		if (!p) {
+			clia_err("failed to dup view focus chg command");
+			return;
+		}
 
-	length = client->view_focus_chg_len;
-	do {
-		ret = cb_sendmsg(client->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send view focus chg command length: %llu", length);
-	if (ret < 0) {
-		clia_err("failed to send view focus chg command length. %s",
-			 strerror(errno));
-		client->c->rm_client(client->c, client);
-		return;
+		length = client->view_focus_chg_len;
+		ret = cb_client_agent_send(client,
+					   client->view_focus_chg_cmd,
+					   length, false);
+		clia_debug("send view focus chg command: %llu", length);
 	}
-
-	do {
-		ret = cb_sendmsg(client->sock, client->view_focus_chg_cmd,
-				 length, NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send view focus chg command: %llu", length);
 	if (ret < 0) {
 		clia_err("failed to send view focus chg command. %s",
 			 strerror(errno));
@@ -515,37 +531,31 @@ static void cb_client_agent_send_view_focus_cfg(struct cb_client_agent *client,
 static void cb_client_agent_send_mc_commit_ack(struct cb_client_agent *client,
 					       u64 result)
 {
+	struct cb_v2_mc_commit_ack ack;
 	size_t length;
 	s32 ret;
 	u8 *p;
 
-	p = cb_dup_mc_commit_ack_cmd(client->mc_commit_ack_tx_cmd,
-				     client->mc_commit_ack_tx_cmd_t,
-				     client->mc_commit_ack_tx_len,
-				     result);
-	if (!p) {
-		clia_err("failed to dup mc commit ack");
-		return;
-	}
+	if (client->proto >= CB_PROTO_V2) {
+		ack.result = result;
+		ret = cb_client_agent_send_v2(client, CB_V2_OP_MC_COMMIT_ACK,
+					      &ack);
+	} else {
+		p = cb_dup_mc_commit_ack_cmd(client->mc_commit_ack_tx_cmd,
+					     client->mc_commit_ack_tx_cmd_t,
+					     client->mc_commit_ack_tx_len,
+					     result);
+		if (!p) {
+			clia_err("failed to dup mc commit ack");
+			return;
+		}
 
-	length = client->mc_commit_ack_tx_len;
-	do {
-		ret = cb_sendmsg(client->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send mc commit ack length: %llu", length);
-	if (ret < 0) {
-		clia_err("failed to send mc commit ack length. %s",
-			 strerror(errno));
-		client->c->rm_client(client->c, client);
-		return;
+		length = client->mc_commit_ack_tx_len;
+		ret = cb_client_agent_send(client,
+					   client->mc_commit_ack_tx_cmd,
+					   length, false);
+		clia_debug("send mc commit ack: %llu", length);
 	}
-
-	do {
-		ret = cb_sendmsg(client->sock, client->mc_commit_ack_tx_cmd,
-				 length, NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send mc commit ack: %llu", length);
 	if (ret < 0) {
 		clia_err("failed to send mc commit ack. %s", strerror(errno));
 		client->c->rm_client(client->c, client);
@@ -590,22 +600,8 @@ static void cb_client_agent_get_and_send_edid(struct cb_client_agent *client,
 	free(edid_tmp);
 
 	length = client->get_edid_ack_len;
-	do {
-		ret = cb_sendmsg(client->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send get edid ack cmd length: %llu", length);
-	if (ret < 0) {
-		clia_err("failed to send get edid ack cmd length. %s",
-			 strerror(errno));
-		client->c->rm_client(client->c, client);
-		return;
-	}
-
-	do {
-		ret = cb_sendmsg(client->sock, client->get_edid_ack_cmd,
-				 length, NULL);
-	} while (ret == -EAGAIN);
+	ret = cb_client_agent_send(client,
+				   client->get_edid_ack_cmd, length, false);
 	clia_debug("send get edid ack cmd: %llu", length);
 	if (ret < 0) {
 		clia_err("failed to send get edid ack cmd %s",
@@ -631,22 +627,9 @@ static void cb_client_agent_send_kbd_led_status(struct cb_client_agent *client,
 	}
 
 	length = client->kbd_led_status_ack_len;
-	do {
-		ret = cb_sendmsg(client->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send get kbd led st ack cmd length: %llu", length);
-	if (ret < 0) {
-		clia_err("failed to send get kbd led st ack cmd length. %s",
-			 strerror(errno));
-		client->c->rm_client(client->c, client);
-		return;
-	}
-
-	do {
-		ret = cb_sendmsg(client->sock, client->kbd_led_status_ack_cmd,
-				 length, NULL);
-	} while (ret == -EAGAIN);
+	ret = cb_client_agent_send(client,
+				   client->kbd_led_status_ack_cmd,
+				   length, false);
 	clia_debug("send kbd led status ack cmd: %llu", length);
 	if (ret < 0) {
 		clia_err("failed to send kbd led status ack cmd %s",
@@ -672,22 +655,7 @@ static void cb_client_agent_send_shell_cmd(struct cb_client_agent *client,
 	}
 
 	length = client->shell_tx_len;
-	do {
-		ret = cb_sendmsg(client->sock, (u8 *)&length, sizeof(size_t),
-				 NULL);
-	} while (ret == -EAGAIN);
-	clia_debug("send shell cmd length: %llu", length);
-	if (ret < 0) {
-		clia_err("failed to send shell cmd. %s",
-			 strerror(errno));
-		client->c->rm_client(client->c, client);
-		return;
-	}
-
-	do {
-		ret = cb_sendmsg(client->sock, client->shell_tx_cmd,
-				 length, NULL);
-	} while (ret == -EAGAIN);
+	ret = cb_client_agent_send(client, client->shell_tx_cmd, length, false);
 	clia_debug("send shell cmd: %llu", length);
 	if (ret < 0) {
 		clia_err("failed to send shell cmd %p, %s", s,
@@ -732,23 +700,27 @@ static void release_shm_buf(struct cb_buffer *buffer)
 	free(shm_buf);
 }
 
-static void destroy_bo(struct cb_client_agent *client, struct cb_buffer *buffer)
+static void capture_stop(struct cb_client_agent *client, s32 pipe)
 {
-	struct cb_surface *s;
+	if (!(client->capture_mask & (1U << pipe)))
+		return;
 
-	list_del(&buffer->link);
-	list_for_each_entry(s, &client->surfaces, link) {
-		if (s->buffer_pending == buffer) {
-			s->buffer_pending = NULL;
-		}
-	}
+	client->c->capture_stop(client->c, pipe, client);
+	client->capture_mask &= ~(1U << pipe);
+	memset(client->capture_bos[pipe], 0, sizeof(client->capture_bos[pipe]));
+}
 
-	clia_warn("destroy bo: %lX", (u64)buffer);
+static void release_bo(struct cb_client_agent *client,
+		       struct cb_buffer *buffer)
+{
 	switch (buffer->info.type) {
 	case CB_BUF_TYPE_SHM:
 		clia_warn("release shm-buf");
 		release_shm_buf(buffer);
 		break;
+	case CB_BUF_TYPE_SOLID:
+		free(buffer);
+		break;
 	case CB_BUF_TYPE_DMA:
 		clia_warn("release dma-buf");
 		list_del(&buffer->dma_buf_flipped_l.link);
@@ -763,21 +735,55 @@ static void destroy_bo(struct cb_client_agent *client, struct cb_buffer *buffer)
 	}
 }
 
+static void destroy_bo(struct cb_client_agent *client, struct cb_buffer *buffer)
+{
+	struct cb_surface *s, **surfaces;
+	s32 i, j;
+	u32 k;
+
+	/* the bo cannot be written back any more */
+	for (i = 0; client->capture_mask && i < MAX_NR_OUTPUTS; i++) {
+		for (j = 0; j < CB_CAPTURE_BO_MAX; j++) {
+			if (client->capture_bos[i][j] == buffer) {
+				clia_warn("stop capture %d, bo destroyed", i);
+				capture_stop(client, i);
+				break;
+			}
+		}
+	}
+
+	cb_handle_free(client->buffers, buffer->id);
+	surfaces = (struct cb_surface **)cb_handle_objects(client->surfaces);
+	for (k = 0; k < cb_handle_count(client->surfaces); k++) {
+		s = surfaces[k];
+		if (s->buffer_pending == buffer) {
+			s->buffer_pending = NULL;
+		}
+	}
+
+	clia_warn("destroy bo: %lX", buffer->id);
+	release_bo(client, buffer);
+}
+
 static void surface_destroy(struct cb_client_agent *client,
 			    struct cb_surface *s)
 {
-	struct cb_buffer *b, *next_b;
+	struct cb_buffer *b;
+	u32 n;
 
 	clia_notice("remove a surface");
-	list_del(&s->link);
+	cb_handle_free(client->surfaces, s->id);
 	cb_signal_emit(&s->destroy_signal, NULL);
 	if (s->view) {
 		client->c->rm_view_from_comp(client->c, s->view);
+		cb_handle_free(client->views, s->view->id);
 		free(s->view);
 	}
 	if (s->use_renderer)
 		cb_signal_rm(&s->flipped_l);
-	list_for_each_entry_safe(b, next_b, &client->buffers, link) {
+	/* from the end, destroy_bo() moves the last buffer into its slot */
+	while ((n = cb_handle_count(client->buffers))) {
+		b = cb_handle_objects(client->buffers)[n - 1];
 		clia_warn("clear buffer remained %p", b);
 		destroy_bo(client, b);
 	}
@@ -789,13 +795,28 @@ static void surface_destroy(struct cb_client_agent *client,
 
 void cb_client_agent_destroy(struct cb_client_agent *client)
 {
-	struct cb_surface *s, *n;
+	struct cb_surface *s;
+	u32 n;
+
 	if (!client)
 		return;
 
-	list_for_each_entry_safe(s, n, &client->surfaces, link) {
+	if (client->capture_mask)
+		client->c->capture_stop(client->c, -1, client);
+	client->capture_mask = 0;
+
+	client->c->unregister_mouse_cursor(client->c, client, 0);
+
+	while ((n = cb_handle_count(client->surfaces))) {
+		s = cb_handle_objects(client->surfaces)[n - 1];
 		surface_destroy(client, s);
 	}
+	cb_handle_table_destroy(client->surfaces);
+	client->surfaces = NULL;
+	cb_handle_table_destroy(client->views);
+	client->views = NULL;
+	cb_handle_table_destroy(client->buffers);
+	client->buffers = NULL;
 
 	if (client->sock_source) {
 		cb_event_source_remove(client->sock_source);
@@ -807,6 +828,30 @@ void cb_client_agent_destroy(struct cb_client_agent *client)
 		client->sock = 0;
 	}
 
+	if (client->tx) {
+		cb_ipc_tx_destroy(client->tx);
+		client->tx = NULL;
+	}
+
+	if (client->rx_idle_source) {
+		cb_event_source_remove(client->rx_idle_source);
+		client->rx_idle_source = NULL;
+	}
+
+	if (client->rx) {
+		cb_ipc_rx_destroy(client->rx);
+		client->rx = NULL;
+	}
+
+	if (client->c2s_ring_source) {
+		cb_event_source_remove(client->c2s_ring_source);
+		client->c2s_ring_source = NULL;
+	}
+	cb_shm_ring_destroy(client->c2s_ring);
+	client->c2s_ring = NULL;
+	cb_shm_ring_destroy(client->s2c_ring);
+	client->s2c_ring = NULL;
+
 	if (client->surface_id_created_tx_cmd_t)
 		free(client->surface_id_created_tx_cmd_t);
 	if (client->surface_id_created_tx_cmd)
@@ -894,7 +939,8 @@ static void bo_destroy_proc(struct cb_client_agent *client, u8 *buf)
 {
 	struct cb_buffer *buffer;
 
-	buffer = (struct cb_buffer *)cb_server_parse_destroy_bo_cmd(buf);
+	buffer = cb_handle_lookup(client->buffers,
+				  cb_server_parse_destroy_bo_cmd(buf));
 	if (!buffer) {
 		clia_err("failed to parse destroy bo command");
 		return;
@@ -913,10 +959,10 @@ static s32 dma_buf_bo_commit_proc(struct cb_client_agent *client,
 	s32 ret;
 
 	bo_id = info->bo_id;
-	s = (struct cb_surface *)(info->surface_id);
+	s = cb_handle_lookup(client->surfaces, info->surface_id);
 	v = s->view;
 
-	buffer = (struct cb_buffer *)bo_id;
+	buffer = cb_handle_lookup(client->buffers, bo_id);
 
 	v->area.pos.x = info->view_x;
 	v->area.pos.y = info->view_y;
@@ -942,10 +988,10 @@ static void surface_bo_commit_proc(struct cb_client_agent *client,
 	struct cb_region d;
 
 	bo_id = info->bo_id;
-	s = (struct cb_surface *)(info->surface_id);
+	s = cb_handle_lookup(client->surfaces, info->surface_id);
 	v = s->view;
 
-	buffer = (struct cb_buffer *)bo_id;
+	buffer = cb_handle_lookup(client->buffers, bo_id);
 
 	if (info->bo_damage.w && info->bo_damage.h) {
 		cb_region_init_rect(&d,
@@ -977,35 +1023,28 @@ static void surface_bo_commit_proc(struct cb_client_agent *client,
 	client->c->commit_surface(client->c, s);
 }
 
-static void bo_commit_proc(struct cb_client_agent *client, u8 *buf)
+static void bo_commit_info_proc(struct cb_client_agent *client,
+				struct cb_commit_info *info)
 {
-	struct cb_commit_info info;
 	struct cb_buffer *buffer, *buffer_last;
 	struct cb_surface *s;
 	struct cb_view *v;
 	u64 bo_id;
 
-	if (cb_server_parse_commit_req_cmd(buf, &info) < 0) {
-		clia_err("failed to parse bo commit.");
-		cb_client_agent_send_bo_commit_ack(client, COMMIT_FAILED,
-						   info.surface_id);
-		return;
-	}
-
-	bo_id = info.bo_id;
-	buffer = (struct cb_buffer *)(bo_id);
+	bo_id = info->bo_id;
+	buffer = cb_handle_lookup(client->buffers, bo_id);
 	if (!buffer) {
 		clia_err("invalid buffer");
 		cb_client_agent_send_bo_commit_ack(client, COMMIT_FAILED,
-						   info.surface_id);
+						   info->surface_id);
 		return;
 	}
 
-	s = (struct cb_surface *)(info.surface_id);
+	s = cb_handle_lookup(client->surfaces, info->surface_id);
 	if (!s) {
 		clia_err("invalid surface");
 		cb_client_agent_send_bo_commit_ack(client, COMMIT_FAILED,
-						   info.surface_id);
+						   info->surface_id);
 		return;
 	}
 
@@ -1013,7 +1052,7 @@ static void bo_commit_proc(struct cb_client_agent *client, u8 *buf)
 	if (!v) {
 		clia_err("invalid view");
 		cb_client_agent_send_bo_commit_ack(client, COMMIT_FAILED,
-						   info.surface_id);
+						   info->surface_id);
 		return;
 	}
 
@@ -1025,57 +1064,72 @@ static void bo_commit_proc(struct cb_client_agent *client, u8 *buf)
 			printf("Replace last buffer %lX\n",
 				  (u64)(s->buffer_last));
 			buffer_last = s->buffer_last;
-			if (dma_buf_bo_commit_proc(client, &info) < 0) {
+			if (dma_buf_bo_commit_proc(client, info) < 0) {
 				clia_err("failed to commit buffer 1");
 				printf("failed to commit buffer 1\n");
 				cb_client_agent_send_bo_commit_ack(client,
 							COMMIT_FAILED,
-							info.surface_id);
+							info->surface_id);
 				if (buffer) {
 					client->send_bo_complete(client,
 								 buffer,
-							info.surface_id);
+							info->surface_id);
 				}
 			} else {
 				clia_debug("send complete %lX", buffer_last);
 				printf("send complete %lX\n", (u64)buffer_last);
 				client->send_bo_complete(client, buffer_last,
-							 info.surface_id);
+							 info->surface_id);
 				cb_client_agent_send_bo_commit_ack(client,
 							bo_id,
-							info.surface_id);
+							info->surface_id);
 				cb_client_agent_send_bo_commit_ack(client,
 							COMMIT_REPLACE,
-							info.surface_id);
+							info->surface_id);
 			}
 		} else {
-			if (dma_buf_bo_commit_proc(client, &info) < 0) {
+			if (dma_buf_bo_commit_proc(client, info) < 0) {
 				clia_err("failed to commit buffer.");
 				printf("failed to commit buffer.\n");
 				cb_client_agent_send_bo_commit_ack(client,
 							COMMIT_FAILED,
-							info.surface_id);
+							info->surface_id);
 				if (buffer)
 					client->send_bo_complete(client,
 								 buffer,
-							info.surface_id);
+							info->surface_id);
 			} else {
 				cb_client_agent_send_bo_commit_ack(client,
 							bo_id,
-							info.surface_id);
+							info->surface_id);
 			}
 		}
 	} else if (buffer->info.type == CB_BUF_TYPE_SHM ||
+		   buffer->info.type == CB_BUF_TYPE_SOLID ||
 		   (buffer->info.type == CB_BUF_TYPE_DMA &&
 		    buffer->info.composed)) {
-		surface_bo_commit_proc(client, &info);
+		surface_bo_commit_proc(client, info);
 		cb_client_agent_send_bo_commit_ack(client, bo_id,
-						   info.surface_id);
+						   info->surface_id);
 	} else {
 		clia_err("unknown buffer type. %d", buffer->info.type);
+		cb_client_agent_send_bo_commit_ack(client, COMMIT_FAILED,
+						   info->surface_id);
+	}
+}
+
+static void bo_commit_proc(struct cb_client_agent *client, u8 *buf)
+{
+	struct cb_commit_info info;
+
+	if (cb_server_parse_commit_req_cmd(buf, &info) < 0) {
+		clia_err("failed to parse bo commit.");
 		cb_client_agent_send_bo_commit_ack(client, COMMIT_FAILED,
 						   info.surface_id);
+		return;
 	}
+
+	bo_commit_info_proc(client, &info);
 }
 
 static void surface_bo_afc_commit_proc(struct cb_client_agent *client,
@@ -1086,28 +1140,18 @@ static void surface_bo_afc_commit_proc(struct cb_client_agent *client,
 	struct cb_view *v;
 	u64 bo_id;
 	struct cb_region d;
-	s32 i;
-	struct cb_rect *rc;
 
 	bo_id = info->bo_id;
-	s = (struct cb_surface *)(info->surface_id);
+	s = cb_handle_lookup(client->surfaces, info->surface_id);
 	v = s->view;
 
-	buffer = (struct cb_buffer *)bo_id;
+	buffer = cb_handle_lookup(client->buffers, bo_id);
 
 	if (info->count_damages) {
-		for (i = 0; i < info->count_damages; i++) {
-			rc = &info->damages[i];
-			if (rc->w && rc->h) {
-				cb_region_init_rect(&d,
-					    rc->pos.x,
-					    rc->pos.y,
-					    rc->w,
-					    rc->h);
-				cb_region_union(&s->damage, &s->damage, &d);
-				cb_region_fini(&d);
-			}
-		}
+		cb_region_init_rects(&d, info->damages, info->count_damages);
+		cb_region_coarsen(&d, AFC_DAMAGE_MAX_BOXES);
+		cb_region_union(&s->damage, &s->damage, &d);
+		cb_region_fini(&d);
 	}
 
 	cb_region_fini(&s->opaque);
@@ -1147,7 +1191,7 @@ static void bo_af_commit_proc(struct cb_client_agent *client, u8 *buf)
 	}
 
 	bo_id = afc->bo_id;
-	buffer = (struct cb_buffer *)(bo_id);
+	buffer = cb_handle_lookup(client->buffers, bo_id);
 	if (!buffer) {
 		clia_err("invalid buffer for af commit");
 		cb_client_agent_send_bo_commit_ack(client, COMMIT_FAILED,
@@ -1155,7 +1199,7 @@ static void bo_af_commit_proc(struct cb_client_agent *client, u8 *buf)
 		return;
 	}
 
-	s = (struct cb_surface *)(afc->surface_id);
+	s = cb_handle_lookup(client->surfaces, afc->surface_id);
 	if (!s) {
 		clia_err("invalid surface for af commit");
 		cb_client_agent_send_bo_commit_ack(client, COMMIT_FAILED,
@@ -1176,6 +1220,7 @@ static void bo_af_commit_proc(struct cb_client_agent *client, u8 *buf)
 		cb_client_agent_send_bo_commit_ack(client, COMMIT_FAILED,
 						   afc->surface_id);
 	} else if (buffer->info.type == CB_BUF_TYPE_SHM ||
+		   buffer->info.type == CB_BUF_TYPE_SOLID ||
 		   (buffer->info.type == CB_BUF_TYPE_DMA &&
 		    buffer->info.composed)) {
 		surface_bo_afc_commit_proc(client, afc);
@@ -1207,8 +1252,15 @@ static void surface_create_proc(struct cb_client_agent *client, u8 *buf)
 		goto err;
 
 	memset(s, 0, sizeof(*s));
+	s->id = cb_handle_alloc(client->surfaces, s);
+	if (!s->id) {
+		clia_err("too many surfaces");
+		free(s);
+		goto err;
+	}
 	s->client_agent = client;
 	s->is_opaque = sinfo.is_opaque;
+	s->tiled = sinfo.tiled;
 	cb_region_init_rect(&s->damage, sinfo.damage.pos.x, sinfo.damage.pos.y,
 			    sinfo.damage.w, sinfo.damage.h);
 	cb_region_init_rect(&s->opaque, sinfo.opaque.pos.x,
@@ -1217,7 +1269,6 @@ static void surface_create_proc(struct cb_client_agent *client, u8 *buf)
 	s->height = sinfo.height;
 	cb_signal_init(&s->destroy_signal);
 
-	list_add_tail(&s->link, &client->surfaces);
 	INIT_LIST_HEAD(&s->flipped_l.link);
 	
 	cb_client_agent_send_surface_ack(client, s);
@@ -1247,7 +1298,11 @@ static void view_create_proc(struct cb_client_agent *client, u8 *buf)
 		goto err;
 	}
 
-	s = (struct cb_surface *)vinfo.surface_id;
+	s = cb_handle_lookup(client->surfaces, vinfo.surface_id);
+	if (!s) {
+		clia_err("failed to create view, stale surface id");
+		goto err;
+	}
 
 	/* create view */
 	v = calloc(1, sizeof(*v));
@@ -1255,6 +1310,12 @@ static void view_create_proc(struct cb_client_agent *client, u8 *buf)
 		goto err;
 
 	memset(v, 0, sizeof(*v));
+	v->id = cb_handle_alloc(client->views, v);
+	if (!v->id) {
+		clia_err("too many views");
+		free(v);
+		goto err;
+	}
 	v->alpha = vinfo.alpha;
 	v->surface = s;
 	s->view = v;
@@ -1277,6 +1338,7 @@ static void bo_create_proc(struct cb_client_agent *client, u8 *buf)
 {
 	struct cb_buffer_info buffer_info;
 	struct cb_buffer *buffer;
+	struct cb_fds fds;
 	s32 ret, i;
 
 	ret = cb_server_parse_create_bo_cmd(buf, &buffer_info);
@@ -1289,15 +1351,17 @@ static void bo_create_proc(struct cb_client_agent *client, u8 *buf)
 	switch (buffer_info.type) {
 	case CB_BUF_TYPE_SHM:
 		/* copy fds */
+		cb_ipc_rx_take_fds(client->rx, &fds);
 		for (i = 0; i < 4; i++) {
-			if (i < client->ipc_fds.count) {
-				buffer_info.fd[i] = client->ipc_fds.fds[i];
-				client->ipc_fds.fds[i] = 0;
+			if (i < fds.count) {
+				buffer_info.fd[i] = fds.fds[i];
+				fds.fds[i] = 0;
 			} else {
 				buffer_info.fd[i] = 0;
 			}
 		}
-		client->ipc_fds.count = 0;
+		for (; i < fds.count; i++)
+			close(fds.fds[i]);
 
 		printf("received shm bo fd: %d, import.\n", buffer_info.fd[0]);
 		buffer = import_shm_buf(&buffer_info);
@@ -1307,17 +1371,26 @@ static void bo_create_proc(struct cb_client_agent *client, u8 *buf)
 		}
 		printf("import shm bo ok.\n");
 		break;
+	case CB_BUF_TYPE_SOLID:
+		/* nothing to import, the color travels in the info */
+		buffer = calloc(1, sizeof(*buffer));
+		if (!buffer)
+			goto err;
+		memcpy(&buffer->info, &buffer_info, sizeof(buffer_info));
+		break;
 	case CB_BUF_TYPE_DMA:
 		/* copy fds */
+		cb_ipc_rx_take_fds(client->rx, &fds);
 		for (i = 0; i < 4; i++) {
-			if (i < client->ipc_fds.count) {
-				buffer_info.fd[i] = client->ipc_fds.fds[i];
-				client->ipc_fds.fds[i] = 0;
+			if (i < fds.count) {
+				buffer_info.fd[i] = fds.fds[i];
+				fds.fds[i] = 0;
 			} else {
 				buffer_info.fd[i] = 0;
 			}
 		}
-		client->ipc_fds.count = 0;
+		for (; i < fds.count; i++)
+			close(fds.fds[i]);
 
 		if (!buffer_info.composed) {
 			buffer = client->c->import_so_dmabuf(client->c,
@@ -1333,7 +1406,12 @@ static void bo_create_proc(struct cb_client_agent *client, u8 *buf)
 		goto err;
 	}
 
-	list_add_tail(&buffer->link, &client->buffers);
+	buffer->id = cb_handle_alloc(client->buffers, buffer);
+	if (!buffer->id) {
+		clia_err("too many bos");
+		release_bo(client, buffer);
+		goto err;
+	}
 	cb_client_agent_send_bo_create_ack(client, buffer);
 
 	return;
@@ -1341,35 +1419,39 @@ err:
 	cb_client_agent_send_bo_create_ack(client, NULL);
 }
 
-static void mc_proc(struct cb_client_agent *client, u8 *buf)
+static struct shm_buffer *find_shm_bo(struct cb_client_agent *client,
+				      u64 bo_id)
+{
+	struct cb_buffer *b;
+
+	b = cb_handle_lookup(client->buffers, bo_id);
+	if (!b || b->info.type != CB_BUF_TYPE_SHM)
+		return NULL;
+
+	return container_of(b, struct shm_buffer, base);
+}
+
+static void mc_info_proc(struct cb_client_agent *client,
+			 struct cb_mc_info *info)
 {
-	struct cb_mc_info info;
 	struct shm_buffer *buffer;
-	u64 bo_id;
 	s32 ret;
 
-	if (cb_server_parse_mc_commit_cmd(buf, &info) < 0) {
-		clia_err("failed to parse mc commit.");
-		return;
-	}
-
-	switch (info.type) {
+	switch (info->type) {
 	case MC_CMD_TYPE_SET_CURSOR:
-		bo_id = info.bo_id;
-		buffer = container_of((struct cb_buffer *)bo_id,
-				      struct shm_buffer, base);
+		buffer = find_shm_bo(client, info->bo_id);
 		if (!buffer) {
 			cb_client_agent_send_mc_commit_ack(client,
 							   (u64)(-EINVAL));
 			return;
 		}
 		ret = client->c->set_mouse_cursor(client->c, buffer->shm.map,
-					info.cursor.w,
-					info.cursor.h,
-					info.cursor.w * 4,
-					info.cursor.hot_x,
-					info.cursor.hot_y,
-					info.alpha_src_pre_mul);
+					info->cursor.w,
+					info->cursor.h,
+					info->cursor.w * 4,
+					info->cursor.hot_x,
+					info->cursor.hot_y,
+					info->alpha_src_pre_mul);
 		if (ret < 0) {
 			clia_err("failed to set cursor %d", ret);
 			cb_client_agent_send_mc_commit_ack(client,
@@ -1378,6 +1460,37 @@ static void mc_proc(struct cb_client_agent *client, u8 *buf)
 		}
 		cb_client_agent_send_mc_commit_ack(client, 0);
 		break;
+	case MC_CMD_TYPE_REGISTER_CURSOR:
+		buffer = find_shm_bo(client, info->bo_id);
+		if (!buffer) {
+			cb_client_agent_send_mc_commit_ack(client,
+							   (u64)(-EINVAL));
+			return;
+		}
+		ret = client->c->register_mouse_cursor(client->c, client,
+					info->shape_id,
+					buffer->shm.map,
+					info->cursor.w,
+					info->cursor.h,
+					info->cursor.w * 4,
+					info->cursor.hot_x,
+					info->cursor.hot_y,
+					info->alpha_src_pre_mul);
+		if (ret < 0)
+			clia_err("failed to register cursor %u %d",
+				 info->shape_id, ret);
+		cb_client_agent_send_mc_commit_ack(client, (u64)ret);
+		break;
+	case MC_CMD_TYPE_SELECT_CURSOR:
+		ret = client->c->select_mouse_cursor(client->c, client,
+						     info->shape_id);
+		cb_client_agent_send_mc_commit_ack(client, (u64)ret);
+		break;
+	case MC_CMD_TYPE_UNREGISTER_CURSOR:
+		client->c->unregister_mouse_cursor(client->c, client,
+						   info->shape_id);
+		cb_client_agent_send_mc_commit_ack(client, 0);
+		break;
 	case MC_CMD_TYPE_SHOW:
 		client->c->show_mouse_cursor(client->c);
 		cb_client_agent_send_mc_commit_ack(client, 0);
@@ -1391,6 +1504,73 @@ static void mc_proc(struct cb_client_agent *client, u8 *buf)
 	}
 }
 
+static void mc_proc(struct cb_client_agent *client, u8 *buf)
+{
+	struct cb_mc_info info;
+
+	if (cb_server_parse_mc_commit_cmd(buf, &info) < 0) {
+		clia_err("failed to parse mc commit.");
+		return;
+	}
+
+	mc_info_proc(client, &info);
+}
+
+static void capture_done_cb(void *userdata, s32 pipe,
+			    struct cb_buffer *buffer, u64 seq)
+{
+	struct cb_client_agent *client = userdata;
+	struct cb_shell_info shell_info;
+
+	memset(&shell_info, 0, sizeof(shell_info));
+	shell_info.cmd = CB_SHELL_OUTPUT_CAPTURE_NOTIFY;
+	shell_info.value.capture.pipe = pipe;
+	shell_info.value.capture.bo_id = buffer->id;
+	shell_info.value.capture.seq = seq;
+	clia_debug("captured pipe %d bo %lX seq %lu", pipe, buffer->id, seq);
+	cb_client_agent_send_shell_cmd(client, &shell_info);
+}
+
+static struct cb_buffer *find_bo(struct cb_client_agent *client, u64 bo_id)
+{
+	return cb_handle_lookup(client->buffers, bo_id);
+}
+
+static s64 capture_start(struct cb_client_agent *client,
+			 struct cb_capture_info *cap)
+{
+	struct cb_buffer *buffers[CB_CAPTURE_BO_MAX];
+	s32 ret;
+	u32 i;
+
+	if (cap->pipe < 0 || cap->pipe >= MAX_NR_OUTPUTS)
+		return -EINVAL;
+
+	if (!cap->count_bos || cap->count_bos > CB_CAPTURE_BO_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < cap->count_bos; i++) {
+		buffers[i] = find_bo(client, cap->bo_ids[i]);
+		if (!buffers[i]) {
+			clia_err("capture bo %lX not found", cap->bo_ids[i]);
+			return -ENOENT;
+		}
+	}
+
+	capture_stop(client, cap->pipe);
+	ret = client->c->capture_start(client->c, cap->pipe, buffers,
+				       cap->count_bos, cap->interval_ms,
+				       client, capture_done_cb);
+	if (ret < 0)
+		return ret;
+
+	client->capture_mask |= (1U << cap->pipe);
+	for (i = 0; i < cap->count_bos; i++)
+		client->capture_bos[cap->pipe][i] = buffers[i];
+
+	return 0;
+}
+
 static void shell_proc(struct cb_client_agent *client, u8 *buf)
 {
 	s32 ret;
@@ -1555,32 +1735,201 @@ static void shell_proc(struct cb_client_agent *client, u8 *buf)
 		}
 		cb_client_agent_send_shell_cmd(client, &shell_info);
 		break;
+	case CB_SHELL_OUTPUT_CAPTURE_START:
+		clia_notice("capture start pipe %d, %u bo(s), interval %u ms",
+			    shell_info.value.capture.pipe,
+			    shell_info.value.capture.count_bos,
+			    shell_info.value.capture.interval_ms);
+		shell_info.value.capture.result = capture_start(client,
+						&shell_info.value.capture);
+		cb_client_agent_send_shell_cmd(client, &shell_info);
+		break;
+	case CB_SHELL_OUTPUT_CAPTURE_RELEASE:
+		clia_debug("capture release pipe %d bo %lX",
+			   shell_info.value.capture.pipe,
+			   shell_info.value.capture.bo_id);
+		client->c->capture_release(client->c,
+				shell_info.value.capture.pipe,
+				find_bo(client, shell_info.value.capture.bo_id));
+		break;
+	case CB_SHELL_OUTPUT_CAPTURE_STOP:
+		clia_notice("capture stop pipe %d",
+			    shell_info.value.capture.pipe);
+		if (shell_info.value.capture.pipe >= 0 &&
+		    shell_info.value.capture.pipe < MAX_NR_OUTPUTS)
+			capture_stop(client, shell_info.value.capture.pipe);
+		break;
 	default:
 		break;
 	}
 }
 
-static void ipc_proc(struct cb_client_agent *client)
+static s32 client_agent_ring_cb(s32 fd, u32 mask, void *data);
+
+static void shm_setup_proc(struct cb_client_agent *client, u8 *buf)
+{
+	struct cb_fds fds;
+	void *c2s = NULL, *s2c = NULL;
+	u64 ring_size;
+	u8 *ack;
+	u32 n, i;
+	s32 ret = -EINVAL;
+
+	cb_ipc_rx_take_fds(client->rx, &fds);
+	if (client->c2s_ring || fds.count != 3
+	    || cb_server_parse_shm_setup_cmd(buf, &ring_size) < 0) {
+		clia_err("bad shm transport setup.");
+		goto out;
+	}
+
+	/* fds: ring area, c2s doorbell, s2c doorbell */
+	c2s = cb_shm_ring_create(fds.fds[0], CB_SHM_RING_C2S, false,
+				 fds.fds[1]);
+	if (!c2s)
+		goto out;
+	fds.fds[1] = -1;
+	s2c = cb_shm_ring_create(fds.fds[0], CB_SHM_RING_S2C, true,
+				 fds.fds[2]);
+	if (!s2c)
+		goto out;
+	fds.fds[2] = -1;
+
+	client->c2s_ring_source = cb_event_loop_add_fd(client->loop,
+						cb_shm_ring_get_fd(c2s),
+						CB_EVT_READABLE,
+						client_agent_ring_cb,
+						client);
+	if (!client->c2s_ring_source)
+		goto out;
+
+	client->c2s_ring = c2s;
+	client->s2c_ring = s2c;
+	c2s = s2c = NULL;
+	clia_notice("client %p uses shm transport, ring size %llu", client,
+		    ring_size);
+	ret = 0;
+
+out:
+	cb_shm_ring_destroy(c2s);
+	cb_shm_ring_destroy(s2c);
+	for (i = 0; i < fds.count; i++) {
+		if (fds.fds[i] >= 0)
+			close(fds.fds[i]);
+	}
+
+	/* the last message through the socket, the rest takes the ring */
+	ack = cb_server_create_shm_setup_ack_cmd(ret, &n);
+	if (!ack) {
+		client->c->rm_client(client->c, client);
+		return;
+	}
+	if (cb_client_agent_send(client, ack, n, false) < 0) {
+		clia_err("failed to send shm setup ack. %s", strerror(errno));
+		client->c->rm_client(client->c, client);
+	} else if (!ret) {
+		client->s2c_ring_on = true;
+	}
+	free(ack);
+}
+
+static void v2_proc(struct cb_client_agent *client, u8 *buf, size_t ipc_sz)
+{
+	struct cb_commit_info info;
+	struct cb_mc_info mc;
+	struct cb_v2_destroy_bo *destroy;
+	struct cb_buffer *buffer;
+	void *body;
+	u16 opcode;
+	u32 seq;
+
+	if (client->proto < CB_PROTO_V2) {
+		clia_err("v2 message before protocol select");
+		return;
+	}
+
+	body = cb_v2_decode(buf, ipc_sz, &opcode, &seq);
+	if (!body) {
+		clia_err("malformed v2 message, size %lu", ipc_sz);
+		return;
+	}
+
+	if (seq != client->v2_rx_seq)
+		clia_warn("v2 message seq %u, expect %u", seq,
+			  client->v2_rx_seq);
+	client->v2_rx_seq = seq + 1;
+
+	switch (opcode) {
+	case CB_V2_OP_COMMIT:
+		clia_debug("receive v2 commit cmd");
+		cb_v2_commit_to_info(&info, body);
+		bo_commit_info_proc(client, &info);
+		break;
+	case CB_V2_OP_DESTROY_BO:
+		clia_debug("receive v2 destroy bo cmd");
+		destroy = body;
+		buffer = cb_handle_lookup(client->buffers, destroy->bo_id);
+		if (!buffer) {
+			clia_err("failed to parse destroy bo command");
+			return;
+		}
+		destroy_bo(client, buffer);
+		break;
+	case CB_V2_OP_MC_COMMIT:
+		clia_debug("receive v2 mc commit cmd");
+		if (client->capability & CB_CLIENT_CAP_MC) {
+			cb_v2_mc_commit_to_info(&mc, body);
+			mc_info_proc(client, &mc);
+		}
+		break;
+	default:
+		clia_err("unexpected v2 opcode %u", opcode);
+		break;
+	}
+}
+
+/*
+ * A frame is a v2 message, checked by cb_v2_decode(), or a u32 head with
+ * exactly one TLV. Frames are sized by the client, so check them before
+ * any field is read.
+ */
+static s32 ipc_frame_check(u8 *buf, size_t ipc_sz)
+{
+	struct cb_tlv *tlv;
+
+	if (cb_v2_is_msg(buf, ipc_sz))
+		return 0;
+
+	if (ipc_sz < sizeof(u32) + sizeof(*tlv))
+		return -EPROTO;
+
+	tlv = (struct cb_tlv *)(buf + sizeof(u32));
+	if (ipc_sz != sizeof(u32) + sizeof(*tlv) + tlv->length)
+		return -EPROTO;
+
+	return 0;
+}
+
+static void ipc_proc(struct cb_client_agent *client, u8 *buf, size_t ipc_sz)
 {
-	u8 *buf;
-	size_t ipc_sz;
 	u32 flag;
 	struct cb_tlv *tlv;
 	u64 cap, raw_input_en, pipe;
-	u32 led_status;
+	u32 led_status, version;
 
 	if (!client)
 		return;
 
-	ipc_sz = client->ipc_sz;
-	buf = &client->ipc_buf[0] + sizeof(size_t);
+	if (cb_v2_is_msg(buf, ipc_sz)) {
+		v2_proc(client, buf, ipc_sz);
+		return;
+	}
+
 	flag = *((u32 *)buf);
 	tlv = (struct cb_tlv *)(buf + sizeof(u32));
 	if (tlv->tag == CB_TAG_UNKNOWN) {
 		clia_err("unknown TAG ~~~~~~~~~~~");
 		return;
 	}
-	assert(ipc_sz == (tlv->length + sizeof(*tlv) + sizeof(flag)));
 
 	switch (tlv->tag) {
 	case CB_TAG_RAW_INPUT_EN:
@@ -1623,6 +1972,24 @@ static void ipc_proc(struct cb_client_agent *client)
 			cb_client_agent_get_and_send_edid(client, pipe);
 		}
 		return;
+	case CB_TAG_SHM_SETUP:
+		shm_setup_proc(client, buf);
+		return;
+	case CB_TAG_SHM_ON:
+		if (client->s2c_ring_on)
+			client->c2s_ring_on = true;
+		else
+			clia_err("shm transport is not set up.");
+		return;
+	case CB_TAG_PROTO_SELECT:
+		if (cb_server_parse_proto_select_cmd(buf, &version) < 0) {
+			clia_err("failed to parse protocol select command.");
+		} else {
+			clia_notice("client %p speaks protocol v%u", client,
+				    version);
+			client->proto = version;
+		}
+		return;
 	case CB_TAG_WIN:
 		break;
 	default:
@@ -1669,84 +2036,172 @@ static void ipc_proc(struct cb_client_agent *client)
 	}
 }
 
-static s32 client_agent_sock_cb(s32 fd, u32 mask, void *data)
+static void client_agent_rx_idle_cb(void *data);
+
+/*
+ * Next frame from the client. With the shm transport on, frames come from
+ * the c2s ring and a marker there stands for a run of socket frames, which
+ * may have been taken already while the ring was drained. Ring frames are
+ * exact-size copies, ipc_frame_check() covers them as well.
+ */
+static s32 client_agent_next_frame(struct cb_client_agent *client, u8 **buf,
+				   size_t *sz)
+{
+	s32 ret;
+
+	if (!client->c2s_ring_on)
+		return cb_ipc_rx_next(client->rx, buf, sz);
+
+	for (;;) {
+		if (client->sock_frames_due > 0) {
+			/* 0 until the socket frame arrives */
+			ret = cb_ipc_rx_next(client->rx, buf, sz);
+			if (ret > 0)
+				client->sock_frames_due--;
+			return ret;
+		}
+
+		ret = cb_shm_ring_read(client->c2s_ring, buf, sz);
+		if (ret == CB_SHM_RING_MARKER) {
+			client->sock_frames_due += *sz;
+			continue;
+		}
+		if (ret != 0)
+			return ret;
+		if (!cb_shm_ring_sleep(client->c2s_ring))
+			continue;
+
+		/* the ring is drained, socket frames are next in order */
+		ret = cb_ipc_rx_next(client->rx, buf, sz);
+		if (ret > 0)
+			client->sock_frames_due--;
+		return ret;
+	}
+}
+
+/*
+ * Dispatch the complete frames already read, at most CLIENT_RX_BUDGET per
+ * call so that one busy client does not hold the loop. Leftovers are
+ * dispatched from an idle source. Return -errno if the client is broken.
+ */
+static s32 client_agent_dispatch(struct cb_client_agent *client)
+{
+	size_t sz;
+	u8 *buf;
+	s32 ret, n;
+
+	for (n = 0; n < CLIENT_RX_BUDGET; n++) {
+		if (client->destroy_idle_source)
+			return 0;
+		ret = client_agent_next_frame(client, &buf, &sz);
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			return 0;
+		ret = ipc_frame_check(buf, sz);
+		if (ret < 0) {
+			clia_err("malformed frame from client %p, %lu bytes",
+				 client, sz);
+			return ret;
+		}
+		ipc_proc(client, buf, sz);
+	}
+
+	if (!client->rx_idle_source && !client->destroy_idle_source)
+		client->rx_idle_source = cb_event_loop_add_idle(client->loop,
+						client_agent_rx_idle_cb,
+						client);
+
+	return 0;
+}
+
+static void client_agent_rx_idle_cb(void *data)
 {
-	s32 ret, i;
-	size_t byts_rd;
 	struct cb_client_agent *client = data;
-	s32 flag; /* 0: length not received, 1: length received. */
-	struct cb_fds ipc_fds;
-	s32 *p;
+	s32 ret;
 
-	if (client->cursor >= ((u8 *)(client->ipc_buf) + sizeof(size_t))) {
-		flag = 1;
-	} else {
-		flag = 0;
+	client->rx_idle_source = NULL;
+	ret = client_agent_dispatch(client);
+	if (ret < 0) {
+		clia_err("bad message from client (%s).", strerror(-ret));
+		client->c->rm_client(client->c, client);
 	}
+}
 
-	do {
-		/* bytes_to_rd is set when client create: sizeof(size_t) */
-		/* printf("try to receive %lu\n", client->byts_to_rd); */
-		ret = cb_recvmsg(client->sock, client->cursor,
-				 client->byts_to_rd, &ipc_fds);
-		/* printf("receive return %d\n", ret); */
-	} while (ret == -EAGAIN);
+static s32 client_agent_ring_cb(s32 fd, u32 mask, void *data)
+{
+	struct cb_client_agent *client = data;
+	s32 ret;
+
+	cb_shm_ring_doorbell_ack(client->c2s_ring);
+
+	if (client->destroy_idle_source || client->rx_idle_source)
+		return 0;
 
+	ret = client_agent_dispatch(client);
 	if (ret < 0) {
-		clia_err("failed to recv client (%s).", strerror(-ret));
+		clia_err("bad message from client (%s).", strerror(-ret));
 		client->c->rm_client(client->c, client);
 		return ret;
-	} else if (ret == 0) {
+	}
+
+	return 0;
+}
+
+static s32 client_agent_sock_cb(s32 fd, u32 mask, void *data)
+{
+	struct cb_client_agent *client = data;
+	bool full;
+	s32 ret;
+
+	if (mask & CB_EVT_WRITABLE) {
+		ret = cb_client_agent_flush(client);
+		if (ret < 0) {
+			clia_err("failed to flush client (%s).",
+				 strerror(-ret));
+			client->c->rm_client(client->c, client);
+			return ret;
+		}
+	}
+
+	if (!(mask & (CB_EVT_READABLE | CB_EVT_HANGUP | CB_EVT_ERROR)))
+		return 0;
+
+	if (client->destroy_idle_source)
+		return 0;
+
+	ret = cb_ipc_rx_fill(client->rx, client->sock, CLIENT_RX_READ_MAX);
+	if (ret == 0) {
 		clia_warn("connection lost.");
 		client->c->rm_client(client->c, client);
 		return 0;
+	} else if (ret < 0 && ret != -EAGAIN && ret != -ENOBUFS) {
+		clia_err("failed to recv client (%s).", strerror(-ret));
+		client->c->rm_client(client->c, client);
+		return ret;
 	}
+	full = (ret == -ENOBUFS);
 
-	if (ipc_fds.count > 0) {
-		p = &client->ipc_fds.fds[client->ipc_fds.count];
-		for (i = 0; i < ipc_fds.count; i++) {
-			p[i] = ipc_fds.fds[i];
-		}
-		client->ipc_fds.count += ipc_fds.count;
-	}
-
-	client->cursor += ret;
-	client->byts_to_rd -= ret;
-	byts_rd = ret;
-
-	if (!flag) {
-		if (ret >= sizeof(size_t)) {
-			/* received the length */
-			flag = 1;
-			memcpy(&client->byts_to_rd, client->ipc_buf,
-			       sizeof(size_t));
-			client->ipc_sz = client->byts_to_rd;
-			/* printf("ipc size: %lu\n", client->ipc_sz); */
-			/* printf("%p %p\n", client->cursor, client->ipc_buf);*/
-			if ((byts_rd - sizeof(size_t)) > client->ipc_sz) {
-				/* received more than one ipc message */
-				client->byts_to_rd = 0;
-			} else {
-				client->byts_to_rd -= (byts_rd -sizeof(size_t));
-			}
-		}
+	/* the idle source is already on the way */
+	if (client->rx_idle_source)
+		return 0;
+
+	ret = client_agent_dispatch(client);
+	if (ret < 0) {
+		clia_err("bad message from client (%s).", strerror(-ret));
+		client->c->rm_client(client->c, client);
+		return ret;
 	}
 
-	if (!client->byts_to_rd) {
-		client->cursor = (u8 *)client->ipc_buf;
-		client->byts_to_rd = sizeof(size_t);
-		/* printf("complete.\n"); */
-		/* TODO &client->ipc_buf[0] + sizeof(size_t), ipc_sz */
-		/*
-		printf("proc ipc message: %p, %lu\n",
-			&client->ipc_buf[0] + sizeof(size_t), client->ipc_sz);
-		printf("ipc received %d fds.\n", client->ipc_fds.count);
-		*/
-		for (i = 0; i < client->ipc_fds.count; i++) {
-			printf("fds[%d]: %d\n", i, client->ipc_fds.fds[i]);
-		}
-		ipc_proc(client);
-		client->ipc_fds.count = 0;
+	/*
+	 * Nothing more could be dispatched, yet the buffer is full, the
+	 * socket frame it waits for can never complete.
+	 */
+	if (full && client->c2s_ring_on
+	    && !client->rx_idle_source && !client->destroy_idle_source) {
+		clia_err("client socket frame exceeds the receive buffer.");
+		client->c->rm_client(client->c, client);
+		return -EPROTO;
 	}
 
 	return 0;
@@ -1769,6 +2224,15 @@ struct cb_client_agent *cb_client_agent_create(s32 sock,
 	memset(client, 0 ,sizeof(*client));
 	client->sock = sock;
 	client->loop = loop;
+	client->proto = CB_PROTO_V1;
+
+	client->tx = cb_ipc_tx_create(CLIENT_TX_SIZE, CLIENT_TX_MAX);
+	if (!client->tx)
+		goto err;
+
+	client->rx = cb_ipc_rx_create(CLIENT_RX_SIZE, CB_IPC_BUF_MAX_LEN);
+	if (!client->rx)
+		goto err;
 
 	client->sock_source = cb_event_loop_add_fd(client->loop, client->sock,
 						   CB_EVT_READABLE,
@@ -1776,10 +2240,8 @@ struct cb_client_agent *cb_client_agent_create(s32 sock,
 						   client);
 	if (!client->sock_source)
 		goto err;
+	client->sock_mask = CB_EVT_READABLE;
 
-	client->byts_to_rd = sizeof(size_t);
-	client->cursor = (u8 *)(client->ipc_buf);
-	client->ipc_sz = 0;
 	client->c = c;
 
 	client->surface_id_created_tx_cmd_t
@@ -1880,10 +2342,19 @@ struct cb_client_agent *cb_client_agent_create(s32 sock,
 	client->destroy_pending = cb_client_agent_destroy_pending;
 	client->send_view_focus_chg = cb_client_agent_send_view_focus_cfg;
 
-	/* init surface list */
-	INIT_LIST_HEAD(&client->surfaces);
-	/* init buffer list */
-	INIT_LIST_HEAD(&client->buffers);
+	/* handle tables, the IDs clients use for these objects */
+	client->surfaces = cb_handle_table_create(CLIENT_HANDLE_SURFACE,
+						  CLIENT_HANDLE_MAX);
+	if (!client->surfaces)
+		goto err;
+	client->views = cb_handle_table_create(CLIENT_HANDLE_VIEW,
+					       CLIENT_HANDLE_MAX);
+	if (!client->views)
+		goto err;
+	client->buffers = cb_handle_table_create(CLIENT_HANDLE_BO,
+						 CLIENT_HANDLE_MAX);
+	if (!client->buffers)
+		goto err;
 
 	return client;
 
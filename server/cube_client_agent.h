@@ -34,26 +34,42 @@ struct cb_server;
 #endif
 
 struct cb_client_agent {
-	u8 ipc_buf[CB_IPC_BUF_MAX_LEN];
-	size_t ipc_sz, byts_to_rd;
-	u8 *cursor;
-	struct cb_fds ipc_fds;
+	void *rx; /* inbound frames and fds */
+	struct cb_event_source *rx_idle_source;
 	s32 sock;
 	struct cb_event_source *sock_source;
+	u32 sock_mask;
+	void *tx; /* outbound message queue */
+	u64 tx_dropped;
+	/* optional shared memory transport, see cube_shm_ring.h */
+	void *c2s_ring, *s2c_ring;
+	struct cb_event_source *c2s_ring_source;
+	bool c2s_ring_on, s2c_ring_on;
+	/*
+	 * socket frames announced by c2s ring markers, not dispatched yet,
+	 * below 0 when taken before their marker
+	 */
+	s64 sock_frames_due;
+	/* protocol version selected by the client, see cube_protocal_v2.h */
+	u32 proto;
+	u32 v2_tx_seq, v2_rx_seq;
 	struct cb_event_source *destroy_idle_source;
 	struct cb_event_loop *loop;
 	struct list_head link;
 	struct compositor *c;
 
-	/* list of surfaces */
-	struct list_head surfaces;
-
-	/* list of buffers */
-	struct list_head buffers;
+	/* handle tables of surfaces, views and buffers, see cube_handle.h */
+	void *surfaces;
+	void *views;
+	void *buffers;
 
 	u64 capability;
 	bool raw_input_en;
 
+	/* outputs being captured by this client */
+	u32 capture_mask;
+	struct cb_buffer *capture_bos[MAX_NR_OUTPUTS][CB_CAPTURE_BO_MAX];
+
 	u8 *surface_id_created_tx_cmd_t;
 	u8 *surface_id_created_tx_cmd;
 	u32 surface_id_created_tx_len;
@@ -43,7 +43,10 @@
 #include <cube_renderer.h>
 #include <cube_compositor.h>
 #include <cube_protocal.h>
-#include <cube_cache.h>
+#include <cube_slab.h>
+#include <cube_handle.h>
+#include <cube_arena.h>
+#include <cube_tile_damage.h>
 #include <cube_client_agent.h>
 #include <cube_def_cursor.h>
 #include <cube_vkey_map.h>
@@ -55,6 +58,18 @@
 
 #define MC_MAX_WIDTH 64
 #define MC_MAX_HEIGHT 64
+/* uploaded cursor shapes cached per output */
+#define MC_CACHE_SIZE 8
+
+/* SHM surfaces up to this size may be blitted onto an overlay plane */
+#define BLIT_SHOW_MAX_PIXELS (256 * 256)
+/* successive small commits needed before the surface is promoted */
+#define BLIT_SHOW_PROMOTE_COMMITS 3
+/* commit damage of a blitted surface above this many boxes goes to tiles */
+#define BLIT_DAMAGE_MAX_BOXES 32
+#define BLIT_DAMAGE_TILE_SHIFT 4
+/* stack boxes for the tiled commit damage */
+#define BLIT_DAMAGE_SCRATCH_BOXES 64
 
 #define GLOBAL_DESKTOP_SZ 65536.0f
 
@@ -159,6 +174,10 @@ struct scanout_task {
 	struct cb_rect *src, *dst;
 	s32 zpos;
 	bool alpha_src_pre_mul;
+	/* plane alpha */
+	u16 alpha;
+	/* rotated by plane */
+	u32 transform;
 	struct list_head link;
 };
 
@@ -179,6 +198,14 @@ struct cb_output {
 
 	/* planes except cursor plane and primary plane */
 	struct list_head free_planes;
+	/*
+	 * overlay plane demand which cannot be satisfied by free_planes,
+	 * fed to the plane pool at the next frame boundary.
+	 */
+	u32 planes_wanted;
+	u32 plane_want_fourcc;
+	s32 plane_want_zpos;
+	bool plane_want_alpha;
 	/*
 	 * if primary plane is occupied by renderer, it cannot be used to
 	 * display DMA-BUF direct show surface.
@@ -200,12 +227,38 @@ struct cb_output {
 	/* global coordinates e.g. (0 - 65535) rect */
 	struct cb_rect g_desktop_rc;
 
+	/* enum cb_output_transform, counter-clockwise */
+	u32 transform;
+	/*
+	 * the transform is done by primary plane's rotation, otherwise the
+	 * renderer composes rotated.
+	 */
+	bool hw_transform;
+
 	/* physical output size */
 	u32 crtc_w, crtc_h;
+	/* view port on the rotated screen, crtc_view_port if not rotated */
+	struct cb_rect view_port;
 	/* view port in physical area */
 	struct cb_rect crtc_view_port;
 	/* renderer's surface fb src rect */
 	struct cb_rect native_surface_src;
+	/* renderer's surface fb dst rect, the whole crtc */
+	struct cb_rect native_surface_dst;
+	/*
+	 * internal render resolution, percent of the (rotated) mode size.
+	 * renderer's surface is allocated at render_scale, the area drawn
+	 * in it (native_surface_src) is render_scale_cur which the governor
+	 * moves between CB_RENDER_SCALE_MIN and render_scale.
+	 * primary plane scales it up to the crtc.
+	 */
+	u32 render_scale;
+	u32 render_scale_cur;
+	bool render_scale_auto;
+	u32 surface_w, surface_h;
+	/* render time statistics for the governor */
+	u64 render_nsec_avg;
+	u32 render_frames;
 
 	/* scanout output */
 	struct output *output;
@@ -265,19 +318,35 @@ struct cb_output {
 	struct cb_rect mc_view_port;
 	/* mouse cursor on screen or not */
 	bool mc_on_screen;
-	/* cursor buffers */
-	struct cb_buffer *mc_buf[2];
+	/*
+	 * cursor buffers, a LRU cache of uploaded cursor shapes,
+	 * keyed by content hash (0 means empty).
+	 */
+	struct cb_buffer *mc_buf[MC_CACHE_SIZE];
+	u64 mc_hash[MC_CACHE_SIZE];
+	u64 mc_stamp[MC_CACHE_SIZE];
+	/* packed copy of each uploaded shape, a hash hit is checked on it */
+	u8 *mc_data[MC_CACHE_SIZE];
+	u32 mc_w[MC_CACHE_SIZE], mc_h[MC_CACHE_SIZE];
 	
 	/*
 	 * cursor buf current (prepare to be or already committed into kernel)
 	 * buffer index
 	 */
 	s32 mc_buf_cur;
+	/* cursor buf to be committed when mc_damaged */
+	s32 mc_buf_next;
+	/* last committed cursor buf, it may be still on screen */
+	s32 mc_buf_prev;
 	bool mc_damaged;
 
 	/* scanout's output pageflip listener */
 	struct cb_listener output_flipped_l;
 
+	/* vblank sequence event listener, used to anchor repaint after idle */
+	struct cb_listener vblank_seq_l;
+	bool vblank_seq_pending;
+
 	/* repaint related */
 	/* list of scanout tasks */
 	struct list_head so_tasks;
@@ -304,6 +373,145 @@ struct cb_output {
 
 	/* renderable buffer changed */
 	bool renderable_buffer_changed;
+
+	/*
+	 * clone: the output scans out the leader's renderable buffer instead
+	 * of rendering the same desktop again. clone_src is the area of the
+	 * leader's buffer covering this output's desktop_rc.
+	 */
+	struct cb_output *clone_leader;
+	struct cb_output *clone_next;
+	/* leader whose buffer failed the TEST_ONLY commit */
+	struct cb_output *clone_rejected;
+	struct cb_rect clone_src;
+	bool clone_tested;
+	bool clone_shown;
+
+	/*
+	 * renderer's surface and output are created by the first frame which
+	 * needs composition, and released render_idle_msec after the last one.
+	 */
+	struct cb_event_source *render_idle_timer;
+	bool render_idle;
+
+	/*
+	 * bottom solid color view filled by the CRTC's background color
+	 * this frame, it needs neither composition nor the dummy buffer.
+	 */
+	struct cb_view *bg_view;
+
+	/* writeback capture session */
+	struct cb_capture *capture;
+
+	/* demoted blit views waiting for their buffers to leave screen */
+	struct list_head blit_retired;
+
+	/*
+	 * direct scanout of a fullscreen renderer surface.
+	 * the client buffer is put on primary plane instead of being
+	 * composed, its complete message is deferred until it leaves screen.
+	 */
+	struct cb_view *bypass_view;
+	/* committed buffer not shown yet */
+	struct cb_buffer *bypass_pending;
+	/* buffer queued or on screen */
+	struct cb_buffer *bypass_cur;
+	/* buffer to be completed at next flip */
+	struct cb_buffer *bypass_done;
+	/* primary plane source rect of bypass buffer */
+	struct cb_rect bypass_src;
+};
+
+/* scanout import of a renderer DMA-BUF, used by direct scanout */
+struct bypass_buf {
+	struct cb_buffer *rd_buf;
+	/* NULL if the buffer cannot be scanned out */
+	struct cb_buffer *so_buf;
+	struct list_head link;
+};
+
+/*
+ * small SHM surface shown on an overlay plane.
+ * the damaged pixels are copied by CPU into a dumb buffer pair at repaint,
+ * so neither the GPU nor the primary plane's rendered buffer is touched.
+ */
+struct cb_view_blit {
+	struct cb_output *output;
+	struct plane *plane;
+
+	struct cb_buffer *bufs[2];
+	/* damage each buffer has missed since it was last written */
+	struct cb_region missed[2];
+	/* index of the buffer scanned out, -1 if none */
+	s32 cur;
+	/* surface's buffer has not been copied yet */
+	bool dirty;
+	/* SHM buffer held until it is replaced or the view is demoted */
+	struct cb_buffer *complete_buf;
+
+	/* damage the renderer's texture has missed */
+	struct cb_region tex_damage;
+
+	/* scattered commit damage rounded to tiles */
+	struct cb_tile_damage tiles;
+
+	/* flips to wait before destroying the buffers */
+	s32 retire_flips;
+	struct list_head link;
+};
+
+/* writeback capture session of an output */
+struct cb_capture {
+	struct cb_output *output;
+
+	/* user's capture targets */
+	u32 count;
+	struct cb_buffer *buffers[CB_CAPTURE_BO_MAX];
+	/* dumb staging buffers for SHM targets */
+	struct cb_buffer *stages[CB_CAPTURE_BO_MAX];
+	/* buffer is being written back or held by user */
+	bool busy[CB_CAPTURE_BO_MAX];
+	/* index of the buffer being written back, -1 if none */
+	s32 inflight;
+
+	u32 interval_ms;
+	u64 seq;
+	struct cb_event_source *timer;
+
+	/* writeback job complete listener */
+	struct cb_listener done_l;
+
+	void *userdata;
+	void (*captured_cb)(void *userdata, s32 pipe,
+			    struct cb_buffer *buffer, u64 seq);
+};
+
+/*
+ * overlay plane which can be attached to more than one output.
+ * it is put into the free_planes of its owner only.
+ */
+struct cb_plane_slot {
+	u32 id;
+	/* each output's copy of the plane, NULL if not attachable */
+	struct plane *planes[MAX_NR_OUTPUTS];
+	/* output owns the plane, NULL if none */
+	struct cb_output *owner;
+	/* output the plane is moving to, waiting for the old CRTC */
+	struct cb_output *target;
+	struct list_head link;
+};
+
+/* cursor shape registered by client */
+struct mc_shape {
+	void *owner;
+	u32 id;
+	u64 hash;
+	u32 width, height;
+	s32 hot_x, hot_y;
+	bool alpha_src_pre_mul;
+	/* ARGB data, stride is width * 4 */
+	u8 *data;
+	struct list_head link;
 };
 
 struct cb_compositor {
@@ -358,10 +566,20 @@ struct cb_compositor {
 	struct cb_rect mc_src;
 	/* mouse cursor's alpha is blended or not */
 	bool mc_alpha_src_pre_mul;
+	/* registered cursor shapes */
+	struct list_head mc_shapes;
+	/* cursor cache LRU clock */
+	u64 mc_stamp;
 
 	/* repaint timer */
 	struct cb_event_source *repaint_timer;
 
+	/* overlay planes shared between outputs */
+	struct list_head plane_pool;
+
+	/* renderer DMA-BUFs imported into scanout for direct scanout */
+	struct list_head bypass_bufs;
+
 	/* outputs */
 	s32 count_outputs;
 	struct cb_output **outputs;
@@ -371,6 +589,8 @@ struct cb_compositor {
 
 	/* scanout task cache */
 	void *so_task_cache;
+	/* transient state of one repaint, reset when the commit is issued */
+	void *frame_arena;
 
 	/* for input event */
 	struct udev *udev;
@@ -390,6 +610,9 @@ struct cb_compositor {
 	float mc_accel;
 	s32 touch_pipe;
 
+	/* idle time before releasing renderer's surface, 0: never */
+	u32 render_idle_msec;
+
 	/* touchscreen attached (only one touch screen is supported) */
 	bool touchscreen_attached;
 
@@ -633,9 +856,69 @@ static bool primary_support_fmt(struct cb_output *o, enum cb_pix_fmt fmt)
 	return false;
 }
 
+static bool output_transposed(struct cb_output *o)
+{
+	return (o->transform == CB_TRANSFORM_90 ||
+		o->transform == CB_TRANSFORM_270);
+}
+
+/*
+ * Map a rectangle on the rotated screen to crtc coordinates.
+ * the screen is rotated counter-clockwise as DRM plane's rotation.
+ */
+static void output_transform_rect(struct cb_output *o, struct cb_rect *rc)
+{
+	struct cb_rect t = *rc;
+	s32 lw, lh;
+
+	if (output_transposed(o)) {
+		lw = o->crtc_h;
+		lh = o->crtc_w;
+	} else {
+		lw = o->crtc_w;
+		lh = o->crtc_h;
+	}
+
+	switch (o->transform) {
+	case CB_TRANSFORM_90:
+		rc->pos.x = t.pos.y;
+		rc->pos.y = lw - t.pos.x - (s32)t.w;
+		rc->w = t.h;
+		rc->h = t.w;
+		break;
+	case CB_TRANSFORM_180:
+		rc->pos.x = lw - t.pos.x - (s32)t.w;
+		rc->pos.y = lh - t.pos.y - (s32)t.h;
+		break;
+	case CB_TRANSFORM_270:
+		rc->pos.x = lh - t.pos.y - (s32)t.h;
+		rc->pos.y = t.pos.x;
+		rc->w = t.h;
+		rc->h = t.w;
+		break;
+	default:
+		break;
+	}
+}
+
+/* whether the plane can show a buffer on the rotated output */
+static bool plane_support_output_transform(struct cb_output *o,
+					   struct plane *plane)
+{
+	if (o->transform == CB_TRANSFORM_NORMAL)
+		return true;
+
+	/* the clipping of non-scaling plane is done on un-rotated crtc */
+	if (!plane->scale_support)
+		return false;
+
+	return (plane->transforms & (1U << o->transform)) != 0;
+}
+
 static struct plane *find_free_output_plane(struct cb_output *o,
 					    enum cb_pix_fmt fmt,
-					    s32 zpos)
+					    s32 zpos,
+					    bool alpha)
 {
 	char fourcc[4] = {0};
 	struct plane *plane;
@@ -683,6 +966,10 @@ static struct plane *find_free_output_plane(struct cb_output *o,
 	list_for_each_entry(plane, &o->free_planes, link) {
 		if (zpos != -1 && plane->zpos != zpos)
 			continue;
+		if (alpha && !plane->alpha_support)
+			continue;
+		if (!plane_support_output_transform(o, plane))
+			continue;
 		for (i = 0; i < plane->count_formats; i++) {
 			if (!memcmp((char *)&plane->formats[i], fourcc, 4)) {
 				return plane;
@@ -692,9 +979,99 @@ static struct plane *find_free_output_plane(struct cb_output *o,
 
 	comp_err("cannot find plane which supports format %4.4s.", fourcc);
 
+	/* ask the plane pool for one */
+	o->planes_wanted++;
+	memcpy(&o->plane_want_fourcc, fourcc, 4);
+	o->plane_want_zpos = zpos;
+	o->plane_want_alpha = alpha;
+
 	return NULL;
 }
 
+static bool plane_is_free(struct cb_output *o, struct plane *plane)
+{
+	struct plane *p;
+
+	list_for_each_entry(p, &o->free_planes, link) {
+		if (p == plane)
+			return true;
+	}
+
+	return false;
+}
+
+static bool plane_support_fourcc(struct plane *plane, u32 fourcc)
+{
+	s32 i;
+
+	for (i = 0; i < plane->count_formats; i++) {
+		if (plane->formats[i] == fourcc)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * add output's copy of a shared plane into the pool.
+ * return true if the output becomes the owner.
+ */
+static bool plane_pool_add(struct cb_output *output, struct plane *plane)
+{
+	struct cb_compositor *c = output->c;
+	struct cb_plane_slot *slot;
+	bool found = false;
+
+	list_for_each_entry(slot, &c->plane_pool, link) {
+		if (slot->id == plane->id) {
+			found = true;
+			break;
+		}
+	}
+
+	if (!found) {
+		slot = calloc(1, sizeof(*slot));
+		if (!slot)
+			return false;
+		slot->id = plane->id;
+		list_add_tail(&slot->link, &c->plane_pool);
+	}
+
+	slot->planes[output->pipe] = plane;
+	if (slot->owner || slot->target)
+		return false;
+
+	if (output->output->acquire_plane(output->output, plane) < 0)
+		return false;
+
+	slot->owner = output;
+	comp_notice("shared plane %u -> output %d", slot->id, output->pipe);
+	return true;
+}
+
+static void plane_pool_remove_output(struct cb_output *output)
+{
+	struct cb_compositor *c = output->c;
+	struct cb_plane_slot *slot, *next;
+	s32 i;
+
+	list_for_each_entry_safe(slot, next, &c->plane_pool, link) {
+		slot->planes[output->pipe] = NULL;
+		if (slot->owner == output)
+			slot->owner = NULL;
+		if (slot->target == output)
+			slot->target = NULL;
+		for (i = 0; i < MAX_NR_OUTPUTS; i++) {
+			if (slot->planes[i])
+				break;
+		}
+		if (i == MAX_NR_OUTPUTS) {
+			list_del(&slot->link);
+			free(slot);
+		}
+	}
+}
+
 static void output_free_planes_prepare(struct cb_output *output)
 {
 	struct output *o = output->output;
@@ -706,6 +1083,11 @@ static void output_free_planes_prepare(struct cb_output *output)
 		if (plane) {
 			switch (plane->type) {
 			case PLANE_TYPE_OVERLAY:
+				if (plane->possible_outputs &
+				    (plane->possible_outputs - 1)) {
+					if (!plane_pool_add(output, plane))
+						break;
+				}
 				list_add_tail(&plane->link,
 					      &output->free_planes);
 				comp_debug("stack plane [zpos]: %lu",
@@ -718,6 +1100,34 @@ static void output_free_planes_prepare(struct cb_output *output)
 	} while (plane);
 }
 
+static void blit_destroy(struct cb_compositor *c, struct cb_view_blit *blit)
+{
+	s32 i;
+
+	for (i = 0; i < 2; i++) {
+		if (blit->bufs[i])
+			c->so->dumb_buffer_destroy(c->so, blit->bufs[i]);
+		cb_region_fini(&blit->missed[i]);
+	}
+	cb_region_fini(&blit->tex_damage);
+	cb_tile_damage_fini(&blit->tiles);
+	free(blit);
+}
+
+static void retire_blits(struct cb_output *o, bool force)
+{
+	struct cb_view_blit *blit, *next;
+
+	list_for_each_entry_safe(blit, next, &o->blit_retired, link) {
+		if (!force && --blit->retire_flips > 0)
+			continue;
+		list_del(&blit->link);
+		blit_destroy(o->c, blit);
+	}
+}
+
+static void capture_destroy(struct cb_capture *cap);
+
 static void cb_output_destroy(struct cb_output *output)
 {
 	struct cb_compositor *c;
@@ -728,6 +1138,9 @@ static void cb_output_destroy(struct cb_output *output)
 
 	c = output->c;
 
+	if (output->capture)
+		capture_destroy(output->capture);
+
 	if (output->primary_vflipped_timer)
 		cb_event_source_remove(output->primary_vflipped_timer);
 
@@ -743,16 +1156,23 @@ static void cb_output_destroy(struct cb_output *output)
 	if (output->disable_timer)
 		cb_event_source_remove(output->disable_timer);
 
+	if (output->render_idle_timer)
+		cb_event_source_remove(output->render_idle_timer);
+
 	if (output->dummy && c && c->so)
 		c->so->dumb_buffer_destroy(c->so, output->dummy);
-	for (i = 0; i < 2; i++) {
+	for (i = 0; i < MC_CACHE_SIZE; i++) {
 		if (output->mc_buf[i] && c && c->so) {
 			comp_notice("destroy cursor bo");
 			c->so->cursor_bo_destroy(c->so, output->mc_buf[i]);
 		}
+		free(output->mc_data[i]);
 	}
 
+	retire_blits(output, true);
 	output_free_planes_finish(output);
+	if (c)
+		plane_pool_remove_output(output);
 
 	if (output->output && c && c->so)
 		output->c->so->pipeline_destroy(c->so, output->output);
@@ -861,6 +1281,7 @@ static void gen_global_pos(struct cb_output *o)
 static void update_mc_view_port(struct cb_output *output, bool gen_g_pos)
 {
 	struct cb_compositor *c = output->c;
+	struct cb_rect hot;
 	s32 dx, dy;
 
 	if (((c->mc_desktop_pos.x - c->mc_hot_pos.x) >=
@@ -876,16 +1297,31 @@ static void update_mc_view_port(struct cb_output *output, bool gen_g_pos)
 		output->mc_on_screen = true;
 		if (gen_g_pos)
 			gen_global_pos(output);
-		output->mc_view_port.pos.x = output->crtc_view_port.pos.x;
-		output->mc_view_port.pos.y = output->crtc_view_port.pos.y;
 		dx = c->mc_desktop_pos.x - output->desktop_rc.pos.x;
 		dy = c->mc_desktop_pos.y - output->desktop_rc.pos.y;
-		output->mc_view_port.pos.x += (s32)((float)dx / output->scale);
-		output->mc_view_port.pos.x -= c->mc_hot_pos.x;
-		output->mc_view_port.pos.y += (s32)((float)dy / output->scale);
-		output->mc_view_port.pos.y -= c->mc_hot_pos.y;
+		hot.pos.x = output->view_port.pos.x
+				+ (s32)((float)dx / output->scale);
+		hot.pos.y = output->view_port.pos.y
+				+ (s32)((float)dy / output->scale);
 		output->mc_view_port.w = MC_MAX_WIDTH;
 		output->mc_view_port.h = MC_MAX_WIDTH;
+		if (output->transform != CB_TRANSFORM_NORMAL &&
+		    !(output->cursor_plane->transforms &
+		      (1U << output->transform))) {
+			/* cursor shape is not rotated, only its hot spot */
+			hot.w = hot.h = 1;
+			output_transform_rect(output, &hot);
+			output->mc_view_port.pos.x = hot.pos.x
+							- c->mc_hot_pos.x;
+			output->mc_view_port.pos.y = hot.pos.y
+							- c->mc_hot_pos.y;
+		} else {
+			output->mc_view_port.pos.x = hot.pos.x
+							- c->mc_hot_pos.x;
+			output->mc_view_port.pos.y = hot.pos.y
+							- c->mc_hot_pos.y;
+			output_transform_rect(output, &output->mc_view_port);
+		}
 	} else {
 		output->mc_on_screen = false;
 	}
@@ -893,6 +1329,44 @@ static void update_mc_view_port(struct cb_output *output, bool gen_g_pos)
 
 static void set_fix_touch_min_max_pending(struct input_device *dev);
 
+static u32 render_scale_size(u32 size, u32 scale)
+{
+	if (scale >= CB_RENDER_SCALE_MAX)
+		return size;
+
+	size = (size * scale / CB_RENDER_SCALE_MAX) & (~1U);
+	return MAX(size, 2);
+}
+
+/* renderer's surface size and the area drawn in it */
+static void update_render_size(struct cb_output *o)
+{
+	u32 w, h, scale, cur;
+
+	/* rotated by plane, renderer draws the rotated screen */
+	if (o->hw_transform && output_transposed(o)) {
+		w = o->crtc_h;
+		h = o->crtc_w;
+	} else {
+		w = o->crtc_w;
+		h = o->crtc_h;
+	}
+
+	if (o->primary_plane && o->primary_plane->scale_support) {
+		scale = o->render_scale;
+		cur = MIN(o->render_scale_cur, scale);
+	} else {
+		scale = cur = CB_RENDER_SCALE_MAX;
+	}
+
+	o->surface_w = render_scale_size(w, scale);
+	o->surface_h = render_scale_size(h, scale);
+	o->native_surface_src.pos.x = 0;
+	o->native_surface_src.pos.y = 0;
+	o->native_surface_src.w = render_scale_size(w, cur);
+	o->native_surface_src.h = render_scale_size(h, cur);
+}
+
 /*
  * Calculate rectangle on crtc coordinates for desktop canvas.
  * desktop canvas's size is the real full screen buffer's size.
@@ -901,42 +1375,54 @@ static void update_crtc_view_port(struct cb_output *output)
 {
 	struct cb_mode *mode;
 	s32 calc;
+	u32 lw, lh;
 	struct input_device *dev;
 	struct cb_compositor *c;
 
+	output->hw_transform = (output->transform != CB_TRANSFORM_NORMAL &&
+				output->primary_plane &&
+				(output->primary_plane->transforms &
+				 (1U << output->transform)));
 	mode = output->output->get_current_mode(output->output);
 	if (!mode) {
 		output->crtc_w = output->crtc_h = 0;
+		memset(&output->view_port, 0, sizeof(output->view_port));
 		memset(&output->crtc_view_port, 0,
 			sizeof(output->crtc_view_port));
 	} else {
-		output->native_surface_src.w = mode->width;
-		output->native_surface_src.h = mode->height;
-		output->native_surface_src.pos.x = 0;
-		output->native_surface_src.pos.y = 0;
 		output->crtc_w = mode->width;
 		output->crtc_h = mode->height;
-		calc = output->crtc_w * output->desktop_rc.h
-				/ output->desktop_rc.w;
-		if (calc <= output->crtc_h) {
-			output->scale = (float)output->desktop_rc.w
-						/ output->crtc_w;
-			output->crtc_view_port.pos.x = 0;
-			output->crtc_view_port.pos.y =
-				(output->crtc_h - calc) / 2;
-			output->crtc_view_port.w = output->crtc_w;
-			output->crtc_view_port.h = calc;
+		/* size of the rotated screen */
+		if (output_transposed(output)) {
+			lw = output->crtc_h;
+			lh = output->crtc_w;
+		} else {
+			lw = output->crtc_w;
+			lh = output->crtc_h;
+		}
+		update_render_size(output);
+		output->native_surface_dst.pos.x = 0;
+		output->native_surface_dst.pos.y = 0;
+		output->native_surface_dst.w = mode->width;
+		output->native_surface_dst.h = mode->height;
+		calc = lw * output->desktop_rc.h / output->desktop_rc.w;
+		if (calc <= lh) {
+			output->scale = (float)output->desktop_rc.w / lw;
+			output->view_port.pos.x = 0;
+			output->view_port.pos.y = (lh - calc) / 2;
+			output->view_port.w = lw;
+			output->view_port.h = calc;
 		} else {
-			output->scale = (float)output->desktop_rc.h
-				/ output->crtc_h;
-			calc = output->desktop_rc.w * output->crtc_h
+			output->scale = (float)output->desktop_rc.h / lh;
+			calc = output->desktop_rc.w * lh
 				/ output->desktop_rc.h;
-			output->crtc_view_port.pos.x =
-				(output->crtc_w - calc) / 2;
-			output->crtc_view_port.pos.y = 0;
-			output->crtc_view_port.w = calc;
-			output->crtc_view_port.h = output->crtc_h;
+			output->view_port.pos.x = (lw - calc) / 2;
+			output->view_port.pos.y = 0;
+			output->view_port.w = calc;
+			output->view_port.h = lh;
 		}
+		output->crtc_view_port = output->view_port;
+		output_transform_rect(output, &output->crtc_view_port);
 		c = output->c;
 		if (c->touchscreen_attached) {
 			list_for_each_entry(dev, &c->input_devs, link) {
@@ -1042,14 +1528,113 @@ static void cancel_so_tasks(struct cb_output *output)
 		if (sot->buffer && (sot->buffer->dirty & (1U << output->pipe))){
 			sot->buffer->dirty &= (~(1U << output->pipe));
 		}
-		cb_cache_put(sot, c->so_task_cache);
+		cb_slab_put(sot, c->so_task_cache);
 	}
 
 	output->renderable_buffer_changed = false;
 	comp_warn("Clear output %d renderable_buffer_changed", output->pipe);
 }
 
-static void disable_output_render(struct cb_output *o)
+static bool output_view_port_full(struct cb_output *o)
+{
+	return !o->crtc_view_port.pos.x && !o->crtc_view_port.pos.y &&
+	       o->crtc_view_port.w == o->crtc_w &&
+	       o->crtc_view_port.h == o->crtc_h;
+}
+
+/*
+ * f can show l's renderable buffer if f's desktop lies in l's, none of them
+ * is letterboxed or rotated and l renders f's area with no less pixels.
+ */
+static bool clone_candidate(struct cb_output *f, struct cb_output *l)
+{
+	struct cb_rect *rf = &f->desktop_rc, *rl = &l->desktop_rc;
+	u32 w, h;
+
+	if (f == l || !l->enabled || l->clone_next ||
+	    l == f->clone_rejected)
+		return false;
+
+	if (f->transform != CB_TRANSFORM_NORMAL ||
+	    l->transform != CB_TRANSFORM_NORMAL)
+		return false;
+
+	if (!output_view_port_full(f) || !output_view_port_full(l))
+		return false;
+
+	if (rf->pos.x < rl->pos.x || rf->pos.y < rl->pos.y ||
+	    rf->pos.x + rf->w > rl->pos.x + rl->w ||
+	    rf->pos.y + rf->h > rl->pos.y + rl->h)
+		return false;
+
+	w = rf->w * l->crtc_w / rl->w;
+	h = rf->h * l->crtc_h / rl->h;
+	if (w < f->crtc_w || h < f->crtc_h)
+		return false;
+
+	if ((w != f->crtc_w || h != f->crtc_h ||
+	     l->render_scale < CB_RENDER_SCALE_MAX) &&
+	    !f->primary_plane->scale_support)
+		return false;
+
+	return true;
+}
+
+static bool clone_is_leader(struct cb_compositor *c, struct cb_output *o)
+{
+	s32 i;
+
+	for (i = 0; i < c->count_outputs; i++) {
+		if (c->outputs[i]->clone_next == o)
+			return true;
+	}
+
+	return false;
+}
+
+/* pick a leader for the outputs showing a part of another one's desktop */
+static void update_clone_outputs(struct cb_compositor *c)
+{
+	struct cb_output *f, *l, *leader;
+	s32 i, j;
+
+	for (i = 0; i < c->count_outputs; i++)
+		c->outputs[i]->clone_next = NULL;
+
+	for (i = 0; i < c->count_outputs; i++) {
+		f = c->outputs[i];
+		if (!f->enabled || clone_is_leader(c, f))
+			continue;
+		leader = NULL;
+		for (j = 0; j < c->count_outputs; j++) {
+			l = c->outputs[j];
+			if (!clone_candidate(f, l))
+				continue;
+			if (!leader || l->crtc_w * l->crtc_h >
+					leader->crtc_w * leader->crtc_h)
+				leader = l;
+		}
+		f->clone_next = leader;
+	}
+
+	for (i = 0; i < c->count_outputs; i++) {
+		f = c->outputs[i];
+		if (f->clone_next == f->clone_leader)
+			continue;
+		if (f->clone_next) {
+			comp_notice("output %d clones output %d", f->pipe,
+				    f->clone_next->pipe);
+		} else {
+			comp_notice("output %d renders by itself", f->pipe);
+		}
+		f->clone_leader = f->clone_next;
+		f->clone_tested = false;
+		f->clone_shown = false;
+		f->renderable_buffer_changed = true;
+	}
+}
+
+static void release_output_render(struct cb_output *o)
 {
 	if (o->ro) {
 		o->ro->destroy(o->ro);
@@ -1063,34 +1648,119 @@ static void disable_output_render(struct cb_output *o)
 	}
 }
 
-static s32 suspend(struct cb_compositor *c)
+/* it depends on update_crtc_view_port to get the surface size */
+static bool acquire_output_render(struct cb_output *o)
 {
-	struct cb_output *o;
-	s32 i;
-	struct cb_mode *mode;
+	struct cb_compositor *c = o->c;
+	s32 vid;
 
-	comp_notice("Suspend >>>>>>>>>>>>>>");
-	if (!c || !c->outputs)
-		return -EINVAL;
+	if (o->ro)
+		return true;
 
-	if (c->suspend_pending) {
-		comp_notice("suspend pending, try later.");
-		return -EAGAIN;
+	o->native_surface = o->output->native_surface_create(o->output,
+							     o->surface_w,
+							     o->surface_h);
+	if (!o->native_surface) {
+		comp_err("failed to create native surface");
+		return false;
+	}
+	o->ro = c->r->output_create(c->r, NULL, o->native_surface,
+				    (s32 *)(&c->native_fmt), 1, &vid,
+				    &o->desktop_rc,
+				    o->native_surface_src.w,
+				    o->native_surface_src.h,
+				    o->pipe);
+	if (!o->ro) {
+		comp_err("failed to create renderer output");
+		o->output->native_surface_destroy(o->output, o->native_surface);
+		o->native_surface = NULL;
+		return false;
 	}
+	o->ro->set_transform(o->ro, o->hw_transform ? CB_TRANSFORM_NORMAL
+						    : o->transform);
+	comp_notice("output %d renderer's surface %ux%u created", o->pipe,
+		    o->surface_w, o->surface_h);
+	o->renderable_buffer_changed = true;
 
-	for (i = 0; i < c->count_outputs; i++) {
-		o = c->outputs[i];
-		if (!o)
-			continue;
+	return true;
+}
 
-		if (o->enabled) {
-			o->disable_pending = true;
-			o->enabled = false;
-			mode = o->output->get_current_mode(o->output);
-			if (mode) {
-				comp_notice("Save mode %ux%u@%u",
-					    mode->width, mode->height,
-					    mode->vrefresh);
+static s32 render_idle_timer_cb(void *data)
+{
+	struct cb_output *o = data;
+
+	if (!o->render_idle || !o->ro)
+		return 0;
+
+	comp_notice("output %d renderer's surface released after %u ms idle",
+		    o->pipe, o->c->render_idle_msec);
+	release_output_render(o);
+
+	return 0;
+}
+
+/* track whether any view on the output needs composition */
+static void update_render_idle(struct cb_output *o, bool idle)
+{
+	if (idle == o->render_idle)
+		return;
+
+	o->render_idle = idle;
+	if (!idle) {
+		cb_event_source_timer_update(o->render_idle_timer, 0, 0);
+		/* rbuf_cur is dropped while idle */
+		o->renderable_buffer_changed = true;
+	} else if (o->ro && o->c->render_idle_msec) {
+		cb_event_source_timer_update(o->render_idle_timer,
+					     o->c->render_idle_msec, 0);
+	}
+}
+
+static void disable_output_render(struct cb_output *o)
+{
+	update_render_idle(o, false);
+	release_output_render(o);
+	update_clone_outputs(o->c);
+}
+
+/*
+ * renderer's surface is created on demand with the output's current size,
+ * see acquire_output_render.
+ */
+static void enable_output_render(struct cb_output *o)
+{
+	release_output_render(o);
+	update_clone_outputs(o->c);
+}
+
+static s32 suspend(struct cb_compositor *c)
+{
+	struct cb_output *o;
+	s32 i;
+	struct cb_mode *mode;
+
+	comp_notice("Suspend >>>>>>>>>>>>>>");
+	if (!c || !c->outputs)
+		return -EINVAL;
+
+	if (c->suspend_pending) {
+		comp_notice("suspend pending, try later.");
+		return -EAGAIN;
+	}
+
+	for (i = 0; i < c->count_outputs; i++) {
+		o = c->outputs[i];
+		if (!o)
+			continue;
+
+		if (o->enabled) {
+			o->disable_pending = true;
+			o->enabled = false;
+			mode = o->output->get_current_mode(o->output);
+			if (mode) {
+				comp_notice("Save mode %ux%u@%u",
+					    mode->width, mode->height,
+					    mode->vrefresh);
 				memcpy(&o->mode_save, mode, sizeof(*mode));
 				o->mode_saved = true;
 			} else {
@@ -1184,6 +1854,9 @@ static s32 cb_compositor_destroy(struct compositor *comp)
 	struct cb_compositor *c = to_cb_c(comp);
 	s32 i, ret;
 	struct cb_view *view, *view_next;
+	struct mc_shape *shape, *shape_next;
+	struct bypass_buf *bb, *bb_next;
+	struct cb_slab_stats st;
 
 	if (c->dbg_source) {
 		cb_event_source_remove(c->dbg_source);
@@ -1235,11 +1908,31 @@ static s32 cb_compositor_destroy(struct compositor *comp)
 		list_del(&view->link);
 	}
 
+	list_for_each_entry_safe(bb, bb_next, &c->bypass_bufs, link) {
+		list_del(&bb->link);
+		if (bb->so_buf && c->so)
+			c->so->release_dmabuf(c->so, bb->so_buf);
+		free(bb);
+	}
+
 	if (c->so)
 		c->so->destroy(c->so);
 
-	if (c->so_task_cache)
-		cb_cache_destroy(c->so_task_cache);
+	if (c->so_task_cache) {
+		cb_slab_get_stats(c->so_task_cache, &st);
+		comp_debug("so task cache: hits %lu misses %lu peak %u",
+			   st.hits, st.misses, st.peak);
+		cb_slab_destroy(c->so_task_cache);
+	}
+
+	if (c->frame_arena)
+		cb_arena_destroy(c->frame_arena);
+
+	list_for_each_entry_safe(shape, shape_next, &c->mc_shapes, link) {
+		list_del(&shape->link);
+		free(shape->data);
+		free(shape);
+	}
 
 	free(c);
 
@@ -1349,6 +2042,119 @@ static void fill_cursor(struct cb_compositor *c, struct cb_buffer *b,
 				data, width, height, stride);
 }
 
+/* FNV-1a hash of cursor content */
+static u64 mc_hash(u8 *data, u32 width, u32 height, u32 stride)
+{
+	u64 hash = 14695981039346656037ull;
+	u32 i, j;
+	u8 *p;
+
+	hash = (hash ^ width) * 1099511628211ull;
+	hash = (hash ^ height) * 1099511628211ull;
+	for (i = 0; i < height; i++) {
+		p = data + i * stride;
+		for (j = 0; j < width * 4; j++)
+			hash = (hash ^ p[j]) * 1099511628211ull;
+	}
+
+	/* 0 means empty slot */
+	return hash ? hash : 1;
+}
+
+/* the slot holds this very shape, not only one with the same hash */
+static bool mc_cache_match(struct cb_output *o, s32 slot, u64 hash, u8 *data,
+			   u32 width, u32 height, u32 stride)
+{
+	u32 i;
+
+	if (!o->mc_buf[slot] || o->mc_hash[slot] != hash)
+		return false;
+	if (o->mc_w[slot] != width || o->mc_h[slot] != height)
+		return false;
+
+	for (i = 0; i < height; i++) {
+		if (memcmp(o->mc_data[slot] + i * width * 4, data + i * stride,
+			   width * 4))
+			return false;
+	}
+
+	return true;
+}
+
+/* key the slot with the shape just uploaded into it */
+static void mc_cache_set(struct cb_output *o, s32 slot, u64 hash, u8 *data,
+			 u32 width, u32 height, u32 stride)
+{
+	u32 i;
+
+	free(o->mc_data[slot]);
+	o->mc_data[slot] = malloc(width * height * 4);
+	if (!o->mc_data[slot]) {
+		/* still on screen, but never found again */
+		o->mc_hash[slot] = 0;
+		return;
+	}
+
+	for (i = 0; i < height; i++)
+		memcpy(o->mc_data[slot] + i * width * 4, data + i * stride,
+		       width * 4);
+	o->mc_hash[slot] = hash;
+	o->mc_w[slot] = width;
+	o->mc_h[slot] = height;
+}
+
+/*
+ * Get cursor buffer of the shape from output's cache, upload it into the
+ * least recently used slot if it is missed.
+ * return slot index or negative errno.
+ */
+static s32 mc_cache_get(struct cb_output *o, u64 hash, u8 *data,
+			u32 width, u32 height, u32 stride)
+{
+	struct cb_compositor *c = o->c;
+	struct cb_buffer_info info;
+	s32 i, slot = -1;
+
+	for (i = 0; i < MC_CACHE_SIZE; i++) {
+		if (mc_cache_match(o, i, hash, data, width, height, stride)) {
+			o->mc_stamp[i] = ++c->mc_stamp;
+			return i;
+		}
+	}
+
+	for (i = 0; i < MC_CACHE_SIZE; i++) {
+		/* do not overwrite the buffer which may be on screen */
+		if (i == o->mc_buf_cur || i == o->mc_buf_prev ||
+		    (o->mc_damaged && i == o->mc_buf_next))
+			continue;
+		if (!o->mc_buf[i]) {
+			memset(&info, 0, sizeof(info));
+			info.pix_fmt = CB_PIX_FMT_ARGB8888;
+			info.width = MC_MAX_WIDTH;
+			info.height = MC_MAX_HEIGHT;
+			o->mc_buf[i] = c->so->cursor_bo_create(c->so, &info);
+			if (!o->mc_buf[i])
+				continue;
+			o->mc_hash[i] = 0;
+			slot = i;
+			break;
+		}
+		if (slot < 0 || o->mc_stamp[i] < o->mc_stamp[slot])
+			slot = i;
+	}
+
+	if (slot < 0)
+		return -ENOMEM;
+
+	comp_debug("[output: %d] upload cursor into slot %d", o->pipe, slot);
+	scanout_buffer_dirty_init(o->mc_buf[slot]);
+	fill_cursor(c, o->mc_buf[slot], data, width, height, stride);
+	mc_cache_set(o, slot, hash, data, width, height, stride);
+	o->mc_stamp[slot] = ++c->mc_stamp;
+
+	return slot;
+}
+
 static void dummy_flipped_cb(struct cb_listener *listener, void *data)
 {
 	struct cb_output *output;
@@ -1359,11 +2165,21 @@ static void dummy_flipped_cb(struct cb_listener *listener, void *data)
 	comp_notice("[output: %d] Dummy flipped", output->pipe);
 }
 
+/* rotate the cursor shape if cursor plane can, see update_mc_view_port */
+static void set_mc_transform(struct cb_output *o, void *fb_info)
+{
+	if (o->transform == CB_TRANSFORM_NORMAL)
+		return;
+
+	if (o->cursor_plane->transforms & (1U << o->transform))
+		scanout_commit_set_fb_transform(fb_info, o->transform);
+}
+
 static void show_dummy(struct cb_output *output)
 {
 	struct cb_compositor *c = output->c;
 	struct scanout_commit_info *commit;
-	void *sd;
+	void *sd, *fb_info;
 
 	commit = scanout_commit_info_alloc();
 	output->dummy_src.pos.x = output->dummy_src.pos.y = 0;
@@ -1383,10 +2199,11 @@ static void show_dummy(struct cb_output *output)
 		comp_debug("Add FB dummy mc %p",
 			   output->mc_buf[output->mc_buf_cur]);
 		if (output->mc_damaged) {
-			output->mc_buf_cur = 1 - output->mc_buf_cur;
+			output->mc_buf_prev = output->mc_buf_cur;
+			output->mc_buf_cur = output->mc_buf_next;
 			output->mc_damaged = false;
 		}
-		scanout_commit_add_fb_info(commit,
+		fb_info = scanout_commit_add_fb_info(commit,
 			output->mc_buf[output->mc_buf_cur],
 			output->output,
 			output->cursor_plane,
@@ -1394,6 +2211,7 @@ static void show_dummy(struct cb_output *output)
 			&output->mc_view_port,
 			-1,
 			c->mc_alpha_src_pre_mul);
+		set_mc_transform(output, fb_info);
 	}
 	sd = c->so->scanout_data_alloc(c->so);
 	c->so->fill_scanout_data(c->so, sd, commit);
@@ -1426,14 +2244,18 @@ static void enable_primary_renderer(struct cb_output *o)
 static void dump_planes(struct cb_compositor *c, struct cb_output *o)
 {
 	struct cb_client_agent *client;
-	struct cb_surface *s;
+	struct cb_surface *s, **surfaces;
 	struct cb_view *v;
 	struct plane *plane;
+	u32 i;
 
 	list_for_each_entry(client, &c->clients, link) {
 		comp_warn("check client %p's plane of pipe %d", client,
 			  o->pipe);
-		list_for_each_entry(s, &client->surfaces, link) {
+		surfaces = (struct cb_surface **)cb_handle_objects(
+							client->surfaces);
+		for (i = 0; i < cb_handle_count(client->surfaces); i++) {
+			s = surfaces[i];
 			v = s->view;
 			plane = v->planes[o->pipe];
 			comp_warn("Plane: %p", plane);
@@ -1502,12 +2324,22 @@ static bool prepare_dma_buf_planes(struct cb_surface *surface,
 		if (!(plane && plane == o->primary_plane)) {
 			comp_debug("find plane for fmt %d, zpos %d",
 				   buffer->info.pix_fmt, view->zpos);
+			/* translucent view stays on plane with alpha */
 			plane = find_free_output_plane(o, buffer->info.pix_fmt,
-					       view->zpos);
+					       view->zpos, view->alpha < 1.0f);
+			if (!plane && view->alpha < 1.0f) {
+				comp_warn("no alpha plane on output %d, "
+					  "show view opaque", o->pipe);
+				plane = find_free_output_plane(o,
+						buffer->info.pix_fmt,
+						view->zpos, false);
+			}
 		}
 		if (!plane) {
 			comp_warn("cannot find plane for output %d", o->pipe);
-			if (primary_support_fmt(o, buffer->info.pix_fmt)) {
+			if (primary_support_fmt(o, buffer->info.pix_fmt) &&
+			    plane_support_output_transform(o,
+							   o->primary_plane)) {
 				plane = o->primary_plane;
 				if (o->primary_renderer_disabled) {
 					comp_warn("output %d's primary already "
@@ -1588,7 +2420,7 @@ static void dma_buf_flipped_cb(struct cb_listener *listener, void *data)
 
 	comp_debug("del dma buf flipped listener begin");
 	list_del(&listener->link);
-	client->send_bo_flipped(client, buffer, (u64)surface);
+	client->send_bo_flipped(client, buffer, surface->id);
 	comp_debug("del dma buf flipped listener end");
 }
 
@@ -1600,7 +2432,7 @@ static void dma_buf_completed_cb(struct cb_listener *listener, void *data)
 
 	comp_debug("del dma buf complete listener begin");
 	list_del(&listener->link);
-	client->send_bo_complete(client, buffer, (u64)surface);
+	client->send_bo_complete(client, buffer, surface->id);
 	buffer->completed_l_added = false;
 	comp_debug("del dma buf complete listener end");
 }
@@ -1611,8 +2443,6 @@ static void head_changed_cb(struct cb_listener *listener, void *data)
 					   conn_st_chg_changed_l);
 	struct head *head = o->head;
 	struct output *output = o->output;
-	struct cb_compositor *c = o->c;
-	s32 vid;
 
 	if (o->c->disable_head_detect)
 		return;
@@ -1630,19 +2460,7 @@ static void head_changed_cb(struct cb_listener *listener, void *data)
 		/* update view port before show dummy */
 		update_crtc_view_port(o);
 		show_dummy(o);
-		o->native_surface = output->native_surface_create(output);
-		if (!o->native_surface) {
-			comp_err("failed to create native surface");
-			assert(o->native_surface);
-		}
-		o->ro = c->r->output_create(c->r, NULL, o->native_surface,
-					    (s32 *)(&c->native_fmt), 1, &vid,
-					    &o->desktop_rc,
-					    o->crtc_w, o->crtc_h, o->pipe);
-		if (!o->ro) {
-			comp_err("failed to create renderer output");
-			assert(o->ro);
-		}
+		enable_output_render(o);
 		printf("output %d is enabled. repaint_status: %d.\n",
 			o->pipe, o->repaint_status);
 		comp_notice("output %d is enabled. repaint_status: %d",
@@ -1725,9 +2543,7 @@ static s32 suspend_timer_cb(void *data)
 static s32 output_disable_timer_cb(void *data)
 {
 	struct cb_output *o = data;
-	struct cb_compositor *c = o->c;
 	struct output *output = o->output;
-	s32 vid;
 
 	printf("Try to disable output: %d\n", o->pipe);
 	comp_notice("Try to disable output: %d", o->pipe);
@@ -1746,23 +2562,7 @@ static s32 output_disable_timer_cb(void *data)
 			/* update view port before show dummy */
 			update_crtc_view_port(o);
 			show_dummy(o);
-			o->native_surface = output->native_surface_create(
-						output);
-			if (!o->native_surface) {
-				comp_err("failed to create native surface");
-				assert(o->native_surface);
-			}
-			o->ro = c->r->output_create(c->r, NULL,
-						    o->native_surface,
-						    (s32 *)(&c->native_fmt),
-						    1, &vid,
-						    &o->desktop_rc,
-						    o->crtc_w, o->crtc_h,
-						    o->pipe);
-			if (!o->ro) {
-				comp_err("failed to create renderer output");
-				assert(o->ro);
-			}
+			enable_output_render(o);
 			o->switch_mode_pending = false;
 			o->pending_mode = NULL;
 			cb_signal_emit(&o->switch_mode_signal, NULL);
@@ -1931,6 +2731,101 @@ direct_repaint:
 	update_repaint_timer(o->c);
 }
 
+static void bypass_complete(struct cb_buffer *buffer)
+{
+	struct cb_surface *surface = buffer->surface;
+	struct cb_client_agent *client;
+
+	if (!surface)
+		return;
+
+	client = surface->client_agent;
+	client->send_bo_complete(client, buffer, surface->id);
+}
+
+/* buffer leaves screen after the next flip */
+static void bypass_retire(struct cb_output *o, struct cb_buffer *buffer)
+{
+	if (!buffer || buffer == o->bypass_done)
+		return;
+
+	if (o->bypass_done)
+		bypass_complete(o->bypass_done);
+	o->bypass_done = buffer;
+}
+
+/* switch output back to composition */
+static void bypass_exit(struct cb_output *o)
+{
+	if (!o->bypass_view)
+		return;
+
+	comp_notice("output %d leaves direct scanout", o->pipe);
+	bypass_retire(o, o->bypass_cur);
+	o->bypass_cur = NULL;
+	if (o->bypass_pending) {
+		bypass_complete(o->bypass_pending);
+		o->bypass_pending = NULL;
+	}
+	o->bypass_view = NULL;
+	o->renderable_buffer_changed = true;
+}
+
+/*
+ * return true if the complete message of the committed buffer is
+ * deferred because the surface is scanned out directly.
+ */
+static bool bypass_defer_complete(struct cb_surface *surface)
+{
+	struct cb_compositor *c = surface->c;
+	struct cb_buffer *buffer = surface->buffer_pending;
+	struct cb_output *o;
+	s32 i;
+
+	if (buffer->info.type != CB_BUF_TYPE_DMA)
+		return false;
+
+	for (i = 0; i < c->count_outputs; i++) {
+		o = c->outputs[i];
+		if (o->bypass_view != surface->view)
+			continue;
+		/* never shown */
+		if (o->bypass_pending && o->bypass_pending != buffer &&
+		    o->bypass_pending != o->bypass_cur)
+			bypass_complete(o->bypass_pending);
+		o->bypass_pending = buffer;
+		return true;
+	}
+
+	return false;
+}
+
+static void bypass_forget_buffer(struct cb_compositor *c, struct cb_buffer *b)
+{
+	struct bypass_buf *bb, *next;
+	struct cb_output *o;
+	s32 i;
+
+	for (i = 0; i < c->count_outputs; i++) {
+		o = c->outputs[i];
+		if (o->bypass_pending == b)
+			o->bypass_pending = NULL;
+		if (o->bypass_cur == b)
+			o->bypass_cur = NULL;
+		if (o->bypass_done == b)
+			o->bypass_done = NULL;
+	}
+
+	list_for_each_entry_safe(bb, next, &c->bypass_bufs, link) {
+		if (bb->rd_buf != b)
+			continue;
+		list_del(&bb->link);
+		if (bb->so_buf)
+			c->so->release_dmabuf(c->so, bb->so_buf);
+		free(bb);
+	}
+}
+
 static void output_flipped_cb(struct cb_listener *listener, void *data)
 {
 	struct timespec last;
@@ -1956,9 +2851,41 @@ static void output_flipped_cb(struct cb_listener *listener, void *data)
 	last.tv_sec = output->sec;
 	last.tv_nsec = output->usec * 1000l;
 
+	retire_blits(o, false);
+
+	/* direct scanout buffer has left screen */
+	if (o->bypass_done) {
+		bypass_complete(o->bypass_done);
+		o->bypass_done = NULL;
+	}
+
+	/* flip time stamp is a better anchor */
+	o->vblank_seq_pending = false;
 	schedule_repaint(o, &last);
 }
 
+static void output_vblank_seq_cb(struct cb_listener *listener, void *data)
+{
+	struct cb_output *o = container_of(listener, struct cb_output,
+					   vblank_seq_l);
+	struct vblank_seq *vs = data;
+
+	if (!o->vblank_seq_pending)
+		return;
+
+	o->vblank_seq_pending = false;
+	if (o->repaint_status != REPAINT_WAIT_COMPLETION)
+		return;
+
+	if (!o->enabled) {
+		o->repaint_status = REPAINT_NOT_SCHEDULED;
+		return;
+	}
+
+	comp_debug("[OUTPUT: %d] vblank seq %lu", o->pipe, vs->seq);
+	schedule_repaint(o, &vs->ts);
+}
+
 static s32 vflipped_timer_cb(void *data)
 {
 	struct cb_output *o = data;
@@ -1992,7 +2919,7 @@ static struct cb_output *cb_output_create(struct cb_compositor *c,
 	struct cb_output *output = NULL;
 	struct scanout *so;
 	struct cb_buffer_info info;
-	s32 vid, i;
+	s32 i;
 
 	if (!c || !pipecfg)
 		goto err;
@@ -2000,8 +2927,11 @@ static struct cb_output *cb_output_create(struct cb_compositor *c,
 	output = calloc(1, sizeof(*output));
 	output->c = c;
 	output->pipe = pipecfg->output_index;
+	output->render_scale = CB_RENDER_SCALE_MAX;
+	output->render_scale_cur = CB_RENDER_SCALE_MAX;
 
 	INIT_LIST_HEAD(&output->so_tasks);
+	INIT_LIST_HEAD(&output->blit_retired);
 
 	/* create scanout pipeline */
 	so = c->so;
@@ -2029,13 +2959,19 @@ static struct cb_output *cb_output_create(struct cb_compositor *c,
 		output->mc_buf[i] = so->cursor_bo_create(so, &info);
 		if (!output->mc_buf[i])
 			goto err;
-
-		fill_cursor(c, output->mc_buf[i],
-			    DEF_MC_DAT, DEF_MC_WIDTH, DEF_MC_HEIGHT,
-			    (DEF_MC_WIDTH << 2));
 	}
 
+	/* the others are created on demand */
+	fill_cursor(c, output->mc_buf[0], DEF_MC_DAT, DEF_MC_WIDTH,
+		    DEF_MC_HEIGHT, (DEF_MC_WIDTH << 2));
+	mc_cache_set(output, 0, mc_hash(DEF_MC_DAT, DEF_MC_WIDTH,
+					DEF_MC_HEIGHT, (DEF_MC_WIDTH << 2)),
+		     DEF_MC_DAT, DEF_MC_WIDTH, DEF_MC_HEIGHT,
+		     (DEF_MC_WIDTH << 2));
+	output->mc_stamp[0] = ++c->mc_stamp;
 	output->mc_buf_cur = 0;
+	output->mc_buf_next = 0;
+	output->mc_buf_prev = 0;
 
 	/* prepare dummy buffer */
 	memset(&info, 0, sizeof(info));
@@ -2056,6 +2992,12 @@ static struct cb_output *cb_output_create(struct cb_compositor *c,
 	output->output->add_page_flip_notify(output->output,
 					     &output->output_flipped_l);
 
+	/* register output's vblank sequence handler */
+	output->vblank_seq_l.notify = output_vblank_seq_cb;
+	INIT_LIST_HEAD(&output->vblank_seq_l.link);
+	output->output->add_vblank_seq_notify(output->output,
+					      &output->vblank_seq_l);
+
 	/* register dummy page flip handler */
 	output->dummy_flipped_l.notify = dummy_flipped_cb;
 	INIT_LIST_HEAD(&output->dummy_flipped_l.link);
@@ -2072,6 +3014,12 @@ static struct cb_output *cb_output_create(struct cb_compositor *c,
 	output->g_desktop_rc.w = GLOBAL_DESKTOP_SZ;
 	output->g_desktop_rc.h = GLOBAL_DESKTOP_SZ;
 
+	output->render_idle_timer = cb_event_loop_add_timer(c->loop,
+							    render_idle_timer_cb,
+							    output);
+	if (!output->render_idle_timer)
+		goto err;
+
 	/* prepare disable timer */
 	output->disable_pending = false;
 	output->disable_timer = cb_event_loop_add_timer(c->loop,
@@ -2116,22 +3064,7 @@ static struct cb_output *cb_output_create(struct cb_compositor *c,
 		update_crtc_view_port(output);
 		output->enabled = true;
 		show_dummy(output);
-		output->native_surface = output->output->native_surface_create(
-						output->output);
-		if (!output->native_surface) {
-			comp_err("failed to create native surface");
-			assert(output->native_surface);
-		}
-		output->ro = c->r->output_create(c->r, NULL,
-					output->native_surface,
-					(s32 *)(&c->native_fmt), 1, &vid,
-					&output->desktop_rc,
-					output->crtc_w, output->crtc_h,
-					output->pipe);
-		if (!output->ro) {
-			comp_err("failed to create renderer output");
-			assert(output->ro);
-		}
+		enable_output_render(output);
 		/* set initial debounced head status as 'plug in' */
 		output->conn_st_db = true;
 	} else {
@@ -2161,7 +3094,7 @@ static void cb_compositor_resume(struct compositor *comp)
 	struct cb_compositor *c = to_cb_c(comp);
 	struct cb_output *o;
 	struct cb_mode *mode = NULL;
-	s32 i, vid;
+	s32 i;
 
 	if (!comp)
 		return;
@@ -2203,22 +3136,7 @@ static void cb_compositor_resume(struct compositor *comp)
 			update_crtc_view_port(o);
 			o->enabled = true;
 			show_dummy(o);
-			o->native_surface = o->output->native_surface_create(
-							o->output);
-			if (!o->native_surface) {
-				comp_err("failed to create native surface");
-				assert(o->native_surface);
-			}
-			o->ro = c->r->output_create(c->r, NULL,
-						o->native_surface,
-						(s32 *)(&c->native_fmt), 1,
-						&vid,
-						&o->desktop_rc,
-						o->crtc_w, o->crtc_h, o->pipe);
-			if (!o->ro) {
-				comp_err("failed to create renderer output");
-				assert(o->ro);
-			}
+			enable_output_render(o);
 			/* set initial debounced head status as 'plug in' */
 			o->conn_st_db = true;
 		} else {
@@ -2240,7 +3158,7 @@ static s32 cb_compositor_switch_mode_ext(struct compositor *comp, s32 pipe,
 {
 	struct cb_compositor *c = to_cb_c(comp);
 	struct cb_output *o;
-	s32 vid, i;
+	s32 i;
 	struct cb_mode *mode;
 
 	if (!comp || pipe < 0 || !mr)
@@ -2289,19 +3207,7 @@ static s32 cb_compositor_switch_mode_ext(struct compositor *comp, s32 pipe,
 		/* update view port before show dummy */
 		update_crtc_view_port(o);
 		show_dummy(o);
-		o->native_surface = o->output->native_surface_create(o->output);
-		if (!o->native_surface) {
-			comp_err("failed to create native surface");
-			assert(o->native_surface);
-		}
-		o->ro = c->r->output_create(c->r, NULL, o->native_surface,
-					    (s32 *)(&c->native_fmt), 1, &vid,
-					    &o->desktop_rc,
-					    o->crtc_w, o->crtc_h, o->pipe);
-		if (!o->ro) {
-			comp_err("failed to create renderer output");
-			assert(o->ro);
-		}
+		enable_output_render(o);
 		o->pending_mode = NULL;
 		o->switch_mode_pending = false;
 		o->disable_pending = false;
@@ -2316,7 +3222,7 @@ static s32 cb_compositor_switch_mode(struct compositor *comp, s32 pipe,
 {
 	struct cb_compositor *c = to_cb_c(comp);
 	struct cb_output *o;
-	s32 vid, i;
+	s32 i;
 
 	if (!comp || !mode || pipe < 0)
 		return -EINVAL;
@@ -2359,19 +3265,7 @@ static s32 cb_compositor_switch_mode(struct compositor *comp, s32 pipe,
 		/* update view port before show dummy */
 		update_crtc_view_port(o);
 		show_dummy(o);
-		o->native_surface = o->output->native_surface_create(o->output);
-		if (!o->native_surface) {
-			comp_err("failed to create native surface");
-			assert(o->native_surface);
-		}
-		o->ro = c->r->output_create(c->r, NULL, o->native_surface,
-					    (s32 *)(&c->native_fmt), 1, &vid,
-					    &o->desktop_rc,
-					    o->crtc_w, o->crtc_h, o->pipe);
-		if (!o->ro) {
-			comp_err("failed to create renderer output");
-			assert(o->ro);
-		}
+		enable_output_render(o);
 		o->pending_mode = NULL;
 		o->switch_mode_pending = false;
 		o->disable_pending = false;
@@ -2653,9 +3547,34 @@ static void idle_repaint(void *data)
 {
 	struct cb_output *output = data;
 	struct timespec ts, now, vbl2now;
+	struct vblank_seq vs;
 	s32 ret;
 
 	assert(output->repaint_status == REPAINT_START_FROM_IDLE);
+
+	/*
+	 * Anchor the first frame to the kernel's vblank time stamp.
+	 * If the last vblank is too old to extrapolate from, wait for the
+	 * next one.
+	 */
+	ret = output->output->get_vblank_seq(output->output, &vs);
+	if (!ret) {
+		output->repaint_status = REPAINT_WAIT_COMPLETION;
+		clock_gettime(output->c->clock_type, &now);
+		timespec_sub(&vbl2now, &now, &vs.ts);
+		if (timespec_to_nsec(&vbl2now) < output->output->refresh_nsec) {
+			schedule_repaint(output, &vs.ts);
+			return;
+		}
+		ret = output->output->queue_vblank_seq(output->output,
+						       vs.seq + 1);
+		if (!ret) {
+			output->vblank_seq_pending = true;
+			return;
+		}
+		output->repaint_status = REPAINT_START_FROM_IDLE;
+	}
+
 	ret = output->output->query_vblank(output->output, &ts);
 	if (!ret) {
 		clock_gettime(output->c->clock_type, &now);
@@ -2730,6 +3649,9 @@ static void cb_compositor_get_desktop_layout(struct compositor *comp,
 			sizeof(struct cb_rect));
 		memcpy(&layout->cfg[i].input_rc, &o->g_desktop_rc,
 			sizeof(struct cb_rect));
+		layout->cfg[i].transform = o->transform;
+		layout->cfg[i].render_scale = o->render_scale;
+		layout->cfg[i].render_scale_auto = o->render_scale_auto;
 		comp_notice("\t----- desktop[%d]: %d,%d %ux%u", i,
 			    layout->cfg[i].desktop_rc.pos.x,
 			    layout->cfg[i].desktop_rc.pos.y,
@@ -2810,6 +3732,8 @@ static void cb_compositor_set_desktop_layout(struct compositor *comp,
 	struct cb_rect *rc_src, *rc_dst, *rc_src_input, *rc_dst_input;
 	struct cb_compositor *c = to_cb_c(comp);
 	struct cb_output *o;
+	bool surface_changed;
+	u32 scale;
 
 	for (i = 0; i < layout->count_heads; i++) {
 		pipe = layout->cfg[i].pipe;
@@ -2839,13 +3763,56 @@ static void cb_compositor_set_desktop_layout(struct compositor *comp,
 			comp_notice("\t----- input[%d]: %d,%d %ux%u", pipe,
 				    rc_dst_input->pos.x, rc_dst_input->pos.y,
 				    rc_dst_input->w, rc_dst_input->h);
+			surface_changed = false;
+			if (layout->cfg[i].transform < CB_TRANSFORM_NR &&
+			    layout->cfg[i].transform != o->transform) {
+				comp_notice("\t----- rotation[%d]: %u -> %u",
+					    pipe, o->transform * 90,
+					    layout->cfg[i].transform * 90);
+				o->transform = layout->cfg[i].transform;
+				surface_changed = true;
+			}
+			if (layout->cfg[i].render_scale) {
+				scale = MIN(layout->cfg[i].render_scale,
+					    CB_RENDER_SCALE_MAX);
+				scale = MAX(scale, CB_RENDER_SCALE_MIN);
+				if (scale != o->render_scale) {
+					comp_notice("\t----- render scale[%d]: "
+						    "%u%% -> %u%%", pipe,
+						    o->render_scale, scale);
+					o->render_scale = scale;
+					surface_changed = true;
+				}
+			}
+			o->render_scale_auto = layout->cfg[i].render_scale_auto;
+			if (!o->render_scale_auto || surface_changed)
+				o->render_scale_cur = o->render_scale;
+			o->render_frames = 0;
 			update_crtc_view_port(o);
 			/* update renderer's layout */
-			if (o->enabled) {
+			if (o->ro) {
 				o->ro->layout_changed(o->ro, rc_dst,
-					      o->crtc_w, o->crtc_h);
+					      o->native_surface_src.w,
+					      o->native_surface_src.h);
+				o->renderable_buffer_changed = true;
 			}
-			if (layout->cfg[i].mode_handle) {
+			if (!layout->cfg[i].mode_handle &&
+			    !(layout->cfg[i].mr.w && layout->cfg[i].mr.h &&
+			      layout->cfg[i].mr.refresh &&
+			      layout->cfg[i].mr.pixel_freq) &&
+			    surface_changed && o->enabled) {
+				/*
+				 * renderer's surface and planes are rebuilt
+				 * by re-enabling the current mode.
+				 */
+				ret = cb_compositor_switch_mode(comp, pipe,
+					cb_compositor_get_current_timing(comp,
+									 pipe));
+				if (ret) {
+					comp_err("failed to rebuild renderer's "
+						 "surface");
+				}
+			} else if (layout->cfg[i].mode_handle) {
 				comp_notice("client request to switch mode");
 				ret = cb_compositor_switch_mode(comp, pipe,
 						layout->cfg[i].mode_handle);
@@ -2870,12 +3837,44 @@ static void cb_compositor_set_desktop_layout(struct compositor *comp,
 			break;
 		}
 	}
+	/* the new layout may be cloned again */
+	for (j = 0; j < c->count_outputs; j++)
+		c->outputs[j]->clone_rejected = NULL;
+	update_clone_outputs(c);
 	cb_compositor_repaint(c);
 
 	/* notify all client about the change */
 	broadcast_layout_changed_event(c);
 }
 
+static s32 set_mouse_cursor(struct cb_compositor *c, u64 hash,
+			    u8 *data, u32 width, u32 height, u32 stride,
+			    s32 hot_x, s32 hot_y, bool alpha_src_pre_mul)
+{
+	struct cb_output *o;
+	s32 i, slot;
+
+	c->mc_hot_pos.x = hot_x;
+	c->mc_hot_pos.y = hot_y;
+	c->mc_alpha_src_pre_mul = alpha_src_pre_mul;
+	for (i = 0; i < c->count_outputs; i++) {
+		o = c->outputs[i];
+		slot = mc_cache_get(o, hash, data, width, height, stride);
+		if (slot < 0) {
+			comp_err("[output: %d] failed to get cursor buffer",
+				 o->pipe);
+			continue;
+		}
+		/* a cached shape only swaps cursor fb */
+		o->mc_buf_next = slot;
+		o->mc_damaged = (slot != o->mc_buf_cur);
+		update_mc_view_port(o, false);
+		cb_compositor_repaint_by_output(o);
+	}
+
+	return 0;
+}
+
 static s32 cb_compositor_set_mouse_cursor(struct compositor *comp,
 					  u8 *data, u32 width, u32 height,
 					  u32 stride,
@@ -2883,9 +3882,6 @@ static s32 cb_compositor_set_mouse_cursor(struct compositor *comp,
 					  bool alpha_src_pre_mul)
 {
 	struct cb_compositor *c = to_cb_c(comp);
-	struct cb_buffer *buffer;
-	struct cb_output *o;
-	s32 i, work_index;
 
 	if (!data || !width || width > MC_MAX_WIDTH || !height ||
 	    height > MC_MAX_HEIGHT || !stride || !comp) {
@@ -2893,31 +3889,121 @@ static s32 cb_compositor_set_mouse_cursor(struct compositor *comp,
 		return -EINVAL;
 	}
 
-	c->mc_hot_pos.x = hot_x;
-	c->mc_hot_pos.y = hot_y;
-	c->mc_alpha_src_pre_mul = alpha_src_pre_mul;
-	for (i = 0; i < c->count_outputs; i++) {
-		o = c->outputs[i];
-		work_index = 1 - o->mc_buf_cur;
-		buffer = o->mc_buf[work_index];
-		scanout_buffer_dirty_init(buffer);
-		fill_cursor(c, buffer, data, width, height, stride);
-		o->mc_damaged = true;
-		update_mc_view_port(o, false);
-		cb_compositor_repaint_by_output(o);
+	return set_mouse_cursor(c, mc_hash(data, width, height, stride),
+				data, width, height, stride, hot_x, hot_y,
+				alpha_src_pre_mul);
+}
+
+static struct mc_shape *find_mc_shape(struct cb_compositor *c, void *owner,
+				      u32 id)
+{
+	struct mc_shape *shape;
+
+	list_for_each_entry(shape, &c->mc_shapes, link) {
+		if (shape->owner == owner && shape->id == id)
+			return shape;
 	}
 
-	return 0;
+	return NULL;
 }
 
-#define LONG_BITS (sizeof(long) * 8)
-#define NLONGS(x) (((x) + LONG_BITS - 1) / LONG_BITS)
-
-static enum input_type test_dev(const char *dev)
+static void cb_compositor_unregister_mouse_cursor(struct compositor *comp,
+						  void *owner, u32 id)
 {
-	s32 fd;
-	u8 evbit[EV_MAX/8 + 1];
-	char buffer[64];
+	struct cb_compositor *c = to_cb_c(comp);
+	struct mc_shape *shape, *next;
+
+	if (!comp)
+		return;
+
+	list_for_each_entry_safe(shape, next, &c->mc_shapes, link) {
+		if (shape->owner != owner)
+			continue;
+		if (id && shape->id != id)
+			continue;
+		list_del(&shape->link);
+		free(shape->data);
+		free(shape);
+	}
+}
+
+static s32 cb_compositor_register_mouse_cursor(struct compositor *comp,
+					       void *owner, u32 id,
+					       u8 *data, u32 width, u32 height,
+					       u32 stride,
+					       s32 hot_x, s32 hot_y,
+					       bool alpha_src_pre_mul)
+{
+	struct cb_compositor *c = to_cb_c(comp);
+	struct mc_shape *shape;
+	u32 i;
+
+	if (!comp || !id || !data || !width || width > MC_MAX_WIDTH ||
+	    !height || height > MC_MAX_HEIGHT || stride < width * 4) {
+		comp_err("illegal mc shape param");
+		return -EINVAL;
+	}
+
+	cb_compositor_unregister_mouse_cursor(comp, owner, id);
+
+	shape = calloc(1, sizeof(*shape));
+	if (!shape)
+		return -ENOMEM;
+
+	shape->data = malloc(width * height * 4);
+	if (!shape->data) {
+		free(shape);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < height; i++)
+		memcpy(shape->data + i * width * 4, data + i * stride,
+		       width * 4);
+
+	shape->owner = owner;
+	shape->id = id;
+	shape->width = width;
+	shape->height = height;
+	shape->hot_x = hot_x;
+	shape->hot_y = hot_y;
+	shape->alpha_src_pre_mul = alpha_src_pre_mul;
+	shape->hash = mc_hash(shape->data, width, height, width * 4);
+	list_add_tail(&shape->link, &c->mc_shapes);
+	comp_debug("register mc shape %u %ux%u hash %016lX", id, width,
+		   height, shape->hash);
+
+	return 0;
+}
+
+static s32 cb_compositor_select_mouse_cursor(struct compositor *comp,
+					     void *owner, u32 id)
+{
+	struct cb_compositor *c = to_cb_c(comp);
+	struct mc_shape *shape;
+
+	if (!comp)
+		return -EINVAL;
+
+	shape = find_mc_shape(c, owner, id);
+	if (!shape) {
+		comp_err("mc shape %u not found", id);
+		return -ENOENT;
+	}
+
+	return set_mouse_cursor(c, shape->hash, shape->data, shape->width,
+				shape->height, shape->width * 4,
+				shape->hot_x, shape->hot_y,
+				shape->alpha_src_pre_mul);
+}
+
+#define LONG_BITS (sizeof(long) * 8)
+#define NLONGS(x) (((x) + LONG_BITS - 1) / LONG_BITS)
+
+static enum input_type test_dev(const char *dev)
+{
+	s32 fd;
+	u8 evbit[EV_MAX/8 + 1];
+	char buffer[64];
 	u32 i;
 	u64 props[NLONGS(INPUT_PROP_CNT)];
 
@@ -4092,35 +5178,95 @@ static void touch_syn_proc(struct input_device *dev, struct input_event *event,
 	}
 }
 
+/*
+ * The panel is mounted with the output, map the normalized position on the
+ * panel's axis to the axis of the rotated desktop.
+ * return true if it is on desktop's x axis.
+ */
+static bool touch_rotate_pos(struct input_device *dev, bool x_axis, u16 *pos)
+{
+	struct cb_compositor *c = dev->c;
+	struct cb_output *o = c->outputs[c->touch_pipe];
+	u16 inv = 65535 - *pos;
+
+	switch (o->transform) {
+	case CB_TRANSFORM_90:
+		/* panel x -> desktop y, panel y -> desktop x inverted */
+		if (!x_axis)
+			*pos = inv;
+		return !x_axis;
+	case CB_TRANSFORM_180:
+		*pos = inv;
+		return x_axis;
+	case CB_TRANSFORM_270:
+		/* panel x -> desktop y inverted, panel y -> desktop x */
+		if (x_axis)
+			*pos = inv;
+		return !x_axis;
+	default:
+		return x_axis;
+	}
+}
+
+static void touch_st_pos(struct input_device *dev, bool x_axis, u16 pos)
+{
+	dev->ts.st_changed = true;
+	if (x_axis) {
+		dev->ts.st_x = pos;
+		if (dev->tinfo.type == ST_TOUCH) {
+			dev->ts.slots[0].pos_x_changed = true;
+			dev->ts.slots[0].pos_x = pos;
+			dev->ts.slots[0].commit_pending = true;
+		}
+	} else {
+		dev->ts.st_y = pos;
+		if (dev->tinfo.type == ST_TOUCH) {
+			dev->ts.slots[0].pos_y_changed = true;
+			dev->ts.slots[0].pos_y = pos;
+			dev->ts.slots[0].commit_pending = true;
+		}
+	}
+}
+
+static void touch_mt_pos(struct input_device *dev, bool x_axis, u16 pos)
+{
+	struct cb_compositor *c = dev->c;
+
+	dev->ts.last_slot->commit_pending = true;
+	if (x_axis) {
+		dev->ts.last_slot->pos_x = pos;
+		dev->ts.last_slot->pos_x_changed = true;
+	} else {
+		dev->ts.last_slot->pos_y = pos;
+		dev->ts.last_slot->pos_y_changed = true;
+	}
+	if (dev->ts.last_slot == &dev->ts.slots[0]) {
+		/*
+		 * calc desktop pos for touch
+		 * touch_pipe -> output
+		 */
+		touch_tpos(c, dev->ts.slots[0].pos_x,
+			   dev->ts.slots[0].pos_y,
+			   &dev->tpos, x_axis);
+	}
+}
+
 static void touch_abs_proc(struct input_device *dev, struct input_event *event)
 {
 	u16 gx, gy;
 	s32 i;
 	s16 pressed = -1;
-	struct cb_compositor *c = dev->c;
 
 	switch (event->code) {
 	case ABS_X:
 		touch_debug("EV_ABS ABS_X %d", event->value);
 		touch_pos_proc(dev, event->value, -1, &gx, NULL);
-		dev->ts.st_x = gx;
-		dev->ts.st_changed = true;
-		if (dev->tinfo.type == ST_TOUCH) {
-			dev->ts.slots[0].pos_x_changed = true;
-			dev->ts.slots[0].pos_x = gx;
-			dev->ts.slots[0].commit_pending = true;
-		}
+		touch_st_pos(dev, touch_rotate_pos(dev, true, &gx), gx);
 		break;
 	case ABS_Y:
 		touch_debug("EV_ABS ABS_Y %d", event->value);
 		touch_pos_proc(dev, -1, event->value, NULL, &gy);
-		dev->ts.st_y = gy;
-		dev->ts.st_changed = true;
-		if (dev->tinfo.type == ST_TOUCH) {
-			dev->ts.slots[0].pos_y_changed = true;
-			dev->ts.slots[0].pos_y = gy;
-			dev->ts.slots[0].commit_pending = true;
-		}
+		touch_st_pos(dev, touch_rotate_pos(dev, false, &gy), gy);
 		break;
 	case ABS_MT_TRACKING_ID:
 		touch_debug("EV_ABS ABS_MT_TRACKING_ID %08X", event->value);
@@ -4145,34 +5291,12 @@ static void touch_abs_proc(struct input_device *dev, struct input_event *event)
 	case ABS_MT_POSITION_X:
 		touch_debug("EV_ABS ABS_MT_POSITION_X %d", event->value);
 		touch_pos_proc(dev, event->value, -1, &gx, NULL);
-		dev->ts.last_slot->commit_pending = true;
-		dev->ts.last_slot->pos_x = gx;
-		dev->ts.last_slot->pos_x_changed = true;
-		if (dev->ts.last_slot == &dev->ts.slots[0]) {
-			/*
-			 * calc desktop pos for touch
-			 * touch_pipe -> output
-			 */
-			touch_tpos(c, dev->ts.slots[0].pos_x,
-				   dev->ts.slots[0].pos_y,
-				   &dev->tpos, true);
-		}
+		touch_mt_pos(dev, touch_rotate_pos(dev, true, &gx), gx);
 		break;
 	case ABS_MT_POSITION_Y:
 		touch_debug("EV_ABS ABS_MT_POSITION_Y %d", event->value);
 		touch_pos_proc(dev, -1, event->value, NULL, &gy);
-		dev->ts.last_slot->commit_pending = true;
-		dev->ts.last_slot->pos_y = gy;
-		dev->ts.last_slot->pos_y_changed = true;
-		if (dev->ts.last_slot == &dev->ts.slots[0]) {
-			/*
-			 * calc desktop pos for touch
-			 * touch_pipe -> output
-			 */
-			touch_tpos(c, dev->ts.slots[0].pos_x,
-				   dev->ts.slots[0].pos_y,
-				   &dev->tpos, false);
-		}
+		touch_mt_pos(dev, touch_rotate_pos(dev, false, &gy), gy);
 		break;
 	case ABS_MT_SLOT:
 		touch_debug("EV_ABS ABS_MT_SLOT %d", event->value);
@@ -4713,18 +5837,20 @@ err:
 	return -1;
 }
 
-static void add_renderer_buffer_to_task(struct cb_output *o,
-					struct cb_buffer *buffer)
+static struct scanout_task *
+add_renderer_buffer_to_task(struct cb_output *o, struct cb_buffer *buffer)
 {
 	struct scanout_task *sot;
 
-	sot = cb_cache_get(o->c->so_task_cache, false);
+	sot = cb_slab_get(o->c->so_task_cache, false);
 	sot->buffer = buffer;
 	sot->plane = o->primary_plane;
 	sot->zpos = -1;
 	sot->src = &o->native_surface_src;
-	sot->dst = &o->native_surface_src;
+	sot->dst = &o->native_surface_dst;
 	sot->alpha_src_pre_mul = true;
+	sot->alpha = PLANE_ALPHA_OPAQUE;
+	sot->transform = o->hw_transform ? o->transform : CB_TRANSFORM_NORMAL;
 	list_add_tail(&sot->link, &o->so_tasks);
 
 	if (sot->buffer == NULL) {
@@ -4740,6 +5866,8 @@ static void add_renderer_buffer_to_task(struct cb_output *o,
 			o->primary_occupied_by_renderer = true;
 		}
 	}
+
+	return sot;
 }
 
 static bool setup_view_output_mask(struct cb_view *view,
@@ -4777,7 +5905,7 @@ static bool setup_view_output_mask(struct cb_view *view,
 		if (!cb_region_is_not_empty(&view_area)) {
 			view->output_mask &= (~(1U << o->pipe));
 		} else {
-			if (view->direct_show) {
+			if (view->direct_show || view->blit) {
 				view->src_areas[pipe].pos.x =
 					view_area.extents.p1.x -
 					view->area.pos.x;
@@ -4797,20 +5925,23 @@ static bool setup_view_output_mask(struct cb_view *view,
 
 				view->dst_areas[pipe].pos.x = 
 				  (float)(view_area.extents.p1.x) *
-				  o->crtc_view_port.w / o->desktop_rc.w
-				  + o->crtc_view_port.pos.x;
+				  o->view_port.w / o->desktop_rc.w
+				  + o->view_port.pos.x;
 				view->dst_areas[pipe].pos.y =
 				  (float)(view_area.extents.p1.y) *
-				  o->crtc_view_port.h / o->desktop_rc.h
-				  + o->crtc_view_port.pos.y;
+				  o->view_port.h / o->desktop_rc.h
+				  + o->view_port.pos.y;
 				view->dst_areas[pipe].w =
 				  (float)(view_area.extents.p2.x -
 				          view_area.extents.p1.x) *
-				         o->crtc_view_port.w / o->desktop_rc.w;
+				         o->view_port.w / o->desktop_rc.w;
 				view->dst_areas[pipe].h =
 				  (float)(view_area.extents.p2.y -
 				          view_area.extents.p1.y) *
-				         o->crtc_view_port.h / o->desktop_rc.h;
+				         o->view_port.h / o->desktop_rc.h;
+				/* planes are rotated by the output transform */
+				output_transform_rect(o,
+						      &view->dst_areas[pipe]);
 				/*
 				printf("SRC [%d]: %d,%d %ux%u\n", o->pipe,
 					view->src_areas[pipe].pos.x,
@@ -4845,7 +5976,7 @@ static void surface_flipped_cb(struct cb_listener *listener, void *data)
 	if (view->painted) {
 		view->painted = false;
 		cancel_renderer_surface(surface, true);
-		client->send_bo_flipped(client, NULL, (u64)surface);
+		client->send_bo_flipped(client, NULL, surface->id);
 	}
 }
 
@@ -4904,6 +6035,235 @@ static void update_top_view_according_to_rm(struct cb_compositor *c,
 	}
 }
 
+static bool rect_overlap(struct cb_rect *a, struct cb_rect *b)
+{
+	if (a->pos.x >= b->pos.x + (s32)b->w || b->pos.x >= a->pos.x + (s32)a->w)
+		return false;
+	if (a->pos.y >= b->pos.y + (s32)b->h || b->pos.y >= a->pos.y + (s32)a->h)
+		return false;
+	return true;
+}
+
+/* check whether the view can be shown on an overlay by CPU copy */
+static bool blit_show_eligible(struct cb_view *view, struct cb_buffer *buffer,
+			       struct cb_output **output)
+{
+	struct cb_compositor *c = view->surface->c;
+	struct cb_output *o = NULL;
+	struct cb_view *v;
+	bool above = true;
+	s32 i;
+
+	if (buffer->info.type != CB_BUF_TYPE_SHM)
+		return false;
+	if (buffer->info.pix_fmt != CB_PIX_FMT_ARGB8888 &&
+	    buffer->info.pix_fmt != CB_PIX_FMT_XRGB8888)
+		return false;
+	if (buffer->info.width * buffer->info.height > BLIT_SHOW_MAX_PIXELS)
+		return false;
+	/* scaling is not done by CPU copy, alpha is left to the plane */
+	if (view->area.w != buffer->info.width ||
+	    view->area.h != buffer->info.height)
+		return false;
+
+	/* the view must be on one output */
+	for (i = 0; i < c->count_outputs; i++) {
+		if (!(view->output_mask & (1U << c->outputs[i]->pipe)))
+			continue;
+		if (o)
+			return false;
+		o = c->outputs[i];
+	}
+	if (!o || !o->enabled)
+		return false;
+
+	/*
+	 * overlay is above all rendered content, so no view above it may
+	 * overlap, and it must not be mixed with other planes.
+	 */
+	list_for_each_entry(v, &c->views, link) {
+		if (v == view) {
+			above = false;
+			continue;
+		}
+		if (!(v->output_mask & (1U << o->pipe)))
+			continue;
+		if (!rect_overlap(&v->area, &view->area))
+			continue;
+		if (above || v->direct_show || v->blit)
+			return false;
+	}
+
+	*output = o;
+	return true;
+}
+
+static s32 blit_show_start(struct cb_view *view, struct cb_output *o)
+{
+	struct cb_surface *surface = view->surface;
+	struct cb_compositor *c = surface->c;
+	struct cb_buffer *buffer = surface->buffer_pending;
+	struct cb_view_blit *blit;
+	struct cb_buffer_info info;
+	struct plane *plane;
+	s32 i;
+
+	plane = find_free_output_plane(o, buffer->info.pix_fmt, view->zpos,
+				       view->alpha < 1.0f);
+	if (!plane)
+		return -ENOSPC;
+
+	if ((o->view_port.w != o->desktop_rc.w ||
+	     o->view_port.h != o->desktop_rc.h) && !plane->scale_support)
+		return -EINVAL;
+
+	blit = calloc(1, sizeof(*blit));
+	if (!blit)
+		return -ENOMEM;
+
+	memset(&info, 0, sizeof(info));
+	info.pix_fmt = buffer->info.pix_fmt;
+	info.width = buffer->info.width;
+	info.height = buffer->info.height;
+	for (i = 0; i < 2; i++)
+		cb_region_init_rect(&blit->missed[i], 0, 0, info.width,
+				    info.height);
+	cb_region_init(&blit->tex_damage);
+	if (cb_tile_damage_init(&blit->tiles, info.width, info.height,
+				BLIT_DAMAGE_TILE_SHIFT) < 0) {
+		blit_destroy(c, blit);
+		return -ENOMEM;
+	}
+	INIT_LIST_HEAD(&blit->link);
+	for (i = 0; i < 2; i++) {
+		blit->bufs[i] = c->so->dumb_buffer_create(c->so, &info);
+		if (!blit->bufs[i]) {
+			blit_destroy(c, blit);
+			return -ENOMEM;
+		}
+	}
+
+	blit->output = o;
+	blit->plane = get_free_output_plane(o, plane);
+	blit->cur = -1;
+	view->blit = blit;
+	/* calculate plane's src / dst area */
+	setup_view_output_mask(view, c);
+
+	/* let the primary drop the surface */
+	o->renderable_buffer_changed = true;
+	comp_notice("blit surface %p (%ux%u) on output %d plane zpos %lu",
+		    surface, info.width, info.height, o->pipe, plane->zpos);
+
+	return 0;
+}
+
+static void blit_show_stop(struct cb_view *view, bool reupload)
+{
+	struct cb_view_blit *blit = view->blit;
+	struct cb_surface *surface = view->surface;
+	struct cb_client_agent *client = surface->client_agent;
+	struct cb_output *o = blit->output;
+
+	view->blit = NULL;
+	put_free_output_plane(o, blit->plane);
+
+	/* the renderer has to catch up with the pixels it missed */
+	if (reupload) {
+		cb_region_union(&surface->damage, &surface->damage,
+				&blit->tex_damage);
+		/* outside a commit the held buffer is the only source */
+		if (!surface->buffer_pending)
+			surface->c->r->flush_damage(surface->c->r, surface);
+	}
+
+	if (blit->complete_buf && blit->complete_buf != surface->buffer_pending)
+		client->send_bo_complete(client, blit->complete_buf,
+					 surface->id);
+	blit->complete_buf = NULL;
+
+	o->renderable_buffer_changed = true;
+	cb_compositor_repaint_by_output(o);
+	comp_notice("stop blitting surface %p on output %d", surface, o->pipe);
+
+	if (blit->cur < 0) {
+		blit_destroy(surface->c, blit);
+		return;
+	}
+
+	/* the buffer is on screen until the plane disabling commit flips */
+	blit->retire_flips = 2;
+	list_add_tail(&blit->link, &o->blit_retired);
+}
+
+/*
+ * return true if the commit is taken by the blit show, the damage is
+ * then consumed here instead of being uploaded to the renderer.
+ */
+static bool blit_show_commit(struct cb_view *view)
+{
+	struct cb_surface *surface = view->surface;
+	struct cb_buffer *buffer = surface->buffer_pending;
+	struct cb_client_agent *client = surface->client_agent;
+	struct cb_view_blit *blit = view->blit;
+	struct cb_output *o = NULL;
+	struct cb_region tiled, *damage;
+	CB_REGION_STORAGE(BLIT_DAMAGE_SCRATCH_BOXES) tiled_scratch;
+	s32 i;
+
+	if (!blit_show_eligible(view, buffer, &o)) {
+		view->small_commits = 0;
+		if (blit)
+			blit_show_stop(view, true);
+		return false;
+	}
+
+	if (blit && (blit->output != o ||
+		     blit->bufs[0]->info.pix_fmt != buffer->info.pix_fmt ||
+		     blit->bufs[0]->info.width != buffer->info.width ||
+		     blit->bufs[0]->info.height != buffer->info.height)) {
+		blit_show_stop(view, true);
+		blit = NULL;
+	}
+
+	if (!blit) {
+		if (++view->small_commits < BLIT_SHOW_PROMOTE_COMMITS)
+			return false;
+		if (blit_show_start(view, o) < 0)
+			return false;
+		blit = view->blit;
+	}
+
+	/*
+	 * scattered damage, round it to tiles before merging it three times,
+	 * the exact damage is merged if that fails.
+	 */
+	cb_region_init_with_scratch(&tiled, &tiled_scratch,
+				    ARRAY_SIZE(tiled_scratch.boxes));
+	damage = &surface->damage;
+	if (cb_region_count_boxes(damage) > BLIT_DAMAGE_MAX_BOXES) {
+		cb_tile_damage_add_region(&blit->tiles, damage);
+		if (!cb_tile_damage_to_region(&blit->tiles, &tiled))
+			damage = &tiled;
+		cb_tile_damage_clear(&blit->tiles);
+	}
+
+	for (i = 0; i < 2; i++)
+		cb_region_union(&blit->missed[i], &blit->missed[i], damage);
+	cb_region_union(&blit->tex_damage, &blit->tex_damage, damage);
+	cb_region_fini(&tiled);
+	cb_region_clear(&surface->damage);
+
+	/* the older buffer will not be copied any more */
+	if (blit->complete_buf && blit->complete_buf != buffer)
+		client->send_bo_complete(client, blit->complete_buf,
+					 surface->id);
+	blit->complete_buf = buffer;
+	blit->dirty = true;
+
+	return true;
+}
+
 static void cb_compositor_commit_surface(struct compositor *comp,
 					 struct cb_surface *surface)
 {
@@ -4912,6 +6272,8 @@ static void cb_compositor_commit_surface(struct compositor *comp,
 	struct cb_client_agent *client = surface->client_agent;
 	struct cb_output *o;
 	u32 mask, diff;
+	bool blitted = false;
+	s32 i;
 
 	comp_debug("commit surface %p's buffer %p", surface,
 		   surface->buffer_pending);
@@ -4922,6 +6284,13 @@ static void cb_compositor_commit_surface(struct compositor *comp,
 		/* remove view */
 		comp_notice("remove view link");
 		list_del(&view->link);
+		view->small_commits = 0;
+		if (view->blit)
+			blit_show_stop(view, false);
+		for (i = 0; i < c->count_outputs; i++) {
+			if (c->outputs[i]->bypass_view == view)
+				bypass_exit(c->outputs[i]);
+		}
 		cancel_renderer_surface(surface, true);
 		cb_compositor_repaint(c);
 	} else {
@@ -4945,8 +6314,12 @@ static void cb_compositor_commit_surface(struct compositor *comp,
 			c->r->attach_buffer(c->r, surface,
 					    surface->buffer_pending);
 		}
+
+		blitted = blit_show_commit(view);
+
 		/* DMA-BUF for renderer do not need to flush damage */
-		if (surface->buffer_pending->info.type == CB_BUF_TYPE_SHM) {
+		if (!blitted &&
+		    surface->buffer_pending->info.type == CB_BUF_TYPE_SHM) {
 			c->r->flush_damage(c->r, surface);
 		}
 
@@ -4963,12 +6336,24 @@ static void cb_compositor_commit_surface(struct compositor *comp,
 			cb_signal_add(&o->surface_flipped_signal,
 				      &surface->flipped_l);
 		}
-		cb_compositor_repaint(c);
+		if (blitted)
+			cb_compositor_repaint_by_output(view->blit->output);
+		else
+			cb_compositor_repaint(c);
 	}
 
-	set_renderable_buffer_changed(c, view, diff);
+	/* the primary's rendered buffer is reused by blitted surface */
+	if (!blitted || diff)
+		set_renderable_buffer_changed(c, view, diff);
 
-	client->send_bo_complete(client, surface->buffer_pending, (u64)surface);
+	/*
+	 * blitted buffer is completed when it is replaced or demoted,
+	 * directly scanned out buffer after it leaves screen.
+	 */
+	if (!blitted && !(surface->buffer_pending &&
+			  bypass_defer_complete(surface)))
+		client->send_bo_complete(client, surface->buffer_pending,
+					 surface->id);
 	surface->buffer_pending = NULL;
 }
 
@@ -4978,6 +6363,7 @@ static bool is_yuv(enum cb_pix_fmt pix_fmt)
 	case CB_PIX_FMT_NV12:
 	case CB_PIX_FMT_NV16:
 	case CB_PIX_FMT_NV24:
+	case CB_PIX_FMT_YUYV:
 		return true;
 	default:
 		return false;
@@ -4991,20 +6377,27 @@ static void add_dma_buf_to_task(struct cb_output *o, struct cb_surface *surface,
 	struct scanout_task *sot;
 	struct cb_view *view = surface->view;
 	bool find = false;
+	u16 alpha = PLANE_ALPHA_OPAQUE;
 
 	if (!plane)
 		return;
 
+	if (view->alpha <= 0.0f)
+		alpha = 0;
+	else if (view->alpha < 1.0f && plane->alpha_support)
+		alpha = (u16)(view->alpha * PLANE_ALPHA_OPAQUE + 0.5f);
+
 	list_for_each_entry(sot, &o->so_tasks, link) {
 		if (sot->plane == plane) {
 			find = true;
 			sot->buffer = buffer;
+			sot->alpha = alpha;
 			break;
 		}
 	}
 
 	if (!find) {
-		sot = cb_cache_get(c->so_task_cache, false);
+		sot = cb_slab_get(c->so_task_cache, false);
 		sot->buffer = buffer;
 		sot->plane = plane;
 		sot->zpos = view->zpos;
@@ -5017,6 +6410,9 @@ static void add_dma_buf_to_task(struct cb_output *o, struct cb_surface *surface,
 		}
 		sot->dst = &view->dst_areas[o->pipe];
 		sot->alpha_src_pre_mul = true;
+		sot->alpha = alpha;
+		/* the plane is chosen to support output's transform */
+		sot->transform = o->transform;
 		list_add_tail(&sot->link, &o->so_tasks);
 	}
 }
@@ -5236,6 +6632,8 @@ static void cb_compositor_release_rd_dmabuf(struct compositor *comp,
 	if (!b)
 		return;
 
+	bypass_forget_buffer(c, b);
+
 	return c->r->release_dmabuf(c->r, b);
 }
 
@@ -5259,72 +6657,351 @@ static void cb_compositor_release_so_dmabuf(struct compositor *comp,
 	}
 }
 
-static void cb_compositor_add_view(struct compositor *comp, struct cb_view *v)
+static void capture_destroy(struct cb_capture *cap)
 {
-	struct cb_compositor *c = to_cb_c(comp);
-	struct cb_view *top_view, *fv, *first_normal_view;
-	struct cb_client_agent *client;
+	struct cb_output *o;
+	struct cb_compositor *c;
+	s32 i;
 
-	if (!comp)
+	if (!cap)
 		return;
 
-	if (!v)
-		return;
+	o = cap->output;
+	c = o->c;
 
-	if (v->float_view) {
-		list_add(&v->link, &c->views);
-		return;
-	} else {
-		first_normal_view = NULL;
-		list_for_each_entry(fv, &c->views, link) {
-			if (!fv->float_view) {
-				first_normal_view = fv;
-				break;
-			}
-		}
-		if (first_normal_view) {
-			list_add(&v->link, first_normal_view->link.prev);
-		} else {
-			list_add_tail(&v->link, &c->views);
-		}
-	}
+	if (cap->timer)
+		cb_event_source_remove(cap->timer);
 
-	top_view = c->top_view;
-	c->top_view = v;
-	if (top_view != c->top_view) {
-		comp_notice("New top view: %lX -> %lX", (u64)top_view,
-			    (u64)c->top_view);
-		client = v->surface->client_agent;
-		client->send_view_focus_chg(client, v, true);
-		if (top_view) {
-			client = top_view->surface->client_agent;
-			client->send_view_focus_chg(client, top_view, false);
-		}
+	if (cap->done_l.notify)
+		cb_signal_rm(&cap->done_l);
+
+	/* detach writeback connector, take effect with the next commit */
+	o->output->capture_enable(o->output, false);
+
+	for (i = 0; i < cap->count; i++) {
+		if (cap->stages[i])
+			c->so->dumb_buffer_destroy(c->so, cap->stages[i]);
 	}
+
+	o->capture = NULL;
+	free(cap);
 }
 
-static void cb_compositor_rm_view(struct compositor *comp, struct cb_view *v)
+static void capture_done_cb(struct cb_listener *listener, void *data)
 {
-	struct cb_compositor *c = to_cb_c(comp);
+	struct cb_capture *cap = container_of(listener, struct cb_capture,
+					      done_l);
+	struct cb_buffer *b = data, *dst, *stage;
+	struct shm_buffer *shm;
+	u8 *src_p, *dst_p;
+	u32 row_sz, i;
+	s32 index;
 
-	if (!comp)
+	index = cap->inflight;
+	if (index < 0)
 		return;
 
-	if (v) {
-		list_del(&v->link);
-		update_top_view_according_to_rm(c, v);
+	dst = cap->buffers[index];
+	stage = cap->stages[index];
+	if (b != (stage ? stage : dst)) {
+		comp_err("[output: %d] unknown capture buffer %p",
+			 cap->output->pipe, b);
+		return;
 	}
 
-	v->surface->buffer_pending = NULL;
-	if (v->surface && v->surface->use_renderer)
-		cb_compositor_commit_surface(comp, v->surface);
-	else
-		cb_compositor_commit_dma_buf(comp, v->surface);
+	cap->inflight = -1;
+
+	if (stage) {
+		/* copy writeback result to SHM */
+		shm = container_of(dst, struct shm_buffer, base);
+		src_p = stage->info.maps[0];
+		dst_p = shm->shm.map;
+		row_sz = MIN(stage->info.strides[0], dst->info.strides[0]);
+		for (i = 0; i < dst->info.height; i++) {
+			memcpy(dst_p, src_p, row_sz);
+			src_p += stage->info.strides[0];
+			dst_p += dst->info.strides[0];
+		}
+	}
+
+	cap->seq++;
+	comp_debug("[output: %d] captured %p seq %lu", cap->output->pipe,
+		   dst, cap->seq);
+	cap->captured_cb(cap->userdata, cap->output->pipe, dst, cap->seq);
 }
 
-static void destroy_surface_fb_cb(struct cb_buffer *b, void *userdata)
+static s32 capture_timer_cb(void *data)
 {
-	struct cb_output *o = userdata;
+	struct cb_capture *cap = data;
+	struct cb_output *o = cap->output;
+	struct cb_buffer *b;
+	s32 i, ret;
+
+	if (cap->interval_ms)
+		cb_event_source_timer_update(cap->timer, cap->interval_ms, 0);
+	else
+		cb_event_source_timer_update(cap->timer, 0,
+					     o->output->refresh_nsec / 1000);
+
+	if (!o->enabled || cap->inflight >= 0)
+		return 0;
+
+	for (i = 0; i < cap->count; i++) {
+		if (!cap->busy[i])
+			break;
+	}
+
+	if (i == cap->count) {
+		comp_debug("[output: %d] all capture buffers are busy",
+			   o->pipe);
+		return 0;
+	}
+
+	if (cap->buffers[i]->info.width != o->crtc_w ||
+	    cap->buffers[i]->info.height != o->crtc_h) {
+		comp_debug("[output: %d] capture size mismatch %ux%u",
+			   o->pipe, o->crtc_w, o->crtc_h);
+		return 0;
+	}
+
+	b = cap->stages[i] ? cap->stages[i] : cap->buffers[i];
+	ret = o->output->capture(o->output, b);
+	if (ret < 0) {
+		if (ret != -EBUSY)
+			comp_err("[output: %d] capture failed %s", o->pipe,
+				 strerror(-ret));
+		return 0;
+	}
+
+	cap->busy[i] = true;
+	cap->inflight = i;
+
+	/* writeback job is committed with the next frame */
+	cb_compositor_repaint_by_output(o);
+
+	return 0;
+}
+
+static s32 cb_compositor_capture_start(struct compositor *comp, s32 pipe,
+				       struct cb_buffer **buffers, u32 count,
+				       u32 interval_ms, void *userdata,
+				       void (*captured_cb)(void *userdata,
+							   s32 pipe,
+							   struct cb_buffer *b,
+							   u64 seq))
+{
+	struct cb_compositor *c = to_cb_c(comp);
+	struct cb_buffer_info info;
+	struct cb_capture *cap;
+	struct cb_output *o;
+	s32 ret;
+	u32 i;
+
+	if (!comp || !buffers || !captured_cb)
+		return -EINVAL;
+
+	if (pipe < 0 || pipe >= c->count_outputs)
+		return -EINVAL;
+
+	if (!count || count > CB_CAPTURE_BO_MAX)
+		return -EINVAL;
+
+	o = c->outputs[pipe];
+	if (o->capture)
+		return -EBUSY;
+
+	if (!o->enabled)
+		return -ENODEV;
+
+	for (i = 0; i < count; i++) {
+		if (!buffers[i])
+			return -EINVAL;
+		if (buffers[i]->info.width != o->crtc_w ||
+		    buffers[i]->info.height != o->crtc_h) {
+			comp_err("[output: %d] capture buffer %ux%u "
+				 "!= %ux%u", pipe, buffers[i]->info.width,
+				 buffers[i]->info.height, o->crtc_w,
+				 o->crtc_h);
+			return -EINVAL;
+		}
+		/* composed DMA-BUF is not a scanout buffer */
+		if (buffers[i]->info.type == CB_BUF_TYPE_DMA &&
+		    buffers[i]->info.composed)
+			return -EINVAL;
+		if (buffers[i]->info.type != CB_BUF_TYPE_DMA &&
+		    buffers[i]->info.type != CB_BUF_TYPE_SHM)
+			return -EINVAL;
+	}
+
+	cap = calloc(1, sizeof(*cap));
+	if (!cap)
+		return -ENOMEM;
+
+	cap->output = o;
+	cap->count = count;
+	cap->inflight = -1;
+	cap->interval_ms = interval_ms;
+	cap->userdata = userdata;
+	cap->captured_cb = captured_cb;
+	o->capture = cap;
+
+	for (i = 0; i < count; i++) {
+		cap->buffers[i] = buffers[i];
+		if (buffers[i]->info.type != CB_BUF_TYPE_SHM)
+			continue;
+		/* display controller cannot write SHM, use staging bo */
+		memset(&info, 0, sizeof(info));
+		info.pix_fmt = buffers[i]->info.pix_fmt;
+		info.width = buffers[i]->info.width;
+		info.height = buffers[i]->info.height;
+		cap->stages[i] = c->so->dumb_buffer_create(c->so, &info);
+		if (!cap->stages[i]) {
+			ret = -ENOMEM;
+			goto err;
+		}
+	}
+
+	ret = o->output->capture_enable(o->output, true);
+	if (ret < 0) {
+		comp_err("[output: %d] no writeback connector", pipe);
+		goto err;
+	}
+
+	cap->done_l.notify = capture_done_cb;
+	o->output->add_capture_notify(o->output, &cap->done_l);
+
+	cap->timer = cb_event_loop_add_timer(c->loop, capture_timer_cb, cap);
+	if (!cap->timer) {
+		ret = -ENOMEM;
+		goto err;
+	}
+	/* the first frame attaches the writeback connector */
+	cb_event_source_timer_update(cap->timer, 1, 0);
+	cb_compositor_repaint_by_output(o);
+
+	comp_notice("[output: %d] capture started, %u bo(s), interval %u ms",
+		    pipe, count, interval_ms);
+	return 0;
+
+err:
+	capture_destroy(cap);
+	return ret;
+}
+
+static s32 cb_compositor_capture_release(struct compositor *comp, s32 pipe,
+					 struct cb_buffer *buffer)
+{
+	struct cb_compositor *c = to_cb_c(comp);
+	struct cb_capture *cap;
+	u32 i;
+
+	if (!comp || !buffer)
+		return -EINVAL;
+
+	if (pipe < 0 || pipe >= c->count_outputs)
+		return -EINVAL;
+
+	cap = c->outputs[pipe]->capture;
+	if (!cap)
+		return -ENOENT;
+
+	for (i = 0; i < cap->count; i++) {
+		if (cap->buffers[i] == buffer && i != cap->inflight) {
+			cap->busy[i] = false;
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+static void cb_compositor_capture_stop(struct compositor *comp, s32 pipe,
+				       void *userdata)
+{
+	struct cb_compositor *c = to_cb_c(comp);
+	struct cb_capture *cap;
+	s32 i;
+
+	if (!comp)
+		return;
+
+	for (i = 0; i < c->count_outputs; i++) {
+		if (pipe >= 0 && i != pipe)
+			continue;
+		cap = c->outputs[i]->capture;
+		if (!cap || cap->userdata != userdata)
+			continue;
+		comp_notice("[output: %d] capture stopped", i);
+		capture_destroy(cap);
+	}
+}
+
+static void cb_compositor_add_view(struct compositor *comp, struct cb_view *v)
+{
+	struct cb_compositor *c = to_cb_c(comp);
+	struct cb_view *top_view, *fv, *first_normal_view;
+	struct cb_client_agent *client;
+
+	if (!comp)
+		return;
+
+	if (!v)
+		return;
+
+	if (v->float_view) {
+		list_add(&v->link, &c->views);
+		return;
+	} else {
+		first_normal_view = NULL;
+		list_for_each_entry(fv, &c->views, link) {
+			if (!fv->float_view) {
+				first_normal_view = fv;
+				break;
+			}
+		}
+		if (first_normal_view) {
+			list_add(&v->link, first_normal_view->link.prev);
+		} else {
+			list_add_tail(&v->link, &c->views);
+		}
+	}
+
+	top_view = c->top_view;
+	c->top_view = v;
+	if (top_view != c->top_view) {
+		comp_notice("New top view: %lX -> %lX", (u64)top_view,
+			    (u64)c->top_view);
+		client = v->surface->client_agent;
+		client->send_view_focus_chg(client, v, true);
+		if (top_view) {
+			client = top_view->surface->client_agent;
+			client->send_view_focus_chg(client, top_view, false);
+		}
+	}
+}
+
+static void cb_compositor_rm_view(struct compositor *comp, struct cb_view *v)
+{
+	struct cb_compositor *c = to_cb_c(comp);
+
+	if (!comp)
+		return;
+
+	if (v) {
+		list_del(&v->link);
+		update_top_view_according_to_rm(c, v);
+	}
+
+	v->surface->buffer_pending = NULL;
+	if (v->surface && v->surface->use_renderer)
+		cb_compositor_commit_surface(comp, v->surface);
+	else
+		cb_compositor_commit_dma_buf(comp, v->surface);
+}
+
+static void destroy_surface_fb_cb(struct cb_buffer *b, void *userdata)
+{
+	struct cb_output *o = userdata;
 
 	if (!o)
 		return;
@@ -5339,7 +7016,7 @@ static void do_virtual_renderer_repaint(struct cb_output *o)
 {
 	struct cb_compositor *c = o->c;
 	struct cb_view *view;
-	struct r_output *ro = o->ro;
+	struct r_output *ro;
 	u32 ms, us;
 	u32 refresh_nsec;
 	bool repainted;
@@ -5351,6 +7028,9 @@ static void do_virtual_renderer_repaint(struct cb_output *o)
 		if (list_empty(&c->views)) {
 			goto out;
 		}
+		if (!acquire_output_render(o))
+			goto out;
+		ro = o->ro;
 		repainted = ro->repaint(ro, &c->views);
 		if (!repainted) {
 			o->rbuf_cur = NULL;
@@ -5376,21 +7056,394 @@ out:
 	o->renderable_buffer_changed = false;
 }
 
+/* import renderer's DMA-BUF into scanout once */
+static struct cb_buffer *bypass_import(struct cb_compositor *c,
+				       struct cb_buffer *buffer)
+{
+	struct bypass_buf *bb;
+	struct cb_buffer_info info;
+
+	list_for_each_entry(bb, &c->bypass_bufs, link) {
+		if (bb->rd_buf == buffer)
+			return bb->so_buf;
+	}
+
+	bb = calloc(1, sizeof(*bb));
+	if (!bb)
+		return NULL;
+	bb->rd_buf = buffer;
+
+	/* the renderer owns the fd, scanout closes its own copy */
+	info = buffer->info;
+	info.fd[0] = dup(buffer->info.fd[0]);
+	if (info.fd[0] >= 0) {
+		bb->so_buf = c->so->import_dmabuf(c->so, &info);
+		if (!bb->so_buf)
+			close(info.fd[0]);
+	}
+	if (!bb->so_buf)
+		comp_notice("DMA-BUF %p cannot be scanned out", buffer);
+	list_add_tail(&bb->link, &c->bypass_bufs);
+
+	return bb->so_buf;
+}
+
+/* find the single opaque fullscreen surface which can bypass composition */
+static struct cb_view *bypass_candidate(struct cb_output *o)
+{
+	struct cb_compositor *c = o->c;
+	struct cb_view *view, *found = NULL;
+	struct cb_buffer *buffer;
+
+	if (o->primary_renderer_disabled)
+		return NULL;
+
+	/* scaled or GL rotated output needs composition */
+	if (o->view_port.w != o->desktop_rc.w ||
+	    o->view_port.h != o->desktop_rc.h)
+		return NULL;
+	if (o->transform != CB_TRANSFORM_NORMAL && !o->hw_transform)
+		return NULL;
+
+	list_for_each_entry(view, &c->views, link) {
+		if (!(view->output_mask & (1U << o->pipe)))
+			continue;
+		/* shown on their own planes */
+		if (view->direct_show || view->blit)
+			continue;
+		if (found)
+			return NULL;
+		found = view;
+	}
+
+	if (!found)
+		return NULL;
+	if (found->output_mask != (1U << o->pipe))
+		return NULL;
+	if (found->alpha < 1.0f)
+		return NULL;
+	if (found->area.pos.x != o->desktop_rc.pos.x ||
+	    found->area.pos.y != o->desktop_rc.pos.y ||
+	    found->area.w != o->desktop_rc.w ||
+	    found->area.h != o->desktop_rc.h)
+		return NULL;
+
+	buffer = found->surface->buffer_cur;
+	if (!buffer || buffer->info.type != CB_BUF_TYPE_DMA ||
+	    !buffer->info.composed)
+		return NULL;
+	if (buffer->info.width != o->view_port.w ||
+	    buffer->info.height != o->view_port.h)
+		return NULL;
+	if (buffer->info.pix_fmt != CB_PIX_FMT_XRGB8888 &&
+	    !(buffer->info.pix_fmt == CB_PIX_FMT_ARGB8888 &&
+	      found->surface->is_opaque))
+		return NULL;
+	if (!primary_support_fmt(o, buffer->info.pix_fmt))
+		return NULL;
+
+	return found;
+}
+
+/* put the client buffer on primary plane, return false to compose */
+static bool do_bypass_repaint(struct cb_output *o)
+{
+	struct cb_compositor *c = o->c;
+	struct cb_view *view;
+	struct cb_buffer *buffer, *fb;
+	struct scanout_task *sot;
+
+	view = bypass_candidate(o);
+	if (!view) {
+		bypass_exit(o);
+		return false;
+	}
+
+	buffer = view->surface->buffer_cur;
+	fb = bypass_import(c, buffer);
+	if (!fb) {
+		bypass_exit(o);
+		return false;
+	}
+
+	if (o->bypass_view != view) {
+		bypass_exit(o);
+		comp_notice("output %d enters direct scanout", o->pipe);
+		o->bypass_view = view;
+	}
+
+	if (buffer != o->bypass_cur) {
+		bypass_retire(o, o->bypass_cur);
+		o->bypass_cur = buffer;
+	}
+	if (o->bypass_pending == buffer)
+		o->bypass_pending = NULL;
+
+	o->bypass_src.pos.x = 0;
+	o->bypass_src.pos.y = 0;
+	o->bypass_src.w = buffer->info.width;
+	o->bypass_src.h = buffer->info.height;
+
+	sot = cb_slab_get(c->so_task_cache, false);
+	sot->buffer = fb;
+	sot->plane = o->primary_plane;
+	sot->zpos = -1;
+	sot->src = &o->bypass_src;
+	sot->dst = &o->crtc_view_port;
+	sot->alpha_src_pre_mul = true;
+	sot->alpha = PLANE_ALPHA_OPAQUE;
+	sot->transform = o->transform;
+	list_add_tail(&sot->link, &o->so_tasks);
+	o->primary_occupied_by_renderer = true;
+
+	view->painted = true;
+	o->renderable_buffer_changed = false;
+
+	return true;
+}
+
+/* frames between two decisions of the render scale governor */
+#define RENDER_SCALE_PERIOD 30
+#define RENDER_SCALE_STEP 10
+
+/*
+ * Lower the render scale when composition takes more than 3/4 of the
+ * refresh period, raise it again below 2/5. GL fill cost follows the square
+ * of the scale, one step up does not cross the upper threshold.
+ */
+static void render_scale_governor(struct cb_output *o)
+{
+	u64 budget = o->output->refresh_nsec;
+	u32 scale = o->render_scale_cur;
+
+	if (!o->render_scale_auto || !o->primary_plane->scale_support)
+		return;
+
+	if (o->render_frames < RENDER_SCALE_PERIOD)
+		return;
+
+	if (o->render_nsec_avg > budget * 3 / 4) {
+		if (scale > CB_RENDER_SCALE_MIN + RENDER_SCALE_STEP)
+			scale -= RENDER_SCALE_STEP;
+		else
+			scale = CB_RENDER_SCALE_MIN;
+	} else if (o->render_nsec_avg < budget * 2 / 5) {
+		scale = MIN(scale + RENDER_SCALE_STEP, o->render_scale);
+	}
+	o->render_frames = 0;
+
+	if (scale == o->render_scale_cur)
+		return;
+
+	comp_notice("output %d render scale %u%% -> %u%% (%lu ns)",
+		    o->pipe, o->render_scale_cur, scale, o->render_nsec_avg);
+	o->render_scale_cur = scale;
+	update_render_size(o);
+	o->ro->layout_changed(o->ro, &o->desktop_rc,
+			      o->native_surface_src.w,
+			      o->native_surface_src.h);
+	o->renderable_buffer_changed = true;
+}
+
+static void render_scale_account(struct cb_output *o, struct timespec *start)
+{
+	struct timespec now, elapsed;
+	u64 nsec;
+
+	if (!o->render_scale_auto)
+		return;
+
+	clock_gettime(o->c->clock_type, &now);
+	timespec_sub(&elapsed, &now, start);
+	nsec = timespec_to_nsec(&elapsed);
+	/* moving average, the new sample weights 1/8 */
+	if (!o->render_frames)
+		o->render_nsec_avg = nsec;
+	else
+		o->render_nsec_avg = (o->render_nsec_avg * 7 + nsec) / 8;
+	o->render_frames++;
+}
+
+static bool clone_test(struct cb_output *o, struct cb_buffer *buffer)
+{
+	struct scanout *so = o->c->so;
+	struct scanout_commit_info commit;
+	s32 ret;
+
+	if (!so->test_scanout)
+		return true;
+
+	/* called from repaint, the frame arena is reset after the commit */
+	scanout_commit_info_init(&commit, o->c->frame_arena);
+	scanout_commit_add_fb_info(&commit, buffer, o->output, o->primary_plane,
+				   &o->clone_src, &o->native_surface_dst,
+				   -1, true);
+	ret = so->test_scanout(so, &commit);
+	scanout_commit_info_fini(&commit);
+
+	return !ret;
+}
+
+/*
+ * Scan out the part of the leader's renderable buffer showing this output's
+ * desktop. return false if the output has to render by itself.
+ */
+static bool do_clone_repaint(struct cb_output *o)
+{
+	struct cb_output *l = o->clone_leader;
+	struct cb_rect *rf = &o->desktop_rc, *rl;
+	struct cb_rect src;
+	struct scanout_task *sot;
+
+	if (!l)
+		return false;
+
+	if (!l->rbuf_cur || l->primary_renderer_disabled || l->bypass_view) {
+		/* nothing to share, render by itself until it comes back */
+		if (o->clone_shown) {
+			o->clone_shown = false;
+			o->renderable_buffer_changed = true;
+		}
+		return false;
+	}
+
+	/* the leader's render scale may change */
+	rl = &l->desktop_rc;
+	src.pos.x = (rf->pos.x - rl->pos.x) * l->native_surface_src.w / rl->w;
+	src.pos.y = (rf->pos.y - rl->pos.y) * l->native_surface_src.h / rl->h;
+	src.w = rf->w * l->native_surface_src.w / rl->w;
+	src.h = rf->h * l->native_surface_src.h / rl->h;
+	if (memcmp(&src, &o->clone_src, sizeof(src))) {
+		memcpy(&o->clone_src, &src, sizeof(src));
+		o->clone_tested = false;
+	}
+
+	if (!o->clone_tested) {
+		if (!clone_test(o, l->rbuf_cur)) {
+			comp_warn("output %d cannot scan out output %d's "
+				  "buffer, render by itself", o->pipe, l->pipe);
+			o->clone_rejected = l;
+			update_clone_outputs(o->c);
+			return false;
+		}
+		o->clone_tested = true;
+	}
+
+	sot = add_renderer_buffer_to_task(o, l->rbuf_cur);
+	sot->src = &o->clone_src;
+	sot->transform = CB_TRANSFORM_NORMAL;
+	o->clone_shown = true;
+	o->renderable_buffer_changed = false;
+
+	return true;
+}
+
+/* the bottom view is an opaque solid color covering the whole output */
+static struct cb_view *output_solid_background(struct cb_output *o)
+{
+	struct cb_view *view;
+	struct cb_buffer *buffer;
+	struct cb_rect *rc = &o->desktop_rc;
+
+	list_for_each_entry_reverse(view, &o->c->views, link) {
+		if (!(view->output_mask & (1U << o->pipe)))
+			continue;
+		if (view->direct_show || view->blit)
+			return NULL;
+		buffer = view->surface->buffer_cur;
+		if (!buffer || buffer->info.type != CB_BUF_TYPE_SOLID)
+			return NULL;
+		if (((buffer->info.color >> 24) & 0xFF) != 0xFF ||
+		    view->alpha < 1.0f)
+			return NULL;
+		if (view->area.pos.x > rc->pos.x ||
+		    view->area.pos.y > rc->pos.y ||
+		    view->area.pos.x + (s32)view->area.w <
+				rc->pos.x + (s32)rc->w ||
+		    view->area.pos.y + (s32)view->area.h <
+				rc->pos.y + (s32)rc->h)
+			return NULL;
+		return view;
+	}
+
+	return NULL;
+}
+
+/* let the CRTC fill the solid background if it can */
+static void update_crtc_background(struct cb_output *o)
+{
+	struct cb_view *view = output_solid_background(o);
+
+	o->bg_view = NULL;
+	if (view && !o->output->set_background_color(o->output,
+				view->surface->buffer_cur->info.color)) {
+		o->bg_view = view;
+		return;
+	}
+
+	/* composed or unsupported, restore the default */
+	o->output->set_background_color(o->output, 0xFF000000);
+}
+
+/* some view on the output is neither on a plane nor blitted */
+static bool output_needs_composition(struct cb_output *o)
+{
+	struct cb_view *view;
+
+	list_for_each_entry(view, &o->c->views, link) {
+		if (!(view->output_mask & (1U << o->pipe)))
+			continue;
+		if (view->direct_show || view->blit || view == o->bg_view)
+			continue;
+		return true;
+	}
+
+	return false;
+}
+
 static void do_renderer_repaint(struct cb_output *o)
 {
 	struct cb_compositor *c = o->c;
-	struct r_output *ro = o->ro;
+	struct r_output *ro;
 	struct cb_buffer *buffer;
+	struct timespec start;
 	bool repainted;
 
 	comp_debug("do_renderer_repaint %d", o->pipe);
 
+	o->bg_view = NULL;
 	if (o->primary_renderer_disabled) {
+		bypass_exit(o);
 		do_virtual_renderer_repaint(o);
 		return;
 	}
 
+	if (do_bypass_repaint(o))
+		return;
+
+	if (do_clone_repaint(o))
+		return;
+
+	update_crtc_background(o);
+	if (!output_needs_composition(o)) {
+		update_render_idle(o, true);
+		comp_debug("set output %d's rbuf_cur NULL", o->pipe);
+		o->rbuf_cur = NULL;
+		goto out;
+	}
+	update_render_idle(o, false);
+
+	if (!acquire_output_render(o)) {
+		o->rbuf_cur = NULL;
+		goto out;
+	}
+	ro = o->ro;
+
+	/* apply before the buffer is added to the task with its src */
+	render_scale_governor(o);
+
 	if (o->renderable_buffer_changed) {
+		clock_gettime(c->clock_type, &start);
 		if (list_empty(&c->views)) {
 			comp_debug("set output %d's rbuf_cur NULL", o->pipe);
 			o->rbuf_cur = NULL;
@@ -5415,6 +7468,7 @@ static void do_renderer_repaint(struct cb_output *o)
 		comp_debug("set output %d's rbuf_cur %p", o->pipe, buffer);
 		/* printf("set output %d's rbuf_cur %p\n", o->pipe, buffer); */
 		o->rbuf_cur = buffer;
+		render_scale_account(o, &start);
 	}/* else {
 		return;
 	}*/
@@ -5474,6 +7528,168 @@ static void do_dma_buf_repaint(struct cb_output *o)
 	}
 }
 
+/* copy damaged pixels of blitted surfaces and queue their overlays */
+static void do_blit_repaint(struct cb_output *o)
+{
+	struct cb_compositor *c = o->c;
+	struct cb_view *view;
+	struct cb_view_blit *blit;
+	struct cb_surface *surface;
+	struct cb_buffer *src, *dst;
+	struct cb_output *eo;
+	struct shm_buffer *shm;
+	struct cb_box *boxes;
+	u8 *src_p, *dst_p;
+	s32 i, j, count_boxes, back;
+	u32 row_sz;
+
+	list_for_each_entry_reverse(view, &c->views, link) {
+		blit = view->blit;
+		if (!blit || blit->output != o)
+			continue;
+		surface = view->surface;
+		/*
+		 * other views may have been raised, moved or put on planes
+		 * since it committed, let the renderer draw it this frame.
+		 */
+		if (!blit_show_eligible(view, surface->buffer_cur, &eo) ||
+		    eo != o) {
+			blit_show_stop(view, true);
+			continue;
+		}
+		if (blit->dirty) {
+			/*
+			 * repaint follows the flip, the buffer which is not
+			 * on screen is free now.
+			 */
+			back = blit->cur < 0 ? 0 : (blit->cur ^ 1);
+			src = surface->buffer_cur;
+			dst = blit->bufs[back];
+			shm = container_of(src, struct shm_buffer, base);
+			cb_region_intersect_rect(&blit->missed[back],
+						 &blit->missed[back], 0, 0,
+						 dst->info.width,
+						 dst->info.height);
+			boxes = cb_region_boxes(&blit->missed[back],
+						&count_boxes);
+			for (i = 0; i < count_boxes; i++) {
+				row_sz = (boxes[i].p2.x - boxes[i].p1.x) * 4;
+				src_p = (u8 *)shm->shm.map +
+					boxes[i].p1.y * src->info.strides[0] +
+					boxes[i].p1.x * 4;
+				dst_p = (u8 *)dst->info.maps[0] +
+					boxes[i].p1.y * dst->info.strides[0] +
+					boxes[i].p1.x * 4;
+				for (j = boxes[i].p1.y; j < boxes[i].p2.y; j++) {
+					memcpy(dst_p, src_p, row_sz);
+					src_p += src->info.strides[0];
+					dst_p += dst->info.strides[0];
+				}
+			}
+			cb_region_clear(&blit->missed[back]);
+			blit->cur = back;
+			blit->dirty = false;
+			view->painted = true;
+		}
+		add_dma_buf_to_task(o, surface, blit->bufs[blit->cur],
+				    blit->plane);
+	}
+}
+
+/* find a shared plane which is idle elsewhere and fits o's demand */
+static struct cb_plane_slot *plane_pool_find_idle(struct cb_compositor *c,
+						  struct cb_output *o,
+						  u32 starving)
+{
+	struct cb_plane_slot *slot;
+	struct cb_output *owner;
+	struct plane *plane;
+
+	list_for_each_entry(slot, &c->plane_pool, link) {
+		plane = slot->planes[o->pipe];
+		owner = slot->owner;
+		if (!plane || slot->target || owner == o)
+			continue;
+		if (o->plane_want_zpos != -1 &&
+		    plane->zpos != o->plane_want_zpos)
+			continue;
+		if (o->plane_want_alpha && !plane->alpha_support)
+			continue;
+		if (!plane_support_output_transform(o, plane))
+			continue;
+		if (!plane_support_fourcc(plane, o->plane_want_fourcc))
+			continue;
+		if (!owner)
+			return slot;
+		/* never take a plane from an output which lacks planes too */
+		if (starving & (1U << owner->pipe))
+			continue;
+		if (plane_is_free(owner, slot->planes[owner->pipe]))
+			return slot;
+	}
+
+	return NULL;
+}
+
+/*
+ * reassign shared planes at frame boundary.
+ *
+ * moving a plane between CRTCs takes two commits: the old owner disables
+ * it first, the new owner gets the plane after that commit completes.
+ */
+static void plane_pool_rebalance(struct cb_compositor *c)
+{
+	struct cb_plane_slot *slot;
+	struct cb_output *o, *owner;
+	struct plane *plane;
+	u32 starving = 0;
+	s32 i;
+
+	list_for_each_entry(slot, &c->plane_pool, link) {
+		o = slot->target;
+		if (!o)
+			continue;
+		plane = slot->planes[o->pipe];
+		if (o->output->acquire_plane(o->output, plane) < 0)
+			continue;
+		slot->owner = o;
+		slot->target = NULL;
+		put_free_output_plane(o, plane);
+		comp_notice("shared plane %u moved to output %d", slot->id,
+			    o->pipe);
+	}
+
+	for (i = 0; i < c->count_outputs; i++) {
+		o = c->outputs[i];
+		if (o->planes_wanted && o->enabled)
+			starving |= (1U << o->pipe);
+	}
+
+	for (i = 0; i < c->count_outputs; i++) {
+		o = c->outputs[i];
+		if (!(starving & (1U << o->pipe)))
+			continue;
+		slot = plane_pool_find_idle(c, o, starving);
+		if (!slot)
+			continue;
+		owner = slot->owner;
+		if (owner) {
+			plane = slot->planes[owner->pipe];
+			get_free_output_plane(owner, plane);
+			owner->output->release_plane(owner->output, plane);
+			slot->owner = NULL;
+			/* the release takes effect with the owner's commit */
+			cb_compositor_repaint_by_output(owner);
+			comp_notice("shared plane %u: output %d -> output %d",
+				    slot->id, owner->pipe, o->pipe);
+		}
+		slot->target = o;
+	}
+
+	for (i = 0; i < c->count_outputs; i++)
+		c->outputs[i]->planes_wanted = 0;
+}
+
 /* repaint timer proc */
 static s32 output_repaint_timer_handler(void *data)
 {
@@ -5481,13 +7697,18 @@ static s32 output_repaint_timer_handler(void *data)
 	struct cb_output *o;
 	struct scanout_task *sot, *sot_next;
 	s32 i;
-	struct scanout_commit_info *commit;
-	void *sd;
+	struct scanout_commit_info commit;
+	void *sd, *fb_info;
 	s64 msec_to_repaint;
 	struct timespec now;
 	bool output_empty, empty = true;
+#ifdef CUBE_ALLOC_DEBUG
+	s64 heap_allocs = cb_heap_alloc_count();
+#endif
 
-	commit = scanout_commit_info_alloc();
+	scanout_commit_info_init(&commit, c->frame_arena);
+
+	plane_pool_rebalance(c);
 
 	/*
 	 * deal with the output that has been scheduled repainting.
@@ -5497,12 +7718,19 @@ static s32 output_repaint_timer_handler(void *data)
 	 *     set repaint_status as REPAINT_WAIT_COMPLETION
 	 *         (waiting for page flip)
 	 */
-	for (i = 0; i < c->count_outputs; i++) {
-		o = c->outputs[i];
+	for (i = 0; i < c->count_outputs * 2; i++) {
+		o = c->outputs[i % c->count_outputs];
 		if (o->repaint_status != REPAINT_SCHEDULED) {
 			continue;
 		}
 
+		/*
+		 * clone leaders go first so that the followers show the buffer
+		 * rendered for this frame, the second pass picks up the rest.
+		 */
+		if (i < c->count_outputs && o->clone_leader)
+			continue;
+
 		clock_gettime(c->clock_type, &now);
 		msec_to_repaint = timespec_sub_to_msec(&o->next_repaint, &now);
 		if (msec_to_repaint > 1) {
@@ -5516,18 +7744,20 @@ static s32 output_repaint_timer_handler(void *data)
 
 		do_dma_buf_repaint(o);
 
+		do_blit_repaint(o);
+
 		/* do renderer's repaint */
 		do_renderer_repaint(o);
 
 		list_for_each_entry_safe(sot, sot_next, &o->so_tasks, link) {
 			list_del(&sot->link);
 			if (sot->buffer == NULL) {
-				cb_cache_put(sot, c->so_task_cache);
+				cb_slab_put(sot, c->so_task_cache);
 				continue;
 			}
 			output_empty = false;
 			empty = false;
-			scanout_commit_add_fb_info(commit,
+			fb_info = scanout_commit_add_fb_info(&commit,
 					   sot->buffer,
 					   o->output,
 					   sot->plane,
@@ -5535,15 +7765,22 @@ static s32 output_repaint_timer_handler(void *data)
 					   sot->dst,
 					   -1,
 					   sot->alpha_src_pre_mul);
-			cb_cache_put(sot, c->so_task_cache);
+			if (fb_info && sot->alpha != PLANE_ALPHA_OPAQUE)
+				scanout_commit_set_fb_alpha(fb_info,
+							    sot->alpha);
+			if (fb_info && sot->transform != CB_TRANSFORM_NORMAL)
+				scanout_commit_set_fb_transform(fb_info,
+							sot->transform);
+			cb_slab_put(sot, c->so_task_cache);
 		}
 
 		if (!c->mc_hide && o->mc_on_screen) {
 			if (o->mc_damaged) {
-				o->mc_buf_cur = 1 - o->mc_buf_cur;
+				o->mc_buf_prev = o->mc_buf_cur;
+				o->mc_buf_cur = o->mc_buf_next;
 				o->mc_damaged = false;
 			}
-			scanout_commit_add_fb_info(commit,
+			fb_info = scanout_commit_add_fb_info(&commit,
 				   o->mc_buf[o->mc_buf_cur],
 				   o->output,
 				   o->cursor_plane,
@@ -5551,12 +7788,18 @@ static s32 output_repaint_timer_handler(void *data)
 				   &o->mc_view_port,
 				   -1,
 				   c->mc_alpha_src_pre_mul);
+			set_mc_transform(o, fb_info);
 			output_empty = false;
 			empty = false;
 		}
 
-		if (output_empty) {
-			scanout_commit_add_fb_info(commit, o->dummy,
+		if (output_empty && o->bg_view) {
+			/* no plane at all, the CRTC fills the background */
+			scanout_commit_add_output(&commit, o->output);
+			output_empty = false;
+			empty = false;
+		} else if (output_empty) {
+			scanout_commit_add_fb_info(&commit, o->dummy,
 				o->output, o->primary_plane,
 				&o->dummy_src, &o->crtc_view_port,
 				0, true);
@@ -5573,10 +7816,17 @@ static s32 output_repaint_timer_handler(void *data)
 	}
 
 	sd = c->so->scanout_data_alloc(c->so);
-	c->so->fill_scanout_data(c->so, sd, commit);
+	c->so->fill_scanout_data(c->so, sd, &commit);
 	c->so->do_scanout(c->so, sd);
 out:
-	scanout_commit_info_free(commit);
+	scanout_commit_info_fini(&commit);
+	cb_arena_reset(c->frame_arena);
+
+#ifdef CUBE_ALLOC_DEBUG
+	heap_allocs = cb_heap_alloc_count() - heap_allocs;
+	if (heap_allocs)
+		comp_debug("repaint: %ld heap allocations", heap_allocs);
+#endif
 
 	update_repaint_timer(c);
 	return 0;
@@ -5718,7 +7968,8 @@ struct compositor *compositor_create(char *device_name,
 				     struct pipeline *pipecfgs,
 				     s32 count_outputs,
 				     s32 touch_pipe,
-				     float mc_accel)
+				     float mc_accel,
+				     u32 render_idle_msec)
 {
 	struct cb_compositor *c;
 	s32 i, vid;
@@ -5727,15 +7978,24 @@ struct compositor *compositor_create(char *device_name,
 	if (!c)
 		return NULL;
 
+	INIT_LIST_HEAD(&c->mc_shapes);
+	INIT_LIST_HEAD(&c->plane_pool);
+	INIT_LIST_HEAD(&c->bypass_bufs);
+
 	c->touch_pipe = touch_pipe;
 	c->mc_accel = mc_accel;
+	c->render_idle_msec = render_idle_msec;
 
 	c->loop = loop;
 
-	c->so_task_cache = cb_cache_create(sizeof(struct scanout_task), 128);
+	c->so_task_cache = cb_slab_create(sizeof(struct scanout_task), 128, 0);
 	if (!c->so_task_cache)
 		goto err;
 
+	c->frame_arena = cb_arena_create(4096);
+	if (!c->frame_arena)
+		goto err;
+
 	c->base.destroy = cb_compositor_destroy;
 
 	c->so = scanout_create(device_name, loop);
@@ -5822,6 +8082,9 @@ struct compositor *compositor_create(char *device_name,
 	c->base.import_so_dmabuf = cb_compositor_import_so_dmabuf;
 	c->base.release_rd_dmabuf = cb_compositor_release_rd_dmabuf;
 	c->base.release_so_dmabuf = cb_compositor_release_so_dmabuf;
+	c->base.capture_start = cb_compositor_capture_start;
+	c->base.capture_release = cb_compositor_capture_release;
+	c->base.capture_stop = cb_compositor_capture_stop;
 	c->base.add_view_to_comp = cb_compositor_add_view;
 	c->base.rm_view_from_comp = cb_compositor_rm_view;
 	c->base.dispatch_hotplug_event = cb_compositor_dispatch_hpd;
@@ -5843,6 +8106,9 @@ struct compositor *compositor_create(char *device_name,
 	c->base.hide_mouse_cursor = cb_compositor_hide_mouse_cursor;
 	c->base.show_mouse_cursor = cb_compositor_show_mouse_cursor;
 	c->base.set_mouse_cursor = cb_compositor_set_mouse_cursor;
+	c->base.register_mouse_cursor = cb_compositor_register_mouse_cursor;
+	c->base.unregister_mouse_cursor = cb_compositor_unregister_mouse_cursor;
+	c->base.select_mouse_cursor = cb_compositor_select_mouse_cursor;
 	c->base.add_client = cb_compositor_add_client;
 	c->base.init_client_dbg = cb_compositor_init_client_dbg;
 	c->base.rm_client = cb_compositor_rm_client;
@@ -27,10 +27,12 @@
 #include <cube_signal.h>
 #include <cube_region.h>
 #include <cube_protocal.h>
-#include <cube_client_agent.h>
 
+/* used by client agent as well */
 #define MAX_NR_OUTPUTS 32
 
+#include <cube_client_agent.h>
+
 struct cb_buffer {
 	struct cb_buffer_info info;
 	struct cb_signal destroy_signal;
@@ -49,8 +51,8 @@ struct cb_buffer {
 	 */
 	u32 dirty;
 
-	/* link to client's buffer list */
-	struct list_head link;
+	/* handle in the client agent's buffer table, the bo ID on the wire */
+	u64 id;
 
 	struct cb_surface *surface;
 
@@ -73,6 +75,7 @@ struct pipeline {
 };
 
 struct compositor;
+struct cb_view_blit;
 
 struct cb_surface {
 	struct cb_compositor *c;
@@ -101,6 +104,8 @@ struct cb_surface {
 	struct cb_buffer *buffer_last;
 
 	bool is_opaque;
+	/* the buffer is repeated over the whole view from its origin */
+	bool tiled;
 	struct cb_signal destroy_signal;
 
 	/* where it should to be displayed */
@@ -130,14 +135,17 @@ struct cb_surface {
 	struct cb_output *output; /* the output generate vblank signal */
 	/************************************************************/
 
-	/* link to client agent */
-	struct list_head link;
+	/* handle in the client agent's surface table, the ID on the wire */
+	u64 id;
 };
 
 struct cb_view {
 	/* link to surface */
 	struct cb_surface *surface;
 
+	/* handle in the client agent's view table, the ID on the wire */
+	u64 id;
+
 	bool direct_show;
 
 	/* link to compositor's view list */
@@ -172,6 +180,14 @@ struct cb_view {
 
 	bool painted;
 
+	/*
+	 * small SHM surface copied into compositor's dumb buffers and shown
+	 * on an overlay plane, the renderer skips it. NULL if not.
+	 */
+	struct cb_view_blit *blit;
+	/* count of successive commits which could be blitted */
+	u32 small_commits;
+
 	/* for float view: server do not send focus on / lost message */
 	bool float_view;
 
@@ -332,6 +348,23 @@ struct compositor {
 				s32 hot_x, s32 hot_y,
 				bool alpha_blended);
 
+	/*
+	 * register mouse cursor shape, only ARGB is supported.
+	 * the shape is identified by (owner, id), id must not be 0.
+	 */
+	s32 (*register_mouse_cursor)(struct compositor *c, void *owner, u32 id,
+				     u8 *data, u32 width, u32 height,
+				     u32 stride,
+				     s32 hot_x, s32 hot_y,
+				     bool alpha_blended);
+
+	/* unregister mouse cursor shape, id 0 means all shapes of owner */
+	void (*unregister_mouse_cursor)(struct compositor *c, void *owner,
+					u32 id);
+
+	/* set mouse cursor shape by registered id */
+	s32 (*select_mouse_cursor)(struct compositor *c, void *owner, u32 id);
+
 	/* write keyboard led status */
 	void (*set_kbd_led_status)(struct compositor *c, u32 led_status);
 	
@@ -363,6 +396,33 @@ struct compositor {
 	/* release direct show DMA-BUF */
 	void (*release_so_dmabuf)(struct compositor *c,
 				  struct cb_buffer *buffer);
+
+	/*
+	 * Start capturing output by writeback.
+	 * 	buffers: SHM buffers or direct show DMA-BUF buffers in the size
+	 * 	         of the output's current video timing.
+	 * 	interval_ms: capture interval, 0 means once per refresh.
+	 * 	captured_cb: called when a buffer is filled with a new frame,
+	 * 	             the buffer is not written again until it is
+	 * 	             released by capture_release.
+	 * Only one capture session is supported per output.
+	 */
+	s32 (*capture_start)(struct compositor *c, s32 pipe,
+			     struct cb_buffer **buffers, u32 count,
+			     u32 interval_ms, void *userdata,
+			     void (*captured_cb)(void *userdata, s32 pipe,
+						 struct cb_buffer *buffer,
+						 u64 seq));
+
+	/* give the captured buffer back to the capture session */
+	s32 (*capture_release)(struct compositor *c, s32 pipe,
+			       struct cb_buffer *buffer);
+
+	/*
+	 * Stop capturing output.
+	 * pipe < 0 means stopping all capture sessions started by userdata.
+	 */
+	void (*capture_stop)(struct compositor *c, s32 pipe, void *userdata);
 };
 
 /* compositor creator */
@@ -371,7 +431,8 @@ struct compositor *compositor_create(char *device_name,
 				     struct pipeline *pipecfgs,
 				     s32 count_outputs,
 				     s32 touch_pipe,
-				     float mc_accel);
+				     float mc_accel,
+				     u32 render_idle_msec);
 
 #endif
 
@@ -40,6 +40,12 @@ struct r_output {
 	void (*layout_changed)(struct r_output *o,
 			       struct cb_rect *render_area,
 			       u32 disp_w, u32 disp_h);
+
+	/*
+	 * compose rotated (enum cb_output_transform), used when the plane
+	 * cannot rotate the output.
+	 */
+	void (*set_transform)(struct r_output *o, u32 transform);
 };
 
 struct renderer {
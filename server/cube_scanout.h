@@ -45,6 +45,12 @@ struct cb_mode {
 	bool preferred;
 };
 
+/* vblank sequence and its time stamp (scanout's clock) */
+struct vblank_seq {
+	u64 seq;
+	struct timespec ts;
+};
+
 struct fb_info {
 	struct cb_buffer *buffer;
 	struct output *output;
@@ -52,11 +58,22 @@ struct fb_info {
 	struct cb_rect src, dst;
 	s32 zpos;
 	bool alpha_src_pre_mul;
+	/* plane alpha, 0 (transparent) - PLANE_ALPHA_OPAQUE */
+	u16 alpha;
+	/*
+	 * enum cb_output_transform, rotation done by the plane. src is in
+	 * buffer coordinates, dst in crtc coordinates after rotation.
+	 */
+	u32 transform;
 	struct list_head link;
 };
 
+#define PLANE_ALPHA_OPAQUE 0xFFFF
+
 struct scanout_commit_info {
 	struct list_head fb_commits;
+	/* fb infos are allocated from this frame arena if set */
+	void *arena;
 };
 
 /* commit info helper functions */
@@ -65,6 +82,12 @@ void scanout_set_buffer_dirty(struct cb_buffer *buffer, struct output *output);
 bool scanout_clr_buffer_dirty(struct cb_buffer *buffer, struct output *output);
 
 struct scanout_commit_info *scanout_commit_info_alloc(void);
+/*
+ * set up a commit info owned by the caller, fb infos live in arena until it
+ * is reset, fini is not needed in that case.
+ */
+void scanout_commit_info_init(struct scanout_commit_info *commit, void *arena);
+void scanout_commit_info_fini(struct scanout_commit_info *commit);
 void *scanout_commit_add_fb_info(struct scanout_commit_info *commit,
 				 struct cb_buffer *buffer,
 				 struct output *output,
@@ -73,6 +96,9 @@ void *scanout_commit_add_fb_info(struct scanout_commit_info *commit,
 				 struct cb_rect *dst,
 				 s32 zpos,
 				 bool alpha_src_pre_mul);
+/* commit the output without any plane, the CRTC shows background color */
+void *scanout_commit_add_output(struct scanout_commit_info *commit,
+				struct output *output);
 void scanout_commit_mod_fb_info(struct scanout_commit_info *commit,
 				void *fb_info,
 				struct cb_buffer *buffer,
@@ -82,6 +108,10 @@ void scanout_commit_mod_fb_info(struct scanout_commit_info *commit,
 				struct cb_rect *dst,
 				s32 zpos,
 				bool alpha_src_pre_mul);
+/* the fb is opaque unless alpha is set, the plane must support alpha */
+void scanout_commit_set_fb_alpha(void *fb_info, u16 alpha);
+/* the fb is not rotated unless set, the plane must support the transform */
+void scanout_commit_set_fb_transform(void *fb_info, u32 transform);
 void scanout_commit_info_free(struct scanout_commit_info *commit);
 
 /* a output represent a LCDC/CRTC */
@@ -154,8 +184,12 @@ struct output {
 	/* disable video output, may be because the monitor is unpluged. */
 	s32 (*disable)(struct output *o);
 
-	/* create native surface for renderer */
-	void *(*native_surface_create)(struct output *o);
+	/*
+	 * create native surface for renderer. the size may differ from the
+	 * current mode, when the surface is shown by a plane which is
+	 * rotated 90 / 270 degree or scales it up.
+	 */
+	void *(*native_surface_create)(struct output *o, u32 width, u32 height);
 
 	/* destroy native surface */
 	void (*native_surface_destroy)(struct output *o, void *surface);
@@ -165,6 +199,65 @@ struct output {
 
 	/* query vblank */
 	s32 (*query_vblank)(struct output *o, struct timespec *ts);
+
+	/*
+	 * writeback capture
+	 *
+	 * capture_enable: attach (or detach) a writeback connector to the
+	 *                 output's CRTC, it takes effect with the next commit.
+	 *                 return -ENODEV if there is no writeback connector
+	 *                 for the output.
+	 * capture: write the next committed frame back into buffer.
+	 *          buffer must be a scanout buffer (dumb buffer or direct show
+	 *          DMA-BUF) in the size of the current mode.
+	 *          return -EBUSY if a capture is still in progress.
+	 * add_capture_notify: the listener is notified with the buffer when
+	 *                     the writeback job completes.
+	 */
+	s32 (*capture_enable)(struct output *o, bool en);
+	s32 (*capture)(struct output *o, struct cb_buffer *buffer);
+	s32 (*add_capture_notify)(struct output *o, struct cb_listener *l);
+
+	/*
+	 * vblank sequence
+	 *
+	 * get_vblank_seq: get current vblank sequence and time stamp.
+	 * queue_vblank_seq: request an event at vblank sequence seq
+	 *                   (absolute), the listener is notified with
+	 *                   struct vblank_seq.
+	 * both return -ENOTSUP if the backend does not support it.
+	 */
+	s32 (*get_vblank_seq)(struct output *o, struct vblank_seq *vs);
+	s32 (*queue_vblank_seq)(struct output *o, u64 seq);
+	s32 (*add_vblank_seq_notify)(struct output *o, struct cb_listener *l);
+
+	/*
+	 * shared overlay plane ownership
+	 *
+	 * an overlay plane reported by several outputs must be owned by only
+	 * one of them at a time. it is owned by nobody after pipeline
+	 * creation.
+	 *
+	 * acquire_plane: take the ownership of plane for this output.
+	 *                return -EBUSY if another output still owns the plane
+	 *                or has not committed its release yet.
+	 * release_plane: give up the ownership. the plane is disabled on this
+	 *                CRTC by the next commit of the output, it can be
+	 *                acquired by another output after that commit
+	 *                completes.
+	 */
+	s32 (*acquire_plane)(struct output *o, struct plane *plane);
+	void (*release_plane)(struct output *o, struct plane *plane);
+
+	/*
+	 * background color
+	 *
+	 * set_background_color: the CRTC shows the ARGB8888 color where no
+	 *                       plane covers the screen, it takes effect with
+	 *                       the next commit.
+	 *                       return -ENOTSUP if the CRTC cannot fill it.
+	 */
+	s32 (*set_background_color)(struct output *o, u32 argb);
 };
 
 enum dpms_state {
@@ -232,6 +325,17 @@ struct plane {
 	/* the sink of this plane */
 	struct output *output;
 
+	/*
+	 * hardware plane id. a plane which can be attached to several CRTCs
+	 * is reported once per output, all the copies share the same id.
+	 */
+	u32 id;
+	/* bit mask of output index the plane can be attached to */
+	u32 possible_outputs;
+
+	/* bit mask of (1 << enum cb_output_transform) done by hardware */
+	u32 transforms;
+
 	/* input pixel format supported */
 	s32 count_formats;
 	u32 *formats;
@@ -267,6 +371,14 @@ struct scanout {
 	/* commit user settings to scanout */
 	void (*do_scanout)(struct scanout *so, void *scanout_data);
 
+	/*
+	 * check whether the planes in commit can be shown on their outputs'
+	 * current configuration, nothing is committed.
+	 * returns 0 if the kernel accepts it.
+	 */
+	s32 (*test_scanout)(struct scanout *so,
+			    struct scanout_commit_info *commit);
+
 	/* get native device */
 	void *(*get_native_dev)(struct scanout *so);
 
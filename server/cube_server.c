@@ -48,6 +48,9 @@
 #define MAIN_ARG_MAX_NR 16
 #define MAIN_ARG_MAX_LEN 128
 
+/* release renderer's surface of an output after 3s without composition */
+#define RENDER_IDLE_MSEC_DEF 3000
+
 static enum cb_log_level serv_dbg = CB_LOG_DEBUG;
 
 #define serv_debug(fmt, ...) do { \
@@ -76,7 +79,7 @@ static enum cb_log_level serv_dbg = CB_LOG_DEBUG;
 	cb_tlog("[SERV][ERROR ] " fmt, ##__VA_ARGS__); \
 } while (0);
 
-static char short_options[] = "bhs:d:t:a:l:";
+static char short_options[] = "bhs:d:t:a:l:r:";
 
 static struct option long_options[] = {
 	{"background", 0, NULL, 'b'},
@@ -86,6 +89,7 @@ static struct option long_options[] = {
 	{"touch-pipe", 1, NULL, 't'},
 	{"mc-accel", 1, NULL, 'a'},
 	{"logo", 1, NULL, 'l'},
+	{"render-idle", 1, NULL, 'r'},
 	{NULL, 0, NULL, 0},
 };
 
@@ -146,6 +150,9 @@ static void usage(void)
 	printf("\t\t-t, --touch-pipe=pipe number, touch screen index.\n");
 	printf("\t\t-a, --mc-accel=mouse accelerator, default 1.0.\n");
 	printf("\t\t-p, --logo=24bit bmp logo file, default no logo\n");
+	printf("\t\t-r, --render-idle=ms, release renderer's surface after "
+	       "ms without composition, 0 never, default %u.\n",
+	       RENDER_IDLE_MSEC_DEF);
 }
 
 struct child_process {
@@ -537,7 +544,7 @@ static s32 comp_destroy_delayed_proc(void *data)
 }
 
 static struct cb_server *cb_server_create(s32 seat, char *dev, s32 touch_pipe,
-					  float mc_accel)
+					  float mc_accel, u32 render_idle_msec)
 {
 	struct cb_server *server;
 	char name[64];
@@ -595,7 +602,7 @@ static struct cb_server *cb_server_create(s32 seat, char *dev, s32 touch_pipe,
 
 	server->disp_nr = pipe_nr;
 	server->c = compositor_create(dev, server->loop, pipe_cfg, pipe_nr,
-				      touch_pipe, mc_accel);
+				      touch_pipe, mc_accel, render_idle_msec);
 	if (!server->c)
 		goto err;
 
@@ -625,6 +632,7 @@ s32 main(s32 argc, char **argv)
 	s32 seat = 0;
 	s32 touch_pipe = 0;
 	float mc_accel = 1.0f;
+	u32 render_idle_msec = RENDER_IDLE_MSEC_DEF;
 	char log_argv0[MAIN_ARG_MAX_LEN];
 	char log_argv2[MAIN_ARG_MAX_LEN];
 	char *log_argv[MAIN_ARG_MAX_NR] = {NULL};
@@ -632,6 +640,7 @@ s32 main(s32 argc, char **argv)
 	char *p;
 	char touch_pipe_s[MAIN_ARG_MAX_LEN];
 	char mc_accel_s[MAIN_ARG_MAX_LEN];
+	char render_idle_s[MAIN_ARG_MAX_LEN];
 	char processdir[MAIN_ARG_MAX_LEN];
 	char *desktop_argv[MAIN_ARG_MAX_NR] = {NULL};
 	char desktop_argv0[MAIN_ARG_MAX_LEN] = {0};
@@ -662,6 +671,9 @@ s32 main(s32 argc, char **argv)
 		case 'a':
 			mc_accel = atof(optarg);
 			break;
+		case 'r':
+			render_idle_msec = atoi(optarg);
+			break;
 		case 'l':
 			strcpy(desktop_argv1, "-l");
 			strcpy(desktop_argv2, optarg);
@@ -700,15 +712,20 @@ s32 main(s32 argc, char **argv)
 		memset(mc_accel_s, 0, MAIN_ARG_MAX_LEN);
 		sprintf(mc_accel_s, "%1.1f", mc_accel);
 		server_argv[8] = mc_accel_s;
-		server_argv[9] = NULL;
+		server_argv[9] = "-r";
+		memset(render_idle_s, 0, MAIN_ARG_MAX_LEN);
+		sprintf(render_idle_s, "%u", render_idle_msec);
+		server_argv[10] = render_idle_s;
+		server_argv[11] = NULL;
 		desktop_argv[0] = desktop_argv0;
 		desktop_argv[1] = desktop_argv1;
 		desktop_argv[2] = desktop_argv2;
-		run_background(3, log_argv, 9, server_argv,
+		run_background(3, log_argv, 11, server_argv,
 			       desktop_argc, desktop_argv);
 	}
 
-	server = cb_server_create(seat, device_name, touch_pipe, mc_accel);
+	server = cb_server_create(seat, device_name, touch_pipe, mc_accel,
+				  render_idle_msec);
 	if (!server)
 		goto err;
 
@@ -28,6 +28,8 @@
 #include <unistd.h>
 #include <assert.h>
 #include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
 #include <libudev.h>
 #include <stdint.h>
 #include <inttypes.h>
@@ -38,7 +40,8 @@
 #include <gbm.h>
 #include <cube_utils.h>
 #include <cube_event.h>
-#include <cube_cache.h>
+#include <cube_slab.h>
+#include <cube_arena.h>
 #include <cube_log.h>
 #include <cube_compositor.h>
 #include <cube_scanout.h>
@@ -46,6 +49,59 @@
 #define USE_DRM_PRIME 1
 #define PRESET_MODE_CFG "/etc/preset_mode.cfg"
 
+/* old libdrm headers do not know writeback connectors */
+#ifndef DRM_CLIENT_CAP_WRITEBACK_CONNECTORS
+#define DRM_CLIENT_CAP_WRITEBACK_CONNECTORS 5
+#endif
+
+#ifndef DRM_MODE_CONNECTOR_WRITEBACK
+#define DRM_MODE_CONNECTOR_WRITEBACK 18
+#endif
+
+/* old kernel headers do not know CLOSEFB ioctl */
+#ifndef DRM_IOCTL_MODE_CLOSEFB
+struct drm_mode_closefb {
+	__u32 fb_id;
+	__u32 pad;
+};
+
+#define DRM_IOCTL_MODE_CLOSEFB DRM_IOWR(0xD0, struct drm_mode_closefb)
+#endif
+
+/* old kernel headers do not know CRTC sequence ioctls */
+#ifndef DRM_IOCTL_CRTC_GET_SEQUENCE
+struct drm_crtc_get_sequence {
+	__u32 crtc_id;
+	__u32 active;
+	__u64 sequence;
+	__s64 sequence_ns;
+};
+
+#define DRM_CRTC_SEQUENCE_RELATIVE 0x00000001
+#define DRM_CRTC_SEQUENCE_NEXT_ON_MISS 0x00000002
+
+struct drm_crtc_queue_sequence {
+	__u32 crtc_id;
+	__u32 flags;
+	__u64 sequence;
+	__u64 user_data;
+};
+
+#define DRM_EVENT_CRTC_SEQUENCE 0x03
+
+struct drm_event_crtc_sequence {
+	struct drm_event base;
+	__u64 user_data;
+	__s64 time_ns;
+	__u64 sequence;
+};
+
+#define DRM_IOCTL_CRTC_GET_SEQUENCE \
+	DRM_IOWR(0x3b, struct drm_crtc_get_sequence)
+#define DRM_IOCTL_CRTC_QUEUE_SEQUENCE \
+	DRM_IOWR(0x3c, struct drm_crtc_queue_sequence)
+#endif
+
 /* static enum cb_log_level drm_dbg = CB_LOG_DEBUG; */
 static enum cb_log_level drm_dbg = CB_LOG_NOTICE;
 
@@ -225,6 +281,8 @@ enum {
 	PLANE_PROP_GLOBAL_ALPHA,
 	PLANE_PROP_BLEND_MODE,
 	PLANE_PROP_ALPHA_SRC_PRE_MUL,
+	PLANE_PROP_ALPHA,
+	PLANE_PROP_ROTATION,
 	PLANE_PROP_NR,
 };
 
@@ -293,6 +351,22 @@ static struct enum_value plane_alpha_src_enum[] = {
 	},
 };
 
+/* indexed by enum cb_output_transform */
+static struct enum_value plane_rotation_enum[] = {
+	[CB_TRANSFORM_NORMAL] = {
+		.name = "rotate-0",
+	},
+	[CB_TRANSFORM_90] = {
+		.name = "rotate-90",
+	},
+	[CB_TRANSFORM_180] = {
+		.name = "rotate-180",
+	},
+	[CB_TRANSFORM_270] = {
+		.name = "rotate-270",
+	},
+};
+
 static const struct drm_prop plane_props[] = {
 	[PLANE_PROP_TYPE] = {
 		.name = "type",
@@ -384,6 +458,47 @@ static const struct drm_prop plane_props[] = {
 			},
 		},
 	},
+	[PLANE_PROP_ALPHA] = {
+		.name = "alpha",
+		.type = DRM_PROP_TYPE_RANGE,
+	},
+	[PLANE_PROP_ROTATION] = {
+		.name = "rotation",
+		.type = DRM_PROP_TYPE_BITMASK,
+		.c = {
+			.ev = {
+				.count_values = CB_TRANSFORM_NR,
+				.values = plane_rotation_enum,
+			},
+		},
+	},
+};
+
+enum {
+	WRITEBACK_PROP_CRTC_ID = 0,
+	WRITEBACK_PROP_FB_ID,
+	WRITEBACK_PROP_OUT_FENCE_PTR,
+	WRITEBACK_PROP_PIXEL_FORMATS,
+	WRITEBACK_PROP_NR,
+};
+
+static const struct drm_prop writeback_props[] = {
+	[WRITEBACK_PROP_CRTC_ID] = {
+		.name = "CRTC_ID",
+		.type = DRM_PROP_TYPE_OBJECT,
+	},
+	[WRITEBACK_PROP_FB_ID] = {
+		.name = "WRITEBACK_FB_ID",
+		.type = DRM_PROP_TYPE_OBJECT,
+	},
+	[WRITEBACK_PROP_OUT_FENCE_PTR] = {
+		.name = "WRITEBACK_OUT_FENCE_PTR",
+		.type = DRM_PROP_TYPE_RANGE,
+	},
+	[WRITEBACK_PROP_PIXEL_FORMATS] = {
+		.name = "WRITEBACK_PIXEL_FORMATS",
+		.type = DRM_PROP_TYPE_BLOB,
+	},
 };
 
 enum {
@@ -394,6 +509,7 @@ enum {
 	CRTC_PROP_TOP_MARGIN,
 	CRTC_PROP_BOTTOM_MARGIN,
 	CRTC_PROP_ALPHA_SCALE,
+	CRTC_PROP_BACKGROUND_COLOR,
 	CRTC_PROP_NR,
 };
 
@@ -426,6 +542,10 @@ static const struct drm_prop crtc_props[] = {
 		.name = "ALPHA_SCALE",
 		.type = DRM_PROP_TYPE_RANGE,
 	},
+	[CRTC_PROP_BACKGROUND_COLOR] = {
+		.name = "BACKGROUND_COLOR",
+		.type = DRM_PROP_TYPE_RANGE,
+	},
 };
 
 static const char *drm_connector_name[] = {
@@ -447,6 +567,7 @@ static const char *drm_connector_name[] = {
 	[DRM_MODE_CONNECTOR_VIRTUAL] = "Virtual",
 	[DRM_MODE_CONNECTOR_DSI] = "DSI",
 	[DRM_MODE_CONNECTOR_DPI] = "DPI",
+	[DRM_MODE_CONNECTOR_WRITEBACK] = "Writeback",
 };
 
 struct drm_mode {
@@ -492,6 +613,8 @@ struct drm_plane_state {
 	u32 src_x, src_y;
 	u32 src_w, src_h;
 	bool alpha_src_pre_mul;
+	u16 alpha;
+	u32 transform;
 };
 
 struct drm_output_state {
@@ -499,6 +622,8 @@ struct drm_output_state {
 	struct drm_scanout *dev;
 	struct list_head link;
 	struct list_head plane_states;
+	/* index of the output's state arena it is allocated from */
+	s32 arena;
 };
 
 struct drm_pending_state {
@@ -506,6 +631,27 @@ struct drm_pending_state {
 	struct list_head output_states;
 };
 
+/*
+ * writeback connector, it is not a display head but a capture engine which
+ * can be attached to one of the CRTCs in possible_crtcs.
+ */
+struct drm_writeback {
+	struct drm_scanout *dev;
+
+	u32 connector_id;
+	u32 possible_crtcs;
+
+	u32 count_formats;
+	u32 *formats;
+
+	struct drm_prop props[WRITEBACK_PROP_NR];
+
+	/* output which owns the writeback connector */
+	struct drm_output *output;
+
+	struct list_head link;
+};
+
 struct drm_output {
 	struct output base;
 
@@ -525,6 +671,12 @@ struct drm_output {
 	struct drm_mode *custom_mode;
 
 	struct drm_output_state *state_cur, *state_last;
+	/*
+	 * output / plane states are allocated from these, one arena is reset
+	 * when the last state allocated from it is released after the flip.
+	 */
+	void *state_arena[2];
+	u32 state_arena_live[2];
 
 	bool page_flip_pending;
 
@@ -536,6 +688,25 @@ struct drm_output {
 	struct drm_plane *cursor;
 
 	struct list_head planes;
+
+	/* writeback capture */
+	struct drm_writeback *wb;
+	/* capture enabled by user / writeback connector attached to crtc */
+	bool wb_wanted, wb_attached;
+	/* fb to be written back by the next commit */
+	struct drm_fb *wb_fb_pending;
+	/* fb in writeback progress */
+	struct drm_fb *wb_fb;
+	s32 wb_fence_fd;
+	struct cb_event_source *wb_fence_source;
+	/* writeback complete signal */
+	struct cb_signal capture_signal;
+	/* CRTC sequence ioctls not supported by kernel */
+	bool seq_unsupported;
+	/* queued vblank sequence event signal */
+	struct cb_signal vblank_seq_signal;
+	/* CRTC background color, 16 bits per component ARGB */
+	u64 bg_color;
 };
 
 #define MONITOR_NAME_LEN 13
@@ -561,6 +732,30 @@ struct drm_head {
 	struct drm_prop props[CONNECTOR_PROP_NR];
 	drmModeConnectorPtr connector;
 
+	/* a probe job is queued to the hotplug worker */
+	bool probing;
+	/* probe results with old sequence are dropped */
+	u32 probe_seq;
+
+	struct list_head link;
+};
+
+/*
+ * connector probe job
+ * The hotplug worker only reads connector_id / edid_prop_id and fills the
+ * results, head is only touched in the event loop thread.
+ */
+struct drm_probe_job {
+	struct drm_head *head;
+	u32 seq;
+	u32 connector_id;
+	u32 edid_prop_id;
+
+	/* results */
+	drmModeConnectorPtr connector;
+	u8 *edid;
+	size_t edid_length;
+
 	struct list_head link;
 };
 
@@ -576,6 +771,15 @@ struct drm_plane {
 
 	u32 plane_id;
 
+	/* overlay plane which can be attached to more than one CRTC */
+	bool shared;
+	/* this output's copy owns the hardware plane */
+	bool owned;
+	/* released, the next commit of this output disables the plane */
+	bool release_pending;
+	/* the disabling commit has been sent, wait for its completion */
+	bool release_committed;
+
 	struct drm_prop props[PLANE_PROP_NR];
 };
 
@@ -590,6 +794,40 @@ struct drm_scanout {
 	struct cb_event_source *udev_drm_source;
 	s32 sysnum;
 
+	/*
+	 * hotplug worker, connector probing and EDID reading may take
+	 * hundreds of milliseconds, run them out of the event loop.
+	 */
+	pthread_t probe_thread;
+	bool probe_thread_created;
+	pthread_mutex_t probe_mutex;
+	pthread_cond_t probe_cond;
+	bool probe_exit;
+	/* jobs to be run, protected by probe_mutex */
+	struct list_head probe_jobs;
+	/* jobs done, protected by probe_mutex */
+	struct list_head probe_results;
+	/* job being run by worker, protected by probe_mutex */
+	struct drm_probe_job *probe_cur;
+	/* worker -> event loop notification */
+	s32 probe_efd;
+	struct cb_event_source *probe_source;
+
+	/*
+	 * deferred fb removal
+	 * RmFB may wait for the next vblank, CLOSEFB is used if kernel
+	 * supports it, otherwise fb ids are removed by the reaper thread.
+	 */
+	bool closefb_unsupported;
+	pthread_t reaper_thread;
+	bool reaper_created;
+	pthread_mutex_t reaper_mutex;
+	pthread_cond_t reaper_cond;
+	bool reaper_exit;
+	/* fb ids to be removed, protected by reaper_mutex */
+	u32 *reap_fb_ids;
+	u32 count_reap_fb_ids, size_reap_fb_ids;
+
 	struct gbm_device *gbm;
 	u32 gbm_format;
 
@@ -601,12 +839,13 @@ struct drm_scanout {
 	struct list_head outputs;
 	struct list_head heads;
 	struct list_head planes;
+	struct list_head writebacks;
 
 	/* cache */
 	void *drm_fb_cache;
 	void *ps_cache;
-	void *os_cache;
-	void *pls_cache;
+	/* reused by every commit */
+	drmModeAtomicReq *req;
 
 	bool check_preset_mode;
 	u32 preset_width, preset_height, preset_min_refresh, preset_max_refresh;
@@ -957,7 +1196,7 @@ drm_pending_state_create(struct drm_scanout *dev)
 {
 	struct drm_pending_state *ps;
 
-	ps = cb_cache_get(dev->ps_cache, false);
+	ps = cb_slab_get(dev->ps_cache, false);
 	if (!ps)
 		return NULL;
 	ps->dev = dev;
@@ -970,6 +1209,7 @@ drm_output_state_create(struct drm_pending_state *ps, struct drm_output *output)
 {
 	struct drm_output_state *os;
 	struct drm_scanout *dev;
+	s32 idx;
 
 	if (!ps)
 		return NULL;
@@ -978,10 +1218,14 @@ drm_output_state_create(struct drm_pending_state *ps, struct drm_output *output)
 	if (!dev)
 		return NULL;
 
-	os = cb_cache_get(dev->os_cache, false);
+	/* the other arena still holds the state on screen */
+	idx = output->state_arena_live[0] ? 1 : 0;
+	os = cb_arena_alloc(output->state_arena[idx], sizeof(*os));
 	if (!os)
 		return NULL;
+	output->state_arena_live[idx]++;
 
+	os->arena = idx;
 	os->dev = dev;
 	os->output = output;
 	INIT_LIST_HEAD(&os->plane_states);
@@ -1013,8 +1257,9 @@ drm_plane_state_create(struct drm_output_state *os, struct drm_plane *plane,
 {
 	struct drm_plane_state *ps;
 	struct drm_scanout *dev = os->dev;
+	struct drm_output *output = os->output;
 
-	ps = cb_cache_get(dev->pls_cache, false);
+	ps = cb_arena_alloc(output->state_arena[os->arena], sizeof(*ps));
 	if (!ps)
 		return NULL;
 
@@ -1027,6 +1272,92 @@ drm_plane_state_create(struct drm_output_state *os, struct drm_plane *plane,
 	return ps;
 }
 
+static void *drm_reaper_thread(void *data)
+{
+	struct drm_scanout *dev = data;
+	u32 *fb_ids = NULL, size = 0, count, i;
+
+	pthread_mutex_lock(&dev->reaper_mutex);
+	for (;;) {
+		if (!dev->count_reap_fb_ids) {
+			if (dev->reaper_exit)
+				break;
+			pthread_cond_wait(&dev->reaper_cond,
+					  &dev->reaper_mutex);
+			continue;
+		}
+
+		/* take the whole batch, so RmFB runs without lock */
+		if (size < dev->size_reap_fb_ids) {
+			free(fb_ids);
+			size = dev->size_reap_fb_ids;
+			fb_ids = malloc(size * sizeof(u32));
+			if (!fb_ids) {
+				size = 0;
+				pthread_cond_wait(&dev->reaper_cond,
+						  &dev->reaper_mutex);
+				continue;
+			}
+		}
+		count = dev->count_reap_fb_ids;
+		memcpy(fb_ids, dev->reap_fb_ids, count * sizeof(u32));
+		dev->count_reap_fb_ids = 0;
+		pthread_mutex_unlock(&dev->reaper_mutex);
+
+		for (i = 0; i < count; i++)
+			drmModeRmFB(dev->fd, fb_ids[i]);
+
+		pthread_mutex_lock(&dev->reaper_mutex);
+	}
+	pthread_mutex_unlock(&dev->reaper_mutex);
+
+	free(fb_ids);
+	return NULL;
+}
+
+/* remove fb id without blocking the event loop */
+static void drm_fb_rm(struct drm_scanout *dev, u32 fb_id)
+{
+	struct drm_mode_closefb closefb;
+	u32 *fb_ids;
+
+	if (!dev->closefb_unsupported) {
+		memset(&closefb, 0, sizeof(closefb));
+		closefb.fb_id = fb_id;
+		if (!drmIoctl(dev->fd, DRM_IOCTL_MODE_CLOSEFB, &closefb))
+			return;
+		if (errno != EINVAL && errno != ENOTTY) {
+			drm_err("failed to close fb %u. (%s)", fb_id,
+				strerror(errno));
+			return;
+		}
+		drm_notice("CLOSEFB is not supported, use reaper thread.");
+		dev->closefb_unsupported = true;
+	}
+
+	if (!dev->reaper_created)
+		goto rm_now;
+
+	pthread_mutex_lock(&dev->reaper_mutex);
+	if (dev->count_reap_fb_ids == dev->size_reap_fb_ids) {
+		fb_ids = realloc(dev->reap_fb_ids,
+				 (dev->size_reap_fb_ids + 32) * sizeof(u32));
+		if (!fb_ids) {
+			pthread_mutex_unlock(&dev->reaper_mutex);
+			goto rm_now;
+		}
+		dev->reap_fb_ids = fb_ids;
+		dev->size_reap_fb_ids += 32;
+	}
+	dev->reap_fb_ids[dev->count_reap_fb_ids++] = fb_id;
+	pthread_cond_signal(&dev->reaper_cond);
+	pthread_mutex_unlock(&dev->reaper_mutex);
+	return;
+
+rm_now:
+	drmModeRmFB(dev->fd, fb_id);
+}
+
 #ifdef USE_DRM_PRIME
 static void drm_fb_release_dmabuf(struct drm_fb *fb)
 {
@@ -1042,7 +1373,7 @@ static void drm_fb_release_dmabuf(struct drm_fb *fb)
 
 		if (fb->fb_id) {
 			drm_debug("Remove DRM FB");
-			drmModeRmFB(dev->fd, fb->fb_id);
+			drm_fb_rm(dev, fb->fb_id);
 		}
 
 		if (fb->base.info.fd[0]) {
@@ -1050,7 +1381,7 @@ static void drm_fb_release_dmabuf(struct drm_fb *fb)
 			close(fb->base.info.fd[0]);
 		}
 
-		cb_cache_put(fb, dev->drm_fb_cache);
+		cb_slab_put(fb, dev->drm_fb_cache);
 	}
 }
 #else
@@ -1067,9 +1398,9 @@ static void drm_fb_release_dmabuf(struct drm_fb *fb)
 	if (fb) {
 		if (fb->fb_id) {
 			drm_debug("Remove DRM FB");
-			drmModeRmFB(dev->fd, fb->fb_id);
+			drm_fb_rm(dev, fb->fb_id);
 		}
-		cb_cache_put(fb, dev->drm_fb_cache);
+		cb_slab_put(fb, dev->drm_fb_cache);
 	}
 }
 #endif
@@ -1098,9 +1429,9 @@ static void drm_fb_release_cursor_bo(struct drm_fb *fb)
 	if (fb) {
 		if (fb->fb_id) {
 			drm_debug("Remove GBM CURSOR BO DRM FB");
-			drmModeRmFB(dev->fd, fb->fb_id);
+			drm_fb_rm(dev, fb->fb_id);
 		}
-		cb_cache_put(fb, dev->drm_fb_cache);
+		cb_slab_put(fb, dev->drm_fb_cache);
 	}
 }
 
@@ -1127,9 +1458,9 @@ static void drm_fb_release_dumb(struct drm_fb *fb)
 	if (fb) {
 		if (fb->fb_id) {
 			drm_debug("Remove DRM FB");
-			drmModeRmFB(dev->fd, fb->fb_id);
+			drm_fb_rm(dev, fb->fb_id);
 		}
-		cb_cache_put(fb, dev->drm_fb_cache);
+		cb_slab_put(fb, dev->drm_fb_cache);
 	}
 }
 
@@ -1187,24 +1518,21 @@ static void drm_fb_unref(struct drm_fb *fb)
 	}
 }
 
+/* the memory goes with the output state's arena */
 static void drm_plane_state_destroy(struct drm_plane_state *pls)
 {
-	struct drm_scanout *dev;
-
 	if (!pls)
 		return;
 
 	drm_debug("destroy plane state");
 	if (pls->fb && pls->fb->fb_id)
 		drm_fb_unref(pls->fb);
-	dev = pls->dev;
-	cb_cache_put(pls, dev->pls_cache);
 }
 
 static void drm_output_state_destroy(struct drm_output_state *os)
 {
 	struct drm_plane_state *pls, *next_pls;
-	struct drm_scanout *dev;
+	struct drm_output *output;
 
 	drm_debug("destroy output state enter %p", os);
 	if (!os)
@@ -1216,8 +1544,10 @@ static void drm_output_state_destroy(struct drm_output_state *os)
 		drm_plane_state_destroy(pls);
 	}
 
-	dev = os->dev;
-	cb_cache_put(os, dev->os_cache);
+	output = os->output;
+	assert(output->state_arena_live[os->arena]);
+	if (!--output->state_arena_live[os->arena])
+		cb_arena_reset(output->state_arena[os->arena]);
 }
 
 static void drm_pending_state_destroy(struct drm_pending_state *ps)
@@ -1234,7 +1564,7 @@ static void drm_pending_state_destroy(struct drm_pending_state *ps)
 	}
 
 	dev = ps->dev;
-	cb_cache_put(ps, dev->ps_cache);
+	cb_slab_put(ps, dev->ps_cache);
 }
 
 static struct drm_output_state *
@@ -1323,6 +1653,167 @@ static s32 set_plane_prop(drmModeAtomicReq *req,
 	return 0;
 }
 
+/*
+ * plane alpha uses the standard "alpha" property if there is, otherwise
+ * the vendor GLOBAL_ALPHA, scaled to the range of the property.
+ */
+static s32 set_plane_alpha(drmModeAtomicReq *req,
+			   struct drm_plane *plane,
+			   u16 alpha)
+{
+	struct drm_prop *prop;
+	u32 id;
+	u64 max = PLANE_ALPHA_OPAQUE;
+
+	if (plane->props[PLANE_PROP_ALPHA].valid)
+		id = PLANE_PROP_ALPHA;
+	else if (plane->props[PLANE_PROP_GLOBAL_ALPHA].valid)
+		id = PLANE_PROP_GLOBAL_ALPHA;
+	else
+		return 0;
+
+	prop = &plane->props[id];
+	if (prop->c.rv.count_values == 2)
+		max = prop->c.rv.values[1];
+
+	return set_plane_prop(req, plane, id,
+			      ((u64)alpha * max + PLANE_ALPHA_OPAQUE / 2) /
+			      PLANE_ALPHA_OPAQUE);
+}
+
+/* the rotation bit of the given transform, skipped if not supported */
+static s32 set_plane_rotation(drmModeAtomicReq *req,
+			      struct drm_plane *plane,
+			      u32 transform)
+{
+	struct drm_prop *prop = &plane->props[PLANE_PROP_ROTATION];
+
+	if (!prop->valid || transform >= CB_TRANSFORM_NR)
+		return 0;
+
+	if (!prop->c.ev.values[transform].valid)
+		return 0;
+
+	return set_plane_prop(req, plane, PLANE_PROP_ROTATION,
+			      prop->c.ev.values[transform].value);
+}
+
+static s32 set_writeback_prop(drmModeAtomicReq *req,
+			      struct drm_writeback *wb,
+			      u32 prop,
+			      u64 value)
+{
+	s32 ret;
+
+	if (!wb->props[prop].valid)
+		return 0;
+
+	drm_debug("[PROP SET] writeback: %u, %s -> %"PRIu64,
+		  wb->connector_id, wb->props[prop].name, value);
+
+	ret = drmModeAtomicAddProperty(req, wb->connector_id,
+				       wb->props[prop].prop_id, value);
+	if (ret <= 0) {
+		drm_err("[PROP SET] failed to set writeback property %s. (%s)",
+			wb->props[prop].name, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Attaching / detaching a writeback connector changes the CRTC's connector
+ * routing, so it needs a modeset. The connector stays attached while the
+ * capture is enabled, the per frame job only sets WRITEBACK_FB_ID.
+ */
+static s32 drm_output_writeback_commit(drmModeAtomicReq *req,
+				       struct drm_output *output,
+				       u32 *flags)
+{
+	struct drm_writeback *wb = output->wb;
+	s32 ret = 0;
+
+	if (!wb)
+		return 0;
+
+	if (output->wb_wanted != output->wb_attached) {
+		ret |= set_writeback_prop(req, wb, WRITEBACK_PROP_CRTC_ID,
+					  output->wb_wanted ?
+					  	output->crtc_id : 0);
+		*flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+		output->wb_attached = output->wb_wanted;
+		drm_notice("[output %d] writeback connector %u %s",
+			   output->index, wb->connector_id,
+			   output->wb_attached ? "attached" : "detached");
+	}
+
+	if (!output->wb_attached || !output->wb_fb_pending || output->wb_fb)
+		return ret;
+
+	output->wb_fence_fd = -1;
+	ret |= set_writeback_prop(req, wb, WRITEBACK_PROP_FB_ID,
+				  output->wb_fb_pending->fb_id);
+	ret |= set_writeback_prop(req, wb, WRITEBACK_PROP_OUT_FENCE_PTR,
+				  (u64)(unsigned long)(&output->wb_fence_fd));
+	output->wb_fb = output->wb_fb_pending;
+	output->wb_fb_pending = NULL;
+
+	return ret;
+}
+
+static s32 drm_writeback_fence_cb(s32 fd, u32 mask, void *data)
+{
+	struct drm_output *output = data;
+	struct drm_fb *fb = output->wb_fb;
+
+	cb_event_source_remove(output->wb_fence_source);
+	output->wb_fence_source = NULL;
+	close(output->wb_fence_fd);
+	output->wb_fence_fd = -1;
+	output->wb_fb = NULL;
+
+	if (!fb)
+		return 0;
+
+	drm_debug("[output %d] writeback complete, fb %u",
+		  output->index, fb->fb_id);
+	cb_signal_emit(&output->capture_signal, &fb->base);
+	drm_fb_unref(fb);
+
+	return 0;
+}
+
+/* wait for the out fence kernel returned by the committed writeback job */
+static void drm_output_writeback_arm(struct drm_output *output)
+{
+	struct drm_fb *fb = output->wb_fb;
+
+	if (!fb || output->wb_fence_source)
+		return;
+
+	if (output->wb_fence_fd < 0) {
+		drm_err("[output %d] no writeback out fence.", output->index);
+		output->wb_fb = NULL;
+		drm_fb_unref(fb);
+		return;
+	}
+
+	output->wb_fence_source = cb_event_loop_add_fd(output->dev->loop,
+						       output->wb_fence_fd,
+						       CB_EVT_READABLE,
+						       drm_writeback_fence_cb,
+						       output);
+	if (!output->wb_fence_source) {
+		drm_err("[output %d] failed to wait writeback fence.",
+			output->index);
+		close(output->wb_fence_fd);
+		output->wb_fence_fd = -1;
+		output->wb_fb = NULL;
+		drm_fb_unref(fb);
+	}
+}
+
 static u32 drm_refresh_rate_mhz(const drmModeModeInfo *info)
 {
 	u64 refresh;
@@ -1347,6 +1838,65 @@ static inline u64 millihz_to_nsec(u32 mhz)
 	return 1000000000000LL / mhz;
 }
 
+static s32 drm_plane_state_commit(drmModeAtomicReq *req,
+				  struct drm_output *output,
+				  struct drm_plane_state *pls)
+{
+	struct drm_plane *plane = pls->plane;
+	s32 ret = 0;
+
+	ret |= set_plane_prop(req, plane, PLANE_PROP_FB_ID,
+			      pls->fb ? pls->fb->fb_id : 0);
+	/*
+	printf("Commit FB for o %d: p %u: "
+	       "%u %d,%d %ux%u -> %d,%d %ux%u\n",
+			output->index, plane->plane_id,
+			pls->fb->fb_id,
+			pls->src_x, pls->src_x,
+			pls->src_w, pls->src_h,
+			pls->crtc_x, pls->crtc_y,
+			pls->crtc_w, pls->crtc_h);
+	*/
+	ret |= set_plane_prop(req, plane, PLANE_PROP_CRTC_ID,
+			      pls->fb ? output->crtc_id : 0);
+	ret |= set_plane_prop(req, plane, PLANE_PROP_SRC_X,
+			      pls->src_x << 16);
+	ret |= set_plane_prop(req, plane, PLANE_PROP_SRC_Y,
+			      pls->src_y << 16);
+	ret |= set_plane_prop(req, plane, PLANE_PROP_SRC_W,
+			      pls->src_w << 16);
+	ret |= set_plane_prop(req, plane, PLANE_PROP_SRC_H,
+			      pls->src_h << 16);
+	ret |= set_plane_prop(req, plane, PLANE_PROP_CRTC_X,
+			      pls->crtc_x);
+	ret |= set_plane_prop(req, plane, PLANE_PROP_CRTC_Y,
+			      pls->crtc_y);
+	ret |= set_plane_prop(req, plane, PLANE_PROP_CRTC_W,
+			      pls->crtc_w);
+	ret |= set_plane_prop(req, plane, PLANE_PROP_CRTC_H,
+			      pls->crtc_h);
+	if (pls->zpos != -1) {
+		ret |= set_plane_prop(req, plane, PLANE_PROP_ZPOS,
+				      pls->zpos);
+	}
+
+	if (pls->alpha_src_pre_mul) {
+		ret |= set_plane_prop(req, plane,
+				PLANE_PROP_ALPHA_SRC_PRE_MUL,
+				PLANE_ALPHA_SRC_PRE_MUL);
+	} else {
+		ret |= set_plane_prop(req, plane,
+				PLANE_PROP_ALPHA_SRC_PRE_MUL,
+				PLANE_ALPHA_SRC_NON_PRE_MUL);
+	}
+
+	/* always set, the plane may be translucent last time */
+	ret |= set_plane_alpha(req, plane, pls->alpha);
+	ret |= set_plane_rotation(req, plane, pls->transform);
+
+	return ret;
+}
+
 static s32 drm_output_commit(drmModeAtomicReq *req,
 			     struct drm_output_state *os,
 			     u32 *flags)
@@ -1357,8 +1907,15 @@ static s32 drm_output_commit(drmModeAtomicReq *req,
 	struct drm_plane *plane;
 	struct drm_plane_state *pls;
 
-	/* disable all planes first */
+	/*
+	 * disable all planes first, the shared planes owned by other
+	 * outputs are left alone.
+	 */
 	list_for_each_entry(plane, &output->planes, output_link) {
+		if (!plane->owned && !plane->release_pending)
+			continue;
+		if (plane->release_pending)
+			plane->release_committed = true;
 		ret |= set_plane_prop(req, plane, PLANE_PROP_FB_ID, 0);
 		ret |= set_plane_prop(req, plane, PLANE_PROP_CRTC_ID, 0);
 	}
@@ -1371,6 +1928,12 @@ static s32 drm_output_commit(drmModeAtomicReq *req,
 		ret |= set_crtc_prop(req, output, CRTC_PROP_ACTIVE, 0);
 		ret |= set_crtc_prop(req, output, CRTC_PROP_MODE_ID, 0);
 		ret |= set_connector_prop(req, head, CONNECTOR_PROP_CRTC_ID, 0);
+		if (output->wb && output->wb_attached) {
+			/* re-attached when the output is enabled again */
+			ret |= set_writeback_prop(req, output->wb,
+						  WRITEBACK_PROP_CRTC_ID, 0);
+			output->wb_attached = false;
+		}
 		return 0;
 	} else {
 		if (!output->base.head->connected)
@@ -1411,59 +1974,32 @@ static s32 drm_output_commit(drmModeAtomicReq *req,
 				     output->current_mode->blob_id);
 		ret |= set_connector_prop(req, head, CONNECTOR_PROP_CRTC_ID,
 					  output->crtc_id);
+		ret |= set_crtc_prop(req, output, CRTC_PROP_BACKGROUND_COLOR,
+				     output->bg_color);
+		ret |= drm_output_writeback_commit(req, output, flags);
 	}
 
-	list_for_each_entry(pls, &os->plane_states, link) {
-		plane = pls->plane;
-		ret |= set_plane_prop(req, plane, PLANE_PROP_FB_ID,
-				      pls->fb ? pls->fb->fb_id : 0);
-		/*
-		printf("Commit FB for o %d: p %u: "
-		       "%u %d,%d %ux%u -> %d,%d %ux%u\n",
-				output->index, plane->plane_id,
-				pls->fb->fb_id,
-				pls->src_x, pls->src_x,
-				pls->src_w, pls->src_h,
-				pls->crtc_x, pls->crtc_y,
-				pls->crtc_w, pls->crtc_h);
-		*/
-		ret |= set_plane_prop(req, plane, PLANE_PROP_CRTC_ID,
-				      pls->fb ? output->crtc_id : 0);
-		ret |= set_plane_prop(req, plane, PLANE_PROP_SRC_X,
-				      pls->src_x << 16);
-		ret |= set_plane_prop(req, plane, PLANE_PROP_SRC_Y,
-				      pls->src_y << 16);
-		ret |= set_plane_prop(req, plane, PLANE_PROP_SRC_W,
-				      pls->src_w << 16);
-		ret |= set_plane_prop(req, plane, PLANE_PROP_SRC_H,
-				      pls->src_h << 16);
-		ret |= set_plane_prop(req, plane, PLANE_PROP_CRTC_X,
-				      pls->crtc_x);
-		ret |= set_plane_prop(req, plane, PLANE_PROP_CRTC_Y,
-				      pls->crtc_y);
-		ret |= set_plane_prop(req, plane, PLANE_PROP_CRTC_W,
-				      pls->crtc_w);
-		ret |= set_plane_prop(req, plane, PLANE_PROP_CRTC_H,
-				      pls->crtc_h);
-		if (pls->zpos != -1) {
-			ret |= set_plane_prop(req, plane, PLANE_PROP_ZPOS,
-				      pls->zpos);
-		}
-
-		if (pls->alpha_src_pre_mul) {
-			ret |= set_plane_prop(req, plane,
-				PLANE_PROP_ALPHA_SRC_PRE_MUL,
-				PLANE_ALPHA_SRC_PRE_MUL);
-		} else {
-			ret |= set_plane_prop(req, plane,
-				PLANE_PROP_ALPHA_SRC_PRE_MUL,
-				PLANE_ALPHA_SRC_NON_PRE_MUL);
-		}
-	}
+	list_for_each_entry(pls, &os->plane_states, link)
+		ret |= drm_plane_state_commit(req, output, pls);
 
 	return ret;
 }
 
+/* the commit disabling the released planes has completed */
+static void drm_output_planes_released(struct drm_output *output)
+{
+	struct drm_plane *plane;
+
+	list_for_each_entry(plane, &output->planes, output_link) {
+		if (!plane->release_committed)
+			continue;
+		plane->release_committed = false;
+		plane->release_pending = false;
+		drm_debug("plane %u released by CRTC %u", plane->plane_id,
+			  output->crtc_id);
+	}
+}
+
 static void drm_output_state_switch(struct drm_output_state *os, bool async)
 {
 	struct drm_output *output = os->output;
@@ -1495,6 +2031,7 @@ static void drm_output_state_switch(struct drm_output_state *os, bool async)
 		drm_output_state_destroy(os);
 		output->state_cur = NULL;
 		assert(!output->page_flip_pending);
+		drm_output_planes_released(output);
 	}
 }
 
@@ -1503,11 +2040,13 @@ static s32 drm_commit(struct drm_pending_state *ps, bool async)
 	struct drm_scanout *dev = ps->dev;
 	struct drm_output *output;
 	struct drm_output_state *os, *next_os;
-	drmModeAtomicReq *req = drmModeAtomicAlloc();
+	drmModeAtomicReq *req = dev->req;
 	u32 flags = 0;
 	s32 ret = 0;
 	bool empty = true;
 
+	drmModeAtomicSetCursor(req, 0);
+
 	if (async)
 		flags = DRM_MODE_PAGE_FLIP_EVENT |
 			DRM_MODE_PAGE_FLIP_ASYNC |
@@ -1540,13 +2079,15 @@ static s32 drm_commit(struct drm_pending_state *ps, bool async)
 		goto out;
 	}
 
+	list_for_each_entry(output, &dev->outputs, link)
+		drm_output_writeback_arm(output);
+
 out1:
 	list_for_each_entry_safe(os, next_os, &ps->output_states, link) {
 		drm_output_state_switch(os, async);
 	}
 
 out:
-	drmModeAtomicFree(req);
 	drm_pending_state_destroy(ps);
 
 	return 0;
@@ -1570,36 +2111,106 @@ static void drm_do_scanout(struct scanout *so, void *scanout_data)
 	drm_commit(ps, true);
 }
 
-static s32 drm_scanout_data_fill(struct scanout *so,
-				 void *scanout_data,
-				 struct scanout_commit_info *commit)
+/*
+ * Check the planes in commit against the current CRTC configuration with a
+ * TEST_ONLY commit. Nothing is applied and the buffers are not referenced.
+ */
+static s32 drm_test_scanout(struct scanout *so,
+			    struct scanout_commit_info *commit)
 {
-	struct drm_pending_state *ps = scanout_data;
-	struct drm_output_state *os;
+	struct drm_scanout *dev = to_dev(so);
+	drmModeAtomicReq *req;
 	struct drm_output *output;
-	struct drm_plane_state *pls;
+	struct drm_plane_state pls;
 	struct fb_info *info;
-	bool output_found;
-	
+	s32 ret = 0;
+
 	if (list_empty(&commit->fb_commits))
 		return -EINVAL;
-	
+
+	req = dev->req;
+	drmModeAtomicSetCursor(req, 0);
+
 	list_for_each_entry(info, &commit->fb_commits, link) {
 		output = to_drm_output(info->output);
-		if (!output)
+		if (!output || !output->current_mode ||
+		    !output->base.head->connected) {
+			ret = -EINVAL;
+			goto out;
+		}
+
+		/* output only, its owned planes stay as they are */
+		if (!info->plane)
 			continue;
 
-		output_found = false;
-		list_for_each_entry(os, &ps->output_states, link) {
-			if (os->output == output) {
-				output_found = true;
-				break;
-			}
+		memset(&pls, 0, sizeof(pls));
+		pls.fb = to_drm_fb(info->buffer);
+		pls.plane = to_drm_plane(info->plane);
+		pls.dev = dev;
+		pls.zpos = info->zpos;
+		pls.alpha_src_pre_mul = info->alpha_src_pre_mul;
+		pls.alpha = info->alpha;
+		pls.transform = info->transform;
+		pls.src_x = info->src.pos.x;
+		pls.src_y = info->src.pos.y;
+		pls.src_w = info->src.w;
+		pls.src_h = info->src.h;
+		pls.crtc_x = info->dst.pos.x;
+		pls.crtc_y = info->dst.pos.y;
+		pls.crtc_w = info->dst.w;
+		pls.crtc_h = info->dst.h;
+		if (drm_plane_state_commit(req, output, &pls)) {
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+
+	ret = drmModeAtomicCommit(dev->fd, req, DRM_MODE_ATOMIC_TEST_ONLY,
+				  dev);
+	if (ret) {
+		ret = -errno;
+		drm_notice("[KMS] test commit rejected. (%s)",
+			   strerror(errno));
+	}
+
+out:
+	return ret;
+}
+
+static s32 drm_scanout_data_fill(struct scanout *so,
+				 void *scanout_data,
+				 struct scanout_commit_info *commit)
+{
+	struct drm_pending_state *ps = scanout_data;
+	struct drm_output_state *os;
+	struct drm_output *output;
+	struct drm_plane_state *pls;
+	struct fb_info *info;
+	bool output_found;
+	
+	if (list_empty(&commit->fb_commits))
+		return -EINVAL;
+	
+	list_for_each_entry(info, &commit->fb_commits, link) {
+		output = to_drm_output(info->output);
+		if (!output)
+			continue;
+
+		output_found = false;
+		list_for_each_entry(os, &ps->output_states, link) {
+			if (os->output == output) {
+				output_found = true;
+				break;
+			}
 		}
 
 		if (!output_found)
 			os = drm_output_state_create(ps, output);
 
+		/* output without any plane, only CRTC background is shown */
+		if (!info->plane)
+			continue;
+
 		pls = drm_plane_state_create(os, to_drm_plane(info->plane),
 					     to_drm_fb(info->buffer));
 /*
@@ -1607,6 +2218,8 @@ static s32 drm_scanout_data_fill(struct scanout *so,
 */
 		pls->zpos = info->zpos;
 		pls->alpha_src_pre_mul = info->alpha_src_pre_mul;
+		pls->alpha = info->alpha;
+		pls->transform = info->transform;
 		pls->src_x = info->src.pos.x;
 		pls->src_y = info->src.pos.y;
 		pls->src_w = info->src.w;
@@ -1628,25 +2241,21 @@ static void drm_output_native_surface_destroy(struct output *o, void *surface)
 	}
 }
 
-static void *drm_output_native_surface_create(struct output *o)
+static void *drm_output_native_surface_create(struct output *o,
+					      u32 width, u32 height)
 {
 	struct drm_output *output = to_drm_output(o);
 	struct drm_scanout *dev = output->dev;
-	struct drm_mode *mode;
 	struct gbm_surface *surface;
 
 	if (!o)
 		return NULL;
 
 	assert(output->current_mode);
-	mode = output->current_mode;
-	surface = gbm_surface_create(dev->gbm,
-				mode->internal.hdisplay,
-				mode->internal.vdisplay,
+	surface = gbm_surface_create(dev->gbm, width, height,
 				dev->gbm_format,
 				GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
-	drm_debug("create surface %ux%u, %u, %p %p",
-		mode->internal.hdisplay, mode->internal.vdisplay,
+	drm_debug("create surface %ux%u, %u, %p %p", width, height,
 		dev->gbm_format, dev->gbm, surface);
 	if (!surface) {
 		drm_err("failed to create gbm surface (%s)", strerror(errno));
@@ -1854,6 +2463,80 @@ drm_output_enumerate_plane_by_fmt(struct output *o,
 	return NULL;
 }
 
+static s32 drm_output_acquire_plane(struct output *o, struct plane *p)
+{
+	struct drm_output *output = to_drm_output(o), *other;
+	struct drm_plane *plane = to_drm_plane(p), *copy;
+
+	if (!plane || p->output != o)
+		return -EINVAL;
+
+	if (!plane->shared || plane->owned)
+		return 0;
+
+	/*
+	 * a plane can only move to another CRTC after the commit which
+	 * disables it on the old CRTC has completed.
+	 */
+	list_for_each_entry(other, &output->dev->outputs, link) {
+		if (other == output)
+			continue;
+		list_for_each_entry(copy, &other->planes, output_link) {
+			if (copy->plane_id != plane->plane_id)
+				continue;
+			if (copy->owned || copy->release_pending)
+				return -EBUSY;
+		}
+	}
+
+	plane->owned = true;
+	drm_info("plane %u acquired by CRTC %u", plane->plane_id,
+		 output->crtc_id);
+
+	return 0;
+}
+
+static void drm_output_release_plane(struct output *o, struct plane *p)
+{
+	struct drm_output *output = to_drm_output(o);
+	struct drm_plane *plane = to_drm_plane(p);
+
+	if (!plane || p->output != o)
+		return;
+
+	if (!plane->shared || !plane->owned)
+		return;
+
+	plane->owned = false;
+	/* CRTC is off, so is the plane */
+	if (!output->current_mode)
+		return;
+
+	plane->release_pending = true;
+	drm_info("plane %u released by CRTC %u, wait for commit",
+		 plane->plane_id, output->crtc_id);
+}
+
+/* DRM_ARGB64 uses 16 bits per component */
+static inline u64 argb8888_to_argb16(u32 argb)
+{
+	return ((u64)((argb >> 24) & 0xFF) * 0x101 << 48) |
+	       ((u64)((argb >> 16) & 0xFF) * 0x101 << 32) |
+	       ((u64)((argb >> 8) & 0xFF) * 0x101 << 16) |
+	       ((u64)(argb & 0xFF) * 0x101);
+}
+
+static s32 drm_output_set_background_color(struct output *o, u32 argb)
+{
+	struct drm_output *output = to_drm_output(o);
+
+	if (!output->props[CRTC_PROP_BACKGROUND_COLOR].valid)
+		return -ENOTSUP;
+
+	output->bg_color = argb8888_to_argb16(argb);
+	return 0;
+}
+
 static s32 drm_output_enable(struct output *o, struct cb_mode *mode)
 {
 	struct drm_output *output = to_drm_output(o);
@@ -1934,6 +2617,8 @@ static struct plane *drm_plane_create(struct drm_scanout *dev,
 	}
 
 	INIT_LIST_HEAD(&plane->base.link);
+	plane->base.id = plane->plane_id;
+	plane->base.possible_outputs = p->possible_crtcs;
 	plane->base.count_formats = p->count_formats;
 	plane->base.formats = calloc(plane->base.count_formats, sizeof(u32));
 	memcpy(plane->base.formats, p->formats,
@@ -1964,6 +2649,12 @@ static struct plane *drm_plane_create(struct drm_scanout *dev,
 			plane->base.type = PLANE_TYPE_CURSOR;
 	}
 
+	if (plane->base.type == PLANE_TYPE_OVERLAY &&
+	    (plane->base.possible_outputs &
+	     (plane->base.possible_outputs - 1)))
+		plane->shared = true;
+	plane->owned = !plane->shared;
+
 	value = drm_get_prop_value(&plane->props[PLANE_PROP_FEATURE], props);
 	if (value != (u64)(-1)) {
 		prop = &plane->props[PLANE_PROP_FEATURE];
@@ -1999,6 +2690,19 @@ static struct plane *drm_plane_create(struct drm_scanout *dev,
 		drm_debug("pdaf pos support: %d", plane->base.pdaf_pos_support);
 	}
 
+	if (plane->props[PLANE_PROP_ALPHA].valid)
+		plane->base.alpha_support = true;
+
+	plane->base.transforms = 1U << CB_TRANSFORM_NORMAL;
+	if (plane->props[PLANE_PROP_ROTATION].valid) {
+		prop = &plane->props[PLANE_PROP_ROTATION];
+		for (i = 0; i < CB_TRANSFORM_NR; i++) {
+			if (prop->c.ev.values[i].valid)
+				plane->base.transforms |= (1U << i);
+		}
+	}
+	drm_debug("transforms: %02X", plane->base.transforms);
+
 	alpha_src = drm_get_prop_value(
 			&plane->props[PLANE_PROP_ALPHA_SRC_PRE_MUL],
 			props);
@@ -2026,56 +2730,90 @@ err:
 	return NULL;
 }
 
-static void drm_get_and_parse_edid(struct drm_head *head, 
-				   drmModeObjectProperties *props)
+/*
+ * Read EDID blob of the connector.
+ * It does not touch any head, so it can be run by the hotplug worker.
+ * If the EDID blob is not ready, the connector is probed again, and *conn
+ * is replaced by the new one.
+ */
+static void drm_read_edid(s32 fd, u32 connector_id, u32 edid_prop_id,
+			  drmModeConnectorPtr *conn, u8 **data, size_t *length)
 {
-	u32 blob_id;
 #ifdef READ_EDID_TRY_MAX
 #undef READ_EDID_TRY_MAX
 #endif
 #define READ_EDID_TRY_MAX 5
 
-	s32 i, blob_get_cnt = READ_EDID_TRY_MAX;
+	drmModeObjectProperties *props;
 	drmModePropertyBlobPtr blob;
-	const u8 *p;
+	u32 blob_id;
+	s32 i, j;
 
-	blob_id = (u32)drm_get_prop_value(&head->props[CONNECTOR_PROP_EDID],
-					  props);
+	*data = NULL;
+	*length = 0;
 
-	if (blob_id == (u32)(-1))
+	if (!edid_prop_id)
 		return;
 
-retry:
-	blob = drmModeGetPropertyBlob(head->dev->fd, blob_id);
-	blob_get_cnt--;
-	if (!blob || !blob->data || !blob->length) {
-		if (blob_get_cnt > 0) {
-			if (blob) {
-				drmModeFreePropertyBlob(blob);
-			}
+	for (i = 0; i < READ_EDID_TRY_MAX; i++) {
+		if (i) {
 			usleep(50000);
 			drm_warn("failed to get edid blob, retry again.");
-			drmModeFreeConnector(head->connector);
-			head->connector = drmModeGetConnector(head->dev->fd,
-						head->connector_id);
-			goto retry;
+			drmModeFreeConnector(*conn);
+			*conn = drmModeGetConnector(fd, connector_id);
+			if (!(*conn))
+				return;
 		}
-		goto out;
+
+		props = drmModeObjectGetProperties(fd, connector_id,
+						   DRM_MODE_OBJECT_CONNECTOR);
+		if (!props)
+			continue;
+		blob_id = 0;
+		for (j = 0; j < props->count_props; j++) {
+			if (props->props[j] == edid_prop_id) {
+				blob_id = (u32)props->prop_values[j];
+				break;
+			}
+		}
+		drmModeFreeObjectProperties(props);
+		if (!blob_id)
+			continue;
+
+		blob = drmModeGetPropertyBlob(fd, blob_id);
+		if (!blob || !blob->data || !blob->length) {
+			if (blob)
+				drmModeFreePropertyBlob(blob);
+			continue;
+		}
+
+		*data = (u8 *)malloc(blob->length);
+		if (*data) {
+			*length = blob->length;
+			memcpy(*data, blob->data, blob->length);
+			drm_debug("Get EDID blob, %u bytes.", blob->length);
+		}
+		drmModeFreePropertyBlob(blob);
+		return;
 	}
+}
+
+/* take the ownership of EDID data, parse monitor's name */
+static void drm_head_set_edid(struct drm_head *head, u8 *data, size_t length)
+{
+	const u8 *p;
+	s32 i;
+
+	if (!data || !length)
+		return;
 
 	if (head->edid.data) {
 		free(head->edid.data);
 		head->edid.data = NULL;
 	}
 
-	head->edid.length = blob->length;
-	head->edid.data = (u8 *)malloc(blob->length);
-	if (!head->edid.data) {
-		head->edid.length = 0;
-		goto out;
-	}
-	memcpy(head->edid.data, blob->data, blob->length);
-	drm_debug("Get EDID blob, %u bytes.", blob->length);
+	head->edid.length = length;
+	head->edid.data = data;
 	p = head->edid.data;
 
 	/*
@@ -2110,9 +2848,113 @@ retry:
 	}
 	drm_debug("Monitor: %s", head->monitor_name);
 
-out:
-	if (blob)
-		drmModeFreePropertyBlob(blob);
+	if (strlen(head->monitor_name))
+		head->base.monitor_name = head->monitor_name;
+}
+
+static u32 drm_head_edid_prop_id(struct drm_head *head)
+{
+	if (!head->props[CONNECTOR_PROP_EDID].valid)
+		return 0;
+
+	return head->props[CONNECTOR_PROP_EDID].prop_id;
+}
+
+static void drm_probe_job_free(struct drm_probe_job *job)
+{
+	if (job->connector)
+		drmModeFreeConnector(job->connector);
+	if (job->edid)
+		free(job->edid);
+	free(job);
+}
+
+static void *drm_probe_thread(void *data)
+{
+	struct drm_scanout *dev = data;
+	struct drm_probe_job *job;
+	u64 val = 1;
+
+	pthread_mutex_lock(&dev->probe_mutex);
+	while (!dev->probe_exit) {
+		if (list_empty(&dev->probe_jobs)) {
+			pthread_cond_wait(&dev->probe_cond, &dev->probe_mutex);
+			continue;
+		}
+		job = list_first_entry(&dev->probe_jobs, struct drm_probe_job,
+				       link);
+		list_del(&job->link);
+		dev->probe_cur = job;
+		pthread_mutex_unlock(&dev->probe_mutex);
+
+		/* full probe, the new monitor's modes are required */
+		job->connector = drmModeGetConnector(dev->fd,
+						     job->connector_id);
+		if (job->connector &&
+		    job->connector->connection == DRM_MODE_CONNECTED)
+			drm_read_edid(dev->fd, job->connector_id,
+				      job->edid_prop_id, &job->connector,
+				      &job->edid, &job->edid_length);
+
+		pthread_mutex_lock(&dev->probe_mutex);
+		dev->probe_cur = NULL;
+		list_add_tail(&job->link, &dev->probe_results);
+		write(dev->probe_efd, &val, sizeof(val));
+	}
+	pthread_mutex_unlock(&dev->probe_mutex);
+
+	return NULL;
+}
+
+static s32 drm_probe_queue(struct drm_head *head)
+{
+	struct drm_scanout *dev = head->dev;
+	struct drm_probe_job *job;
+
+	job = calloc(1, sizeof(*job));
+	if (!job)
+		return -ENOMEM;
+
+	job->head = head;
+	job->seq = head->probe_seq;
+	job->connector_id = head->connector_id;
+	job->edid_prop_id = drm_head_edid_prop_id(head);
+	head->probing = true;
+
+	drm_debug("queue probe job for connector %u", head->connector_id);
+	pthread_mutex_lock(&dev->probe_mutex);
+	list_add_tail(&job->link, &dev->probe_jobs);
+	pthread_cond_signal(&dev->probe_cond);
+	pthread_mutex_unlock(&dev->probe_mutex);
+
+	return 0;
+}
+
+/* the head is destroyed, drop its jobs */
+static void drm_probe_forget_head(struct drm_head *head)
+{
+	struct drm_scanout *dev = head->dev;
+	struct drm_probe_job *job, *next;
+
+	if (!dev->probe_thread_created)
+		return;
+
+	pthread_mutex_lock(&dev->probe_mutex);
+	list_for_each_entry_safe(job, next, &dev->probe_jobs, link) {
+		if (job->head == head) {
+			list_del(&job->link);
+			drm_probe_job_free(job);
+		}
+	}
+	list_for_each_entry_safe(job, next, &dev->probe_results, link) {
+		if (job->head == head) {
+			list_del(&job->link);
+			drm_probe_job_free(job);
+		}
+	}
+	if (dev->probe_cur && dev->probe_cur->head == head)
+		dev->probe_cur->head = NULL;
+	pthread_mutex_unlock(&dev->probe_mutex);
 }
 
 static s32 drm_head_copy_edid(struct head *h, u8 *data, size_t *length)
@@ -2153,6 +2995,8 @@ static void drm_head_destroy(struct head *h)
 	if (!head)
 		return;
 
+	drm_probe_forget_head(head);
+
 	if (head->connector)
 		drmModeFreeConnector(head->connector);
 
@@ -2168,10 +3012,38 @@ static void drm_head_destroy(struct head *h)
 	free(head);
 }
 
+/*
+ * head index counts display connectors only, writeback connectors are listed
+ * in the resources too once the client cap is set.
+ */
+static u32 drm_display_connector_id(struct drm_scanout *dev, s32 index)
+{
+	drmModeConnectorPtr conn;
+	u32 type;
+	s32 i;
+
+	for (i = 0; i < dev->res->count_connectors; i++) {
+		conn = drmModeGetConnectorCurrent(dev->fd,
+						  dev->res->connectors[i]);
+		if (!conn)
+			continue;
+		type = conn->connector_type;
+		drmModeFreeConnector(conn);
+		if (type == DRM_MODE_CONNECTOR_WRITEBACK)
+			continue;
+		if (!index--)
+			return dev->res->connectors[i];
+	}
+
+	return 0;
+}
+
 static struct head *drm_head_create(struct drm_scanout *dev, s32 index)
 {
 	struct drm_head *head = NULL;
 	drmModeObjectProperties *props;
+	size_t edid_length;
+	u8 *edid;
 
 	drm_info("Creating head %d...", index);
 	head = calloc(1, sizeof(*head));
@@ -2185,11 +3057,10 @@ static struct head *drm_head_create(struct drm_scanout *dev, s32 index)
 
 	cb_signal_init(&head->head_changed_signal);
 
-	if (index >= dev->res->count_connectors)
+	head->connector_id = drm_display_connector_id(dev, index);
+	if (!head->connector_id)
 		goto err;
 
-	head->connector_id = dev->res->connectors[index];
-
 	head->connector = drmModeGetConnector(dev->fd, head->connector_id);
 	if (!head->connector) {
 		drm_err("failed to get drm connector. (%s)", strerror(errno));
@@ -2218,15 +3089,17 @@ static struct head *drm_head_create(struct drm_scanout *dev, s32 index)
 	drm_prop_prepare(dev, connector_props, head->props, CONNECTOR_PROP_NR,
 			 props);
 
+	drmModeFreeObjectProperties(props);
+
 	if (head->base.connected) {
-		drm_get_and_parse_edid(head, props);
-		if (head->edid.data && head->edid.length &&
-		    strlen(head->monitor_name))
-			head->base.monitor_name = head->monitor_name;
+		drm_read_edid(dev->fd, head->connector_id,
+			      drm_head_edid_prop_id(head), &head->connector,
+			      &edid, &edid_length);
+		drm_head_set_edid(head, edid, edid_length);
+		if (!head->connector)
+			goto err;
 	}
 
-	drmModeFreeObjectProperties(props);
-
 	list_add_tail(&head->link, &dev->heads);
 	drm_info("Create head complete.");
 
@@ -2369,6 +3242,99 @@ static s32 drm_output_add_page_flip_notify(struct output *o,
 	return 0;
 }
 
+static s32 drm_output_capture_enable(struct output *o, bool en)
+{
+	struct drm_output *output = to_drm_output(o);
+	struct drm_writeback *wb;
+
+	if (!o)
+		return -EINVAL;
+
+	if (!en) {
+		output->wb_wanted = false;
+		if (output->wb_fb_pending) {
+			drm_fb_unref(output->wb_fb_pending);
+			output->wb_fb_pending = NULL;
+		}
+		return 0;
+	}
+
+	if (!output->wb) {
+		list_for_each_entry(wb, &output->dev->writebacks, link) {
+			if (wb->output)
+				continue;
+			if (!(wb->possible_crtcs & (1U << output->index)))
+				continue;
+			if (!wb->props[WRITEBACK_PROP_FB_ID].valid)
+				continue;
+			wb->output = output;
+			output->wb = wb;
+			break;
+		}
+	}
+
+	if (!output->wb) {
+		drm_warn("[output %d] no writeback connector available.",
+			 output->index);
+		return -ENODEV;
+	}
+
+	output->wb_wanted = true;
+	return 0;
+}
+
+static s32 drm_output_capture(struct output *o, struct cb_buffer *buffer)
+{
+	struct drm_output *output = to_drm_output(o);
+	struct drm_writeback *wb;
+	struct drm_fb *fb;
+	s32 i;
+
+	if (!o || !buffer)
+		return -EINVAL;
+
+	wb = output->wb;
+	if (!wb || !output->wb_wanted)
+		return -ENODEV;
+
+	fb = to_drm_fb(buffer);
+	if (!fb->fb_id)
+		return -EINVAL;
+
+	if (!output->current_mode && !output->pending_mode)
+		return -ENODEV;
+
+	if (output->wb_fb_pending || output->wb_fb)
+		return -EBUSY;
+
+	for (i = 0; i < wb->count_formats; i++) {
+		if (wb->formats[i] == fb->fourcc)
+			break;
+	}
+	if (wb->count_formats && i == wb->count_formats) {
+		drm_err("[output %d] writeback does not support %4.4s",
+			output->index, (char *)&fb->fourcc);
+		return -EINVAL;
+	}
+
+	drm_fb_ref(fb);
+	output->wb_fb_pending = fb;
+
+	return 0;
+}
+
+static s32 drm_output_add_capture_notify(struct output *o,
+					 struct cb_listener *l)
+{
+	struct drm_output *output = to_drm_output(o);
+
+	if (!o || !l)
+		return -EINVAL;
+
+	cb_signal_add(&output->capture_signal, l);
+	return 0;
+}
+
 static u32 drm_waitvblank_pipe(struct drm_output *output)
 {
 	if (output->index > 1)
@@ -2412,6 +3378,82 @@ static s32 drm_output_query_vblank(struct output *o, struct timespec *ts)
 	return ret;
 }
 
+static s32 drm_output_get_vblank_seq(struct output *o, struct vblank_seq *vs)
+{
+	struct drm_output *output = to_drm_output(o);
+	struct drm_crtc_get_sequence get_seq;
+
+	if (!o || !vs)
+		return -EINVAL;
+
+	if (output->seq_unsupported)
+		return -ENOTSUP;
+
+	memset(&get_seq, 0, sizeof(get_seq));
+	get_seq.crtc_id = output->crtc_id;
+	if (drmIoctl(output->dev->fd, DRM_IOCTL_CRTC_GET_SEQUENCE, &get_seq)) {
+		if (errno == EINVAL || errno == ENOTTY ||
+		    errno == EOPNOTSUPP) {
+			drm_notice("CRTC sequence ioctl is not supported.");
+			output->seq_unsupported = true;
+			return -ENOTSUP;
+		}
+		return -errno;
+	}
+
+	if (!get_seq.active || !get_seq.sequence_ns)
+		return -ENODEV;
+
+	vs->seq = get_seq.sequence;
+	vs->ts.tv_sec = get_seq.sequence_ns / 1000000000ll;
+	vs->ts.tv_nsec = get_seq.sequence_ns % 1000000000ll;
+
+	return 0;
+}
+
+static s32 drm_output_queue_vblank_seq(struct output *o, u64 seq)
+{
+	struct drm_output *output = to_drm_output(o);
+	struct drm_crtc_queue_sequence queue_seq;
+
+	if (!o)
+		return -EINVAL;
+
+	if (output->seq_unsupported)
+		return -ENOTSUP;
+
+	memset(&queue_seq, 0, sizeof(queue_seq));
+	queue_seq.crtc_id = output->crtc_id;
+	/* fire at next vblank if seq is already passed */
+	queue_seq.flags = DRM_CRTC_SEQUENCE_NEXT_ON_MISS;
+	queue_seq.sequence = seq;
+	queue_seq.user_data = output->crtc_id;
+	if (drmIoctl(output->dev->fd, DRM_IOCTL_CRTC_QUEUE_SEQUENCE,
+		     &queue_seq)) {
+		if (errno == ENOTTY || errno == EOPNOTSUPP) {
+			output->seq_unsupported = true;
+			return -ENOTSUP;
+		}
+		drm_err("failed to queue vblank seq %lu. (%s)", seq,
+			strerror(errno));
+		return -errno;
+	}
+
+	return 0;
+}
+
+static s32 drm_output_add_vblank_seq_notify(struct output *o,
+					    struct cb_listener *l)
+{
+	struct drm_output *output = to_drm_output(o);
+
+	if (!o || !l)
+		return -EINVAL;
+
+	cb_signal_add(&output->vblank_seq_signal, l);
+	return 0;
+}
+
 static void drm_output_destroy(struct output *o)
 {
 	struct drm_output *output = to_drm_output(o);
@@ -2424,6 +3466,21 @@ static void drm_output_destroy(struct output *o)
 
 	cb_signal_fini(&output->flipped_signal);
 
+	if (output->wb_fence_source) {
+		cb_event_source_remove(output->wb_fence_source);
+		output->wb_fence_source = NULL;
+	}
+	if (output->wb_fence_fd >= 0)
+		close(output->wb_fence_fd);
+	if (output->wb_fb)
+		drm_fb_unref(output->wb_fb);
+	if (output->wb_fb_pending)
+		drm_fb_unref(output->wb_fb_pending);
+	if (output->wb)
+		output->wb->output = NULL;
+	cb_signal_fini(&output->capture_signal);
+	cb_signal_fini(&output->vblank_seq_signal);
+
 	list_for_each_entry_safe(plane, next_plane, &output->planes,
 				 output_link) {
 		drm_plane_destroy(&plane->base);
@@ -2433,6 +3490,9 @@ static void drm_output_destroy(struct output *o)
 
 	drm_prop_finish(output->props, CRTC_PROP_NR);
 
+	cb_arena_destroy(output->state_arena[0]);
+	cb_arena_destroy(output->state_arena[1]);
+
 	free(output);
 }
 
@@ -2455,6 +3515,16 @@ static struct output *drm_output_create(struct drm_scanout *dev,
 	output->index = output_index;
 	output->base.index = output_index;
 	INIT_LIST_HEAD(&output->planes);
+	output->wb_fence_fd = -1;
+	for (i = 0; i < 2; i++) {
+		output->state_arena[i] = cb_arena_create(1024);
+		if (!output->state_arena[i])
+			goto err;
+	}
+	cb_signal_init(&output->capture_signal);
+	cb_signal_init(&output->vblank_seq_signal);
+	/* kernel default, opaque black */
+	output->bg_color = argb8888_to_argb16(0xFF000000);
 
 	if (output_index >= dev->res->count_crtcs)
 		goto err;
@@ -2567,7 +3637,7 @@ static struct cb_buffer *drm_scanout_cursor_bo_create(
 	struct drm_scanout *dev = to_dev(so);
 	s32 ret;
 
-	fb = cb_cache_get(dev->drm_fb_cache, true);
+	fb = cb_slab_get(dev->drm_fb_cache, true);
 	if (!fb)
 		goto err;
 
@@ -2628,7 +3698,7 @@ err:
 		gbm_bo_destroy(fb->bo);
 
 	if (fb)
-		cb_cache_put(fb, dev->drm_fb_cache);
+		cb_slab_put(fb, dev->drm_fb_cache);
 	return NULL;
 }
 
@@ -2642,7 +3712,7 @@ static struct cb_buffer *drm_scanout_dumb_create(struct scanout *so,
 	struct drm_mode_destroy_dumb destroy_arg;
 	s32 ret;
 
-	fb = cb_cache_get(dev->drm_fb_cache, true);
+	fb = cb_slab_get(dev->drm_fb_cache, true);
 	if (!fb)
 		goto err;
 
@@ -2669,6 +3739,27 @@ static struct cb_buffer *drm_scanout_dumb_create(struct scanout *so,
 		create_arg.height = (info->height + 16 - 1) & ~(16 - 1);
 		drm_debug("create argb8888 dumb buffer");
 		break;
+	case CB_PIX_FMT_RGB888:
+		fb->fourcc = DRM_FORMAT_RGB888;
+		create_arg.bpp = 24;
+		create_arg.width = (info->width + 16 - 1) & ~(16 - 1);
+		create_arg.height = (info->height + 16 - 1) & ~(16 - 1);
+		drm_debug("create rgb888 dumb buffer");
+		break;
+	case CB_PIX_FMT_RGB565:
+		fb->fourcc = DRM_FORMAT_RGB565;
+		create_arg.bpp = 16;
+		create_arg.width = (info->width + 16 - 1) & ~(16 - 1);
+		create_arg.height = (info->height + 16 - 1) & ~(16 - 1);
+		drm_debug("create rgb565 dumb buffer");
+		break;
+	case CB_PIX_FMT_YUYV:
+		fb->fourcc = DRM_FORMAT_YUYV;
+		create_arg.bpp = 16;
+		create_arg.width = (info->width + 16 - 1) & ~(16 - 1);
+		create_arg.height = (info->height + 16 - 1) & ~(16 - 1);
+		drm_debug("create yuyv dumb buffer");
+		break;
 	case CB_PIX_FMT_NV12:
 		fb->fourcc = DRM_FORMAT_NV12;
 		create_arg.bpp = 8;
@@ -2729,12 +3820,8 @@ static struct cb_buffer *drm_scanout_dumb_create(struct scanout *so,
 		info->strides[1] = create_arg.pitch * 2;
 		info->offsets[1] = ((info->height + 16 - 1) & ~(16 - 1))
 					* info->strides[0];
-	} else if (info->pix_fmt == CB_PIX_FMT_ARGB8888) {
-		fb->handles[0] = create_arg.handle;
-		info->sizes[0] = create_arg.size;
-		info->strides[0] = create_arg.pitch;
-		info->offsets[0] = 0;
-	} else if (info->pix_fmt == CB_PIX_FMT_XRGB8888) {
+	} else {
+		/* packed formats */
 		fb->handles[0] = create_arg.handle;
 		info->sizes[0] = create_arg.size;
 		info->strides[0] = create_arg.pitch;
@@ -2760,7 +3847,7 @@ static struct cb_buffer *drm_scanout_dumb_create(struct scanout *so,
 		goto err;
 	}
 	info->maps[0] = mmap(NULL, info->sizes[0],
-			     PROT_WRITE, MAP_SHARED,
+			     PROT_READ | PROT_WRITE, MAP_SHARED,
 			     dev->fd, map_arg.offset);
 	if (info->maps[0] == MAP_FAILED) {
 		drm_err("failed to mmap. (%s)", strerror(errno));
@@ -2814,7 +3901,7 @@ err:
 		close(fb->base.info.fd[0]);
 
 	if (fb)
-		cb_cache_put(fb, dev->drm_fb_cache);
+		cb_slab_put(fb, dev->drm_fb_cache);
 	return NULL;
 }
 
@@ -2839,7 +3926,7 @@ static struct cb_buffer *drm_scanout_import_dmabuf(struct scanout *so,
 	s32 ret;
 	u32 handle = 0;
 
-	fb = cb_cache_get(dev->drm_fb_cache, true);
+	fb = cb_slab_get(dev->drm_fb_cache, true);
 	if (!fb)
 		goto err;
 
@@ -2872,6 +3959,15 @@ static struct cb_buffer *drm_scanout_import_dmabuf(struct scanout *so,
 	case CB_PIX_FMT_NV24:
 		fb->fourcc = DRM_FORMAT_NV24;
 		break;
+	case CB_PIX_FMT_RGB888:
+		fb->fourcc = DRM_FORMAT_RGB888;
+		break;
+	case CB_PIX_FMT_RGB565:
+		fb->fourcc = DRM_FORMAT_RGB565;
+		break;
+	case CB_PIX_FMT_YUYV:
+		fb->fourcc = DRM_FORMAT_YUYV;
+		break;
 	default:
 		drm_err("unsupported format.");
 		goto err;
@@ -2885,14 +3981,14 @@ static struct cb_buffer *drm_scanout_import_dmabuf(struct scanout *so,
 		goto err;
 	}
 	fb->handles[0] = handle;
-	if (info->pix_fmt == CB_PIX_FMT_ARGB8888 ||
-	    info->pix_fmt == CB_PIX_FMT_XRGB8888)
-		fb->handles[1] = fb->handles[2] = fb->handles[3] = 0;
-	else if (info->pix_fmt == CB_PIX_FMT_NV12 ||
-		 info->pix_fmt == CB_PIX_FMT_NV16 ||
-		 info->pix_fmt == CB_PIX_FMT_NV24) {
+	if (info->pix_fmt == CB_PIX_FMT_NV12 ||
+	    info->pix_fmt == CB_PIX_FMT_NV16 ||
+	    info->pix_fmt == CB_PIX_FMT_NV24) {
 		fb->handles[1] = fb->handles[0];
 		fb->handles[2] = fb->handles[3] = 0;
+	} else {
+		/* packed formats */
+		fb->handles[1] = fb->handles[2] = fb->handles[3] = 0;
 	}
 
 	drm_notice("width: %u, height: %u, fourcc: %4.4s, handles: %u,%u,%u,%u "
@@ -2935,7 +4031,7 @@ err:
 	}
 
 	if (fb)
-		cb_cache_put(fb, dev->drm_fb_cache);
+		cb_slab_put(fb, dev->drm_fb_cache);
 	return NULL;
 }
 #else
@@ -2953,7 +4049,7 @@ static struct cb_buffer *drm_scanout_import_dmabuf(struct scanout *so,
 		.fd = info->fd[0],
 	};
 
-	fb = cb_cache_get(dev->drm_fb_cache, true);
+	fb = cb_slab_get(dev->drm_fb_cache, true);
 	if (!fb)
 		goto err;
 
@@ -2981,8 +4077,14 @@ static struct cb_buffer *drm_scanout_import_dmabuf(struct scanout *so,
 		fb->fourcc = DRM_FORMAT_NV24;
 		break;
 	case CB_PIX_FMT_RGB888:
+		fb->fourcc = DRM_FORMAT_RGB888;
+		break;
 	case CB_PIX_FMT_RGB565:
+		fb->fourcc = DRM_FORMAT_RGB565;
+		break;
 	case CB_PIX_FMT_YUYV:
+		fb->fourcc = DRM_FORMAT_YUYV;
+		break;
 	case CB_PIX_FMT_YUV420:
 	case CB_PIX_FMT_YUV422:
 	case CB_PIX_FMT_YUV444:
@@ -2990,6 +4092,7 @@ static struct cb_buffer *drm_scanout_import_dmabuf(struct scanout *so,
 		drm_err("unsupported format.");
 		goto err;
 	}
+	import_data.format = fb->fourcc;
 
 	fb->bo = gbm_bo_import(dev->gbm,
 			       GBM_BO_IMPORT_FD, &import_data,
@@ -3032,7 +4135,7 @@ err:
 	}
 
 	if (fb)
-		cb_cache_put(fb, dev->drm_fb_cache);
+		cb_slab_put(fb, dev->drm_fb_cache);
 	return NULL;
 }
 #endif
@@ -3046,13 +4149,13 @@ static void drm_fb_destroy_surface_fb(struct gbm_bo *bo, void *data)
 		assert(fb->type == DRM_FB_TYPE_GBM_SURFACE);
 		if (fb->fb_id) {
 			drm_debug("Remove surface DRM FB");
-			drmModeRmFB(dev->fd, fb->fb_id);
+			drm_fb_rm(dev, fb->fb_id);
 		}
 		if (fb->destroy_surface_fb_cb) {
 			fb->destroy_surface_fb_cb(&fb->base,
 					fb->destroy_surface_fb_cb_userdata);
 		}
-		cb_cache_put(fb, dev->drm_fb_cache);
+		cb_slab_put(fb, dev->drm_fb_cache);
 	}
 }
 
@@ -3093,7 +4196,7 @@ static struct cb_buffer *drm_scanout_get_surface_buf(struct scanout *so,
 		return &fb->base;
 	}
 
-	fb = cb_cache_get(dev->drm_fb_cache, true);
+	fb = cb_slab_get(dev->drm_fb_cache, true);
 	if (!fb)
 		goto err;
 
@@ -3147,7 +4250,7 @@ err:
 	}
 
 	if (fb)
-		cb_cache_put(fb, dev->drm_fb_cache);
+		cb_slab_put(fb, dev->drm_fb_cache);
 	return NULL;
 }
 
@@ -3357,6 +4460,15 @@ drm_scanout_pipeline_create(struct scanout *so, struct pipeline *pipeline_cfg)
 	output->native_surface_destroy = drm_output_native_surface_destroy;
 	output->add_page_flip_notify = drm_output_add_page_flip_notify;
 	output->query_vblank = drm_output_query_vblank;
+	output->capture_enable = drm_output_capture_enable;
+	output->capture = drm_output_capture;
+	output->add_capture_notify = drm_output_add_capture_notify;
+	output->get_vblank_seq = drm_output_get_vblank_seq;
+	output->queue_vblank_seq = drm_output_queue_vblank_seq;
+	output->add_vblank_seq_notify = drm_output_add_vblank_seq_notify;
+	output->acquire_plane = drm_output_acquire_plane;
+	output->release_plane = drm_output_release_plane;
+	output->set_background_color = drm_output_set_background_color;
 
 	drm_info("Create pipeline complete");
 
@@ -3433,55 +4545,137 @@ err:
 	return ret;
 }
 
-static void drm_head_update(struct drm_scanout *dev)
+static void drm_head_reload_props(struct drm_head *head)
 {
-	struct drm_head *head;
-	bool connected;
+	struct drm_scanout *dev = head->dev;
 	drmModeObjectProperties *props;
 
-	list_for_each_entry(head, &dev->heads, link) {
-		connected = false;
-		if (head->connector) {
-			drmModeFreeConnector(head->connector);
-			head->connector = NULL;
-		}
+	drm_prop_finish(head->props, CONNECTOR_PROP_NR);
+	props = drmModeObjectGetProperties(dev->fd, head->connector_id,
+					   DRM_MODE_OBJECT_CONNECTOR);
+	if (!props) {
+		drm_err("failed to get object properties (%s)",strerror(errno));
+		return;
+	}
+	drm_prop_prepare(dev, connector_props, head->props,
+			 CONNECTOR_PROP_NR, props);
+	drmModeFreeObjectProperties(props);
+}
 
-		head->connector = drmModeGetConnector(dev->fd,
-						      head->connector_id);
-		if (!head->connector) {
-			drm_err("failed to get drm connector. (%s)",
-				strerror(errno));
-			continue;
-		}
+/* apply probe result in event loop thread */
+static void drm_head_apply_probe(struct drm_head *head,
+				 struct drm_probe_job *job)
+{
+	if (job->seq != head->probe_seq) {
+		drm_debug("drop stale probe result of connector %u",
+			  head->connector_id);
+		return;
+	}
 
-		if (head->connector->connection == DRM_MODE_CONNECTED)
-			connected = true;
-		if (head->base.connected != connected) {
-			drm_notice("head %u status changed (%s)",
-				   head->connector_id,
-				   connected ? "true" : "false");
-			head->base.connected = connected;
-			drm_prop_finish(head->props, CONNECTOR_PROP_NR);
-			props = drmModeObjectGetProperties(
-					dev->fd, head->connector_id,
-					DRM_MODE_OBJECT_CONNECTOR);
-			drm_prop_prepare(dev, connector_props, head->props,
-					 CONNECTOR_PROP_NR, props);
-			if (head->base.connected) {
-				drm_get_and_parse_edid(head, props);
-				if (head->edid.data && head->edid.length &&
-				    strlen(head->monitor_name)) {
-					head->base.monitor_name
-						= head->monitor_name;
-				}
-			} else {
-				memset(head->monitor_name, 0, MONITOR_NAME_LEN);
-			}
-			drmModeFreeObjectProperties(props);
-			if (head->base.connected)
-				drm_head_update_modes(head);
-			cb_signal_emit(&head->head_changed_signal, &head->base);
-		}
+	head->probing = false;
+
+	if (!job->connector) {
+		drm_err("failed to get drm connector %u", head->connector_id);
+		return;
+	}
+
+	if (head->connector)
+		drmModeFreeConnector(head->connector);
+	head->connector = job->connector;
+	job->connector = NULL;
+
+	if (head->connector->connection != DRM_MODE_CONNECTED) {
+		drm_notice("head %u is gone during probing",
+			   head->connector_id);
+		return;
+	}
+
+	drm_notice("head %u status changed (true)", head->connector_id);
+	head->base.connected = true;
+	drm_head_reload_props(head);
+	drm_head_set_edid(head, job->edid, job->edid_length);
+	job->edid = NULL;
+	drm_head_update_modes(head);
+	cb_signal_emit(&head->head_changed_signal, &head->base);
+}
+
+static s32 drm_probe_done_cb(s32 fd, u32 mask, void *data)
+{
+	struct drm_scanout *dev = data;
+	struct drm_probe_job *job, *next;
+	struct list_head results;
+	u64 val;
+
+	read(fd, &val, sizeof(val));
+
+	INIT_LIST_HEAD(&results);
+	pthread_mutex_lock(&dev->probe_mutex);
+	list_for_each_entry_safe(job, next, &dev->probe_results, link) {
+		list_del(&job->link);
+		list_add_tail(&job->link, &results);
+	}
+	pthread_mutex_unlock(&dev->probe_mutex);
+
+	list_for_each_entry_safe(job, next, &results, link) {
+		list_del(&job->link);
+		if (job->head)
+			drm_head_apply_probe(job->head, job);
+		drm_probe_job_free(job);
+	}
+
+	return 0;
+}
+
+/*
+ * Check connector status without probing.
+ * The kernel has already detected the connector before sending the
+ * hotplug uevent, so the current status is reliable. A full probe (modes
+ * and EDID) is only required for a new monitor, it is done by the hotplug
+ * worker.
+ */
+static void drm_head_check(struct drm_head *head)
+{
+	struct drm_scanout *dev = head->dev;
+	drmModeConnectorPtr conn;
+	bool connected;
+
+	conn = drmModeGetConnectorCurrent(dev->fd, head->connector_id);
+	if (!conn) {
+		drm_err("failed to get drm connector. (%s)", strerror(errno));
+		return;
+	}
+
+	connected = (conn->connection == DRM_MODE_CONNECTED);
+	drmModeFreeConnector(conn);
+
+	if (connected) {
+		if (head->base.connected || head->probing)
+			return;
+		drm_probe_queue(head);
+		return;
+	}
+
+	/* invalidate probe in progress */
+	head->probe_seq++;
+	head->probing = false;
+
+	if (!head->base.connected)
+		return;
+
+	drm_notice("head %u status changed (false)", head->connector_id);
+	head->base.connected = false;
+	memset(head->monitor_name, 0, MONITOR_NAME_LEN);
+	cb_signal_emit(&head->head_changed_signal, &head->base);
+}
+
+static void drm_head_update(struct drm_scanout *dev, u32 connector_id)
+{
+	struct drm_head *head;
+
+	list_for_each_entry(head, &dev->heads, link) {
+		if (connector_id && head->connector_id != connector_id)
+			continue;
+		drm_head_check(head);
 	}
 }
 
@@ -3491,6 +4685,7 @@ static s32 drm_udev_event_cb(s32 fd, u32 mask, void *data)
 	struct drm_scanout *dev = data;
 	const char *sysnum;
 	const char *val;
+	u32 connector_id = 0;
 
 	device = udev_monitor_receive_device(dev->udev_monitor);
 	sysnum = udev_device_get_sysnum(device);
@@ -3501,18 +4696,134 @@ static s32 drm_udev_event_cb(s32 fd, u32 mask, void *data)
 
 	val = udev_device_get_property_value(device, "HOTPLUG");
 	if (val && (!strcmp(val, "1"))) {
-		drm_head_update(dev);
+		/*
+		 * newer kernels tell which connector (and property) is
+		 * changed, otherwise all connectors have to be checked.
+		 */
+		val = udev_device_get_property_value(device, "CONNECTOR");
+		if (val)
+			connector_id = strtoul(val, NULL, 10);
+		val = udev_device_get_property_value(device, "PROPERTY");
+		drm_debug("hotplug event, connector: %u, property: %s",
+			  connector_id, val ? val : "none");
+		drm_head_update(dev, connector_id);
 	}
 	udev_device_unref(device);
 
 	return 0;
 }
 
+static void drm_writeback_destroy(struct drm_writeback *wb)
+{
+	if (!wb)
+		return;
+
+	if (wb->output)
+		wb->output->wb = NULL;
+
+	drm_prop_finish(wb->props, WRITEBACK_PROP_NR);
+	list_del(&wb->link);
+	free(wb->formats);
+	free(wb);
+}
+
+static struct drm_writeback *drm_writeback_create(struct drm_scanout *dev,
+						  drmModeConnectorPtr conn)
+{
+	struct drm_writeback *wb = NULL;
+	drmModeObjectProperties *props;
+	drmModePropertyBlobPtr blob = NULL;
+	drmModeEncoderPtr encoder;
+	u32 blob_id;
+	s32 i;
+
+	wb = calloc(1, sizeof(*wb));
+	if (!wb)
+		return NULL;
+
+	wb->dev = dev;
+	wb->connector_id = conn->connector_id;
+	INIT_LIST_HEAD(&wb->link);
+
+	for (i = 0; i < conn->count_encoders; i++) {
+		encoder = drmModeGetEncoder(dev->fd, conn->encoders[i]);
+		if (!encoder)
+			continue;
+		wb->possible_crtcs |= encoder->possible_crtcs;
+		drmModeFreeEncoder(encoder);
+	}
+
+	props = drmModeObjectGetProperties(dev->fd, wb->connector_id,
+					   DRM_MODE_OBJECT_CONNECTOR);
+	if (!props) {
+		drm_err("failed to get object properties (%s)",strerror(errno));
+		goto err;
+	}
+	drm_prop_prepare(dev, writeback_props, wb->props, WRITEBACK_PROP_NR,
+			 props);
+
+	blob_id = (u32)drm_get_prop_value(
+			&wb->props[WRITEBACK_PROP_PIXEL_FORMATS], props);
+	drmModeFreeObjectProperties(props);
+
+	if (blob_id != (u32)(-1))
+		blob = drmModeGetPropertyBlob(dev->fd, blob_id);
+	if (blob && blob->length) {
+		wb->formats = malloc(blob->length);
+		if (wb->formats) {
+			memcpy(wb->formats, blob->data, blob->length);
+			wb->count_formats = blob->length / sizeof(u32);
+		}
+	}
+	if (blob)
+		drmModeFreePropertyBlob(blob);
+
+	list_add_tail(&wb->link, &dev->writebacks);
+	drm_notice("writeback connector %u, possible crtcs: %08X, formats: %u",
+		   wb->connector_id, wb->possible_crtcs, wb->count_formats);
+
+	return wb;
+
+err:
+	free(wb);
+	return NULL;
+}
+
+static void drm_scanout_enumerate_writebacks(struct drm_scanout *dev)
+{
+	drmModeConnectorPtr conn;
+	s32 i;
+
+	for (i = 0; i < dev->res->count_connectors; i++) {
+		conn = drmModeGetConnectorCurrent(dev->fd,
+						  dev->res->connectors[i]);
+		if (!conn)
+			continue;
+		if (conn->connector_type == DRM_MODE_CONNECTOR_WRITEBACK)
+			drm_writeback_create(dev, conn);
+		drmModeFreeConnector(conn);
+	}
+}
+
+static void drm_slab_stats_dump(const char *name, void *cache)
+{
+	struct cb_slab_stats st;
+
+	if (!cache)
+		return;
+
+	cb_slab_get_stats(cache, &st);
+	drm_debug("%s cache: hits %lu misses %lu peak %u slabs %u/%u",
+		  name, st.hits, st.misses, st.peak, st.slabs, st.slabs_peak);
+}
+
 static void drm_scanout_destroy(struct scanout *so)
 {
 	struct drm_scanout *dev;
 	struct drm_output *output, *next_output;
 	struct drm_head *head, *next_head;
+	struct drm_writeback *wb, *next_wb;
+	struct drm_probe_job *job, *next_job;
 
 	if (!so)
 		return;
@@ -3536,6 +4847,34 @@ static void drm_scanout_destroy(struct scanout *so)
 		dev->drm_source = NULL;
 	}
 
+	if (dev->probe_thread_created) {
+		pthread_mutex_lock(&dev->probe_mutex);
+		dev->probe_exit = true;
+		pthread_cond_signal(&dev->probe_cond);
+		pthread_mutex_unlock(&dev->probe_mutex);
+		pthread_join(dev->probe_thread, NULL);
+		list_for_each_entry_safe(job, next_job, &dev->probe_jobs, link){
+			list_del(&job->link);
+			drm_probe_job_free(job);
+		}
+		list_for_each_entry_safe(job, next_job, &dev->probe_results,
+					 link) {
+			list_del(&job->link);
+			drm_probe_job_free(job);
+		}
+		dev->probe_thread_created = false;
+		pthread_cond_destroy(&dev->probe_cond);
+		pthread_mutex_destroy(&dev->probe_mutex);
+	}
+
+	if (dev->probe_source) {
+		cb_event_source_remove(dev->probe_source);
+		dev->probe_source = NULL;
+	}
+
+	if (dev->probe_efd >= 0)
+		close(dev->probe_efd);
+
 	list_for_each_entry_safe(output, next_output, &dev->outputs, link) {
 		drm_output_destroy(&output->base);
 	}
@@ -3544,9 +4883,26 @@ static void drm_scanout_destroy(struct scanout *so)
 		drm_head_destroy(&head->base);
 	}
 
+	list_for_each_entry_safe(wb, next_wb, &dev->writebacks, link) {
+		drm_writeback_destroy(wb);
+	}
+
 	if (dev->gbm)
 		gbm_device_destroy(dev->gbm);
 
+	/* flush deferred fb removal */
+	if (dev->reaper_created) {
+		pthread_mutex_lock(&dev->reaper_mutex);
+		dev->reaper_exit = true;
+		pthread_cond_signal(&dev->reaper_cond);
+		pthread_mutex_unlock(&dev->reaper_mutex);
+		pthread_join(dev->reaper_thread, NULL);
+		dev->reaper_created = false;
+		pthread_cond_destroy(&dev->reaper_cond);
+		pthread_mutex_destroy(&dev->reaper_mutex);
+	}
+	free(dev->reap_fb_ids);
+
 	if (dev->fd > 0) {
 		if (dev->res)
 			drmModeFreeResources(dev->res);
@@ -3555,14 +4911,15 @@ static void drm_scanout_destroy(struct scanout *so)
 		close(dev->fd);
 	}
 
-	if (dev->pls_cache)
-		cb_cache_destroy(dev->pls_cache);
-	if (dev->os_cache)
-		cb_cache_destroy(dev->os_cache);
+	drm_slab_stats_dump("fb", dev->drm_fb_cache);
+	drm_slab_stats_dump("pending state", dev->ps_cache);
+
+	if (dev->req)
+		drmModeAtomicFree(dev->req);
 	if (dev->ps_cache)
-		cb_cache_destroy(dev->ps_cache);
+		cb_slab_destroy(dev->ps_cache);
 	if (dev->drm_fb_cache)
-		cb_cache_destroy(dev->drm_fb_cache);
+		cb_slab_destroy(dev->drm_fb_cache);
 
 	free(dev);
 	drm_info("Destroy scanout device complete.");
@@ -3622,6 +4979,7 @@ static void page_flip_handler(s32 fd, u32 crtc_id, u32 frame, u32 sec, u32 usec,
 		if (output->crtc_id == crtc_id) {
 			drm_debug("send page flip to user");
 			output->page_flip_pending = false;
+			drm_output_planes_released(output);
 			drm_output_complete(output, sec, usec);
 			found = true;
 		}
@@ -3632,15 +4990,65 @@ static void page_flip_handler(s32 fd, u32 crtc_id, u32 frame, u32 sec, u32 usec,
 	}
 }
 
+static void crtc_sequence_handler(struct drm_scanout *dev, u32 crtc_id,
+				  u64 seq, s64 time_ns)
+{
+	struct drm_output *output;
+	struct vblank_seq vs;
+
+	drm_debug("CRTC_ID: %u vblank seq: %lu", crtc_id, seq);
+	vs.seq = seq;
+	vs.ts.tv_sec = time_ns / 1000000000ll;
+	vs.ts.tv_nsec = time_ns % 1000000000ll;
+	list_for_each_entry(output, &dev->outputs, link) {
+		if (output->crtc_id == crtc_id) {
+			cb_signal_emit(&output->vblank_seq_signal, &vs);
+			return;
+		}
+	}
+
+	drm_err("cannot find crtc_id %u", crtc_id);
+}
+
+/*
+ * drmHandleEvent of old libdrm drops CRTC sequence events,
+ * so parse drm events here.
+ */
 static s32 drm_event_cb(s32 fd, u32 mask, void *data)
 {
-	drmEventContext ctx;
+	struct drm_scanout *dev = data;
+	struct drm_event_crtc_sequence *seq;
+	struct drm_event_vblank *vbl;
+	struct drm_event *e;
+	u8 buf[1024];
+	s32 len, i;
+
+	len = read(fd, buf, sizeof(buf));
+	if (len < (s32)sizeof(*e))
+		return 0;
+
+	i = 0;
+	while (i + (s32)sizeof(*e) <= len) {
+		e = (struct drm_event *)(buf + i);
+		if (e->length < sizeof(*e) || i + e->length > len)
+			break;
+		switch (e->type) {
+		case DRM_EVENT_FLIP_COMPLETE:
+			vbl = (struct drm_event_vblank *)e;
+			page_flip_handler(fd, vbl->crtc_id, vbl->sequence,
+					  vbl->tv_sec, vbl->tv_usec, dev);
+			break;
+		case DRM_EVENT_CRTC_SEQUENCE:
+			seq = (struct drm_event_crtc_sequence *)e;
+			crtc_sequence_handler(dev, (u32)seq->user_data,
+					      seq->sequence, seq->time_ns);
+			break;
+		default:
+			break;
+		}
+		i += e->length;
+	}
 
-	memset(&ctx, 0, sizeof(ctx));
-	ctx.version = 3;
-	ctx.page_flip_handler2 = page_flip_handler;
-	ctx.vblank_handler = NULL;
-	drmHandleEvent(fd, &ctx);
 	return 0;
 }
 
@@ -3795,6 +5203,7 @@ out:
 struct scanout *scanout_create(const char *dev_path, struct cb_event_loop *loop)
 {
 	struct drm_scanout *dev = NULL;
+	bool wb_cap;
 	s32 ret;
 
 	drm_info("Create scanout device [%s] ...", dev_path);
@@ -3812,17 +5221,23 @@ struct scanout *scanout_create(const char *dev_path, struct cb_event_loop *loop)
 	if (!dev)
 		goto err;
 
-	dev->drm_fb_cache = cb_cache_create(sizeof(struct drm_fb), 128);
+	INIT_LIST_HEAD(&dev->outputs);
+	INIT_LIST_HEAD(&dev->heads);
+	INIT_LIST_HEAD(&dev->planes);
+	INIT_LIST_HEAD(&dev->writebacks);
+	INIT_LIST_HEAD(&dev->probe_jobs);
+	INIT_LIST_HEAD(&dev->probe_results);
+	dev->probe_efd = -1;
+
+	dev->drm_fb_cache = cb_slab_create(sizeof(struct drm_fb), 128, 0);
 	if (!dev->drm_fb_cache)
 		goto err;
-	dev->ps_cache = cb_cache_create(sizeof(struct drm_pending_state), 128);
+	dev->ps_cache = cb_slab_create(sizeof(struct drm_pending_state),
+				       128, 0);
 	if (!dev->ps_cache)
 		goto err;
-	dev->os_cache = cb_cache_create(sizeof(struct drm_output_state), 128);
-	if (!dev->os_cache)
-		goto err;
-	dev->pls_cache = cb_cache_create(sizeof(struct drm_plane_state), 128);
-	if (!dev->pls_cache)
+	dev->req = drmModeAtomicAlloc();
+	if (!dev->req)
 		goto err;
 
 	dev->loop = loop;
@@ -3853,6 +5268,11 @@ struct scanout *scanout_create(const char *dev_path, struct cb_event_loop *loop)
 		goto err;
 	}
 
+	wb_cap = drmSetClientCap(dev->fd, DRM_CLIENT_CAP_WRITEBACK_CONNECTORS,
+				 1) ? false : true;
+	if (!wb_cap)
+		drm_notice("DRM driver does not support writeback connectors.");
+
 	dev->res = drmModeGetResources(dev->fd);
 	if (!dev->res) {
 		drm_err("failed to get drm resource. (%s)", strerror(errno));
@@ -3866,6 +5286,9 @@ struct scanout *scanout_create(const char *dev_path, struct cb_event_loop *loop)
 		goto err;
 	}
 
+	if (wb_cap)
+		drm_scanout_enumerate_writebacks(dev);
+
 	dev->drm_source = cb_event_loop_add_fd(dev->loop, dev->fd,
 						CB_EVT_READABLE,
 						drm_event_cb, dev);
@@ -3899,9 +5322,37 @@ struct scanout *scanout_create(const char *dev_path, struct cb_event_loop *loop)
 	if (!dev->udev_drm_source)
 		goto err;
 
-	INIT_LIST_HEAD(&dev->outputs);
-	INIT_LIST_HEAD(&dev->heads);
-	INIT_LIST_HEAD(&dev->planes);
+	dev->probe_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (dev->probe_efd < 0) {
+		drm_err("failed to create eventfd. (%s)", strerror(errno));
+		goto err;
+	}
+
+	dev->probe_source = cb_event_loop_add_fd(dev->loop, dev->probe_efd,
+						 CB_EVT_READABLE,
+						 drm_probe_done_cb, dev);
+	if (!dev->probe_source)
+		goto err;
+
+	pthread_mutex_init(&dev->probe_mutex, NULL);
+	pthread_cond_init(&dev->probe_cond, NULL);
+	if (pthread_create(&dev->probe_thread, NULL, drm_probe_thread, dev)) {
+		drm_err("failed to create hotplug worker.");
+		pthread_cond_destroy(&dev->probe_cond);
+		pthread_mutex_destroy(&dev->probe_mutex);
+		goto err;
+	}
+	dev->probe_thread_created = true;
+
+	pthread_mutex_init(&dev->reaper_mutex, NULL);
+	pthread_cond_init(&dev->reaper_cond, NULL);
+	if (pthread_create(&dev->reaper_thread, NULL, drm_reaper_thread, dev)) {
+		drm_err("failed to create fb reaper.");
+		pthread_cond_destroy(&dev->reaper_cond);
+		pthread_mutex_destroy(&dev->reaper_mutex);
+		goto err;
+	}
+	dev->reaper_created = true;
 
 	dev->base.pipeline_create = drm_scanout_pipeline_create;
 	dev->base.pipeline_destroy = drm_scanout_pipeline_destroy;
@@ -3916,6 +5367,7 @@ struct scanout *scanout_create(const char *dev_path, struct cb_event_loop *loop)
 	dev->base.cursor_bo_update = drm_scanout_cursor_bo_update;
 	dev->base.scanout_data_alloc = drm_scanout_data_alloc;
 	dev->base.do_scanout = drm_do_scanout;
+	dev->base.test_scanout = drm_test_scanout;
 	dev->base.fill_scanout_data = drm_scanout_data_fill;
 	dev->base.get_native_dev = drm_scanout_get_native_dev;
 	dev->base.get_native_format = drm_scanout_get_native_format;
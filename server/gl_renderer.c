@@ -34,7 +34,9 @@
 #include <cube_utils.h>
 #include <cube_log.h>
 #include <cube_array.h>
+#include <cube_arena.h>
 #include <cube_region.h>
+#include <cube_tile_damage.h>
 #include <cube_shm.h>
 #include <cube_signal.h>
 #include <cube_compositor.h>
@@ -45,6 +47,14 @@ static enum cb_log_level egl_dbg = CB_LOG_NOTICE;
 
 #define LAYOUT_CHG_CNT 4
 
+/* upload damage above this many boxes is rounded to tiles */
+#define TEXTURE_DAMAGE_MAX_BOXES 16
+/* and the tiled damage is coarsened above this many boxes */
+#define TEXTURE_DAMAGE_TILED_MAX_BOXES 64
+
+/* stack boxes for the opaque / blended split of a view, per region */
+#define DRAW_VIEW_SCRATCH_BOXES 32
+
 #define gles_debug(fmt, ...) do { \
 	if (gles_dbg >= CB_LOG_DEBUG) { \
 		cb_tlog("[GLES][DEBUG ] " fmt, ##__VA_ARGS__); \
@@ -106,6 +116,7 @@ struct gl_shader {
 	GLint tex_uniforms[3];
 	GLint alpha_uniform;
 	GLint color_uniform;
+	GLint tile_uniform;
 	const char *vertex_source, *fragment_source;
 };
 
@@ -120,6 +131,8 @@ struct gl_renderer {
 
 	struct cb_array vertices;
 	struct cb_array vtxcnt;
+	/* scratch memory of one output repaint */
+	void *frame_arena;
 
 	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture_2d;
 	PFNEGLCREATEIMAGEKHRPROC create_image;
@@ -137,9 +150,13 @@ struct gl_renderer {
 	struct gl_shader texture_shader_rgba;
 	struct gl_shader texture_shader_egl_external;
 	struct gl_shader texture_shader_rgbx;
+	struct gl_shader texture_shader_bgrx;
 	struct gl_shader texture_shader_y_u_v;
 	struct gl_shader texture_shader_y_uv;
 	struct gl_shader texture_shader_y_xuxv;
+	struct gl_shader texture_shader_rgba_tile;
+	struct gl_shader texture_shader_rgbx_tile;
+	struct gl_shader solid_shader;
 	struct gl_shader *current_shader;
 
 	struct cb_signal destroy_signal;
@@ -207,6 +224,54 @@ static const char texture_fragment_shader_rgbx[] =
 	"   gl_FragColor.a = alpha;\n"
 	;
 
+/* DRM RGB888 is B, G, R in memory, GLES2 cannot upload BGR */
+static const char texture_fragment_shader_bgrx[] =
+	"precision mediump float;\n"
+	"varying vec2 v_texcoord;\n"
+	"uniform sampler2D tex;\n"
+	"uniform float alpha;\n"
+	"void main()\n"
+	"{\n"
+	"   gl_FragColor.rgb = alpha * texture2D(tex, v_texcoord).bgr\n;"
+	"   gl_FragColor.a = alpha;\n"
+	;
+
+/* tiled surface: repeat the texture's used area over the view */
+static const char texture_fragment_shader_rgba_tile[] =
+	"precision mediump float;\n"
+	"varying vec2 v_texcoord;\n"
+	"uniform sampler2D tex;\n"
+	"uniform vec2 tile;\n"
+	"uniform float alpha;\n"
+	"void main()\n"
+	"{\n"
+	"   vec2 tc = mod(v_texcoord, tile);\n"
+	"   gl_FragColor = alpha * texture2D(tex, tc)\n;"
+	;
+
+static const char texture_fragment_shader_rgbx_tile[] =
+	"precision mediump float;\n"
+	"varying vec2 v_texcoord;\n"
+	"uniform sampler2D tex;\n"
+	"uniform vec2 tile;\n"
+	"uniform float alpha;\n"
+	"void main()\n"
+	"{\n"
+	"   vec2 tc = mod(v_texcoord, tile);\n"
+	"   gl_FragColor.rgb = alpha * texture2D(tex, tc).rgb\n;"
+	"   gl_FragColor.a = alpha;\n"
+	;
+
+/* solid color surface, color is premultiplied */
+static const char solid_fragment_shader[] =
+	"precision mediump float;\n"
+	"uniform vec4 color;\n"
+	"uniform float alpha;\n"
+	"void main()\n"
+	"{\n"
+	"   gl_FragColor = alpha * color\n;"
+	;
+
 static const char texture_fragment_shader_egl_external[] =
 	"#extension GL_OES_EGL_image_external : require\n"
 	"precision mediump float;\n"
@@ -282,12 +347,16 @@ static const EGLint gl_opaque_attribs[] = {
 
 struct gl_surface_state {
 	GLfloat color[4];
+	/* used part of the texture in texcoord units, for tiled surface */
+	GLfloat tile[2];
 	struct gl_shader *shader;
 
 	GLuint textures[3];
 	s32 count_textures;
 	bool needs_full_upload;
 	struct cb_region texture_damage;
+	/* texture_damage rounded to tiles when it is scattered */
+	struct cb_tile_damage tile_damage;
 
 	GLenum gl_format[3];
 	GLenum gl_pixel_type;
@@ -319,6 +388,10 @@ struct gl_output_state {
 	struct gl_renderer *r;
 	struct cb_rect render_area;
 	u32 disp_w, disp_h;
+	/* egl surface's height, may be larger than the drawn disp_h */
+	s32 surf_h;
+	/* enum cb_output_transform */
+	u32 transform;
 	/* a count to set all surface buffer with new view port */
 	s32 layout_changed;
 };
@@ -368,6 +441,7 @@ static void gl_renderer_destroy(struct renderer *renderer)
 	eglReleaseThread();
 	cb_array_release(&r->vertices);
 	cb_array_release(&r->vtxcnt);
+	cb_arena_destroy(r->frame_arena);
 	free(r);
 }
 
@@ -720,6 +794,9 @@ static void set_shaders(struct gl_renderer *r)
 	r->texture_shader_rgbx.vertex_source = vertex_shader;
 	r->texture_shader_rgbx.fragment_source = texture_fragment_shader_rgbx;
 
+	r->texture_shader_bgrx.vertex_source = vertex_shader;
+	r->texture_shader_bgrx.fragment_source = texture_fragment_shader_bgrx;
+
 	r->texture_shader_y_u_v.vertex_source = vertex_shader;
 	r->texture_shader_y_u_v.fragment_source =
 						texture_fragment_shader_y_u_v;
@@ -730,6 +807,17 @@ static void set_shaders(struct gl_renderer *r)
 	r->texture_shader_y_xuxv.vertex_source = vertex_shader;
 	r->texture_shader_y_xuxv.fragment_source =
 						texture_fragment_shader_y_xuxv;
+
+	r->texture_shader_rgba_tile.vertex_source = vertex_shader;
+	r->texture_shader_rgba_tile.fragment_source =
+					texture_fragment_shader_rgba_tile;
+
+	r->texture_shader_rgbx_tile.vertex_source = vertex_shader;
+	r->texture_shader_rgbx_tile.fragment_source =
+					texture_fragment_shader_rgbx_tile;
+
+	r->solid_shader.vertex_source = vertex_shader;
+	r->solid_shader.fragment_source = solid_fragment_shader;
 }
 
 static s32 gl_setup(struct gl_renderer *r, EGLSurface egl_surface)
@@ -849,6 +937,9 @@ static struct cb_buffer *gl_import_dmabuf(struct renderer *renderer,
 
 	if (info->pix_fmt != CB_PIX_FMT_ARGB8888
 	    && info->pix_fmt != CB_PIX_FMT_XRGB8888
+	    && info->pix_fmt != CB_PIX_FMT_RGB888
+	    && info->pix_fmt != CB_PIX_FMT_RGB565
+	    && info->pix_fmt != CB_PIX_FMT_YUYV
 	    && info->pix_fmt != CB_PIX_FMT_NV12
 	    && info->pix_fmt != CB_PIX_FMT_NV16) {
 		egl_err("cannot support pixel fmt %u", info->pix_fmt);
@@ -862,7 +953,9 @@ static struct cb_buffer *gl_import_dmabuf(struct renderer *renderer,
 	dma_buf->base.info = *info;
 
 	if (info->pix_fmt == CB_PIX_FMT_ARGB8888
-	    || info->pix_fmt == CB_PIX_FMT_XRGB8888) {
+	    || info->pix_fmt == CB_PIX_FMT_XRGB8888
+	    || info->pix_fmt == CB_PIX_FMT_RGB888
+	    || info->pix_fmt == CB_PIX_FMT_RGB565) {
 		attribs[attrib++] = EGL_WIDTH;
 		attribs[attrib++] = info->width;
 		attribs[attrib++] = EGL_HEIGHT;
@@ -879,6 +972,27 @@ static struct cb_buffer *gl_import_dmabuf(struct renderer *renderer,
 		egl_info("w = %u h = %u fd = %d pixel_fmt = %u stride = %u\n",
 			 info->width, info->height, info->fd[0],
 			 info->pix_fmt, info->strides[0]);
+	} else if (info->pix_fmt == CB_PIX_FMT_YUYV) {
+		attribs[attrib++] = EGL_WIDTH;
+		attribs[attrib++] = info->width;
+		attribs[attrib++] = EGL_HEIGHT;
+		attribs[attrib++] = info->height;
+		attribs[attrib++] = EGL_LINUX_DRM_FOURCC_EXT;
+		attribs[attrib++] = cb_pix_fmt_to_fourcc(info->pix_fmt);
+		attribs[attrib++] = EGL_DMA_BUF_PLANE0_FD_EXT;
+		attribs[attrib++] = info->fd[0];
+		attribs[attrib++] = EGL_DMA_BUF_PLANE0_OFFSET_EXT;
+		attribs[attrib++] = info->offsets[0];
+		attribs[attrib++] = EGL_DMA_BUF_PLANE0_PITCH_EXT;
+		attribs[attrib++] = info->strides[0];
+		attribs[attrib++] = EGL_YUV_COLOR_SPACE_HINT_EXT;
+		attribs[attrib++] = EGL_ITU_REC709_EXT;
+		attribs[attrib++] = EGL_SAMPLE_RANGE_HINT_EXT;
+		attribs[attrib++] = EGL_YUV_FULL_RANGE_EXT;
+		attribs[attrib++] = EGL_NONE;
+		egl_info("w = %u h = %u fd = %d pixel_fmt = %u stride = %u\n",
+			 info->width, info->height, info->fd[0],
+			 info->pix_fmt, info->strides[0]);
 	} else if (info->pix_fmt == CB_PIX_FMT_NV12 ||
 		   info->pix_fmt == CB_PIX_FMT_NV16) {
 		attribs[attrib++] = EGL_WIDTH;
@@ -970,6 +1084,23 @@ static void gl_output_layout_changed(struct r_output *output,
 	memcpy(&go->render_area, render_area, sizeof(*render_area));
 }
 
+static void gl_output_set_transform(struct r_output *output, u32 transform)
+{
+	struct gl_output_state *go = to_glo(output);
+
+	if (go->transform == transform)
+		return;
+
+	go->layout_changed = LAYOUT_CHG_CNT;
+	go->transform = transform;
+}
+
+static bool gl_output_transposed(struct gl_output_state *go)
+{
+	return (go->transform == CB_TRANSFORM_90 ||
+		go->transform == CB_TRANSFORM_270);
+}
+
 /* switch surface */
 static s32 gl_switch_output(struct gl_output_state *go)
 {
@@ -1046,6 +1177,7 @@ static s32 load_shader(struct gl_shader *shader, struct gl_renderer *r,
 	shader->tex_uniforms[2] = glGetUniformLocation(shader->program, "tex2");
 	shader->alpha_uniform = glGetUniformLocation(shader->program, "alpha");
 	shader->color_uniform = glGetUniformLocation(shader->program, "color");
+	shader->tile_uniform = glGetUniformLocation(shader->program, "tile");
 
 	return 0;
 }
@@ -1076,6 +1208,7 @@ static void gl_surface_state_destroy(struct gl_surface_state *gs)
 			gs->surface->renderer_state = NULL;
 		glDeleteTextures(gs->count_textures, gs->textures);
 		cb_region_fini(&gs->texture_damage);
+		cb_tile_damage_fini(&gs->tile_damage);
 		list_del(&gs->renderer_destroy_listener.link);
 		INIT_LIST_HEAD(&gs->renderer_destroy_listener.link);
 		list_del(&gs->surface_destroy_listener.link);
@@ -1115,6 +1248,7 @@ static s32 gl_surface_state_create(struct gl_renderer *r,
 	gs->y_inverted = true;
 	gs->surface = surface;
 	cb_region_init(&gs->texture_damage);
+	cb_tile_damage_init(&gs->tile_damage, 0, 0, CB_TILE_SHIFT_DEFAULT);
 
 	gs->surface_destroy_listener.notify =
 		surface_state_handle_surface_destroy;
@@ -1137,6 +1271,34 @@ static struct gl_surface_state *get_surface_state(struct gl_renderer *r,
 	return (struct gl_surface_state *)surface->renderer_state;
 }
 
+/* rotate clip space counter-clockwise, m is column major */
+static void transform_projection(GLfloat *m, u32 transform)
+{
+	GLfloat x, y;
+	s32 i;
+
+	for (i = 0; i < 4; i++) {
+		x = m[i * 4];
+		y = m[i * 4 + 1];
+		switch (transform) {
+		case CB_TRANSFORM_90:
+			m[i * 4] = -y;
+			m[i * 4 + 1] = x;
+			break;
+		case CB_TRANSFORM_180:
+			m[i * 4] = -x;
+			m[i * 4 + 1] = -y;
+			break;
+		case CB_TRANSFORM_270:
+			m[i * 4] = y;
+			m[i * 4 + 1] = -x;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
 static void shader_uniforms(struct gl_shader *shader, struct cb_view *v,
 			    struct gl_output_state *go)
 {
@@ -1169,6 +1331,11 @@ static void shader_uniforms(struct gl_shader *shader, struct cb_view *v,
 	projmat_normal[0] /= go->render_area.w;
 	projmat_normal[5] /= go->render_area.h;
 
+	if (go->transform != CB_TRANSFORM_NORMAL) {
+		transform_projection(projmat_yinvert, go->transform);
+		transform_projection(projmat_normal, go->transform);
+	}
+
 	if (gs->y_inverted) {
 		glUniformMatrix4fv(shader->proj_uniform,
 				   1, GL_FALSE, projmat_yinvert);
@@ -1177,6 +1344,7 @@ static void shader_uniforms(struct gl_shader *shader, struct cb_view *v,
 				   1, GL_FALSE, projmat_normal);
 	}
 	glUniform4fv(shader->color_uniform, 1, gs->color);
+	glUniform2fv(shader->tile_uniform, 1, gs->tile);
 	glUniform1f(shader->alpha_uniform, v->alpha);
 
 	for (i = 0; i < gs->count_textures; i++)
@@ -1195,7 +1363,8 @@ static s32 merge_down(struct cb_box *a, struct cb_box *b, struct cb_box *merge)
 	return 0;
 }
 
-static s32 compress_bands(struct cb_box *inboxes, s32 count_in,
+static s32 compress_bands(struct gl_renderer *r,
+			  struct cb_box *inboxes, s32 count_in,
 			  struct cb_box **outboxes)
 {
 	s32 merged = 0;
@@ -1207,7 +1376,11 @@ static s32 compress_bands(struct cb_box *inboxes, s32 count_in,
 		return 0;
 	}
 
-	out = calloc(count_in, sizeof(struct cb_box));
+	out = cb_arena_alloc(r->frame_arena, count_in * sizeof(struct cb_box));
+	if (!out) {
+		*outboxes = NULL;
+		return 0;
+	}
 	out[0] = inboxes[0];
 	count_out = 1;
 	for (i = 1; i < count_in; i++) {
@@ -1303,7 +1476,6 @@ static s32 texture_region(struct gl_renderer *r,
 	struct gl_surface_state *gs = get_surface_state(r, view->surface);
 	s32 count_boxes, count_surf_boxes, count_raw_boxes, i, j, k;
 	s32 n;
-	bool use_band_compression;
 	struct cb_box *raw_boxes, *boxes, *surf_boxes, *box, *surf_box;
 	u32 count_vtx = 0, *vtxcnt;
 	GLfloat *v, inv_w, inv_h;
@@ -1314,12 +1486,12 @@ static s32 texture_region(struct gl_renderer *r,
 	surf_boxes = cb_region_boxes(surf_region, &count_surf_boxes);
 
 	if (count_raw_boxes < 4) {
-		use_band_compression = false;
 		count_boxes = count_raw_boxes;
 		boxes = raw_boxes;
 	} else {
-		use_band_compression = true;
-		count_boxes = compress_bands(raw_boxes, count_raw_boxes,&boxes);
+		/* released with the frame arena */
+		count_boxes = compress_bands(r, raw_boxes, count_raw_boxes,
+					     &boxes);
 	}
 
 	v = cb_array_add(&r->vertices,
@@ -1362,9 +1534,6 @@ static s32 texture_region(struct gl_renderer *r,
 		}
 	}
 
-	if (use_band_compression)
-		free(boxes);
-
 	return count_vtx;
 }
 
@@ -1403,6 +1572,25 @@ static void repaint_region(struct gl_renderer *r,
 	r->vtxcnt.size = 0;
 }
 
+/* whether a solid or tiled surface covers its whole view opaquely */
+static bool fill_is_opaque(struct gl_surface_state *gs,
+			   struct cb_surface *surface)
+{
+	struct cb_box *ext;
+
+	if (gs->buf_type == CB_BUF_TYPE_SOLID)
+		return gs->color[3] >= 1.0f;
+
+	if (surface->is_opaque)
+		return true;
+	if (!cb_region_is_not_empty(&surface->opaque))
+		return false;
+	ext = cb_region_extents(&surface->opaque);
+	return ext->p1.x <= 0 && ext->p1.y <= 0 &&
+	       ext->p2.x >= (s32)surface->width &&
+	       ext->p2.y >= (s32)surface->height;
+}
+
 static bool draw_view(struct cb_view *v, struct gl_output_state *go,
 		      struct cb_region *damage)
 {
@@ -1410,6 +1598,9 @@ static bool draw_view(struct cb_view *v, struct gl_output_state *go,
 	struct gl_surface_state *gs = get_surface_state(r, v->surface);
 	struct cb_region surface_opaque, surface_blend;
 	struct cb_region view_area, output_area;
+	/* the surface's opaque region is as scattered as the client made it */
+	CB_REGION_STORAGE(DRAW_VIEW_SCRATCH_BOXES) opaque_scratch;
+	CB_REGION_STORAGE(DRAW_VIEW_SCRATCH_BOXES) blend_scratch;
 	/*
 	struct cb_box *boxes;
 	*/
@@ -1481,7 +1672,8 @@ static bool draw_view(struct cb_view *v, struct gl_output_state *go,
 	use_shader(r, gs->shader);
 	shader_uniforms(gs->shader, v, go);
 
-	filter = GL_LINEAR; /* GL_NEAREST */
+	/* linear filter would bleed the tile's opposite edge in */
+	filter = v->surface->tiled ? GL_NEAREST : GL_LINEAR;
 	for (i = 0; i < gs->count_textures; i++) {
 		glActiveTexture(GL_TEXTURE0 + i);
 		glBindTexture(gs->target, gs->textures[i]);
@@ -1489,17 +1681,33 @@ static bool draw_view(struct cb_view *v, struct gl_output_state *go,
 		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, filter);
 	}
 
-	cb_region_init_rect(&surface_blend, 0, 0, v->surface->width,
-			    v->surface->height);
-	cb_region_subtract(&surface_blend, &surface_blend, &v->surface->opaque);
-
-	cb_region_init(&surface_opaque);
-	cb_region_copy(&surface_opaque, &v->surface->opaque);
+	cb_region_init_with_scratch(&surface_opaque, &opaque_scratch,
+				    ARRAY_SIZE(opaque_scratch.boxes));
+	cb_region_init_with_scratch(&surface_blend, &blend_scratch,
+				    ARRAY_SIZE(blend_scratch.boxes));
+	if (gs->buf_type == CB_BUF_TYPE_SOLID || v->surface->tiled) {
+		/* the content fills the whole view, not the buffer size */
+		if (fill_is_opaque(gs, v->surface))
+			cb_region_union_rect(&surface_opaque, &surface_opaque,
+					     0, 0, v->area.w, v->area.h);
+		else
+			cb_region_union_rect(&surface_blend, &surface_blend,
+					     0, 0, v->area.w, v->area.h);
+	} else {
+		cb_region_union_rect(&surface_blend, &surface_blend, 0, 0,
+				     v->surface->width, v->surface->height);
+		cb_region_subtract(&surface_blend, &surface_blend,
+				   &v->surface->opaque);
+		cb_region_copy(&surface_opaque, &v->surface->opaque);
+	}
 
 	if (cb_region_is_not_empty(&surface_opaque)) {
 		if (gs->shader == &r->texture_shader_rgba) {
 			use_shader(r, &r->texture_shader_rgbx);
 			shader_uniforms(&r->texture_shader_rgbx, v, go);
+		} else if (gs->shader == &r->texture_shader_rgba_tile) {
+			use_shader(r, &r->texture_shader_rgbx_tile);
+			shader_uniforms(&r->texture_shader_rgbx_tile, v, go);
 		}
 		if (v->alpha < 1.0f)
 			glEnable(GL_BLEND);
@@ -1536,7 +1744,8 @@ static bool repaint_views(struct gl_output_state *go, struct cb_region *damage,
 	list_for_each_entry_reverse(view, views, link) {
 		if (!(view->output_mask & (1U << go->pipe)))
 			continue;
-		if (view->direct_show) /* not renderable surface */
+		/* not renderable surface or shown on overlay */
+		if (view->direct_show || view->blit)
 			continue;
 		gles_debug("view %p", view);
 		if (draw_view(view, go, damage)) {
@@ -1556,22 +1765,31 @@ static bool gl_output_repaint(struct r_output *output, struct list_head *views)
 	struct cb_region total_damage;
 	EGLBoolean ret;
 	static s32 errored = 0;
-	s32 left, top, calc;
-	u32 width, height;
+	s32 left, top, calc, y_off;
+	u32 width, height, disp_w, disp_h;
 	bool repainted;
 
-	calc = go->disp_w * area->h / area->w;
-	if (calc <= go->disp_h) {
+	/* letterbox on the rotated screen */
+	if (gl_output_transposed(go)) {
+		disp_w = go->disp_h;
+		disp_h = go->disp_w;
+	} else {
+		disp_w = go->disp_w;
+		disp_h = go->disp_h;
+	}
+
+	calc = disp_w * area->h / area->w;
+	if (calc <= disp_h) {
 		left = 0;
-		top = (go->disp_h - calc) / 2;
-		width = go->disp_w;
+		top = (disp_h - calc) / 2;
+		width = disp_w;
 		height = calc;
 	} else {
-		calc = area->w * go->disp_h / area->h;
-		left = (go->disp_w - calc) / 2;
+		calc = area->w * disp_h / area->h;
+		left = (disp_w - calc) / 2;
 		top = 0;
 		width = calc;
-		height = go->disp_h;
+		height = disp_h;
 	}
 
 	if (gl_switch_output(go) < 0)
@@ -1595,7 +1813,17 @@ static bool gl_output_repaint(struct r_output *output, struct list_head *views)
 		go->layout_changed--;
 	}
 
-	glViewport(left, top, width, height);
+	/*
+	 * display area sits on the top-left of the surface when it is drawn
+	 * at a reduced scale, GL's origin is the bottom-left.
+	 */
+	y_off = go->surf_h - go->disp_h;
+
+	/* the border is centered, so is the rotated view port */
+	if (gl_output_transposed(go))
+		glViewport(top, y_off + left, height, width);
+	else
+		glViewport(left, y_off + top, width, height);
 
 	gles_debug("Output[%d] View %d,%d %ux%u %ux%u", go->pipe,
 		   left, top, width, height,
@@ -1604,6 +1832,7 @@ static bool gl_output_repaint(struct r_output *output, struct list_head *views)
 	cb_region_init_rect(&total_damage, 0, 0, area->w, area->h);
 	repainted = repaint_views(go, &total_damage, views);
 	cb_region_fini(&total_damage);
+	cb_arena_reset(r->frame_arena);
 	if (!repainted)
 		return false;
 	/* TODO send frame signal */
@@ -1706,11 +1935,15 @@ static struct r_output *gl_output_create(struct renderer *renderer,
 	go->layout_changed = LAYOUT_CHG_CNT;
 	go->disp_w = disp_w;
 	go->disp_h = disp_h;
+	if (!eglQuerySurface(r->egl_display, egl_surface, EGL_HEIGHT,
+			     &go->surf_h))
+		go->surf_h = disp_h;
 	memcpy(&go->render_area, render_area, sizeof(*render_area));
 
 	go->base.destroy = gl_output_destroy;
 	go->base.repaint = gl_output_repaint;
 	go->base.layout_changed = gl_output_layout_changed;
+	go->base.set_transform = gl_output_set_transform;
 	/* switch to new context ensure flush damage succesful */
 	if (gl_switch_output(go) < 0) {
 		eglDestroySurface(r->egl_display, egl_surface);
@@ -1758,8 +1991,16 @@ static void gl_attach_dma_buffer(struct gl_renderer *r,
 		surface->is_opaque = false;
 		gs->shader = &r->texture_shader_rgba;
 		gs->pitch = buffer->info.strides[0] / 4;
+	} else if (buffer->info.pix_fmt == CB_PIX_FMT_RGB888
+		|| buffer->info.pix_fmt == CB_PIX_FMT_RGB565) {
+		/* the EGL image is sampled as RGB whatever its layout */
+		gs->target = GL_TEXTURE_2D;
+		surface->is_opaque = true;
+		gs->shader = &r->texture_shader_rgbx;
+		gs->pitch = buffer->info.width;
 	} else if (buffer->info.pix_fmt == CB_PIX_FMT_NV12
-	        || buffer->info.pix_fmt == CB_PIX_FMT_NV16) {
+	        || buffer->info.pix_fmt == CB_PIX_FMT_NV16
+	        || buffer->info.pix_fmt == CB_PIX_FMT_YUYV) {
 		gs->target = GL_TEXTURE_EXTERNAL_OES;
 		surface->is_opaque = true;
 		gs->shader = &r->texture_shader_egl_external;
@@ -1778,6 +2019,23 @@ static void gl_attach_dma_buffer(struct gl_renderer *r,
 	gs->surface = surface;
 }
 
+/* bytes per pixel of the first plane, as counted by GL_UNPACK_ROW_LENGTH */
+static s32 shm_format_cpp(u32 pix_fmt)
+{
+	switch (pix_fmt) {
+	case CB_PIX_FMT_XRGB8888:
+	case CB_PIX_FMT_ARGB8888:
+		return 4;
+	case CB_PIX_FMT_RGB888:
+		return 3;
+	case CB_PIX_FMT_RGB565:
+	case CB_PIX_FMT_YUYV:
+		return 2;
+	default:
+		return 1;
+	}
+}
+
 static void gl_attach_shm_buffer(struct gl_renderer *r,
 				 struct cb_surface *surface,
 				 struct cb_buffer *buffer)
@@ -1787,6 +2045,15 @@ static void gl_attach_shm_buffer(struct gl_renderer *r,
 	GLenum gl_pixel_type;
 	s32 pitch;
 	s32 count_planes;
+	s32 cpp;
+
+	/* row length is given in pixels, a partial pixel would skew rows */
+	cpp = shm_format_cpp(buffer->info.pix_fmt);
+	if (buffer->info.strides[0] % cpp) {
+		gles_err("stride %u is not a multiple of %d for format %u",
+			 buffer->info.strides[0], cpp, buffer->info.pix_fmt);
+		return;
+	}
 
 	count_planes = 1;
 	gs->offset[0] = 0;
@@ -1812,6 +2079,39 @@ static void gl_attach_shm_buffer(struct gl_renderer *r,
 		gl_pixel_type = GL_UNSIGNED_BYTE;
 		surface->is_opaque = false;
 		break;
+	case CB_PIX_FMT_RGB565:
+		gs->shader = &r->texture_shader_rgbx;
+		pitch = buffer->info.strides[0] / 2;
+		gl_format[0] = GL_RGB;
+		gl_pixel_type = GL_UNSIGNED_SHORT_5_6_5;
+		surface->is_opaque = true;
+		break;
+	case CB_PIX_FMT_RGB888:
+		gs->shader = &r->texture_shader_bgrx;
+		pitch = buffer->info.strides[0] / 3;
+		gl_format[0] = GL_RGB;
+		gl_pixel_type = GL_UNSIGNED_BYTE;
+		surface->is_opaque = true;
+		break;
+	case CB_PIX_FMT_YUYV:
+		/*
+		 * the same data is sampled twice: as 2 byte texels for Y and
+		 * as Y0 U Y1 V texels of half width for the chroma.
+		 */
+		gs->shader = &r->texture_shader_y_xuxv;
+		pitch = buffer->info.strides[0] / 2;
+		gl_pixel_type = GL_UNSIGNED_BYTE;
+		count_planes = 2;
+		gs->offset[1] = 0;
+		gs->hsub[1] = 2;
+		gs->vsub[1] = 1;
+		if (r->support_texture_rg)
+			gl_format[0] = GL_RG8_EXT;
+		else
+			gl_format[0] = GL_LUMINANCE_ALPHA;
+		gl_format[1] = GL_RGBA;
+		surface->is_opaque = true;
+		break;
 	case CB_PIX_FMT_NV12:
 		pitch = buffer->info.strides[0];
 		gl_pixel_type = GL_UNSIGNED_BYTE;
@@ -1948,6 +2248,19 @@ static void gl_attach_shm_buffer(struct gl_renderer *r,
 		return;
 	}
 
+	/* only packed RGB can be repeated without per-plane coordinates */
+	if (surface->tiled) {
+		if (gs->shader == &r->texture_shader_rgba)
+			gs->shader = &r->texture_shader_rgba_tile;
+		else if (gs->shader == &r->texture_shader_rgbx)
+			gs->shader = &r->texture_shader_rgbx_tile;
+		else
+			gles_warn("tiled surface with format %u is not "
+				  "repeated", buffer->info.pix_fmt);
+		gs->tile[0] = (GLfloat)buffer->info.width / pitch;
+		gs->tile[1] = 1.0f;
+	}
+
 	if (pitch != gs->pitch
 	    || buffer->info.height != gs->h
 	    || gl_format[0] != gs->gl_format[0]
@@ -1970,6 +2283,30 @@ static void gl_attach_shm_buffer(struct gl_renderer *r,
 	}
 }
 
+static void gl_attach_solid_buffer(struct gl_renderer *r,
+				   struct cb_surface *surface,
+				   struct cb_buffer *buffer)
+{
+	struct gl_surface_state *gs = get_surface_state(r, surface);
+	GLfloat a = ((buffer->info.color >> 24) & 0xFF) / 255.0f;
+
+	if (gs->count_textures) {
+		glDeleteTextures(gs->count_textures, gs->textures);
+		gs->count_textures = 0;
+	}
+	gs->shader = &r->solid_shader;
+	gs->color[0] = ((buffer->info.color >> 16) & 0xFF) / 255.0f * a;
+	gs->color[1] = ((buffer->info.color >> 8) & 0xFF) / 255.0f * a;
+	gs->color[2] = (buffer->info.color & 0xFF) / 255.0f * a;
+	gs->color[3] = a;
+	gs->pitch = 1;
+	gs->h = 1;
+	gs->y_inverted = true;
+	gs->buf_type = CB_BUF_TYPE_SOLID;
+	gs->surface = surface;
+	surface->is_opaque = (a >= 1.0f);
+}
+
 static void gl_attach_buffer(struct renderer *renderer,
 			     struct cb_surface *surface,
 			     struct cb_buffer *buffer)
@@ -1991,6 +2328,9 @@ static void gl_attach_buffer(struct renderer *renderer,
 	if (buffer->info.type == CB_BUF_TYPE_SHM) {
 		gl_attach_shm_buffer(r, surface, buffer);
 		gs->buffer = buffer;
+	} else if (buffer->info.type == CB_BUF_TYPE_SOLID) {
+		gl_attach_solid_buffer(r, surface, buffer);
+		gs->buffer = buffer;
 	} else if (buffer->info.type == CB_BUF_TYPE_DMA) {
 		gl_attach_dma_buffer(r, surface, buffer);
 		gs->buffer = buffer;
@@ -2041,6 +2381,9 @@ static void gl_flush_damage(struct renderer *renderer,
 	data = shm_buffer->shm.map;
 	assert(data);
 
+	/* rows are tightly packed at strides[0], which need not be 4 aligned */
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
 	if (!r->support_unpack_subimage) {
 		/* begin access buffer */
 		for (j = 0; j < gs->count_textures; j++) {
@@ -2058,6 +2401,35 @@ static void gl_flush_damage(struct renderer *renderer,
 		goto done;
 	}
 
+	if (!gs->needs_full_upload &&
+	    cb_region_count_boxes(&gs->texture_damage)
+			> TEXTURE_DAMAGE_MAX_BOXES) {
+		/*
+		 * one upload per damaged tile run instead of per box, without
+		 * a tile map of the buffer size the exact damage is kept.
+		 */
+		ret = 0;
+		if (gs->tile_damage.width != buffer->info.width ||
+		    gs->tile_damage.height != buffer->info.height)
+			ret = cb_tile_damage_resize(&gs->tile_damage,
+						    buffer->info.width,
+						    buffer->info.height);
+		if (ret < 0) {
+			gles_warn("failed to resize tile damage %d", ret);
+		} else {
+			cb_tile_damage_add_region(&gs->tile_damage,
+						  &gs->texture_damage);
+			ret = cb_tile_damage_to_region(&gs->tile_damage,
+						       &gs->texture_damage);
+			cb_tile_damage_clear(&gs->tile_damage);
+			/* the damage is gone, upload the whole buffer */
+			if (ret < 0)
+				gs->needs_full_upload = true;
+		}
+		cb_region_coarsen(&gs->texture_damage,
+				  TEXTURE_DAMAGE_TILED_MAX_BOXES);
+	}
+
 	if (gs->needs_full_upload) {
 		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
 		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
@@ -2147,6 +2519,7 @@ static void gl_flush_damage(struct renderer *renderer,
 	/* end access buffer */
 
 done:
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 	cb_region_fini(&gs->texture_damage);
 	cb_region_init(&gs->texture_damage);
 	gs->needs_full_upload = false;
@@ -2223,6 +2596,10 @@ struct renderer *renderer_create(struct compositor *c,
 	if (gl_setup(r, r->dummy_surface) < 0)
 		goto err_egl_init;
 
+	r->frame_arena = cb_arena_create(4096);
+	if (!r->frame_arena)
+		goto err;
+
 	cb_array_init(&r->vertices);
 	cb_array_init(&r->vtxcnt);
 
@@ -30,6 +30,7 @@
 #include <cube_utils.h>
 #include <cube_event.h>
 #include <cube_log.h>
+#include <cube_arena.h>
 #include <cube_compositor.h>
 #include <cube_scanout.h>
 
@@ -45,6 +46,20 @@ struct scanout_commit_info *scanout_commit_info_alloc(void)
 	return info;
 }
 
+void scanout_commit_info_init(struct scanout_commit_info *commit, void *arena)
+{
+	INIT_LIST_HEAD(&commit->fb_commits);
+	commit->arena = arena;
+}
+
+static struct fb_info *fb_info_alloc(struct scanout_commit_info *commit)
+{
+	if (commit->arena)
+		return cb_arena_calloc(commit->arena, sizeof(struct fb_info));
+
+	return calloc(1, sizeof(struct fb_info));
+}
+
 void *scanout_commit_add_fb_info(struct scanout_commit_info *commit,
 				 struct cb_buffer *buffer,
 				 struct output *output,
@@ -59,7 +74,7 @@ void *scanout_commit_add_fb_info(struct scanout_commit_info *commit,
 	if (!commit)
 		return NULL;
 
-	info = calloc(1, sizeof(*info));
+	info = fb_info_alloc(commit);
 	if (!info)
 		return NULL;
 
@@ -70,6 +85,29 @@ void *scanout_commit_add_fb_info(struct scanout_commit_info *commit,
 	info->dst = *dst;
 	info->zpos = zpos;
 	info->alpha_src_pre_mul = alpha_src_pre_mul;
+	info->alpha = PLANE_ALPHA_OPAQUE;
+	info->transform = CB_TRANSFORM_NORMAL;
+
+	list_add_tail(&info->link, &commit->fb_commits);
+
+	return info;
+}
+
+void *scanout_commit_add_output(struct scanout_commit_info *commit,
+				struct output *output)
+{
+	struct fb_info *info;
+
+	if (!commit)
+		return NULL;
+
+	info = fb_info_alloc(commit);
+	if (!info)
+		return NULL;
+
+	info->output = output;
+	info->alpha = PLANE_ALPHA_OPAQUE;
+	info->transform = CB_TRANSFORM_NORMAL;
 
 	list_add_tail(&info->link, &commit->fb_commits);
 
@@ -105,7 +143,27 @@ void scanout_commit_mod_fb_info(struct scanout_commit_info *commit,
 	info->alpha_src_pre_mul = alpha_src_pre_mul;
 }
 
-void scanout_commit_info_free(struct scanout_commit_info *commit)
+void scanout_commit_set_fb_alpha(void *fb_info, u16 alpha)
+{
+	struct fb_info *info = fb_info;
+
+	if (!info)
+		return;
+
+	info->alpha = alpha;
+}
+
+void scanout_commit_set_fb_transform(void *fb_info, u32 transform)
+{
+	struct fb_info *info = fb_info;
+
+	if (!info)
+		return;
+
+	info->transform = transform;
+}
+
+void scanout_commit_info_fini(struct scanout_commit_info *commit)
 {
 	struct fb_info *info, *next_info;
 
@@ -114,9 +172,17 @@ void scanout_commit_info_free(struct scanout_commit_info *commit)
 
 	list_for_each_entry_safe(info, next_info, &commit->fb_commits, link) {
 		list_del(&info->link);
-		free(info);
+		if (!commit->arena)
+			free(info);
 	}
+}
+
+void scanout_commit_info_free(struct scanout_commit_info *commit)
+{
+	if (!commit)
+		return;
 
+	scanout_commit_info_fini(commit);
 	free(commit);
 }
 
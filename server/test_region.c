@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <cube_utils.h>
+#include <cube_region.h>
+#include <cube_arena.h>
+
+#define FRAMES 200000
+#define OUT_W 1920
+#define OUT_H 1080
+#define COUNT_VIEWS 6
+
+/*
+ * Replays synthetic damage traces through the region operations the
+ * renderer and the compositor do per frame (view / output masks, draw_view's
+ * clipping and opaque split, blit damage accumulation).
+ */
+
+struct trace_view {
+	struct cb_rect area;
+	/* opaque part in surface coordinates, up to 3 boxes */
+	struct cb_box opaque[3];
+	s32 count_opaque;
+};
+
+static struct trace_view views[COUNT_VIEWS] = {
+	/* desktop */
+	{ { { 0, 0 }, OUT_W, OUT_H }, { { { 0, 0 }, { OUT_W, OUT_H } } }, 1 },
+	/* terminal, rounded corners */
+	{ { { 100, 80 }, 800, 600 }, {
+		{ { 8, 0 }, { 792, 8 } },
+		{ { 0, 8 }, { 800, 592 } },
+		{ { 8, 592 }, { 792, 600 } } }, 3 },
+	/* browser */
+	{ { { 600, 200 }, 1200, 800 }, { { { 0, 0 }, { 1200, 800 } } }, 1 },
+	/* video */
+	{ { { 1000, 500 }, 640, 360 }, { { { 0, 0 }, { 640, 360 } } }, 1 },
+	/* translucent panel */
+	{ { { 0, 1040 }, OUT_W, 40 }, { { { 0, 0 }, { 0, 0 } } }, 0 },
+	/* popup, fully translucent */
+	{ { { 300, 300 }, 200, 120 }, { { { 0, 0 }, { 0, 0 } } }, 0 },
+};
+
+static u32 seed = 1;
+
+static u32 rnd(u32 n)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) % n;
+}
+
+/* damage of one frame, typing / cursor / video / scrolling mix */
+static void frame_damage(struct cb_region *damage, s32 frame)
+{
+	static s32 cx = 500, cy = 500;
+	s32 i, n, x, y;
+
+	/* cursor moved, old and new position */
+	cb_region_union_rect(damage, damage, cx, cy, 64, 64);
+	cx = (cx + rnd(17) - 8 + OUT_W) % (OUT_W - 64);
+	cy = (cy + rnd(17) - 8 + OUT_H) % (OUT_H - 64);
+	cb_region_union_rect(damage, damage, cx, cy, 64, 64);
+
+	switch (frame % 8) {
+	case 0:
+	case 1:
+	case 2:
+		/* typing in the terminal, caret and a few glyphs */
+		n = 1 + rnd(3);
+		for (i = 0; i < n; i++) {
+			x = 108 + rnd(90) * 8;
+			y = 88 + rnd(36) * 16;
+			cb_region_union_rect(damage, damage, x, y, 8, 16);
+		}
+		break;
+	case 3:
+	case 4:
+		/* video frame */
+		cb_region_union_rect(damage, damage, 1000, 500, 640, 360);
+		break;
+	case 5:
+	case 6:
+		/* browser scrolling, content and scroll bar */
+		cb_region_union_rect(damage, damage, 600, 260, 1180, 740);
+		cb_region_union_rect(damage, damage, 1780, 200, 20, 800);
+		break;
+	default:
+		if (!rnd(16))
+			cb_region_union_rect(damage, damage, 0, 0,
+					     OUT_W, OUT_H);
+		break;
+	}
+}
+
+static s32 draw_view(struct trace_view *v, struct cb_region *damage)
+{
+	struct cb_region view_area, output_area, opaque;
+	struct cb_region surface_opaque, surface_blend;
+	CB_REGION_STORAGE(32) opaque_scratch, blend_scratch;
+	s32 count = 0;
+
+	cb_region_init_rect(&view_area, v->area.pos.x, v->area.pos.y,
+			    v->area.w, v->area.h);
+	cb_region_init_rect(&output_area, 0, 0, OUT_W, OUT_H);
+	cb_region_intersect(&view_area, &view_area, &output_area);
+	if (!cb_region_is_not_empty(&view_area))
+		goto out;
+	cb_region_intersect(&view_area, &view_area, damage);
+
+	if (v->count_opaque)
+		cb_region_init_boxes(&opaque, v->opaque, v->count_opaque);
+	else
+		cb_region_init(&opaque);
+	cb_region_init_with_scratch(&surface_blend, &blend_scratch,
+				    ARRAY_SIZE(blend_scratch.boxes));
+	cb_region_union_rect(&surface_blend, &surface_blend, 0, 0,
+			     v->area.w, v->area.h);
+	cb_region_subtract(&surface_blend, &surface_blend, &opaque);
+	cb_region_init_with_scratch(&surface_opaque, &opaque_scratch,
+				    ARRAY_SIZE(opaque_scratch.boxes));
+	cb_region_copy(&surface_opaque, &opaque);
+
+	count += cb_region_count_boxes(&view_area);
+	count += cb_region_count_boxes(&surface_blend);
+	count += cb_region_count_boxes(&surface_opaque);
+
+	cb_region_fini(&surface_opaque);
+	cb_region_fini(&surface_blend);
+	cb_region_fini(&opaque);
+out:
+	cb_region_fini(&output_area);
+	cb_region_fini(&view_area);
+	return count;
+}
+
+s32 main(s32 argc, char **argv)
+{
+	struct cb_region damage, missed, above, vis;
+	CB_REGION_STORAGE(32) damage_scratch;
+	struct timespec t0, t1;
+	s64 heap_allocs;
+	u64 ns, count = 0;
+	s32 frame, i;
+
+	cb_region_init(&missed);
+	heap_allocs = cb_heap_alloc_count();
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (frame = 0; frame < FRAMES; frame++) {
+		cb_region_init_with_scratch(&damage, &damage_scratch,
+					    ARRAY_SIZE(damage_scratch.boxes));
+		frame_damage(&damage, frame);
+
+		/* visible part of each view, what the overlay planning does */
+		cb_region_init(&above);
+		for (i = COUNT_VIEWS - 1; i >= 0; i--) {
+			cb_region_init_rect(&vis, views[i].area.pos.x,
+					    views[i].area.pos.y,
+					    views[i].area.w, views[i].area.h);
+			cb_region_subtract(&vis, &vis, &above);
+			count += cb_region_count_boxes(&vis);
+			if (views[i].count_opaque)
+				cb_region_union_rect(&above, &above,
+						     views[i].area.pos.x,
+						     views[i].area.pos.y,
+						     views[i].area.w,
+						     views[i].area.h);
+			cb_region_fini(&vis);
+		}
+		cb_region_fini(&above);
+
+		for (i = 0; i < COUNT_VIEWS; i++)
+			count += draw_view(&views[i], &damage);
+
+		/* double buffered blit damage */
+		cb_region_union(&missed, &missed, &damage);
+		count += cb_region_count_boxes(&missed);
+		cb_region_copy(&missed, &damage);
+
+		cb_region_fini(&damage);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	cb_region_fini(&missed);
+
+	ns = (t1.tv_sec - t0.tv_sec) * 1000000000UL + t1.tv_nsec - t0.tv_nsec;
+	printf("%d frames, %lu boxes: %.1f ns/frame\n", FRAMES, count,
+	       (double)ns / FRAMES);
+	if (heap_allocs >= 0)
+		printf("heap allocations: %.2f /frame\n",
+		       (double)(cb_heap_alloc_count() - heap_allocs) / FRAMES);
+	else
+		printf("heap allocations: not counted, build with "
+		       "ALLOC_DEBUG=y\n");
+
+	return 0;
+}
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <cube_utils.h>
+#include <cube_cache.h>
+#include <cube_slab.h>
+
+#define LOOPS 2000000
+#define BATCH 512
+#define WORKING_SET 1024
+#define NR_THREADS 4
+
+struct allocator {
+	const char *name;
+	void *(*create)(size_t size);
+	void (*destroy)(void *c);
+	void *(*get)(void *c, bool clear);
+	void (*put)(void *d, void *c);
+};
+
+static void *cache_create(size_t size)
+{
+	return cb_cache_create(size, 128);
+}
+
+static void *slab_create(size_t size)
+{
+	return cb_slab_create(size, 128, 0);
+}
+
+static void *slab_mag_create(size_t size)
+{
+	return cb_slab_create(size, 128, CB_SLAB_MAGAZINE);
+}
+
+static struct allocator allocators[] = {
+	{ "cb_cache", cache_create, cb_cache_destroy,
+	  cb_cache_get, cb_cache_put },
+	{ "cb_slab", slab_create, cb_slab_destroy,
+	  cb_slab_get, cb_slab_put },
+	{ "cb_slab+mag", slab_mag_create, cb_slab_destroy,
+	  cb_slab_get, cb_slab_put },
+};
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* touch the object so that layout matters, like real users do */
+static inline void touch(void *d, size_t size)
+{
+	((u8 *)d)[0]++;
+	((u8 *)d)[size - 1]++;
+}
+
+static u64 bench_lifo(struct allocator *a, void *c, size_t size)
+{
+	u64 t;
+	void *d;
+	s32 i;
+
+	t = now_ns();
+	for (i = 0; i < LOOPS; i++) {
+		d = a->get(c, false);
+		touch(d, size);
+		a->put(d, c);
+	}
+	return now_ns() - t;
+}
+
+static u64 bench_batch(struct allocator *a, void *c, size_t size)
+{
+	void *d[BATCH];
+	u64 t;
+	s32 i, j;
+
+	t = now_ns();
+	for (i = 0; i < LOOPS / BATCH; i++) {
+		for (j = 0; j < BATCH; j++) {
+			d[j] = a->get(c, true);
+			touch(d[j], size);
+		}
+		for (j = 0; j < BATCH; j++)
+			a->put(d[j], c);
+	}
+	return now_ns() - t;
+}
+
+static u64 bench_random(struct allocator *a, void *c, size_t size)
+{
+	void *d[WORKING_SET];
+	u64 t;
+	u32 seed = 1;
+	s32 i, k;
+
+	for (i = 0; i < WORKING_SET; i++)
+		d[i] = a->get(c, false);
+
+	t = now_ns();
+	for (i = 0; i < LOOPS; i++) {
+		seed = seed * 1103515245 + 12345;
+		k = (seed >> 16) % WORKING_SET;
+		a->put(d[k], c);
+		d[k] = a->get(c, false);
+		touch(d[k], size);
+	}
+	t = now_ns() - t;
+
+	for (i = 0; i < WORKING_SET; i++)
+		a->put(d[i], c);
+	return t;
+}
+
+struct thread_arg {
+	struct allocator *a;
+	void *c;
+	size_t size;
+	u64 ns;
+};
+
+static void *bench_thread(void *data)
+{
+	struct thread_arg *arg = data;
+
+	arg->ns = bench_batch(arg->a, arg->c, arg->size);
+	return NULL;
+}
+
+static void check_slab(void)
+{
+	struct cb_slab_stats st;
+	void *c, *d[300];
+	s32 i, j;
+
+	c = cb_slab_create(40, 16, 0);
+	assert(c);
+	for (i = 0; i < 300; i++) {
+		d[i] = cb_slab_get(c, false);
+		assert(d[i]);
+		assert(!((unsigned long)d[i] & 63));
+		memset(d[i], 0xA5, 40);
+		for (j = 0; j < i; j++)
+			assert(d[i] != d[j]);
+	}
+	cb_slab_get_stats(c, &st);
+	/* in_use also counts the objects parked in the magazine */
+	assert(st.in_use >= 300 && st.peak >= 300);
+	printf("slab: obj %u objs/slab %u slabs %u\n",
+	       st.obj_size, st.objs_per_slab, st.slabs);
+
+	for (i = 0; i < 300; i++)
+		cb_slab_put(d[i], c);
+	d[0] = cb_slab_get(c, true);
+	for (i = 0; i < 40; i++)
+		assert(!((u8 *)d[0])[i]);
+	cb_slab_put(d[0], c);
+
+	cb_slab_shrink(c);
+	cb_slab_get_stats(c, &st);
+	assert(st.in_use == 0 && st.slabs == 0);
+	printf("slab: hits %lu misses %lu peak %u slabs peak %u\n",
+	       st.hits, st.misses, st.peak, st.slabs_peak);
+	cb_slab_destroy(c);
+}
+
+s32 main(s32 argc, char **argv)
+{
+	size_t sizes[] = { 48, 192 };
+	struct thread_arg args[NR_THREADS];
+	pthread_t threads[NR_THREADS];
+	struct allocator *a;
+	void *c;
+	s32 i, j, k;
+
+	check_slab();
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		for (j = 0; j < ARRAY_SIZE(allocators); j++) {
+			a = &allocators[j];
+			c = a->create(sizes[i]);
+			assert(c);
+			printf("%-12s size %3lu: lifo %6.2f batch %6.2f "
+			       "random %6.2f ns/op\n", a->name, sizes[i],
+			       (double)bench_lifo(a, c, sizes[i]) / LOOPS,
+			       (double)bench_batch(a, c, sizes[i]) / LOOPS,
+			       (double)bench_random(a, c, sizes[i]) / LOOPS);
+			a->destroy(c);
+		}
+	}
+
+	/* cb_cache is not thread safe, only the magazine cache can run here */
+	a = &allocators[2];
+	c = a->create(sizes[0]);
+	assert(c);
+	for (k = 0; k < NR_THREADS; k++) {
+		args[k].a = a;
+		args[k].c = c;
+		args[k].size = sizes[0];
+		pthread_create(&threads[k], NULL, bench_thread, &args[k]);
+	}
+	for (k = 0; k < NR_THREADS; k++) {
+		pthread_join(threads[k], NULL);
+		printf("%-12s thread %d: batch %6.2f ns/op\n", a->name, k,
+		       (double)args[k].ns / LOOPS);
+	}
+	a->destroy(c);
+
+	return 0;
+}
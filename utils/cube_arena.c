@@ -0,0 +1,249 @@
+/*
+ * Copyright © 2020 Ruinan Duan, duanruinan@zoho.com 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <string.h>
+#include <cube_utils.h>
+#include <cube_arena.h>
+
+#define CB_ARENA_ALIGN 16
+
+#define ARENA_ALIGN(v) (((v) + CB_ARENA_ALIGN - 1) \
+				& ~((size_t)CB_ARENA_ALIGN - 1))
+
+struct cb_arena_chunk {
+	struct cb_arena_chunk *next;
+	size_t size;
+	size_t used;
+	u8 data[] __attribute__((aligned(CB_ARENA_ALIGN)));
+};
+
+struct cb_arena {
+	size_t chunk_size;
+	/* the head is the current chunk */
+	struct cb_arena_chunk *chunks;
+	size_t used;
+	size_t peak;
+	size_t capacity;
+	u64 grows;
+};
+
+static struct cb_arena_chunk *cb_arena_chunk_add(struct cb_arena *arena,
+						 size_t size)
+{
+	struct cb_arena_chunk *chunk;
+
+	chunk = malloc(sizeof(*chunk) + size);
+	if (!chunk)
+		return NULL;
+
+	chunk->size = size;
+	chunk->used = 0;
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	arena->capacity += size;
+	arena->grows++;
+
+	return chunk;
+}
+
+static void cb_arena_chunks_free(struct cb_arena *arena)
+{
+	struct cb_arena_chunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	arena->chunks = NULL;
+	arena->capacity = 0;
+}
+
+void cb_arena_destroy(void *a)
+{
+	struct cb_arena *arena = a;
+
+	if (!a)
+		return;
+
+	cb_arena_chunks_free(arena);
+	free(arena);
+}
+
+void *cb_arena_create(size_t chunk_size)
+{
+	struct cb_arena *arena;
+
+	if (!chunk_size)
+		return NULL;
+
+	arena = calloc(1, sizeof(*arena));
+	if (!arena)
+		return NULL;
+
+	arena->chunk_size = ARENA_ALIGN(chunk_size);
+	if (!cb_arena_chunk_add(arena, arena->chunk_size)) {
+		free(arena);
+		return NULL;
+	}
+
+	return arena;
+}
+
+void *cb_arena_alloc(void *a, size_t size)
+{
+	struct cb_arena *arena = a;
+	struct cb_arena_chunk *chunk;
+	void *p;
+
+	if (!a || !size)
+		return NULL;
+
+	size = ARENA_ALIGN(size);
+	chunk = arena->chunks;
+	if (!chunk || chunk->used + size > chunk->size) {
+		chunk = cb_arena_chunk_add(arena,
+					   MAX(arena->chunk_size, size));
+		if (!chunk)
+			return NULL;
+	}
+
+	p = chunk->data + chunk->used;
+	chunk->used += size;
+	arena->used += size;
+	if (arena->used > arena->peak)
+		arena->peak = arena->used;
+
+	return p;
+}
+
+void *cb_arena_calloc(void *a, size_t size)
+{
+	void *p = cb_arena_alloc(a, size);
+
+	if (p)
+		memset(p, 0, size);
+
+	return p;
+}
+
+void cb_arena_reset(void *a)
+{
+	struct cb_arena *arena = a;
+	size_t size;
+
+	if (!a)
+		return;
+
+	arena->used = 0;
+	if (arena->chunks && !arena->chunks->next) {
+		arena->chunks->used = 0;
+		return;
+	}
+
+	/* the arena overflowed, replace the chunks by a single one */
+	size = MAX(arena->chunk_size, ARENA_ALIGN(arena->peak));
+	cb_arena_chunks_free(arena);
+	if (!cb_arena_chunk_add(arena, size))
+		cb_arena_chunk_add(arena, arena->chunk_size);
+}
+
+void cb_arena_get_stats(void *a, struct cb_arena_stats *stats)
+{
+	struct cb_arena *arena = a;
+
+	if (!a || !stats)
+		return;
+
+	stats->used = arena->used;
+	stats->peak = arena->peak;
+	stats->capacity = arena->capacity;
+	stats->grows = arena->grows;
+}
+
+#ifdef CUBE_ALLOC_DEBUG
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static u64 heap_allocs = 0;
+
+static inline void heap_alloc_inc(void)
+{
+	__atomic_fetch_add(&heap_allocs, 1, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size)
+{
+	heap_alloc_inc();
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	heap_alloc_inc();
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	heap_alloc_inc();
+	return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	heap_alloc_inc();
+	return __libc_memalign(alignment, size);
+}
+
+s32 posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *p;
+
+	heap_alloc_inc();
+	p = __libc_memalign(alignment, size);
+	if (!p)
+		return ENOMEM;
+	*memptr = p;
+	return 0;
+}
+
+s64 cb_heap_alloc_count(void)
+{
+	return (s64)__atomic_load_n(&heap_allocs, __ATOMIC_RELAXED);
+}
+
+#else
+
+s64 cb_heap_alloc_count(void)
+{
+	return -1;
+}
+
+#endif
+
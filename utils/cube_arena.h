@@ -0,0 +1,66 @@
+/*
+ * Copyright © 2020 Ruinan Duan, duanruinan@zoho.com 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CUBE_ARENA_H
+#define CUBE_ARENA_H
+
+#include <stdbool.h>
+#include <cube_utils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bump allocator for objects which all die at the same point, e.g. the end
+ * of a frame. Nothing is freed individually, cb_arena_reset() rewinds the
+ * whole arena. When a frame overflows the arena, the next reset merges the
+ * chunks into one big enough for it, so a steady state frame does not touch
+ * the heap at all.
+ */
+
+struct cb_arena_stats {
+	size_t used; /* bytes handed out since the last reset */
+	size_t peak; /* max used */
+	size_t capacity;
+	u64 grows; /* chunks allocated from the heap */
+};
+
+void *cb_arena_create(size_t chunk_size);
+void cb_arena_destroy(void *a);
+/* 16 bytes aligned */
+void *cb_arena_alloc(void *a, size_t size);
+void *cb_arena_calloc(void *a, size_t size);
+void cb_arena_reset(void *a);
+void cb_arena_get_stats(void *a, struct cb_arena_stats *stats);
+
+/*
+ * Number of heap allocations (malloc / calloc / realloc / memalign) done by
+ * the process, only counted when built with ALLOC_DEBUG=y, -1 otherwise.
+ */
+s64 cb_heap_alloc_count(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -0,0 +1,226 @@
+/*
+ * Copyright © 2020 Ruinan Duan, duanruinan@zoho.com 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <cube_utils.h>
+#include <cube_handle.h>
+
+#define HANDLE_INIT_ENTRIES 16
+
+/* handle: gen (32) | type (8) | index + 1 (24) */
+#define HANDLE_INDEX_MASK 0xFFFFFFU
+#define HANDLE_TYPE_SHIFT 24
+#define HANDLE_GEN_SHIFT 32
+
+/*
+ * gen is odd while the slot is live and even while it is free, it is
+ * bumped on both, so a freed handle never matches again until the
+ * counter wraps.
+ */
+struct cb_handle_slot {
+	u32 gen;
+	u32 dense; /* dense index if live, next free slot + 1 if free */
+};
+
+struct cb_handle_table {
+	struct cb_handle_slot *slots;
+	void **objs; /* dense */
+	u32 *owners; /* dense index to slot index */
+	u32 count; /* live objects */
+	u32 nr_slots; /* slots ever used */
+	u32 cap; /* allocated entries of all three arrays */
+	u32 max;
+	u32 free_head; /* free slot + 1, 0: none */
+	u8 type;
+};
+
+void *cb_handle_table_create(u8 type, u32 max_entries)
+{
+	struct cb_handle_table *t;
+
+	if (!max_entries || max_entries > CB_HANDLE_MAX_ENTRIES)
+		return NULL;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+
+	t->type = type;
+	t->max = max_entries;
+	return t;
+}
+
+void cb_handle_table_destroy(void *table)
+{
+	struct cb_handle_table *t = table;
+
+	if (!t)
+		return;
+
+	free(t->slots);
+	free(t->objs);
+	free(t->owners);
+	free(t);
+}
+
+static s32 handle_table_grow(struct cb_handle_table *t)
+{
+	struct cb_handle_slot *slots;
+	void **objs;
+	u32 *owners;
+	u32 cap;
+
+	if (t->cap >= t->max)
+		return -ENOSPC;
+
+	cap = t->cap ? t->cap * 2 : HANDLE_INIT_ENTRIES;
+	if (cap > t->max)
+		cap = t->max;
+
+	slots = realloc(t->slots, cap * sizeof(*slots));
+	if (!slots)
+		return -ENOMEM;
+	t->slots = slots;
+	objs = realloc(t->objs, cap * sizeof(*objs));
+	if (!objs)
+		return -ENOMEM;
+	t->objs = objs;
+	owners = realloc(t->owners, cap * sizeof(*owners));
+	if (!owners)
+		return -ENOMEM;
+	t->owners = owners;
+	t->cap = cap;
+	return 0;
+}
+
+u64 cb_handle_alloc(void *table, void *obj)
+{
+	struct cb_handle_table *t = table;
+	struct cb_handle_slot *slot;
+	u32 index;
+
+	if (!t || !obj)
+		return 0;
+
+	if (t->free_head) {
+		index = t->free_head - 1;
+		slot = &t->slots[index];
+		t->free_head = slot->dense;
+	} else {
+		if (t->nr_slots == t->cap && handle_table_grow(t) < 0)
+			return 0;
+		index = t->nr_slots++;
+		slot = &t->slots[index];
+		slot->gen = 0;
+	}
+
+	slot->gen++;
+	slot->dense = t->count;
+	t->objs[t->count] = obj;
+	t->owners[t->count] = index;
+	t->count++;
+
+	return ((u64)slot->gen << HANDLE_GEN_SHIFT)
+		| ((u64)t->type << HANDLE_TYPE_SHIFT)
+		| (index + 1);
+}
+
+static struct cb_handle_slot *handle_slot(struct cb_handle_table *t,
+					  u64 handle)
+{
+	struct cb_handle_slot *slot;
+	u32 index, gen;
+
+	if (!t)
+		return NULL;
+
+	index = (u32)(handle & HANDLE_INDEX_MASK);
+	if (!index || index > t->nr_slots)
+		return NULL;
+	if (((handle >> HANDLE_TYPE_SHIFT) & 0xFF) != t->type)
+		return NULL;
+
+	gen = handle >> HANDLE_GEN_SHIFT;
+	slot = &t->slots[index - 1];
+	if (slot->gen != gen || !(gen & 1))
+		return NULL;
+
+	return slot;
+}
+
+void *cb_handle_lookup(void *table, u64 handle)
+{
+	struct cb_handle_table *t = table;
+	struct cb_handle_slot *slot;
+
+	slot = handle_slot(t, handle);
+	if (!slot)
+		return NULL;
+
+	return t->objs[slot->dense];
+}
+
+void *cb_handle_free(void *table, u64 handle)
+{
+	struct cb_handle_table *t = table;
+	struct cb_handle_slot *slot;
+	u32 dense, last;
+	void *obj;
+
+	slot = handle_slot(t, handle);
+	if (!slot)
+		return NULL;
+
+	dense = slot->dense;
+	obj = t->objs[dense];
+
+	/* keep the dense array packed */
+	last = t->count - 1;
+	if (dense != last) {
+		t->objs[dense] = t->objs[last];
+		t->owners[dense] = t->owners[last];
+		t->slots[t->owners[dense]].dense = dense;
+	}
+	t->count--;
+
+	slot->gen++;
+	slot->dense = t->free_head;
+	t->free_head = (u32)(handle & HANDLE_INDEX_MASK);
+
+	return obj;
+}
+
+u32 cb_handle_count(void *table)
+{
+	struct cb_handle_table *t = table;
+
+	return t ? t->count : 0;
+}
+
+void **cb_handle_objects(void *table)
+{
+	struct cb_handle_table *t = table;
+
+	return t ? t->objs : NULL;
+}
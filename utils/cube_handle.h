@@ -0,0 +1,66 @@
+/*
+ * Copyright © 2020 Ruinan Duan, duanruinan@zoho.com 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CUBE_HANDLE_H
+#define CUBE_HANDLE_H
+
+#include <stdbool.h>
+#include <cube_utils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Handle tables, map the IDs handed out to clients back to objects.
+ *
+ * A handle packs a slot index, the table type and the slot's generation,
+ * which changes whenever the slot is freed. Looking up a stale, forged or
+ * wrong typed handle returns NULL in O(1) instead of reaching freed
+ * memory. Handles are never 0 nor ~0.
+ *
+ * Live objects are also packed in a dense array for iteration. Freeing an
+ * object moves the last one into its place, so a loop freeing objects
+ * should walk from the end.
+ */
+
+/* Largest max_entries of cb_handle_table_create() */
+#define CB_HANDLE_MAX_ENTRIES ((1 << 24) - 2)
+
+void *cb_handle_table_create(u8 type, u32 max_entries);
+void cb_handle_table_destroy(void *table);
+
+/* Return the handle of obj, 0 if the table is full */
+u64 cb_handle_alloc(void *table, void *obj);
+/* Return the object of a live handle or NULL */
+void *cb_handle_lookup(void *table, u64 handle);
+/* Release a handle, return its object or NULL if it was not live */
+void *cb_handle_free(void *table, u64 handle);
+
+/* Live objects, objects[0] to objects[count - 1] */
+u32 cb_handle_count(void *table);
+void **cb_handle_objects(void *table);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
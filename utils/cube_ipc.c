@@ -83,18 +83,12 @@ s32 cb_socket_nonblock(s32 sock)
 	return 0;
 }
 
-/*
- * need to resend when errno == EAGAIN
- * return:
- * > 0: success
- * < 0: failerrno != EAGAIN
- */
-s32 cb_sendmsg(s32 sock, u8 *buf, size_t sz, struct cb_fds *fds)
+static s32 sendmsg_iov(s32 sock, struct iovec *vec, s32 count_vec,
+		       struct cb_fds *fds)
 {
 	s32 ret;
 	struct msghdr msg;
 	struct cmsghdr *p_cmsg;
-	struct iovec vec;
 	char cmsgbuf[CLEN];
 	s32 clen;
 
@@ -113,13 +107,10 @@ s32 cb_sendmsg(s32 sock, u8 *buf, size_t sz, struct cb_fds *fds)
 		clen = 0;
 	}
 
-	vec.iov_base = buf;
-	vec.iov_len = sz;
-
 	msg.msg_name = NULL;
 	msg.msg_namelen = 0;
-	msg.msg_iov = &vec;
-	msg.msg_iovlen = 1;
+	msg.msg_iov = vec;
+	msg.msg_iovlen = count_vec;
 	msg.msg_control = (clen > 0) ? cmsgbuf : NULL;
 	msg.msg_controllen = clen;
 	msg.msg_flags = 0;
@@ -143,6 +134,22 @@ s32 cb_sendmsg(s32 sock, u8 *buf, size_t sz, struct cb_fds *fds)
 	return ret;
 }
 
+/*
+ * need to resend when errno == EAGAIN
+ * return:
+ * > 0: success
+ * < 0: failerrno != EAGAIN
+ */
+s32 cb_sendmsg(s32 sock, u8 *buf, size_t sz, struct cb_fds *fds)
+{
+	struct iovec vec;
+
+	vec.iov_base = buf;
+	vec.iov_len = sz;
+
+	return sendmsg_iov(sock, &vec, 1, fds);
+}
+
 /*
  * need to rerecv when errno == EAGAIN
  * return
@@ -277,3 +284,529 @@ s32 cb_socket_connect(const s32 sock, const char *remote)
 	return -errno;
 }
 
+/* fds to send with the message starting at pos of the stream */
+struct cb_ipc_tx_mark {
+	u64 pos;
+	struct cb_fds fds;
+};
+
+struct cb_ipc_tx {
+	u8 *buf;
+	size_t size; /* power of 2 */
+	size_t max_size;
+	/* stream positions of the first byte not sent / not queued */
+	u64 head, tail;
+
+	/* ring of fd marks, in stream order */
+	struct cb_ipc_tx_mark *marks;
+	u32 size_marks, first_mark, count_marks;
+};
+
+void *cb_ipc_tx_create(size_t size, size_t max_size)
+{
+	struct cb_ipc_tx *tx;
+	size_t sz = 64;
+
+	while (sz < size)
+		sz <<= 1;
+
+	if (max_size < sz)
+		max_size = sz;
+	if (max_size > INT32_MAX)
+		max_size = INT32_MAX;
+
+	tx = calloc(1, sizeof(*tx));
+	if (!tx)
+		return NULL;
+
+	tx->buf = malloc(sz);
+	if (!tx->buf) {
+		free(tx);
+		return NULL;
+	}
+	tx->size = sz;
+	tx->max_size = max_size;
+
+	return tx;
+}
+
+static void tx_mark_close(struct cb_ipc_tx_mark *mark)
+{
+	u32 i;
+
+	for (i = 0; i < mark->fds.count; i++)
+		close(mark->fds.fds[i]);
+	mark->fds.count = 0;
+}
+
+void cb_ipc_tx_destroy(void *tx)
+{
+	struct cb_ipc_tx *q = tx;
+	u32 i;
+
+	if (!q)
+		return;
+
+	for (i = 0; i < q->count_marks; i++)
+		tx_mark_close(&q->marks[(q->first_mark + i) % q->size_marks]);
+	free(q->marks);
+	free(q->buf);
+	free(q);
+}
+
+size_t cb_ipc_tx_pending(void *tx)
+{
+	struct cb_ipc_tx *q = tx;
+
+	return q->tail - q->head;
+}
+
+/* copy n bytes to the ring at stream position pos */
+static void ring_write(u8 *ring, size_t size, u64 pos, const u8 *data,
+		       size_t n)
+{
+	size_t off = pos & (size - 1);
+	size_t first = MIN(n, size - off);
+
+	memcpy(ring + off, data, first);
+	memcpy(ring, data + first, n - first);
+}
+
+static s32 tx_reserve(struct cb_ipc_tx *q, size_t n)
+{
+	size_t used = q->tail - q->head, sz = q->size, off, first;
+	u8 *buf;
+
+	if (used + n <= q->size)
+		return 0;
+
+	while (sz < used + n)
+		sz <<= 1;
+	if (sz > q->max_size)
+		return -ENOBUFS;
+
+	buf = malloc(sz);
+	if (!buf)
+		return -ENOMEM;
+
+	/* keep the stream positions, the ring is indexed by pos & (size-1) */
+	off = q->head & (q->size - 1);
+	first = MIN(used, q->size - off);
+	ring_write(buf, sz, q->head, q->buf + off, first);
+	ring_write(buf, sz, q->head + first, q->buf, used - first);
+	free(q->buf);
+	q->buf = buf;
+	q->size = sz;
+
+	return 0;
+}
+
+static void tx_copy_in(struct cb_ipc_tx *q, const void *data, size_t n)
+{
+	ring_write(q->buf, q->size, q->tail, data, n);
+	q->tail += n;
+}
+
+static s32 tx_add_mark(struct cb_ipc_tx *q, struct cb_fds *fds)
+{
+	struct cb_ipc_tx_mark *marks, *mark;
+	u32 size, i;
+	s32 fd;
+
+	if (fds->count > MAX_FDS_COUNT)
+		return -ERANGE;
+
+	if (q->count_marks == q->size_marks) {
+		size = q->size_marks ? q->size_marks * 2 : 4;
+		marks = malloc(size * sizeof(*marks));
+		if (!marks)
+			return -ENOMEM;
+		for (i = 0; i < q->count_marks; i++)
+			marks[i] = q->marks[(q->first_mark + i)
+						% q->size_marks];
+		free(q->marks);
+		q->marks = marks;
+		q->size_marks = size;
+		q->first_mark = 0;
+	}
+
+	mark = &q->marks[(q->first_mark + q->count_marks) % q->size_marks];
+	mark->pos = q->tail;
+	mark->fds.count = 0;
+	for (i = 0; i < fds->count; i++) {
+		fd = cb_dupfd_cloexec(fds->fds[i], 0);
+		if (fd < 0) {
+			tx_mark_close(mark);
+			return -errno;
+		}
+		mark->fds.fds[mark->fds.count++] = fd;
+	}
+	q->count_marks++;
+
+	return 0;
+}
+
+s32 cb_ipc_tx_queue(void *tx, const u8 *buf, size_t sz, struct cb_fds *fds)
+{
+	struct cb_ipc_tx *q = tx;
+	s32 ret;
+
+	ret = tx_reserve(q, sizeof(size_t) + sz);
+	if (ret < 0)
+		return ret;
+
+	if (fds && fds->count) {
+		ret = tx_add_mark(q, fds);
+		if (ret < 0)
+			return ret;
+	}
+
+	tx_copy_in(q, &sz, sizeof(size_t));
+	tx_copy_in(q, buf, sz);
+
+	return 0;
+}
+
+s32 cb_ipc_tx_flush(void *tx, s32 sock)
+{
+	struct cb_ipc_tx *q = tx;
+	struct cb_ipc_tx_mark *mark;
+	struct cb_fds *fds;
+	struct iovec vec[2];
+	u64 end;
+	size_t off;
+	s32 ret;
+
+	while (q->head != q->tail) {
+		end = q->tail;
+		fds = NULL;
+		if (q->count_marks) {
+			mark = &q->marks[q->first_mark];
+			if (mark->pos == q->head) {
+				fds = &mark->fds;
+				if (q->count_marks > 1)
+					end = q->marks[(q->first_mark + 1)
+						% q->size_marks].pos;
+			} else {
+				end = mark->pos;
+			}
+		}
+
+		off = q->head & (q->size - 1);
+		vec[0].iov_base = q->buf + off;
+		vec[0].iov_len = MIN(end - q->head, q->size - off);
+		vec[1].iov_base = q->buf;
+		vec[1].iov_len = end - q->head - vec[0].iov_len;
+
+		ret = sendmsg_iov(sock, vec, vec[1].iov_len ? 2 : 1, fds);
+		if (ret == -EAGAIN)
+			break;
+		if (ret < 0)
+			return ret;
+
+		if (fds) {
+			/* the fds went with the first byte */
+			tx_mark_close(mark);
+			q->first_mark = (q->first_mark + 1) % q->size_marks;
+			q->count_marks--;
+		}
+		q->head += ret;
+	}
+
+	return q->tail - q->head;
+}
+
+/* fds which came with the read ending at pos of the stream */
+struct cb_ipc_rx_mark {
+	u64 pos;
+	struct cb_fds fds;
+};
+
+struct cb_ipc_rx {
+	u8 *buf;
+	size_t size;
+	size_t max_size;
+	/* buf[head, tail) holds the bytes not parsed yet */
+	size_t head, tail;
+	/* stream position of buf[0] */
+	u64 base;
+	/* aligned copy of a frame which does not start on 8 bytes */
+	u8 *frame;
+	size_t size_frame;
+
+	/* ring of fd marks, in stream order */
+	struct cb_ipc_rx_mark *marks;
+	u32 size_marks, first_mark, count_marks;
+};
+
+void *cb_ipc_rx_create(size_t size, size_t max_size)
+{
+	struct cb_ipc_rx *rx;
+	size_t sz = 64;
+
+	while (sz < size)
+		sz <<= 1;
+
+	if (max_size < sz)
+		max_size = sz;
+
+	rx = calloc(1, sizeof(*rx));
+	if (!rx)
+		return NULL;
+
+	rx->buf = malloc(sz);
+	if (!rx->buf) {
+		free(rx);
+		return NULL;
+	}
+	rx->size = sz;
+	rx->max_size = max_size;
+
+	return rx;
+}
+
+static void rx_mark_close(struct cb_ipc_rx_mark *mark)
+{
+	u32 i;
+
+	for (i = 0; i < mark->fds.count; i++)
+		close(mark->fds.fds[i]);
+	mark->fds.count = 0;
+}
+
+static void rx_mark_pop(struct cb_ipc_rx *rx)
+{
+	rx->first_mark = (rx->first_mark + 1) % rx->size_marks;
+	rx->count_marks--;
+}
+
+void cb_ipc_rx_destroy(void *rx)
+{
+	struct cb_ipc_rx *q = rx;
+
+	if (!q)
+		return;
+
+	while (q->count_marks) {
+		rx_mark_close(&q->marks[q->first_mark]);
+		rx_mark_pop(q);
+	}
+	free(q->marks);
+	free(q->frame);
+	free(q->buf);
+	free(q);
+}
+
+size_t cb_ipc_rx_pending(void *rx)
+{
+	struct cb_ipc_rx *q = rx;
+
+	return q->tail - q->head;
+}
+
+static struct cb_ipc_rx_mark *rx_add_mark(struct cb_ipc_rx *q)
+{
+	struct cb_ipc_rx_mark *marks;
+	u32 size, i;
+
+	if (q->count_marks == q->size_marks) {
+		size = q->size_marks ? q->size_marks * 2 : 4;
+		marks = malloc(size * sizeof(*marks));
+		if (!marks)
+			return NULL;
+		for (i = 0; i < q->count_marks; i++)
+			marks[i] = q->marks[(q->first_mark + i)
+						% q->size_marks];
+		free(q->marks);
+		q->marks = marks;
+		q->size_marks = size;
+		q->first_mark = 0;
+	}
+
+	return &q->marks[(q->first_mark + q->count_marks) % q->size_marks];
+}
+
+/* make room behind tail, moving the unparsed bytes down or growing */
+static s32 rx_reserve(struct cb_ipc_rx *q)
+{
+	size_t used = q->tail - q->head, sz;
+	u8 *buf;
+
+	if (q->tail < q->size)
+		return 0;
+
+	if (q->head) {
+		memmove(q->buf, q->buf + q->head, used);
+		q->base += q->head;
+		q->head = 0;
+		q->tail = used;
+		return 0;
+	}
+
+	if (q->size >= q->max_size)
+		return -ENOBUFS;
+
+	sz = MIN(q->size * 2, q->max_size);
+	buf = realloc(q->buf, sz);
+	if (!buf)
+		return -ENOMEM;
+	q->buf = buf;
+	q->size = sz;
+
+	return 0;
+}
+
+static s32 rx_recv(struct cb_ipc_rx *q, s32 sock)
+{
+	struct msghdr msg;
+	struct iovec vec;
+	char cmsgbuf[CLEN];
+	struct cmsghdr *p_cmsg;
+	struct cb_ipc_rx_mark *mark = NULL;
+	s32 *p_fd, *end;
+	s32 ret;
+
+	vec.iov_base = q->buf + q->tail;
+	vec.iov_len = q->size - q->tail;
+	msg.msg_name = NULL;
+	msg.msg_namelen = 0;
+	msg.msg_iov = &vec;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf;
+	msg.msg_controllen = sizeof(cmsgbuf);
+	msg.msg_flags = 0;
+
+	do {
+		ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return -errno;
+
+	q->tail += ret;
+
+	for (p_cmsg = CMSG_FIRSTHDR(&msg); p_cmsg != NULL;
+	     p_cmsg = CMSG_NXTHDR(&msg, p_cmsg)) {
+		if (p_cmsg->cmsg_level != SOL_SOCKET
+		    || p_cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		p_fd = (s32 *)CMSG_DATA(p_cmsg);
+		end = (s32 *)((u8 *)p_fd + p_cmsg->cmsg_len - CMSG_LEN(0));
+		for (; p_fd < end; p_fd++) {
+			if (!mark) {
+				mark = rx_add_mark(q);
+				if (mark) {
+					mark->pos = q->base + q->tail;
+					mark->fds.count = 0;
+				}
+			}
+			if (!mark || mark->fds.count == MAX_FDS_COUNT) {
+				close(*p_fd);
+				continue;
+			}
+			mark->fds.fds[mark->fds.count++] = *p_fd;
+		}
+	}
+	if (mark)
+		q->count_marks++;
+
+	return ret;
+}
+
+s32 cb_ipc_rx_fill(void *rx, s32 sock, size_t max)
+{
+	struct cb_ipc_rx *q = rx;
+	size_t total = 0;
+	s32 ret;
+
+	while (total < max) {
+		ret = rx_reserve(q);
+		if (ret < 0) {
+			/* full of complete frames, the caller parses first */
+			if (total)
+				break;
+			return ret;
+		}
+
+		ret = rx_recv(q, sock);
+		if (ret == -EAGAIN)
+			break;
+		if (ret < 0)
+			return ret;
+		if (ret == 0) {
+			if (total)
+				break;
+			return 0;
+		}
+		total += ret;
+	}
+
+	if (!total)
+		return -EAGAIN;
+
+	return total > INT32_MAX ? INT32_MAX : total;
+}
+
+s32 cb_ipc_rx_next(void *rx, u8 **buf, size_t *sz)
+{
+	struct cb_ipc_rx *q = rx;
+	size_t used = q->tail - q->head, length;
+	u64 start;
+	u8 *p;
+
+	if (used < sizeof(size_t))
+		return 0;
+
+	memcpy(&length, q->buf + q->head, sizeof(size_t));
+	if (length > q->max_size - sizeof(size_t))
+		return -EMSGSIZE;
+	if (used < sizeof(size_t) + length)
+		return 0;
+
+	/* fds not claimed by the frames before this one are stale */
+	start = q->base + q->head;
+	while (q->count_marks && q->marks[q->first_mark].pos <= start) {
+		rx_mark_close(&q->marks[q->first_mark]);
+		rx_mark_pop(q);
+	}
+
+	p = q->buf + q->head + sizeof(size_t);
+	if ((unsigned long)p & (sizeof(u64) - 1)) {
+		if (q->size_frame < length) {
+			free(q->frame);
+			q->frame = malloc(length);
+			if (!q->frame) {
+				q->size_frame = 0;
+				return -ENOMEM;
+			}
+			q->size_frame = length;
+		}
+		memcpy(q->frame, p, length);
+		p = q->frame;
+	}
+
+	*buf = p;
+	*sz = length;
+	q->head += sizeof(size_t) + length;
+	if (q->head == q->tail) {
+		q->base += q->head;
+		q->head = q->tail = 0;
+	}
+
+	return 1;
+}
+
+s32 cb_ipc_rx_take_fds(void *rx, struct cb_fds *fds)
+{
+	struct cb_ipc_rx *q = rx;
+
+	fds->count = 0;
+	if (!q->count_marks)
+		return 0;
+
+	memcpy(fds, &q->marks[q->first_mark].fds, sizeof(*fds));
+	rx_mark_pop(q);
+
+	return fds->count;
+}
@@ -44,6 +44,38 @@ s32 cb_socket_bind_listen(const s32 sock, const char *name);
 s32 cb_socket_accept(const s32 sock);
 s32 cb_socket_connect(const s32 sock, const char *remote);
 
+/*
+ * Outbound queue of a connection. Messages are framed (size_t length then
+ * payload) into a ring and pushed with one sendmsg per run of messages, a
+ * message carrying fds starts a new run so the fds arrive with it. What the
+ * socket does not take stays queued until cb_ipc_tx_flush() is called again
+ * on EPOLLOUT. The fds are duplicated when queued and closed once sent.
+ */
+void *cb_ipc_tx_create(size_t size, size_t max_size);
+void cb_ipc_tx_destroy(void *tx);
+/* -ENOBUFS if the queue would grow past max_size */
+s32 cb_ipc_tx_queue(void *tx, const u8 *buf, size_t sz, struct cb_fds *fds);
+/* bytes left in the queue, or -errno if the connection is broken */
+s32 cb_ipc_tx_flush(void *tx, s32 sock);
+size_t cb_ipc_tx_pending(void *tx);
+
+/*
+ * Inbound buffer of a connection. cb_ipc_rx_fill() drains the socket with
+ * large reads, cb_ipc_rx_next() then hands out each complete frame in turn.
+ * A frame stays valid until the next fill. Received fds are queued in
+ * stream order and claimed by the frame which needs them, fds left behind
+ * by earlier frames are closed.
+ */
+void *cb_ipc_rx_create(size_t size, size_t max_size);
+void cb_ipc_rx_destroy(void *rx);
+/* bytes read, -EAGAIN if none, 0 if the peer closed, or -errno */
+s32 cb_ipc_rx_fill(void *rx, s32 sock, size_t max);
+/* 1 with the payload of the next frame, 0 if it is not complete yet */
+s32 cb_ipc_rx_next(void *rx, u8 **buf, size_t *sz);
+/* count of fds taken from the oldest queued batch */
+s32 cb_ipc_rx_take_fds(void *rx, struct cb_fds *fds);
+size_t cb_ipc_rx_pending(void *rx);
+
 #ifdef __cplusplus
 }
 #endif
@@ -26,16 +26,18 @@
 #include <errno.h>
 #include <cube_utils.h>
 #include <cube_protocal.h>
+#include <cube_protocal_v2.h>
 
 u8 *cb_server_create_linkup_cmd(u64 link_id, u32 *n)
 {
-	struct cb_tlv *tlv, *tlv_map, *tlv_result;
-	u32 size, size_result, size_map, *map, *head;
+	struct cb_tlv *tlv, *tlv_map, *tlv_result, *tlv_proto;
+	u32 size, size_result, size_proto, size_map, *map, *head;
 	u8 *p;
 
 	size_map = CB_CMD_MAP_SIZE;
 	size_result = sizeof(*tlv) + sizeof(u64);
-	size = sizeof(*tlv) + size_map + size_result + sizeof(u32);
+	size_proto = sizeof(*tlv) + sizeof(u64);
+	size = sizeof(*tlv) + size_map + size_result + size_proto + sizeof(u32);
 	p = calloc(1, size);
 	if (!p)
 		return NULL;
@@ -45,7 +47,7 @@ u8 *cb_server_create_linkup_cmd(u64 link_id, u32 *n)
 
 	tlv = (struct cb_tlv *)(p+sizeof(u32));
 	tlv->tag = CB_TAG_WIN;
-	tlv->length = size_result + size_map;
+	tlv->length = size_result + size_proto + size_map;
 	tlv_map = (struct cb_tlv *)(&tlv->payload[0]);
 	tlv_result = (struct cb_tlv *)(&tlv->payload[0] + size_map);
 	tlv_map->tag = CB_TAG_MAP;
@@ -55,6 +57,11 @@ u8 *cb_server_create_linkup_cmd(u64 link_id, u32 *n)
 	tlv_result->tag = CB_TAG_RESULT;
 	tlv_result->length = sizeof(u64);
 	*((u64 *)(&tlv_result->payload[0])) = link_id;
+	/* old clients only look up the result through the map */
+	tlv_proto = (struct cb_tlv *)((u8 *)tlv_result + size_result);
+	tlv_proto->tag = CB_TAG_PROTO_VERSION;
+	tlv_proto->length = sizeof(u64);
+	*((u64 *)(&tlv_proto->payload[0])) = CB_PROTO_VERSION_MAX;
 	*n = size;
 
 	return p;
@@ -103,6 +110,33 @@ u64 cb_client_parse_link_id(u8 *data)
 	return *((u64 *)(&tlv_result->payload[0]));
 }
 
+u32 cb_client_parse_link_proto(u8 *data)
+{
+	struct cb_tlv *tlv, *tlv_result, *tlv_proto;
+	u32 size, *map;
+	u64 version;
+
+	tlv = (struct cb_tlv *)(data+sizeof(u32));
+	size = sizeof(*tlv) + sizeof(u32) + tlv->length;
+	map = (u32 *)(&((struct cb_tlv *)(&tlv->payload[0]))->payload[0]);
+	tlv_result = (struct cb_tlv *)(data
+			+ map[CB_CMD_LINK_ID_ACK_SHIFT - CB_CMD_OFFSET]);
+	tlv_proto = (struct cb_tlv *)(&tlv_result->payload[0]
+			+ tlv_result->length);
+	if ((u8 *)(&tlv_proto->payload[0]) + sizeof(u64) > data + size)
+		return CB_PROTO_V1;
+	if (tlv_proto->tag != CB_TAG_PROTO_VERSION)
+		return CB_PROTO_V1;
+	if (tlv_proto->length != sizeof(u64))
+		return CB_PROTO_V1;
+	version = *((u64 *)(&tlv_proto->payload[0]));
+	if (version < CB_PROTO_V1)
+		return CB_PROTO_V1;
+	if (version > CB_PROTO_VERSION_MAX)
+		return CB_PROTO_VERSION_MAX;
+	return version;
+}
+
 u8 *cb_client_create_surface_cmd(struct cb_surface_info *s, u32 *n)
 {
 	struct cb_tlv *tlv, *tlv_map, *tlv_surface_create;
@@ -1928,6 +1962,93 @@ s32 cb_client_parse_view_focus_chg_cmd(u8 *data, u64 *view_id, bool *on)
 	return 0;
 }
 
+static u8 *create_u64_cmd(enum cb_tag tag, u64 value, u32 *n)
+{
+	struct cb_tlv *tlv;
+	u32 size, *head;
+	u8 *p;
+
+	size = sizeof(*tlv) + sizeof(u32) + sizeof(u64);
+	p = calloc(1, size);
+	if (!p)
+		return NULL;
+
+	head = (u32 *)p;
+	*head = 0xFE; /* magic or else */
+
+	tlv = (struct cb_tlv *)(p+sizeof(u32));
+	tlv->tag = tag;
+	tlv->length = sizeof(u64);
+	memcpy(&tlv->payload[0], &value, tlv->length);
+	*n = size;
+
+	return p;
+}
+
+static s32 parse_u64_cmd(u8 *data, enum cb_tag tag, u64 *value)
+{
+	struct cb_tlv *tlv;
+
+	if (!value)
+		return -EINVAL;
+
+	tlv = (struct cb_tlv *)(data+sizeof(u32));
+	if (tlv->tag != tag || tlv->length != sizeof(u64))
+		return -EINVAL;
+
+	memcpy(value, &tlv->payload[0], sizeof(u64));
+	return 0;
+}
+
+u8 *cb_client_create_shm_setup_cmd(u64 ring_size, u32 *n)
+{
+	return create_u64_cmd(CB_TAG_SHM_SETUP, ring_size, n);
+}
+
+s32 cb_server_parse_shm_setup_cmd(u8 *data, u64 *ring_size)
+{
+	return parse_u64_cmd(data, CB_TAG_SHM_SETUP, ring_size);
+}
+
+u8 *cb_server_create_shm_setup_ack_cmd(s64 result, u32 *n)
+{
+	return create_u64_cmd(CB_TAG_SHM_SETUP_ACK, (u64)result, n);
+}
+
+s32 cb_client_parse_shm_setup_ack_cmd(u8 *data, s64 *result)
+{
+	return parse_u64_cmd(data, CB_TAG_SHM_SETUP_ACK, (u64 *)result);
+}
+
+u8 *cb_client_create_shm_on_cmd(u32 *n)
+{
+	return create_u64_cmd(CB_TAG_SHM_ON, 0, n);
+}
+
+u8 *cb_client_create_proto_select_cmd(u32 version, u32 *n)
+{
+	return create_u64_cmd(CB_TAG_PROTO_SELECT, version, n);
+}
+
+s32 cb_server_parse_proto_select_cmd(u8 *data, u32 *version)
+{
+	u64 value;
+	s32 ret;
+
+	if (!version)
+		return -EINVAL;
+
+	ret = parse_u64_cmd(data, CB_TAG_PROTO_SELECT, &value);
+	if (ret < 0)
+		return ret;
+
+	if (value < CB_PROTO_V1 || value > CB_PROTO_VERSION_MAX)
+		return -EPROTONOSUPPORT;
+
+	*version = value;
+	return 0;
+}
+
 u8 *cb_client_create_af_commit_buffer(void)
 {
 	u32 size, size_commit, size_map;
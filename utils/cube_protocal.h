@@ -157,6 +157,11 @@ enum cb_tag {
 	CB_TAG_VIEW_FOCUS_CHG, /* view focus on / lost */
 	CB_TAG_MC_COMMIT_INFO, /* mouse cursor */
 	CB_TAG_GUI_INPUT, /* input msg for GUI */
+	CB_TAG_SHM_SETUP, /* u64 ring size, fds: area, c2s/s2c doorbells */
+	CB_TAG_SHM_SETUP_ACK, /* s64 result */
+	CB_TAG_SHM_ON, /* client to server messages go through the ring */
+	CB_TAG_PROTO_VERSION, /* u64 highest version the server speaks */
+	CB_TAG_PROTO_SELECT, /* u64 version the client chose */
 };
 
 struct cb_tlv {
@@ -199,6 +204,8 @@ struct cb_surface_info {
 	struct cb_rect damage;
 	u32 width, height;
 	struct cb_rect opaque;
+	/* repeat the committed SHM buffer over the view (ARGB/XRGB) */
+	bool tiled;
 };
 
 struct cb_view_info {
@@ -279,6 +286,8 @@ enum cb_buffer_type {
 	CB_BUF_TYPE_SHM,
 	CB_BUF_TYPE_DMA,
 	CB_BUF_TYPE_SURFACE,
+	/* memoryless, the view is filled with info.color */
+	CB_BUF_TYPE_SOLID,
 };
 
 struct cb_buffer_info {
@@ -292,6 +301,7 @@ struct cb_buffer_info {
 	void *maps[4];
 	s32 planes;
 	bool composed;  /* for DMA-BUF used (to be composed or not) */
+	u32 color; /* for solid buffer used, ARGB8888, not premultiplied */
 };
 
 #define DAMAGE_AREA_MAX_NR 2048
@@ -338,6 +348,10 @@ enum cb_shell_cmd {
 	CB_SHELL_CANVAS_LAYOUT_CHANGED_NOTIFY,
 	CB_SHELL_OUTPUT_VIDEO_TIMING_ENUMERATE,
 	CB_SHELL_OUTPUT_VIDEO_TIMING_CREAT,
+	CB_SHELL_OUTPUT_CAPTURE_START,
+	CB_SHELL_OUTPUT_CAPTURE_STOP,
+	CB_SHELL_OUTPUT_CAPTURE_RELEASE,
+	CB_SHELL_OUTPUT_CAPTURE_NOTIFY,
 };
 
 #define CB_CONNECTOR_NAME_MAX_LEN 31
@@ -349,10 +363,35 @@ struct mode_req {
 	u32 refresh;
 };
 
+/*
+ * output transform, counter-clockwise rotation of the desktop on the screen.
+ * desktop_rc is given in the rotated (logical) orientation.
+ */
+enum cb_output_transform {
+	CB_TRANSFORM_NORMAL = 0,
+	CB_TRANSFORM_90,
+	CB_TRANSFORM_180,
+	CB_TRANSFORM_270,
+	CB_TRANSFORM_NR,
+};
+
+/* internal render resolution, percent of the mode size */
+#define CB_RENDER_SCALE_MIN 50
+#define CB_RENDER_SCALE_MAX 100
+
 struct output_config {
 	s32 pipe;
 	struct cb_rect desktop_rc;
 	struct cb_rect input_rc;
+	/* enum cb_output_transform */
+	u32 transform;
+	/*
+	 * percent, 0 keeps the current one. it is the upper limit if
+	 * render_scale_auto is set, the compositor lowers it when rendering
+	 * cannot keep up with the refresh rate.
+	 */
+	u32 render_scale;
+	bool render_scale_auto;
 	void *mode_handle;
 	struct mode_req mr;
 	void *custom_mode_handle;
@@ -409,6 +448,36 @@ struct output_timings_enum {
 	struct cb_mode_filter enum_filter;
 };
 
+#define CB_CAPTURE_BO_MAX 4
+
+/*
+ * output capture (via display controller's writeback engine)
+ *
+ * START (client -> server, server feeds back result):
+ *     pipe:        output to be captured.
+ *     bo_ids:      capture targets, SHM bo or direct show DMA-BUF bo in the
+ *                  size of the output's current video timing.
+ *     interval_ms: capture interval, 0 means one frame per refresh.
+ * NOTIFY (server -> client):
+ *     bo_id:       the bo filled with a new frame, it is held by client
+ *                  until RELEASE is sent.
+ *     seq:         frame sequence.
+ * RELEASE (client -> server):
+ *     bo_id:       the bo can be written again.
+ * STOP (client -> server)
+ *
+ * result: 0 on success, negative errno on failure.
+ */
+struct cb_capture_info {
+	s32 pipe;
+	u32 count_bos;
+	u64 bo_ids[CB_CAPTURE_BO_MAX];
+	u32 interval_ms;
+	u64 bo_id;
+	u64 seq;
+	s64 result;
+};
+
 struct cb_debug_flags {
 	u8 clia_flag;
 	u8 comp_flag;
@@ -428,6 +497,7 @@ struct cb_shell_info {
 		struct mode_info mode;
 		s32 modeset_pipe;
 		void *new_mode_handle;
+		struct cb_capture_info capture;
 	} value;
 };
 
@@ -578,6 +648,8 @@ u8 *cb_server_create_linkup_cmd(u64 link_id, u32 *n);
 u8 *cb_dup_linkup_cmd(u8 *dst, u8 *src, u32 n, u64 link_id);
 /* client: parse link ID */
 u64 cb_client_parse_link_id(u8 *data);
+/* client: highest protocol version both sides speak, from the link ID ack */
+u32 cb_client_parse_link_proto(u8 *data);
 
 #define CB_CLIENT_CAP_NOTIFY_LAYOUT (1 << 0)
 #define CB_CLIENT_CAP_RAW_INPUT (1 << 1)
@@ -757,22 +829,33 @@ void cb_cmd_dump(u8 *data);
 /*
  * mouse cursor command
  * 
+ * REGISTER_CURSOR: upload the cursor shape in bo_id once, the client picks
+ *                  a non-zero shape_id for it. The bo can be destroyed
+ *                  after the ack is received.
+ * SELECT_CURSOR: switch to a registered shape by shape_id.
+ * UNREGISTER_CURSOR: release shape_id, 0 means all shapes of the client.
  */
 enum mc_cmd_type {
 	MC_CMD_TYPE_UNKNOWN = 0,
 	MC_CMD_TYPE_SET_CURSOR,
 	MC_CMD_TYPE_SHOW,
 	MC_CMD_TYPE_HIDE,
+	MC_CMD_TYPE_REGISTER_CURSOR,
+	MC_CMD_TYPE_SELECT_CURSOR,
+	MC_CMD_TYPE_UNREGISTER_CURSOR,
 };
 
 struct cb_mc_info {
 	enum mc_cmd_type type;
-	u64 bo_id; /* SHM BO, used when type is MC_CMD_TYPE_SET_CURSOR */
+	/* SHM BO, used when type is MC_CMD_TYPE_SET/REGISTER_CURSOR */
+	u64 bo_id;
 	bool alpha_src_pre_mul; /* Display controller do alpha blending ? */
 	struct {
 		s32 hot_x, hot_y;
 		u32 w, h;
 	} cursor;
+	/* used when type is MC_CMD_TYPE_(UN)REGISTER/SELECT_CURSOR */
+	u32 shape_id;
 };
 
 /* client: mc commit command */
@@ -813,6 +896,26 @@ u8 *cb_dup_view_focus_chg_cmd(u8 *dst, u8 *src, u32 n, u64 view_id, bool on);
 /* client: parse view focus change notify */
 s32 cb_client_parse_view_focus_chg_cmd(u8 *data, u64 *view_id, bool *on);
 
+/*
+ * Shared memory transport, see cube_shm_ring.h.
+ *   client: CB_TAG_SHM_SETUP with the area and both doorbells.
+ *   server: CB_TAG_SHM_SETUP_ACK, its later messages use the s2c ring.
+ *   client: CB_TAG_SHM_ON, its later messages use the c2s ring.
+ */
+u8 *cb_client_create_shm_setup_cmd(u64 ring_size, u32 *n);
+s32 cb_server_parse_shm_setup_cmd(u8 *data, u64 *ring_size);
+u8 *cb_server_create_shm_setup_ack_cmd(s64 result, u32 *n);
+s32 cb_client_parse_shm_setup_ack_cmd(u8 *data, s64 *result);
+u8 *cb_client_create_shm_on_cmd(u32 *n);
+
+/*
+ * Protocol version, see cube_protocal_v2.h.
+ *   client: CB_TAG_PROTO_SELECT after the link ID ack, its later messages
+ *           and the server's replies may use the chosen version.
+ */
+u8 *cb_client_create_proto_select_cmd(u32 version, u32 *n);
+s32 cb_server_parse_proto_select_cmd(u8 *data, u32 *version);
+
 #pragma pack(pop)
 
 enum cb_gui_input_tag {
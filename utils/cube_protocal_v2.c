@@ -0,0 +1,153 @@
+/*
+ * Copyright © 2020 Ruinan Duan, duanruinan@zoho.com 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <cube_utils.h>
+#include <cube_protocal.h>
+#include <cube_protocal_v2.h>
+
+static const u16 v2_body_size[CB_V2_OP_LAST] = {
+	[CB_V2_OP_COMMIT] = sizeof(struct cb_v2_commit),
+	[CB_V2_OP_DESTROY_BO] = sizeof(struct cb_v2_destroy_bo),
+	[CB_V2_OP_MC_COMMIT] = sizeof(struct cb_v2_mc_commit),
+	[CB_V2_OP_COMMIT_ACK] = sizeof(struct cb_v2_commit_ack),
+	[CB_V2_OP_BO_FLIPPED] = sizeof(struct cb_v2_bo_event),
+	[CB_V2_OP_BO_COMPLETE] = sizeof(struct cb_v2_bo_event),
+	[CB_V2_OP_VIEW_FOCUS_CHG] = sizeof(struct cb_v2_view_focus_chg),
+	[CB_V2_OP_MC_COMMIT_ACK] = sizeof(struct cb_v2_mc_commit_ack),
+};
+
+u32 cb_v2_msg_size(u16 opcode)
+{
+	if (opcode >= CB_V2_OP_LAST || !v2_body_size[opcode])
+		return 0;
+
+	return sizeof(struct cb_v2_hdr) + v2_body_size[opcode];
+}
+
+void *cb_v2_encode(u8 *buf, u16 opcode, u32 seq)
+{
+	struct cb_v2_hdr *hdr = (struct cb_v2_hdr *)buf;
+	u32 size;
+
+	size = cb_v2_msg_size(opcode);
+	if (!size)
+		return NULL;
+
+	memset(buf, 0, size);
+	hdr->magic = CB_PROTO_V2_MAGIC;
+	hdr->opcode = opcode;
+	hdr->length = size - sizeof(*hdr);
+	hdr->seq = seq;
+	return buf + sizeof(*hdr);
+}
+
+void *cb_v2_decode(u8 *buf, size_t sz, u16 *opcode, u32 *seq)
+{
+	struct cb_v2_hdr *hdr = (struct cb_v2_hdr *)buf;
+	u32 size;
+
+	if (sz < sizeof(*hdr) || hdr->magic != CB_PROTO_V2_MAGIC)
+		return NULL;
+
+	size = cb_v2_msg_size(hdr->opcode);
+	if (!size || sz != size || hdr->length != size - sizeof(*hdr))
+		return NULL;
+
+	if (opcode)
+		*opcode = hdr->opcode;
+	if (seq)
+		*seq = hdr->seq;
+	return buf + sizeof(*hdr);
+}
+
+void cb_v2_commit_from_info(struct cb_v2_commit *dst,
+			    struct cb_commit_info *src)
+{
+	dst->bo_id = src->bo_id;
+	dst->surface_id = src->surface_id;
+	dst->damage_x = src->bo_damage.pos.x;
+	dst->damage_y = src->bo_damage.pos.y;
+	dst->damage_w = src->bo_damage.w;
+	dst->damage_h = src->bo_damage.h;
+	dst->opaque_x = src->bo_opaque.pos.x;
+	dst->opaque_y = src->bo_opaque.pos.y;
+	dst->opaque_w = src->bo_opaque.w;
+	dst->opaque_h = src->bo_opaque.h;
+	dst->shown = src->shown;
+	dst->view_x = src->view_x;
+	dst->view_y = src->view_y;
+	dst->view_width = src->view_width;
+	dst->view_height = src->view_height;
+	dst->pipe_locked = src->pipe_locked;
+	dst->delta_z = src->delta_z;
+	dst->pad = 0;
+}
+
+void cb_v2_commit_to_info(struct cb_commit_info *dst,
+			  struct cb_v2_commit *src)
+{
+	dst->bo_id = src->bo_id;
+	dst->surface_id = src->surface_id;
+	dst->bo_damage.pos.x = src->damage_x;
+	dst->bo_damage.pos.y = src->damage_y;
+	dst->bo_damage.w = src->damage_w;
+	dst->bo_damage.h = src->damage_h;
+	dst->bo_opaque.pos.x = src->opaque_x;
+	dst->bo_opaque.pos.y = src->opaque_y;
+	dst->bo_opaque.w = src->opaque_w;
+	dst->bo_opaque.h = src->opaque_h;
+	dst->shown = src->shown;
+	dst->view_x = src->view_x;
+	dst->view_y = src->view_y;
+	dst->view_width = src->view_width;
+	dst->view_height = src->view_height;
+	dst->pipe_locked = src->pipe_locked;
+	dst->delta_z = src->delta_z;
+}
+
+void cb_v2_mc_commit_from_info(struct cb_v2_mc_commit *dst,
+			       struct cb_mc_info *src)
+{
+	dst->bo_id = src->bo_id;
+	dst->type = src->type;
+	dst->alpha_src_pre_mul = src->alpha_src_pre_mul;
+	dst->hot_x = src->cursor.hot_x;
+	dst->hot_y = src->cursor.hot_y;
+	dst->w = src->cursor.w;
+	dst->h = src->cursor.h;
+	dst->shape_id = src->shape_id;
+	dst->pad = 0;
+}
+
+void cb_v2_mc_commit_to_info(struct cb_mc_info *dst,
+			     struct cb_v2_mc_commit *src)
+{
+	dst->bo_id = src->bo_id;
+	dst->type = src->type;
+	dst->alpha_src_pre_mul = src->alpha_src_pre_mul ? true : false;
+	dst->cursor.hot_x = src->hot_x;
+	dst->cursor.hot_y = src->hot_y;
+	dst->cursor.w = src->w;
+	dst->cursor.h = src->h;
+	dst->shape_id = src->shape_id;
+}
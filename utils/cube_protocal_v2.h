@@ -0,0 +1,172 @@
+/*
+ * Copyright © 2020 Ruinan Duan, duanruinan@zoho.com 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CUBE_PROTOCAL_V2_H
+#define CUBE_PROTOCAL_V2_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <cube_utils.h>
+#include <cube_protocal.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Protocol v2: fixed layout messages for the per frame traffic.
+ *
+ * A message is a struct cb_v2_hdr followed by one fixed size, little
+ * endian body per opcode, so both sides encode and decode it in place
+ * instead of walking TLVs. The link ID ack carries the highest version
+ * the server speaks, a client which wants v2 sends CB_TAG_PROTO_SELECT
+ * before its first v2 message and the server answers in v2 from then on.
+ * Commands without an opcode here keep using the TLV format.
+ *
+ * CB_PROTO_V2_MAGIC never shows up as the head of a TLV command, so the
+ * receiver tells both formats apart by the first u32 of a frame.
+ */
+#define CB_PROTO_V1 1
+#define CB_PROTO_V2 2
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CB_PROTO_VERSION_MAX CB_PROTO_V2
+#else
+/* bodies are cast in place, big endian hosts stay with TLV */
+#define CB_PROTO_VERSION_MAX CB_PROTO_V1
+#endif
+
+#define CB_PROTO_V2_MAGIC 0x32564243 /* "CBV2" */
+
+enum cb_v2_opcode {
+	CB_V2_OP_UNKNOWN = 0,
+	/* client to server */
+	CB_V2_OP_COMMIT, /* struct cb_v2_commit */
+	CB_V2_OP_DESTROY_BO, /* struct cb_v2_destroy_bo */
+	CB_V2_OP_MC_COMMIT, /* struct cb_v2_mc_commit */
+	/* server to client */
+	CB_V2_OP_COMMIT_ACK, /* struct cb_v2_commit_ack */
+	CB_V2_OP_BO_FLIPPED, /* struct cb_v2_bo_event */
+	CB_V2_OP_BO_COMPLETE, /* struct cb_v2_bo_event */
+	CB_V2_OP_VIEW_FOCUS_CHG, /* struct cb_v2_view_focus_chg */
+	CB_V2_OP_MC_COMMIT_ACK, /* struct cb_v2_mc_commit_ack */
+	CB_V2_OP_LAST,
+};
+
+#pragma pack(push)
+#pragma pack(8)
+
+struct cb_v2_hdr {
+	u32 magic;
+	u16 opcode;
+	u16 length; /* body size */
+	u32 seq; /* per direction, starts at 0 */
+	u32 reserved;
+};
+
+struct cb_v2_commit {
+	u64 bo_id;
+	u64 surface_id;
+	s32 damage_x, damage_y;
+	u32 damage_w, damage_h;
+	s32 opaque_x, opaque_y;
+	u32 opaque_w, opaque_h;
+	s32 shown;
+	s32 view_x, view_y;
+	u32 view_width, view_height;
+	s32 pipe_locked;
+	s32 delta_z;
+	u32 pad;
+};
+
+struct cb_v2_destroy_bo {
+	u64 bo_id;
+};
+
+struct cb_v2_mc_commit {
+	u64 bo_id;
+	u32 type; /* enum mc_cmd_type */
+	u32 alpha_src_pre_mul;
+	s32 hot_x, hot_y;
+	u32 w, h;
+	u32 shape_id;
+	u32 pad;
+};
+
+struct cb_v2_commit_ack {
+	u64 result;
+	u64 surface_id;
+};
+
+struct cb_v2_bo_event {
+	u64 bo_id;
+	u64 surface_id;
+};
+
+struct cb_v2_view_focus_chg {
+	u64 view_id;
+	u32 on;
+	u32 pad;
+};
+
+struct cb_v2_mc_commit_ack {
+	u64 result;
+};
+
+#pragma pack(pop)
+
+/* Largest message, a u64 aligned buffer of this size takes any of them */
+#define CB_V2_MSG_MAX (sizeof(struct cb_v2_hdr) + sizeof(struct cb_v2_commit))
+
+/* Whole message size of an opcode, 0 if unknown */
+u32 cb_v2_msg_size(u16 opcode);
+
+static inline bool cb_v2_is_msg(u8 *buf, size_t sz)
+{
+	return sz >= sizeof(u32) && *((u32 *)buf) == CB_PROTO_V2_MAGIC;
+}
+
+/*
+ * Write the header into a u64 aligned buf of cb_v2_msg_size(opcode) bytes
+ * and return the zeroed body for the caller to fill in.
+ */
+void *cb_v2_encode(u8 *buf, u16 opcode, u32 seq);
+
+/*
+ * Check a received frame against the layout of its opcode and return the
+ * body, or NULL if it is malformed. buf must be u64 aligned.
+ */
+void *cb_v2_decode(u8 *buf, size_t sz, u16 *opcode, u32 *seq);
+
+void cb_v2_commit_from_info(struct cb_v2_commit *dst,
+			    struct cb_commit_info *src);
+void cb_v2_commit_to_info(struct cb_commit_info *dst,
+			  struct cb_v2_commit *src);
+void cb_v2_mc_commit_from_info(struct cb_v2_mc_commit *dst,
+			       struct cb_mc_info *src);
+void cb_v2_mc_commit_to_info(struct cb_mc_info *dst,
+			     struct cb_v2_mc_commit *src);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
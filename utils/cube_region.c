@@ -59,7 +59,9 @@ static struct cb_region_data *broken_data_ptr = &broken_data;
 #define BAD_BOX(box) (((box)->p1.x > (box)->p2.x) \
 			|| ((box)->p1.y < (box)->p2.y))
 
-#define FREE_DATA(reg) if ((reg)->data && (reg)->data->size) free((reg)->data)
+#define FREE_DATA(reg) \
+	if ((reg)->data && (reg)->data->size && (reg)->data != (reg)->storage) \
+		free((reg)->data)
 #define REGION_NIL(reg) ((reg)->data && !(reg)->data->count_boxes)
 #define REGION_NAR(reg) ((reg)->data == broken_data_ptr)
 #define REGION_COUNT_BOXES(reg) ((reg)->data ? (reg)->data->count_boxes : 1)
@@ -127,7 +129,8 @@ static struct cb_region_data *broken_data_ptr = &broken_data;
 
 #define DOWNSIZE(reg, count_boxes) do { \
 	if (((count_boxes) < ((reg)->data->size >> 1)) \
-			&& ((reg)->data->size > 50)) { \
+			&& ((reg)->data->size > 50) \
+			&& ((reg)->data != (reg)->storage)) { \
 		struct cb_region_data * new_data; \
 		u32 data_size = REGION_SZOF(count_boxes); \
 		if (!data_size) { \
@@ -179,10 +182,32 @@ static struct cb_region_data *broken_data_ptr = &broken_data;
      && ((r1)->p1.y <= (r2)->p1.y) \
      && ((r1)->p2.y >= (r2)->p2.y) )
 
+static inline void init_storage(struct cb_region *region)
+{
+	region->inline_storage.hdr.size = CB_REGION_INLINE_BOXES;
+	region->inline_storage.hdr.count_boxes = 0;
+	region->storage = &region->inline_storage.hdr;
+}
+
 void cb_region_init(struct cb_region *region)
 {
 	region->extents = *empty_box_ptr;
 	region->data = empty_data_ptr;
+	init_storage(region);
+}
+
+void cb_region_init_with_scratch(struct cb_region *region, void *scratch,
+				 u32 count)
+{
+	region->extents = *empty_box_ptr;
+	region->data = empty_data_ptr;
+	if (!scratch || !count) {
+		init_storage(region);
+		return;
+	}
+	region->storage = (struct cb_region_data *)scratch;
+	region->storage->size = count;
+	region->storage->count_boxes = 0;
 }
 
 void cb_region_init_rect(struct cb_region *region,
@@ -201,6 +226,7 @@ void cb_region_init_rect(struct cb_region *region,
 	}
 
 	region->data = NULL;
+	init_storage(region);
 }
 
 static u32 REGION_SZOF(u32 n)
@@ -226,6 +252,21 @@ static struct cb_region_data * alloc_data(u32 n)
 	return malloc(sz);
 }
 
+/* hand out the region's own storage when n boxes fit in, else the heap */
+static struct cb_region_data *get_data(struct cb_region *region, u32 n)
+{
+	struct cb_region_data *data;
+
+	if (region->storage && n <= region->storage->size)
+		return region->storage;
+
+	data = alloc_data(n);
+	if (data)
+		data->size = n;
+
+	return data;
+}
+
 static s32 set_break(struct cb_region *region)
 {
 	FREE_DATA(region);
@@ -241,14 +282,13 @@ static s32 box_alloc(struct cb_region *region, s32 n)
 	u32 data_size;
 
 	if (!region->data) {
-		n++;
-		region->data = alloc_data(n);
+		region->data = get_data(region, n + 1);
 		if (!region->data)
 			return set_break(region);
 		region->data->count_boxes = 1;
 		*(REGION_BOX_PTR(region)) = region->extents;
 	} else if (!region->data->size) {
-		region->data = alloc_data(n);
+		region->data = get_data(region, n);
 		if (!region->data)
 			return set_break(region);
 		region->data->count_boxes = 0;
@@ -262,19 +302,24 @@ static s32 box_alloc(struct cb_region *region, s32 n)
 		data_size = REGION_SZOF(n);
 		if (!data_size) {
 			data = NULL;
+		} else if (region->data == region->storage) {
+			/* outgrown the storage, move the boxes to the heap */
+			data = malloc(data_size);
+			if (data)
+				memcpy(data, region->data,
+				       REGION_SZOF(region->data->count_boxes));
 		} else {
 			data = (struct cb_region_data *)
-				realloc(region->data, REGION_SZOF(n));
+				realloc(region->data, data_size);
 		}
 
 		if (!data)
 			return set_break(region);
 
 		region->data = data;
+		region->data->size = n;
 	}
 
-	region->data->size = n;
-
 	return 0;
 }
 
@@ -395,6 +440,10 @@ static s32 region_op(struct cb_region *new_reg,
 	s32 r2y1;
 	s32 new_size;
 	s32 count_boxes;
+	struct cb_region_data *detached = NULL; /* Storage of new_reg moved
+						 * aside while it is a source*/
+	struct cb_box saved[32];        /* Source boxes copied out of
+					 * the storage of new_reg     */
 
 	/*
 	 * Break any region computed from a broken region
@@ -429,6 +478,29 @@ static s32 region_op(struct cb_region *new_reg,
 		new_reg->data = empty_data_ptr;
 	}
 
+	/*
+	 * The boxes of new_reg are about to be rewritten in its storage.
+	 * Keep the source boxes on the stack when they are few, otherwise
+	 * let the result go to the heap and give the storage back at the end.
+	 */
+	if (old_data && old_data == new_reg->storage) {
+		if (old_data->count_boxes <= ARRAY_SIZE(saved)) {
+			memcpy(saved, old_data + 1,
+			       old_data->count_boxes * sizeof(struct cb_box));
+			if (new_reg == reg1) {
+				r1 = saved;
+				r1_end = saved + new_size;
+			} else {
+				r2 = saved;
+				r2_end = saved + count_boxes;
+			}
+			old_data = NULL;
+		} else {
+			detached = new_reg->storage;
+			new_reg->storage = NULL;
+		}
+	}
+
 	/* guess at new size */
 	if (count_boxes > new_size)
 		new_size = count_boxes;
@@ -440,9 +512,20 @@ static s32 region_op(struct cb_region *new_reg,
 	else if (new_reg->data->size)
 		new_reg->data->count_boxes = 0;
 
-	if (new_size > new_reg->data->size) {
+	/* start in the storage when it may hold the result, grow on demand */
+	if (!new_reg->data->size && new_reg->storage
+	    && (new_size >> 1) <= new_reg->storage->size) {
+		new_reg->data = new_reg->storage;
+		new_reg->data->count_boxes = 0;
+	}
+
+	if (new_size > new_reg->data->size
+	    && new_reg->data != new_reg->storage) {
 		if (box_alloc(new_reg, new_size) < 0) {
-			free(old_data);
+			if (detached)
+				new_reg->storage = detached;
+			else
+				free(old_data);
 			return -1;
 		}
 	}
@@ -599,6 +682,10 @@ static s32 region_op(struct cb_region *new_reg,
 		APPEND_REGIONS(new_reg, r2_band_end, r2_end);
 	}
 
+	if (detached) {
+		new_reg->storage = detached;
+		old_data = NULL;
+	}
 	free(old_data);
 
 	if (!(count_boxes = new_reg->data->count_boxes)) {
@@ -615,6 +702,10 @@ static s32 region_op(struct cb_region *new_reg,
 	return 0;
 
 bail:
+	if (detached) {
+		new_reg->storage = detached;
+		old_data = NULL;
+	}
 	free(old_data);
 
 	return set_break(new_reg);
@@ -927,7 +1018,17 @@ static s32 validate(struct cb_region *badreg)
 	num_ri = 1;
 	ri[0].prev_band = 0;
 	ri[0].cur_band = 0;
-	ri[0].reg = *badreg;
+	/* the regions under construction only ever live on the heap */
+	ri[0].reg.storage = NULL;
+	if (badreg->data == badreg->storage) {
+		ri[0].reg.data = alloc_data(count_boxes);
+		if (!ri[0].reg.data)
+			goto bail;
+		memcpy(ri[0].reg.data, badreg->data, REGION_SZOF(count_boxes));
+		ri[0].reg.data->size = count_boxes;
+	} else {
+		ri[0].reg.data = badreg->data;
+	}
 	box = REGION_BOX_PTR(&ri[0].reg);
 	ri[0].reg.extents = *box;
 	ri[0].reg.data->count_boxes = 1;
@@ -1012,6 +1113,7 @@ static s32 validate(struct cb_region *badreg)
 		rit->cur_band = 0;
 		rit->reg.extents = *box;
 		rit->reg.data = (struct cb_region_data *)NULL;
+		rit->reg.storage = NULL;
 
 		/* MUST force allocation */
 		if (box_alloc(&rit->reg, (i + num_ri) / num_ri) < 0)
@@ -1070,7 +1172,18 @@ next_rect:
 			goto bail;
 	}
 
-	*badreg = ri[0].reg;
+	badreg->extents = ri[0].reg.extents;
+	badreg->data = ri[0].reg.data;
+
+	/* move the result back to the storage if it fits */
+	if (badreg->data && badreg->data->size && badreg->storage
+	    && badreg->data->count_boxes <= badreg->storage->size) {
+		badreg->storage->count_boxes = badreg->data->count_boxes;
+		memcpy(badreg->storage + 1, badreg->data + 1,
+		       badreg->data->count_boxes * sizeof(struct cb_box));
+		free(badreg->data);
+		badreg->data = badreg->storage;
+	}
 
 	if (ri != stack_regions)
 		free(ri);
@@ -1087,12 +1200,47 @@ bail:
 	return set_break(badreg);
 }
 
-s32 cb_region_init_boxes(struct cb_region *region,
-			 const struct cb_box *boxes, s32 count)
+/* drop the empty boxes filled in by the caller then sort and band them */
+static s32 init_from_boxes(struct cb_region *region)
 {
 	struct cb_box *inner_boxes, *box;
-	s32 skip, i;
+	s32 skip, i, count;
+
+	inner_boxes = REGION_BOX_PTR(region);
+	count = region->data->count_boxes;
+	skip = 0;
+
+	for (i = 0; i < count; i++) {
+		box = &inner_boxes[i];
+		if (box->p1.x >= box->p2.x || box->p1.y >= box->p2.y)
+			skip++;
+		else if (skip)
+			inner_boxes[i - skip] = inner_boxes[i];
+	}
+
+	region->data->count_boxes -= skip;
+
+	if (region->data->count_boxes == 0) {
+		FREE_DATA(region);
+		cb_region_init(region);
+		return 0;
+	}
 
+	if (region->data->count_boxes == 1) {
+		region->extents = inner_boxes[0];
+		FREE_DATA(region);
+		region->data = NULL;
+		return 0;
+	}
+
+	region->extents.p1.x = region->extents.p2.x = 0;
+
+	return validate(region);
+}
+
+s32 cb_region_init_boxes(struct cb_region *region,
+			 const struct cb_box *boxes, s32 count)
+{
 	if (count == 1) {
 		cb_region_init_rect(region, boxes[0].p1.x, boxes[0].p1.y,
 					boxes[0].p2.x - boxes[0].p1.x,
@@ -1108,39 +1256,123 @@ s32 cb_region_init_boxes(struct cb_region *region,
 	if (box_alloc(region, count) < 0)
 		return -1;
 
-	inner_boxes = REGION_BOXES(region);
+	memcpy(REGION_BOX_PTR(region), boxes, sizeof(struct cb_box) * count);
+	region->data->count_boxes = count;
+
+	return init_from_boxes(region);
+}
+
+s32 cb_region_set_boxes(struct cb_region *region,
+			const struct cb_box *boxes, s32 count)
+{
+	cb_region_clear(region);
+
+	if (count <= 0)
+		return 0;
 
-	memcpy(inner_boxes, boxes, sizeof(struct cb_box) * count);
+	if (box_alloc(region, count) < 0)
+		return -1;
+
+	memcpy(REGION_BOX_PTR(region), boxes, sizeof(struct cb_box) * count);
 	region->data->count_boxes = count;
 
-	skip = 0;
+	return init_from_boxes(region);
+}
 
-	for (i = 0; i < count; i++) {
-		box = &inner_boxes[i];
-		if (box->p1.x >= box->p2.x || box->p1.y >= box->p2.y)
-			skip++;
-		else if (skip)
-			inner_boxes[i - skip] = inner_boxes[i];
-	}
+s32 cb_region_init_rects(struct cb_region *region,
+			 const struct cb_rect *rects, s32 count)
+{
+	struct cb_box *box;
+	s32 i;
 
-	region->data->count_boxes -= skip;
+	cb_region_init(region);
 
-	if (region->data->count_boxes == 0) {
-		FREE_DATA(region);
-		cb_region_init(region);
+	if (count <= 0)
 		return 0;
+
+	if (box_alloc(region, count) < 0)
+		return -1;
+
+	box = REGION_BOX_PTR(region);
+	for (i = 0; i < count; i++, box++) {
+		box->p1.x = rects[i].pos.x;
+		box->p1.y = rects[i].pos.y;
+		box->p2.x = rects[i].pos.x + (s32)rects[i].w;
+		box->p2.y = rects[i].pos.y + (s32)rects[i].h;
 	}
+	region->data->count_boxes = count;
 
-	if (region->data->count_boxes == 1) {
-		region->extents = inner_boxes[0];
+	return init_from_boxes(region);
+}
+
+s32 cb_region_coarsen(struct cb_region *region, s32 max_boxes)
+{
+	struct cb_box *boxes, *box, *box_end, *band_end, *out;
+	s32 count_bands, per_group, n;
+
+	if (!region->data || REGION_NAR(region))
+		return REGION_NAR(region) ? -1 : 0;
+
+	if (region->data->count_boxes <= max_boxes)
+		return 0;
+
+	if (max_boxes <= 1) {
 		FREE_DATA(region);
 		region->data = NULL;
 		return 0;
 	}
 
-	region->extents.p1.x = region->extents.p2.x = 0;
+	/*
+	 * Collapse every band to its horizontal extent. Boxes are y-x banded,
+	 * so the result stays banded, it may only need vertical coalescing.
+	 */
+	boxes = REGION_BOX_PTR(region);
+	box_end = boxes + region->data->count_boxes;
+	out = boxes;
+	for (box = boxes; box != box_end; box = band_end) {
+		band_end = box + 1;
+		while (band_end != box_end && band_end->p1.y == box->p1.y)
+			band_end++;
+		out->p1.x = box->p1.x;
+		out->p1.y = box->p1.y;
+		out->p2.x = (band_end - 1)->p2.x;
+		out->p2.y = box->p2.y;
+		if (out != boxes && (out - 1)->p2.y == out->p1.y
+		    && (out - 1)->p1.x == out->p1.x
+		    && (out - 1)->p2.x == out->p2.x)
+			(out - 1)->p2.y = out->p2.y;
+		else
+			out++;
+	}
+	count_bands = out - boxes;
+
+	/* Still too many, merge runs of consecutive bands */
+	if (count_bands > max_boxes) {
+		per_group = (count_bands + max_boxes - 1) / max_boxes;
+		out = boxes;
+		for (box = boxes; box < boxes + count_bands; box += n) {
+			n = MIN(per_group, count_bands - (s32)(box - boxes));
+			*out = *box;
+			for (band_end = box + 1; band_end < box + n;
+			     band_end++) {
+				out->p1.x = MIN(out->p1.x, band_end->p1.x);
+				out->p2.x = MAX(out->p2.x, band_end->p2.x);
+				out->p2.y = band_end->p2.y;
+			}
+			out++;
+		}
+		count_bands = out - boxes;
+	}
 
-	return validate(region);
+	region->data->count_boxes = count_bands;
+	if (count_bands == 1) {
+		FREE_DATA(region);
+		region->data = NULL;
+	} else {
+		DOWNSIZE(region, count_bands);
+	}
+
+	return 0;
 }
 
 void cb_region_init_with_extents(struct cb_region *region,
@@ -1154,6 +1386,7 @@ void cb_region_init_with_extents(struct cb_region *region,
 	}
 	region->extents = *extents;
 	region->data = NULL;
+	init_storage(region);
 }
 
 void cb_region_fini(struct cb_region *region)
@@ -1232,12 +1465,10 @@ s32 cb_region_copy(struct cb_region *dst, struct cb_region *src)
 	if (!dst->data || (dst->data->size < src->data->count_boxes)) {
 		FREE_DATA(dst);
 
-		dst->data = alloc_data(src->data->count_boxes);
+		dst->data = get_data(dst, src->data->count_boxes);
 
 		if (!dst->data)
 			return set_break(dst);
-
-		dst->data->size = src->data->count_boxes;
 	}
 
 	dst->data->count_boxes = src->data->count_boxes;
@@ -1304,6 +1535,7 @@ s32 cb_region_intersect_rect(struct cb_region *dst,
 	struct cb_region region;
 
 	region.data = NULL;
+	region.storage = NULL;
 	region.extents.p1.x = x;
 	region.extents.p1.y = y;
 	region.extents.p2.x = x + w;
@@ -1370,6 +1602,33 @@ s32 cb_region_union(struct cb_region *new_reg,
 		return 0;
 	}
 
+	/*
+	 * Two rectangles sharing a span and touching or overlapping along it
+	 * make one rectangle
+	 */
+	if (!reg1->data && !reg2->data
+	    && (((reg1->extents.p1.x == reg2->extents.p1.x)
+	          && (reg1->extents.p2.x == reg2->extents.p2.x)
+	          && (reg1->extents.p1.y <= reg2->extents.p2.y)
+	          && (reg2->extents.p1.y <= reg1->extents.p2.y))
+	     || ((reg1->extents.p1.y == reg2->extents.p1.y)
+	          && (reg1->extents.p2.y == reg2->extents.p2.y)
+	          && (reg1->extents.p1.x <= reg2->extents.p2.x)
+	          && (reg2->extents.p1.x <= reg1->extents.p2.x)))) {
+		FREE_DATA(new_reg);
+		new_reg->extents.p1.x = MIN(reg1->extents.p1.x,
+					    reg2->extents.p1.x);
+		new_reg->extents.p1.y = MIN(reg1->extents.p1.y,
+					    reg2->extents.p1.y);
+		new_reg->extents.p2.x = MAX(reg1->extents.p2.x,
+					    reg2->extents.p2.x);
+		new_reg->extents.p2.y = MAX(reg1->extents.p2.y,
+					    reg2->extents.p2.y);
+		new_reg->data = (struct cb_region_data *)NULL;
+
+		return 0;
+	}
+
 	if (region_op(new_reg, reg1, reg2, region_union_o, 1, 1) < 0)
 		return -1;
 
@@ -1399,6 +1658,7 @@ s32 cb_region_union_rect(struct cb_region *dst,
 	}
 
 	region.data = NULL;
+	region.storage = NULL;
 
 	return cb_region_union(dst, src, &region);
 }
@@ -34,18 +34,55 @@ struct cb_region_data {
 	struct cb_box boxes[0];
 };
 
+/* boxes a region holds before it needs the heap */
+#define CB_REGION_INLINE_BOXES 8
+
+/*
+ * Box storage used before falling back to the heap, the region's own inline
+ * storage or a scratch provided by the caller. A region must not be copied
+ * by value, use cb_region_copy().
+ */
+#define CB_REGION_STORAGE(count) \
+	struct { \
+		struct cb_region_data hdr; \
+		struct cb_box boxes[count]; \
+	}
+
 struct cb_region {
 	struct cb_box extents;
 	struct cb_region_data *data;
+	struct cb_region_data *storage;
+	CB_REGION_STORAGE(CB_REGION_INLINE_BOXES) inline_storage;
 };
 
 void cb_region_init(struct cb_region *region);
 
+/*
+ * Init an empty region which keeps up to count boxes in scratch, declared
+ * with CB_REGION_STORAGE(count). The scratch must outlive the region.
+ */
+void cb_region_init_with_scratch(struct cb_region *region, void *scratch,
+				 u32 count);
+
 void cb_region_init_rect(struct cb_region *region, s32 x, s32 y,u32 w, u32 h);
 
 s32 cb_region_init_boxes(struct cb_region *region,
 			 const struct cb_box *boxes, s32 count);
 
+/* Replace the boxes of an initialized region, keeping its storage */
+s32 cb_region_set_boxes(struct cb_region *region,
+			const struct cb_box *boxes, s32 count);
+
+/* Build a region from an unsorted, possibly overlapping rectangle list */
+s32 cb_region_init_rects(struct cb_region *region,
+			 const struct cb_rect *rects, s32 count);
+
+/*
+ * Merge boxes until no more than max_boxes are left, the result covers the
+ * original region and stays within its extents.
+ */
+s32 cb_region_coarsen(struct cb_region *region, s32 max_boxes);
+
 void cb_region_init_with_extents(struct cb_region *region,
 				 struct cb_box *extents);
 
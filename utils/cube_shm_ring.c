@@ -0,0 +1,391 @@
+/*
+ * Copyright © 2020 Ruinan Duan, duanruinan@zoho.com 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cube_utils.h>
+#include <cube_shm_ring.h>
+
+#define RING_MAGIC 0x47524243 /* "CBRG" */
+#define RING_HDR_SIZE 4096
+
+/* Record types, each record is a header then the 8 aligned payload */
+#define REC_MSG 1
+#define REC_MARKER 2
+#define REC_PAD 3 /* skip to the start of the ring */
+
+struct rec_hdr {
+	u32 length;
+	u32 type;
+};
+
+/*
+ * Shared header of a ring. head is only written by the producer, tail and
+ * waiting by the consumer (the producer clears waiting when it rings), each
+ * on its own cache line.
+ */
+struct ring_hdr {
+	u32 magic;
+	u32 size;
+	u8 pad0[56];
+	u64 head;
+	u8 pad1[56];
+	u64 tail;
+	u8 pad2[56];
+	u32 waiting;
+	u8 pad3[60];
+};
+
+struct cb_shm_ring {
+	void *map;
+	size_t map_sz;
+	struct ring_hdr *hdr;
+	u8 *data;
+	u32 size; /* not read back from the shared header */
+	bool producer;
+	/* own end of the ring, head or tail, the peer cannot move it */
+	u64 pos;
+	s32 efd;
+
+	/* producer: socket frames since the last ring message */
+	u32 sock_run;
+
+	/* consumer copy of the last message */
+	u8 *msg;
+	size_t size_msg;
+};
+
+#define REC_ALIGN(n) (((n) + 7) & ~((size_t)7))
+
+static size_t area_size(u32 size)
+{
+	return RING_HDR_SIZE + 2 * (size_t)size;
+}
+
+s32 cb_shm_ring_area_create(u32 size)
+{
+	struct ring_hdr *hdr;
+	void *map;
+	s32 fd, i, ret;
+
+	if (size < CB_SHM_RING_SIZE_MIN || size > CB_SHM_RING_SIZE_MAX
+	    || (size & (size - 1)))
+		return -EINVAL;
+
+	fd = memfd_create("cube-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -errno;
+
+	do {
+		ret = ftruncate(fd, area_size(size));
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		goto err;
+
+	/* the server maps it too, make sure it cannot shrink under it */
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW
+					| F_SEAL_SEAL) < 0)
+		goto err;
+
+	map = mmap(NULL, RING_HDR_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	if (map == MAP_FAILED)
+		goto err;
+
+	for (i = 0; i < 2; i++) {
+		hdr = (struct ring_hdr *)map + i;
+		memset(hdr, 0, sizeof(*hdr));
+		hdr->magic = RING_MAGIC;
+		hdr->size = size;
+		/* the consumer starts idle, the first message rings */
+		hdr->waiting = 1;
+	}
+	munmap(map, RING_HDR_SIZE);
+
+	return fd;
+
+err:
+	ret = -errno;
+	close(fd);
+	return ret;
+}
+
+void *cb_shm_ring_create(s32 fd, enum cb_shm_ring_index index,
+			 bool producer, s32 efd)
+{
+	struct cb_shm_ring *ring;
+	struct ring_hdr *hdr;
+	struct stat st;
+	s32 seals;
+	u32 size;
+
+	if (fd < 0 || efd < 0 || index > CB_SHM_RING_S2C)
+		return NULL;
+
+	seals = fcntl(fd, F_GET_SEALS);
+	if (seals < 0 || !(seals & F_SEAL_SHRINK))
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || st.st_size < RING_HDR_SIZE)
+		return NULL;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	ring->map_sz = st.st_size;
+	ring->map = mmap(NULL, ring->map_sz, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, fd, 0);
+	if (ring->map == MAP_FAILED)
+		goto err;
+
+	hdr = (struct ring_hdr *)ring->map + index;
+	size = hdr->size;
+	if (hdr->magic != RING_MAGIC || size < CB_SHM_RING_SIZE_MIN
+	    || size > CB_SHM_RING_SIZE_MAX || (size & (size - 1))
+	    || area_size(size) > ring->map_sz)
+		goto err_unmap;
+
+	ring->hdr = hdr;
+	ring->size = size;
+	ring->data = (u8 *)ring->map + RING_HDR_SIZE + index * (size_t)size;
+	ring->producer = producer;
+	ring->pos = producer ? hdr->head : hdr->tail;
+	ring->efd = efd;
+	fcntl(efd, F_SETFL, fcntl(efd, F_GETFL) | O_NONBLOCK);
+
+	return ring;
+
+err_unmap:
+	munmap(ring->map, ring->map_sz);
+err:
+	free(ring);
+	return NULL;
+}
+
+void cb_shm_ring_destroy(void *ring)
+{
+	struct cb_shm_ring *r = ring;
+
+	if (!r)
+		return;
+
+	munmap(r->map, r->map_sz);
+	close(r->efd);
+	free(r->msg);
+	free(r);
+}
+
+s32 cb_shm_ring_get_fd(void *ring)
+{
+	struct cb_shm_ring *r = ring;
+
+	return r->efd;
+}
+
+static void ring_doorbell(struct cb_shm_ring *r)
+{
+	u64 one = 1;
+	s32 ret;
+
+	/* pairs with the store then load in cb_shm_ring_sleep() */
+	if (!__atomic_exchange_n(&r->hdr->waiting, 0, __ATOMIC_SEQ_CST))
+		return;
+
+	do {
+		ret = write(r->efd, &one, sizeof(one));
+	} while (ret < 0 && errno == EINTR);
+}
+
+/* Write a record at *head without publishing it */
+static s32 ring_put(struct cb_shm_ring *r, u64 *head, u64 tail, u32 type,
+		    const void *buf, size_t sz)
+{
+	struct rec_hdr *rec;
+	size_t need, off, pad = 0;
+
+	need = sizeof(*rec) + REC_ALIGN(sz);
+	off = *head & (r->size - 1);
+	if (off + need > r->size)
+		pad = r->size - off;
+
+	if (r->size - (*head - tail) < pad + need)
+		return -ENOSPC;
+
+	if (pad) {
+		rec = (struct rec_hdr *)(r->data + off);
+		rec->length = pad - sizeof(*rec);
+		rec->type = REC_PAD;
+		*head += pad;
+		off = 0;
+	}
+
+	rec = (struct rec_hdr *)(r->data + off);
+	rec->length = sz;
+	rec->type = type;
+	memcpy(rec + 1, buf, sz);
+	*head += need;
+
+	return 0;
+}
+
+s32 cb_shm_ring_write(void *ring, const u8 *buf, size_t sz)
+{
+	struct cb_shm_ring *r = ring;
+	u64 head, tail;
+	s32 ret;
+
+	if (!r->producer || !sz)
+		return -EINVAL;
+
+	if (sizeof(struct rec_hdr) + REC_ALIGN(sz) > r->size)
+		return -ENOSPC;
+
+	head = r->pos;
+	tail = __atomic_load_n(&r->hdr->tail, __ATOMIC_ACQUIRE);
+	if (head - tail > r->size)
+		return -EPROTO;
+
+	/* one marker stands for the whole run of socket frames */
+	if (r->sock_run) {
+		ret = ring_put(r, &head, tail, REC_MARKER, &r->sock_run,
+			       sizeof(r->sock_run));
+		if (ret < 0)
+			return ret;
+	}
+
+	/* the marker is dropped with the message, the run goes on */
+	ret = ring_put(r, &head, tail, REC_MSG, buf, sz);
+	if (ret < 0)
+		return ret;
+
+	r->sock_run = 0;
+	r->pos = head;
+	__atomic_store_n(&r->hdr->head, r->pos, __ATOMIC_SEQ_CST);
+	ring_doorbell(r);
+
+	return 0;
+}
+
+void cb_shm_ring_skip(void *ring)
+{
+	struct cb_shm_ring *r = ring;
+
+	r->sock_run++;
+}
+
+s32 cb_shm_ring_read(void *ring, u8 **buf, size_t *sz)
+{
+	struct cb_shm_ring *r = ring;
+	struct rec_hdr rec;
+	u64 head, tail;
+	size_t off, len;
+	u32 count;
+
+	if (r->producer)
+		return -EINVAL;
+
+	tail = r->pos;
+	for (;;) {
+		head = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+		if (head == tail)
+			return 0;
+		if (head - tail > r->size)
+			return -EPROTO;
+
+		off = tail & (r->size - 1);
+		memcpy(&rec, r->data + off, sizeof(rec));
+		len = sizeof(rec) + REC_ALIGN((size_t)rec.length);
+		if (off + len > r->size || len > head - tail)
+			return -EPROTO;
+
+		if (rec.type != REC_PAD)
+			break;
+		tail += len;
+		r->pos = tail;
+		__atomic_store_n(&r->hdr->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	if (rec.type == REC_MARKER) {
+		if (rec.length != sizeof(u32))
+			return -EPROTO;
+		memcpy(&count, r->data + off + sizeof(rec), sizeof(count));
+		if (!count)
+			return -EPROTO;
+		r->pos = tail + len;
+		__atomic_store_n(&r->hdr->tail, r->pos, __ATOMIC_RELEASE);
+		*sz = count;
+		return CB_SHM_RING_MARKER;
+	}
+
+	/* nobody writes empty messages */
+	if (rec.type != REC_MSG || !rec.length)
+		return -EPROTO;
+
+	/* copy out, the peer could change the message under the parser */
+	if (r->size_msg < rec.length) {
+		free(r->msg);
+		r->msg = malloc(rec.length);
+		if (!r->msg) {
+			r->size_msg = 0;
+			return -ENOMEM;
+		}
+		r->size_msg = rec.length;
+	}
+	memcpy(r->msg, r->data + off + sizeof(rec), rec.length);
+	r->pos = tail + len;
+	__atomic_store_n(&r->hdr->tail, r->pos, __ATOMIC_RELEASE);
+
+	*buf = r->msg;
+	*sz = rec.length;
+
+	return CB_SHM_RING_MSG;
+}
+
+bool cb_shm_ring_sleep(void *ring)
+{
+	struct cb_shm_ring *r = ring;
+
+	__atomic_store_n(&r->hdr->waiting, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->hdr->head, __ATOMIC_SEQ_CST) == r->pos)
+		return true;
+
+	__atomic_store_n(&r->hdr->waiting, 0, __ATOMIC_RELAXED);
+	return false;
+}
+
+void cb_shm_ring_doorbell_ack(void *ring)
+{
+	struct cb_shm_ring *r = ring;
+	u64 cnt;
+	s32 ret;
+
+	do {
+		ret = read(r->efd, &cnt, sizeof(cnt));
+	} while (ret < 0 && errno == EINTR);
+}
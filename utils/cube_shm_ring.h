@@ -0,0 +1,100 @@
+/*
+ * Copyright © 2020 Ruinan Duan, duanruinan@zoho.com 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CUBE_SHM_RING_H
+#define CUBE_SHM_RING_H
+
+#include <stdbool.h>
+#include <cube_utils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Single producer, single consumer message rings in shared memory. One
+ * area (a memfd) holds two rings, CB_SHM_RING_C2S from client to server
+ * and CB_SHM_RING_S2C back. Each ring has an eventfd doorbell which the
+ * producer only rings when the consumer went idle, so a busy consumer
+ * never pays for a syscall.
+ *
+ * A message which cannot take the ring (it carries fds or does not fit)
+ * goes through the socket instead. The next ring message is preceded by a
+ * marker counting the socket frames sent since the last one, so the
+ * consumer keeps the order of both streams. A consumer which drained the
+ * ring may take socket frames before their marker shows up, nothing in
+ * the ring can be older than them then.
+ */
+enum cb_shm_ring_index {
+	CB_SHM_RING_C2S = 0,
+	CB_SHM_RING_S2C,
+};
+
+/* Return values of cb_shm_ring_read() */
+#define CB_SHM_RING_MSG 1
+#define CB_SHM_RING_MARKER 2
+
+/* Ring size range, in bytes, power of 2 */
+#define CB_SHM_RING_SIZE_MIN (1 << 12)
+#define CB_SHM_RING_SIZE_MAX (1 << 24)
+
+/* Create a memfd with both rings initialized, return the fd or -errno */
+s32 cb_shm_ring_area_create(u32 size);
+
+/*
+ * Map one ring of an area. On success the ring owns efd, its doorbell,
+ * fd is only used for the mapping and stays with the caller.
+ */
+void *cb_shm_ring_create(s32 fd, enum cb_shm_ring_index index,
+			 bool producer, s32 efd);
+void cb_shm_ring_destroy(void *ring);
+
+/* The doorbell, consumers poll it for readable */
+s32 cb_shm_ring_get_fd(void *ring);
+
+/* -ENOSPC if the message does not fit now, the caller uses the socket */
+s32 cb_shm_ring_write(void *ring, const u8 *buf, size_t sz);
+/* A message went through the socket, counted into the next marker */
+void cb_shm_ring_skip(void *ring);
+
+/*
+ * CB_SHM_RING_MSG with a private copy of the next message, valid until the
+ * next read, CB_SHM_RING_MARKER with the count of socket frames in sz, 0 if
+ * the ring is empty or -EPROTO if the peer corrupted the ring. The copy is
+ * exactly sz bytes, the peer chose sz, so check it before parsing.
+ */
+s32 cb_shm_ring_read(void *ring, u8 **buf, size_t *sz);
+
+/*
+ * Consumer found the ring empty and is about to wait on the doorbell.
+ * Returns false if a message slipped in meanwhile, keep reading then.
+ */
+bool cb_shm_ring_sleep(void *ring);
+
+/* Consumer woke up on the doorbell */
+void cb_shm_ring_doorbell_ack(void *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -0,0 +1,438 @@
+/*
+ * Copyright © 2020 Ruinan Duan, duanruinan@zoho.com 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include <cube_utils.h>
+#include <cube_slab.h>
+
+#define CB_SLAB_CACHE_LINE 64
+#define CB_SLAB_MIN_SIZE 4096
+#define CB_SLAB_MAG_SIZE 32
+#define CB_SLAB_MAX_THREADS 16
+
+#define SLAB_ALIGN(v, a) (((v) + (a) - 1) & ~((size_t)(a) - 1))
+
+/*
+ * Slab header, lives at the start of the slab. Slabs are aligned on their own
+ * (power of two) size, so the header of any object is found by masking.
+ */
+struct cb_slab_page {
+	struct list_head link;
+	void *free; /* next pointer is stored in the free object itself */
+	u8 *base;
+	u32 carved; /* objects taken from base, the rest was never touched */
+	u32 inuse;
+};
+
+struct cb_slab_mag {
+	s32 count;
+	u64 gets; /* folded into cb_slab.gets on refill / flush */
+	void *objs[CB_SLAB_MAG_SIZE];
+} __attribute__((aligned(CB_SLAB_CACHE_LINE)));
+
+struct cb_slab {
+	size_t size;
+	size_t stride;
+	size_t slab_size;
+	size_t hdr_size;
+	u32 objs_per_slab;
+	u32 flags;
+
+	struct list_head partial; /* also holds empty slabs */
+	struct list_head full;
+	u32 nr_empty;
+
+	u64 gets;
+	u64 misses;
+	u32 in_use;
+	u32 peak;
+	u32 slabs;
+	u32 slabs_peak;
+
+	/* magazine of the owner thread, without CB_SLAB_MAGAZINE */
+	struct cb_slab_mag local;
+
+	/* CB_SLAB_MAGAZINE only */
+	pthread_mutex_t mutex;
+	struct cb_slab_mag *mags;
+};
+
+static s32 slab_thread_nr = 0;
+static __thread s32 slab_thread_id = -1;
+
+/* ids are never recycled, threads beyond the limit go through the lock */
+static s32 cb_slab_thread_id(void)
+{
+	if (slab_thread_id < 0)
+		slab_thread_id = __atomic_fetch_add(&slab_thread_nr, 1,
+						    __ATOMIC_RELAXED);
+
+	return slab_thread_id;
+}
+
+static inline void cb_slab_lock(struct cb_slab *s)
+{
+	if (s->mags)
+		pthread_mutex_lock(&s->mutex);
+}
+
+static inline void cb_slab_unlock(struct cb_slab *s)
+{
+	if (s->mags)
+		pthread_mutex_unlock(&s->mutex);
+}
+
+/* NULL if the calling thread has no magazine */
+static inline struct cb_slab_mag *cb_slab_mag_of(struct cb_slab *s)
+{
+	s32 tid;
+
+	if (!s->mags)
+		return &s->local;
+
+	tid = cb_slab_thread_id();
+	if (tid >= CB_SLAB_MAX_THREADS)
+		return NULL;
+
+	return &s->mags[tid];
+}
+
+static inline struct cb_slab_page *cb_slab_page_of(struct cb_slab *s, void *d)
+{
+	return (struct cb_slab_page *)((uintptr_t)d
+					& ~(uintptr_t)(s->slab_size - 1));
+}
+
+static struct cb_slab_page *cb_slab_page_create(struct cb_slab *s)
+{
+	struct cb_slab_page *pg;
+	void *p;
+
+	if (posix_memalign(&p, s->slab_size, s->slab_size))
+		return NULL;
+
+	pg = p;
+	INIT_LIST_HEAD(&pg->link);
+	pg->free = NULL;
+	pg->base = (u8 *)p + s->hdr_size;
+	pg->carved = 0;
+	pg->inuse = 0;
+
+	s->slabs++;
+	if (s->slabs > s->slabs_peak)
+		s->slabs_peak = s->slabs;
+
+	return pg;
+}
+
+static void cb_slab_page_destroy(struct cb_slab *s, struct cb_slab_page *pg)
+{
+	list_del(&pg->link);
+	free(pg);
+	s->slabs--;
+}
+
+static void *cb_slab_alloc_obj(struct cb_slab *s)
+{
+	struct cb_slab_page *pg;
+	void *d;
+
+	if (!list_empty(&s->partial)) {
+		pg = list_first_entry(&s->partial, struct cb_slab_page, link);
+		if (!pg->inuse)
+			s->nr_empty--;
+	} else {
+		pg = cb_slab_page_create(s);
+		if (!pg)
+			return NULL;
+		list_add(&pg->link, &s->partial);
+		s->misses++;
+	}
+
+	if (pg->free) {
+		d = pg->free;
+		pg->free = *((void **)d);
+	} else {
+		d = pg->base + pg->carved * s->stride;
+		pg->carved++;
+	}
+
+	pg->inuse++;
+	if (pg->inuse == s->objs_per_slab) {
+		list_del(&pg->link);
+		list_add(&pg->link, &s->full);
+	}
+
+	s->in_use++;
+	if (s->in_use > s->peak)
+		s->peak = s->in_use;
+
+	return d;
+}
+
+/*
+ * Empty slabs stay on the partial list, so a single object going back and
+ * forth does not move its slab around.
+ */
+static void cb_slab_free_obj(struct cb_slab *s, void *d)
+{
+	struct cb_slab_page *pg = cb_slab_page_of(s, d);
+
+	assert(pg->inuse);
+	*((void **)d) = pg->free;
+	pg->free = d;
+
+	if (pg->inuse == s->objs_per_slab) {
+		list_del(&pg->link);
+		list_add(&pg->link, &s->partial);
+	}
+	pg->inuse--;
+	s->in_use--;
+
+	if (pg->inuse)
+		return;
+
+	/* keep one empty slab back, release the others */
+	if (s->nr_empty)
+		cb_slab_page_destroy(s, pg);
+	else
+		s->nr_empty++;
+}
+
+static void cb_slab_mag_refill(struct cb_slab *s, struct cb_slab_mag *m)
+{
+	void *d;
+
+	cb_slab_lock(s);
+	s->gets += m->gets;
+	m->gets = 0;
+	while (m->count < CB_SLAB_MAG_SIZE / 2) {
+		d = cb_slab_alloc_obj(s);
+		if (!d)
+			break;
+		m->objs[m->count++] = d;
+	}
+	cb_slab_unlock(s);
+}
+
+static void cb_slab_mag_flush(struct cb_slab *s, struct cb_slab_mag *m,
+			      s32 keep)
+{
+	cb_slab_lock(s);
+	s->gets += m->gets;
+	m->gets = 0;
+	while (m->count > keep)
+		cb_slab_free_obj(s, m->objs[--m->count]);
+	cb_slab_unlock(s);
+}
+
+void cb_slab_destroy(void *c)
+{
+	struct cb_slab *s = c;
+	struct cb_slab_page *pg, *n;
+
+	if (!c)
+		return;
+
+	list_for_each_entry_safe(pg, n, &s->partial, link)
+		cb_slab_page_destroy(s, pg);
+	list_for_each_entry_safe(pg, n, &s->full, link)
+		cb_slab_page_destroy(s, pg);
+
+	if (s->mags) {
+		pthread_mutex_destroy(&s->mutex);
+		free(s->mags);
+	}
+
+	free(s);
+}
+
+void *cb_slab_create(size_t size, s32 objs_per_slab, u32 flags)
+{
+	struct cb_slab *s;
+	size_t need;
+	void *p;
+
+	if (!size || objs_per_slab <= 0)
+		return NULL;
+
+	if (posix_memalign(&p, CB_SLAB_CACHE_LINE, sizeof(*s)))
+		return NULL;
+	s = p;
+	memset(s, 0, sizeof(*s));
+
+	s->size = size;
+	s->flags = flags;
+	/*
+	 * Small objects are packed on 16 bytes, bigger ones take whole cache
+	 * lines so that they never share a line with a neighbour.
+	 */
+	if (size >= CB_SLAB_CACHE_LINE / 2)
+		s->stride = SLAB_ALIGN(size, CB_SLAB_CACHE_LINE);
+	else
+		s->stride = SLAB_ALIGN(MAX(size, sizeof(void *)), 16);
+	s->hdr_size = SLAB_ALIGN(sizeof(struct cb_slab_page),
+				 CB_SLAB_CACHE_LINE);
+
+	/*
+	 * Fill the power of two slab completely, objects are carved lazily so
+	 * the tail is not faulted in until it is needed.
+	 */
+	need = s->hdr_size + s->stride * objs_per_slab;
+	s->slab_size = CB_SLAB_MIN_SIZE;
+	while (s->slab_size < need)
+		s->slab_size <<= 1;
+	s->objs_per_slab = (s->slab_size - s->hdr_size) / s->stride;
+
+	INIT_LIST_HEAD(&s->partial);
+	INIT_LIST_HEAD(&s->full);
+
+	if (flags & CB_SLAB_MAGAZINE) {
+		if (pthread_mutex_init(&s->mutex, NULL))
+			goto err;
+		if (posix_memalign(&p, CB_SLAB_CACHE_LINE,
+				   sizeof(struct cb_slab_mag)
+				     * CB_SLAB_MAX_THREADS)) {
+			pthread_mutex_destroy(&s->mutex);
+			goto err;
+		}
+		memset(p, 0, sizeof(struct cb_slab_mag) * CB_SLAB_MAX_THREADS);
+		s->mags = p;
+	}
+
+	return s;
+
+err:
+	free(s);
+	return NULL;
+}
+
+void *cb_slab_get(void *c, bool clear)
+{
+	struct cb_slab *s = c;
+	struct cb_slab_mag *m;
+	void *d = NULL;
+
+	if (!c)
+		return NULL;
+
+	m = cb_slab_mag_of(s);
+	if (m) {
+		if (!m->count)
+			cb_slab_mag_refill(s, m);
+		if (m->count) {
+			d = m->objs[--m->count];
+			m->gets++;
+		}
+	} else {
+		cb_slab_lock(s);
+		s->gets++;
+		d = cb_slab_alloc_obj(s);
+		cb_slab_unlock(s);
+	}
+
+	if (d && clear)
+		memset(d, 0, s->size);
+
+	return d;
+}
+
+void cb_slab_put(void *d, void *c)
+{
+	struct cb_slab *s = c;
+	struct cb_slab_mag *m;
+
+	if (!c || !d)
+		return;
+
+	m = cb_slab_mag_of(s);
+	if (m) {
+		if (m->count == CB_SLAB_MAG_SIZE)
+			cb_slab_mag_flush(s, m, CB_SLAB_MAG_SIZE / 2);
+		m->objs[m->count++] = d;
+	} else {
+		cb_slab_lock(s);
+		cb_slab_free_obj(s, d);
+		cb_slab_unlock(s);
+	}
+}
+
+/*
+ * Release every empty slab. Objects parked in other threads' magazines keep
+ * their slabs alive, only the caller's magazine is flushed first.
+ */
+void cb_slab_shrink(void *c)
+{
+	struct cb_slab *s = c;
+	struct cb_slab_mag *m;
+	struct cb_slab_page *pg, *n;
+
+	if (!c)
+		return;
+
+	m = cb_slab_mag_of(s);
+	if (m)
+		cb_slab_mag_flush(s, m, 0);
+
+	cb_slab_lock(s);
+	list_for_each_entry_safe(pg, n, &s->partial, link) {
+		if (!pg->inuse)
+			cb_slab_page_destroy(s, pg);
+	}
+	s->nr_empty = 0;
+	cb_slab_unlock(s);
+}
+
+/*
+ * in_use counts objects parked in magazines. With CB_SLAB_MAGAZINE, gets
+ * served by a magazine are only accounted when it is refilled or flushed.
+ */
+void cb_slab_get_stats(void *c, struct cb_slab_stats *stats)
+{
+	struct cb_slab *s = c;
+
+	if (!c || !stats)
+		return;
+
+	if (!s->mags) {
+		s->gets += s->local.gets;
+		s->local.gets = 0;
+	}
+
+	cb_slab_lock(s);
+	stats->hits = s->gets > s->misses ? s->gets - s->misses : 0;
+	stats->misses = s->misses;
+	stats->in_use = s->in_use;
+	stats->peak = s->peak;
+	stats->slabs = s->slabs;
+	stats->slabs_peak = s->slabs_peak;
+	stats->obj_size = s->stride;
+	stats->objs_per_slab = s->objs_per_slab;
+	cb_slab_unlock(s);
+}
+
@@ -0,0 +1,76 @@
+/*
+ * Copyright © 2020 Ruinan Duan, duanruinan@zoho.com 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CUBE_SLAB_H
+#define CUBE_SLAB_H
+
+#include <stdbool.h>
+#include <cube_utils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fixed size object allocator.
+ *
+ * Objects are carved out of contiguous, cache line aligned slabs and kept on
+ * an intrusive free list inside each slab, so get / put never call malloc
+ * once the cache is warm. Slabs that become empty are released again (one is
+ * kept back to absorb alloc / free ping-pong, cb_slab_shrink() drops it too).
+ *
+ * A small magazine of recently freed objects sits in front of the slabs and
+ * is refilled / flushed in batches. A cache is not thread safe unless it is
+ * created with CB_SLAB_MAGAZINE, in that case every thread gets a private
+ * magazine and only takes the lock to refill or flush it.
+ */
+
+/* per-thread magazines, makes get / put thread safe */
+#define CB_SLAB_MAGAZINE (1 << 0)
+
+struct cb_slab_stats {
+	u64 hits; /* gets served from already allocated slabs */
+	u64 misses; /* gets which had to allocate a new slab */
+	u32 in_use; /* objects not on a slab free list */
+	u32 peak; /* max in_use */
+	u32 slabs; /* slabs currently allocated */
+	u32 slabs_peak;
+	u32 obj_size; /* object stride in bytes */
+	u32 objs_per_slab;
+};
+
+/*
+ * objs_per_slab is a lower bound, the slab is rounded up to a power of two
+ * and filled with as many objects as fit.
+ */
+void *cb_slab_create(size_t size, s32 objs_per_slab, u32 flags);
+void cb_slab_destroy(void *s);
+void *cb_slab_get(void *s, bool clear);
+void cb_slab_put(void *d, void *s);
+void cb_slab_shrink(void *s);
+void cb_slab_get_stats(void *s, struct cb_slab_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
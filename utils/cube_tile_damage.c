@@ -0,0 +1,302 @@
+/*
+ * Copyright © 2020 Ruinan Duan, duanruinan@zoho.com 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <string.h>
+#include <cube_utils.h>
+#include <cube_region.h>
+#include <cube_tile_damage.h>
+
+#define TILE_SHIFT_MAX 12
+
+static void set_bits(u64 *row, u32 x0, u32 x1)
+{
+	u32 w0 = x0 >> 6, w1 = x1 >> 6;
+	u64 m0 = ~0ULL << (x0 & 63);
+	u64 m1 = ~0ULL >> (63 - (x1 & 63));
+
+	if (w0 == w1) {
+		row[w0] |= m0 & m1;
+		return;
+	}
+
+	row[w0++] |= m0;
+	while (w0 < w1)
+		row[w0++] = ~0ULL;
+	row[w1] |= m1;
+}
+
+/* index of the first bit from 'from' on which is set (or clear) */
+static u32 next_bit(const u64 *row, u32 stride, u32 from, bool set)
+{
+	u32 w = from >> 6;
+	u64 v;
+
+	if (w >= stride)
+		return stride << 6;
+
+	v = set ? row[w] : ~row[w];
+	v &= ~0ULL << (from & 63);
+	while (!v) {
+		if (++w == stride)
+			return stride << 6;
+		v = set ? row[w] : ~row[w];
+	}
+
+	return (w << 6) + __builtin_ctzll(v);
+}
+
+s32 cb_tile_damage_init(struct cb_tile_damage *td, u32 width, u32 height,
+			u32 tile_shift)
+{
+	if (!td || tile_shift > TILE_SHIFT_MAX)
+		return -EINVAL;
+
+	memset(td, 0, sizeof(*td));
+	td->tile_shift = tile_shift;
+
+	return cb_tile_damage_resize(td, width, height);
+}
+
+void cb_tile_damage_fini(struct cb_tile_damage *td)
+{
+	if (!td)
+		return;
+
+	free(td->bits);
+	free(td->boxes);
+	td->bits = NULL;
+	td->boxes = NULL;
+	td->size_boxes = 0;
+	td->cols = td->rows = td->stride = 0;
+	td->width = td->height = 0;
+}
+
+s32 cb_tile_damage_resize(struct cb_tile_damage *td, u32 width, u32 height)
+{
+	u32 cols, rows, stride;
+	u64 *bits = NULL;
+
+	cols = (width + (1U << td->tile_shift) - 1) >> td->tile_shift;
+	rows = (height + (1U << td->tile_shift) - 1) >> td->tile_shift;
+	stride = (cols + 63) >> 6;
+
+	if (cols && rows) {
+		bits = calloc((size_t)rows * stride, sizeof(u64));
+		if (!bits)
+			return -ENOMEM;
+	}
+
+	free(td->bits);
+	free(td->boxes);
+	td->boxes = NULL;
+	td->size_boxes = 0;
+	td->bits = bits;
+	td->width = width;
+	td->height = height;
+	td->cols = cols;
+	td->rows = rows;
+	td->stride = stride;
+
+	return 0;
+}
+
+void cb_tile_damage_clear(struct cb_tile_damage *td)
+{
+	if (td->bits)
+		memset(td->bits, 0,
+		       (size_t)td->rows * td->stride * sizeof(u64));
+}
+
+bool cb_tile_damage_is_not_empty(struct cb_tile_damage *td)
+{
+	u32 i, n = td->rows * td->stride;
+
+	for (i = 0; i < n; i++)
+		if (td->bits[i])
+			return true;
+
+	return false;
+}
+
+s32 cb_tile_damage_count_tiles(struct cb_tile_damage *td)
+{
+	u32 i, n = td->rows * td->stride;
+	s32 count = 0;
+
+	for (i = 0; i < n; i++)
+		count += __builtin_popcountll(td->bits[i]);
+
+	return count;
+}
+
+void cb_tile_damage_add_box(struct cb_tile_damage *td,
+			    const struct cb_box *box)
+{
+	s32 x1, y1, x2, y2;
+	u32 tx0, tx1, ty0, ty1;
+	u64 *row;
+
+	x1 = MAX(box->p1.x, 0);
+	y1 = MAX(box->p1.y, 0);
+	x2 = MIN(box->p2.x, (s32)td->width);
+	y2 = MIN(box->p2.y, (s32)td->height);
+	if (x1 >= x2 || y1 >= y2)
+		return;
+
+	tx0 = (u32)x1 >> td->tile_shift;
+	tx1 = (u32)(x2 - 1) >> td->tile_shift;
+	ty0 = (u32)y1 >> td->tile_shift;
+	ty1 = (u32)(y2 - 1) >> td->tile_shift;
+
+	row = td->bits + ty0 * td->stride;
+	for (; ty0 <= ty1; ty0++, row += td->stride)
+		set_bits(row, tx0, tx1);
+}
+
+void cb_tile_damage_add_rect(struct cb_tile_damage *td, s32 x, s32 y,
+			     u32 w, u32 h)
+{
+	struct cb_box box;
+
+	box.p1.x = x;
+	box.p1.y = y;
+	box.p2.x = x + (s32)w;
+	box.p2.y = y + (s32)h;
+	cb_tile_damage_add_box(td, &box);
+}
+
+void cb_tile_damage_add_region(struct cb_tile_damage *td,
+			       struct cb_region *region)
+{
+	struct cb_box *boxes;
+	s32 i, count_boxes;
+
+	if (!cb_region_is_not_empty(region))
+		return;
+
+	boxes = cb_region_boxes(region, &count_boxes);
+	for (i = 0; i < count_boxes; i++)
+		cb_tile_damage_add_box(td, &boxes[i]);
+}
+
+s32 cb_tile_damage_union(struct cb_tile_damage *dst,
+			 struct cb_tile_damage *src)
+{
+	u32 i, n;
+
+	if (dst->tile_shift != src->tile_shift || dst->cols != src->cols
+	    || dst->rows != src->rows)
+		return -EINVAL;
+
+	n = dst->rows * dst->stride;
+	for (i = 0; i < n; i++)
+		dst->bits[i] |= src->bits[i];
+
+	return 0;
+}
+
+struct cb_box *cb_tile_damage_boxes(struct cb_tile_damage *td,
+				    s32 *count_boxes)
+{
+	u32 ty, x, e, n, cur, prev, count_prev, i, max;
+	const u64 *row;
+	struct cb_box *box;
+	s32 y1, y2;
+	bool same;
+
+	*count_boxes = 0;
+	if (!td->bits)
+		return NULL;
+
+	if (!td->boxes) {
+		/* every other tile damaged is the worst case */
+		max = td->rows * ((td->cols + 1) / 2);
+		td->boxes = malloc(max * sizeof(struct cb_box));
+		if (!td->boxes)
+			return NULL;
+		td->size_boxes = max;
+	}
+
+	n = 0;
+	prev = 0;
+	count_prev = 0;
+	row = td->bits;
+	for (ty = 0; ty < td->rows; ty++, row += td->stride) {
+		y1 = ty << td->tile_shift;
+		y2 = MIN((ty + 1) << td->tile_shift, td->height);
+		cur = n;
+		x = next_bit(row, td->stride, 0, true);
+		while (x < td->cols) {
+			e = next_bit(row, td->stride, x, false);
+			if (e > td->cols)
+				e = td->cols;
+			box = &td->boxes[n++];
+			box->p1.x = x << td->tile_shift;
+			box->p1.y = y1;
+			box->p2.x = MIN(e << td->tile_shift, td->width);
+			box->p2.y = y2;
+			x = next_bit(row, td->stride, e, true);
+		}
+
+		if (n == cur) {
+			count_prev = 0;
+			continue;
+		}
+
+		/* same runs as the row above, make those boxes taller */
+		box = td->boxes;
+		same = (n - cur == count_prev) && (box[prev].p2.y == y1);
+		for (i = 0; same && i < count_prev; i++)
+			same = box[prev + i].p1.x == box[cur + i].p1.x
+			    && box[prev + i].p2.x == box[cur + i].p2.x;
+		if (same) {
+			for (i = 0; i < count_prev; i++)
+				box[prev + i].p2.y = y2;
+			n = cur;
+		} else {
+			prev = cur;
+			count_prev = n - cur;
+		}
+	}
+
+	*count_boxes = n;
+
+	return td->boxes;
+}
+
+s32 cb_tile_damage_to_region(struct cb_tile_damage *td,
+			     struct cb_region *region)
+{
+	struct cb_box *boxes;
+	s32 count_boxes;
+
+	boxes = cb_tile_damage_boxes(td, &count_boxes);
+	if (!boxes) {
+		cb_region_clear(region);
+		return td->bits ? -ENOMEM : 0;
+	}
+
+	return cb_region_set_boxes(region, boxes, count_boxes);
+}
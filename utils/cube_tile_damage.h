@@ -0,0 +1,94 @@
+/*
+ * Copyright © 2020 Ruinan Duan, duanruinan@zoho.com 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CUBE_TILE_DAMAGE_H
+#define CUBE_TILE_DAMAGE_H
+
+#include <stdbool.h>
+#include <cube_utils.h>
+#include <cube_region.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Damage tracked per tile instead of per pixel, one bit for each tile of
+ * (1 << tile_shift) pixels square. Adding damage never creates boxes, so
+ * the cost stays bounded however scattered the damage is, at the price of
+ * rounding it out to the tile grid. cb_tile_damage_boxes() turns the set
+ * tiles into a few merged rectangles, y-x banded like a cb_region.
+ */
+struct cb_tile_damage {
+	u32 width, height;
+	u32 tile_shift;
+	u32 cols, rows;
+	u32 stride; /* u64 words per tile row */
+	u64 *bits;
+
+	/* merged rectangles of the last cb_tile_damage_boxes() */
+	struct cb_box *boxes;
+	u32 size_boxes;
+};
+
+/* Suggested tile size, 64x64 */
+#define CB_TILE_SHIFT_DEFAULT 6
+
+s32 cb_tile_damage_init(struct cb_tile_damage *td, u32 width, u32 height,
+			u32 tile_shift);
+void cb_tile_damage_fini(struct cb_tile_damage *td);
+
+/* Change the covered area, damage is cleared */
+s32 cb_tile_damage_resize(struct cb_tile_damage *td, u32 width, u32 height);
+
+void cb_tile_damage_clear(struct cb_tile_damage *td);
+bool cb_tile_damage_is_not_empty(struct cb_tile_damage *td);
+s32 cb_tile_damage_count_tiles(struct cb_tile_damage *td);
+
+void cb_tile_damage_add_box(struct cb_tile_damage *td,
+			    const struct cb_box *box);
+void cb_tile_damage_add_rect(struct cb_tile_damage *td, s32 x, s32 y,
+			     u32 w, u32 h);
+void cb_tile_damage_add_region(struct cb_tile_damage *td,
+			       struct cb_region *region);
+
+/* Both must cover the same area with the same tile size */
+s32 cb_tile_damage_union(struct cb_tile_damage *dst,
+			 struct cb_tile_damage *src);
+
+/*
+ * Runs of damaged tiles in a row become one box, rows with the same runs
+ * merge into taller boxes. Boxes are clipped to the covered area and stay
+ * valid until the next call.
+ */
+struct cb_box *cb_tile_damage_boxes(struct cb_tile_damage *td,
+				    s32 *count_boxes);
+
+/* Replace the content of an initialized region with the damaged tiles */
+s32 cb_tile_damage_to_region(struct cb_tile_damage *td,
+			     struct cb_region *region);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+